@@ -1,6 +1,11 @@
 #ifndef __ANALYSE__
 #define __ANALYSE__
 
+/* The number of nodes each path can hold, and how many branches can be pending
+ * while build_control_flow_paths() walks a function. */
+#define PATH_LENGTH_MAX 1000
+#define NODE_MID_START_MAX 1000
+
 struct relocation_s {
 	int type; /* 0 = invalid, 1 = external_entry_point, 2 = data */
 	uint64_t index; /* Index into the external_entry_point or data */
@@ -11,7 +16,39 @@ struct mid_start_s {
 	uint64_t valid;
 };
 
+/* One definition of a register (reg_stack = 1, init_value = register)
+ * or stack slot (reg_stack = 2, init_value and offset_value as in value3). */
+struct search_back_def_s {
+	int reg_stack;
+	uint64_t init_value;
+	uint64_t offset_value;
+	int inst;
+};
+
+/* The definitions of one register or stack slot are defs[first] to defs[first + count - 1] */
+struct search_back_range_s {
+	int first;
+	int count;	/* 0 == empty */
+};
+
+struct search_back_index_s {
+	int defs_size;
+	struct search_back_def_s *defs;	/* Sorted by reg_stack, init_value, offset_value, inst */
+	int regs_size;
+	struct search_back_range_s *regs;	/* Indexed by register */
+	int stack_size;		/* Always a power of 2 */
+	struct search_back_range_s *stack;	/* Open addressed by stack slot */
+	int seen_size;
+	int *seen;	/* seen[inst] == epoch when inst has been visited by the current search */
+	int epoch;
+};
+
 extern int tidy_inst_log(struct self_s *self);
+extern uint8_t *inst_log_keep_build(struct self_s *self);
+extern int inst_log_unlink(struct self_s *self, int inst, uint8_t *keep);
+extern int rtl_value_numbering(struct self_s *self, int *removed);
+extern int node_member_set(struct self_s *self, int inst_start, int inst_end, int node);
+extern int is_member_of_loop(struct control_flow_node_s *nodes, int loop_node, int test_node);
 extern int find_node_from_inst(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, int inst);
 extern int node_mid_start_add(struct control_flow_node_s *node, struct node_mid_start_s *node_mid_start, int path, int step);
 extern int path_loop_check(struct path_s *paths, int path, int step, int node, int limit);
@@ -22,28 +59,47 @@ extern int build_control_flow_loops_node_members(struct self_s *self,
 	struct control_flow_node_s *nodes, int nodes_size,
 	struct loop_s *loops, int *loops_size);
 extern int print_control_flow_loops(struct self_s *self, struct loop_s *loops, int *loops_size);
+extern int path_set_add(struct path_set_s *set, int path);
+extern void path_set_free(struct path_set_s *set);
 extern int add_path_to_node(struct control_flow_node_s *node, int path);
 extern int add_looped_path_to_node(struct control_flow_node_s *node, int path);
 extern int is_subset(int size_a, int *a, int size_b, int *b);
-extern int build_node_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size);
+extern int build_node_csr(struct self_s *self, struct external_entry_point_s *external_entry_point);
+extern int build_node_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr);
 extern int build_node_type(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size);
-extern int build_node_if_tail(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size);
+extern int build_node_post_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr);
+extern int build_node_if_tail(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr);
 extern int build_node_paths(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, struct path_s *paths, int *paths_size, int entry_point);
+extern int estimate_control_flow_paths(struct control_flow_node_s *nodes, int nodes_size, int node_start,
+	uint64_t budget, uint64_t *paths_count, int *path_length);
 extern int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, struct path_s *paths, int *paths_size, int *paths_used, int node_start);
 extern int print_control_flow_paths(struct self_s *self, struct path_s *paths, int *paths_size);
 extern int build_control_flow_nodes(struct self_s *self, struct control_flow_node_s *nodes, int *nodes_size);
 extern int build_control_flow_depth(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, struct path_s *paths, int *paths_size, int *paths_used, int node_start);
 extern int print_control_flow_nodes(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size);
 extern int analyse_control_flow_node_links(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size);
-extern int analyse_multi_ret(struct self_s *self, struct path_s *paths, int *paths_size, int *multi_ret_size, int **multi_ret);
-extern int analyse_merge_nodes(struct self_s *self, int function, int node_a, int node_b);
+extern int analyse_merge_nodes(struct self_s *self, int function, int node_a, int node_b, int *node_merged);
+extern int analyse_merge_exit_nodes(struct self_s *self, int function);
 extern int get_value_from_index(struct operand_s *operand, uint64_t *index);
 extern int log_to_label(int store, int indirect, uint64_t index, uint64_t size, uint64_t relocated, uint64_t value_scope, uint64_t value_id, int64_t indirect_offset_value, uint64_t indirect_value_id, struct label_s *label);
+extern int label_table_reserve(struct external_entry_point_s *entry_point, int label);
+extern int label_redirect_find(struct label_redirect_s *label_redirect, int label);
+extern int label_redirect_flatten(struct external_entry_point_s *entry_point);
 extern int register_label(struct external_entry_point_s *entry_point, uint64_t value_id,
 	struct memory_s *value, struct label_redirect_s *label_redirect, struct label_s *labels);
 extern int scan_for_labels_in_function_body(struct self_s *self, struct external_entry_point_s *entry_point,
 			 int start, int end, struct label_redirect_s *label_redirect, struct label_s *labels);
-extern int search_back_local_reg_stack(struct self_s *self, uint64_t mid_start_size, struct mid_start_s *mid_start, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, uint64_t *size, int *search_back_seen, uint64_t **inst_list);
+extern int search_back_index_build(struct self_s *self, struct external_entry_point_s *entry_point);
+extern int search_back_index_find(struct search_back_index_s *index, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, int *first);
+extern int search_back_local_reg_stack(struct self_s *self, struct search_back_index_s *index, uint64_t mid_start_size, struct mid_start_s *mid_start, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, uint64_t *size, uint64_t **inst_list);
+extern int params_labels_fill(struct external_entry_point_s *external_entry_point);
+extern int call_params_fill(struct self_s *self, struct external_entry_point_s *external_entry_point);
+extern int build_regions(struct self_s *self, struct external_entry_point_s *external_entry_point, int *regions_size);
+extern int print_regions(struct self_s *self, struct region_s *region, int depth, FILE *fd);
+extern void function_arena_free(struct self_s *self, struct external_entry_point_s *external_entry_point);
 
 
 
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __ARENA__
+#define __ARENA__
+
+/* A bump allocator. Each function being analysed has one.
+ * Memory is never freed individually, only all at once with arena_reset() or arena_free().
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block_s {
+	struct arena_block_s *prev;
+	size_t size;
+	size_t used;
+	/* data follows */
+};
+
+struct arena_s {
+	struct arena_block_s *block;	/* Current block. Older blocks are on the prev list */
+	size_t block_size;		/* Default size of each new block */
+	size_t total;			/* Total bytes handed out. Used for stats */
+};
+
+extern struct arena_s *arena_create(size_t block_size);
+extern void *arena_alloc(struct arena_s *arena, size_t nmemb, size_t size);
+extern void *arena_realloc(struct arena_s *arena, void *ptr, size_t old_size, size_t new_size);
+extern void arena_reset(struct arena_s *arena);
+extern void arena_free(struct arena_s *arena);
+
+#endif /* __ARENA__ */
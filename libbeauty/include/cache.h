@@ -0,0 +1,60 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __CACHE__
+#define __CACHE__
+
+/* On disk cache of the analysis results, so a function that has not changed
+ * since the last run is not emulated, analysed or converted to LLVM IR again.
+ * Each entry is one file, <dir>/<key hash>.lbc, holding the key, the params
+ * of the function with their labels, its LLVM bitcode and its C.
+ * The key covers the function's bytes and relocations, the functions it calls,
+ * .data and .rodata, the --llvm-passes list and CACHE_VERSION.
+ * The whole key is stored in the entry and compared on load,
+ * so two keys with the same hash cannot give a wrong hit.
+ */
+
+/* Change this whenever the analysis or the LLVM output changes, so old entries are not used. */
+#define CACHE_VERSION "libbeauty 0.2.0 cache 4"
+#define CACHE_MAGIC "LBCACHE1"
+
+struct cache_key_s {
+	size_t size;
+	size_t max;
+	uint8_t *data;
+};
+
+struct cache_s {
+	char *dir;
+	uint64_t global_hash;	/* .data, .rodata and their relocations */
+	struct cache_key_s *key;	/* One per external_entry_point */
+	int hits;
+	int misses;
+};
+
+extern struct cache_s *cache_create(const char *dir);
+extern void cache_key_global(struct cache_s *cache, const void *data, size_t size);
+extern void cache_key_global_relocs(struct cache_s *cache, struct reloc_table_s *reloc_table, uint64_t reloc_table_size);
+extern int cache_build_keys(struct self_s *self, struct cache_s *cache, uint8_t *inst, uint64_t inst_size,
+		struct reloc_table_s *reloc_table, uint64_t reloc_table_size);
+extern int cache_load(struct self_s *self, struct cache_s *cache, int entry);
+extern int cache_store(struct self_s *self, struct cache_s *cache, int entry, const char *bitcode, size_t bitcode_size);
+extern void cache_free(struct cache_s *cache);
+
+#endif /* __CACHE__ */
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __CHECKPOINT__
+#define __CHECKPOINT__
+
+/* Snapshot of the emulation results, taken after tidy_inst_log().
+ * dis64 --checkpoint FILE writes it, dis64 --resume-from FILE loads it instead of emulating again.
+ * The same .o is still needed for the symbols, sections and relocations.
+ * Its .text is stored in the checkpoint and compared on load.
+ *
+ * Layout: a checkpoint_header_s, then the sections it lists.
+ * Each section starts on a CHECKPOINT_ALIGN boundary and holds a plain array,
+ * so the file can be mapped and each array used where it is.
+ * There are no pointers in the file. The prev and next links of the inst_log
+ * are in the links section, prev then next for each entry in turn.
+ * Numbers are in the byte order of the writer. byte_order lets a reader check.
+ */
+
+#define CHECKPOINT_MAGIC "LBCHKPNT"
+/* Change this whenever the layout or the structs written change */
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+#define CHECKPOINT_ALIGN 4096
+
+#define CHECKPOINT_SECTION_TEXT 0		/* uint8_t, the .text the log was made from */
+#define CHECKPOINT_SECTION_FUNCTIONS 1		/* checkpoint_function_s, one per external_entry_point */
+#define CHECKPOINT_SECTION_INST_LOG 2		/* inst_log_entry_s, pointers cleared */
+#define CHECKPOINT_SECTION_LINKS 3		/* int */
+#define CHECKPOINT_SECTION_MEMORY 4		/* checkpoint_memory_s, only the entries in use */
+#define CHECKPOINT_SECTION_MEMORY_USED 5	/* checkpoint_memory_used_s, only the entries in use */
+#define CHECKPOINT_SECTIONS 6
+
+#define CHECKPOINT_MEMORY_TEXT 0
+#define CHECKPOINT_MEMORY_STACK 1
+#define CHECKPOINT_MEMORY_REG 2
+#define CHECKPOINT_MEMORY_DATA 3
+
+struct checkpoint_section_s {
+	uint64_t offset;	/* From the start of the file */
+	uint64_t size;		/* In bytes */
+};
+
+struct checkpoint_header_s {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t inst_log_entry_size;	/* sizeof(struct inst_log_entry_s) of the writer */
+	uint32_t memory_size;		/* sizeof(struct memory_s) of the writer */
+	uint64_t inst_log;		/* Next free inst_log entry */
+	struct checkpoint_section_s section[CHECKPOINT_SECTIONS];
+};
+
+struct checkpoint_function_s {
+	int32_t valid;
+	int32_t type;
+	int32_t section_id;
+	int32_t section_index;
+	uint64_t value;
+	uint64_t inst_log;
+	uint64_t inst_log_end;
+};
+
+struct checkpoint_memory_s {
+	uint32_t function;
+	uint32_t area;		/* CHECKPOINT_MEMORY_* */
+	uint32_t index;
+	uint32_t reserved;
+	struct memory_s memory;	/* prev and next cleared */
+};
+
+struct checkpoint_memory_used_s {
+	uint32_t function;
+	uint32_t index;
+	int32_t value;
+	uint32_t reserved;
+};
+
+extern int checkpoint_write(struct self_s *self, const char *filename, uint64_t inst_log,
+		uint8_t *inst, uint64_t inst_size);
+extern int checkpoint_read(struct self_s *self, const char *filename, uint64_t *inst_log,
+		uint8_t *inst, uint64_t inst_size);
+
+#endif /* __CHECKPOINT__ */
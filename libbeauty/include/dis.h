@@ -37,10 +37,7 @@
 #define RELOCATION_SIZE 1000
 /* For the .text segment. I.e. Instructions. */
 #define MEMORY_TEXT_SIZE 10000
-#define MEMORY_STACK_SIZE 10000
 #define MEMORY_REG_SIZE 100
-/* For the .data segment. I.e. Static data */
-#define MEMORY_DATA_SIZE 10000
 #define MEMORY_USED_SIZE 10000
 #define INST_LOG_ENTRY_SIZE 10000
 #define ENTRY_POINTS_SIZE 1000
@@ -7,6 +7,19 @@ extern struct memory_s *search_store(
         struct memory_s *memory, uint64_t index, int size);
 extern struct memory_s *add_new_store(
 	struct memory_s *memory, uint64_t index, int size);
+extern struct memory_s *memory_map_search(
+	struct memory_map_s *map, uint64_t index, int size_bits);
+extern struct memory_s *memory_map_add(
+	struct memory_map_s *map, uint64_t index, int size_bits);
+extern struct memory_s *memory_map_write(
+	struct memory_map_s *map, uint64_t index, int size_bits);
+extern struct memory_s *memory_map_entry(struct memory_map_s *map, int n);
+extern int memory_map_update_overlaps(
+	struct memory_map_s *map, struct memory_s *written);
+extern int memory_map_share(struct memory_map_s *dst, struct memory_map_s *src);
+extern void memory_map_release(struct memory_map_s *map);
+extern int memory_map_record(struct memory_map_s *map, struct memory_s *entry, int written);
+extern int memory_map_print(struct memory_map_s *map);
 
 //extern instructions_t instructions;
 extern uint8_t *inst;
@@ -46,10 +46,15 @@ struct reloc_table_s {
 
 struct process_state_s {
 	struct memory_s *memory_text;
-	struct memory_s *memory_stack;
+	/* Every stack and data entry of every path, for the later passes */
+	struct memory_map_s *memory_stack;
 	struct memory_s *memory_reg;
-	struct memory_s *memory_data;
+	struct memory_map_s *memory_data;
 	int *memory_used;
+	/* The stack and data as seen by the path being emulated.
+	 * memory_reg is also per path. See machine_state.c */
+	struct memory_map_s *live_stack;
+	struct memory_map_s *live_data;
 };
 
 struct loop_s {
@@ -163,6 +168,30 @@ struct ast_type_index_s {
 	uint64_t index; /* index into the specific object table */
 };
 
+/* Region types. The region tree replaces the fixed size AST tables.
+ * For IF_THEN_ELSE, WHILE, DO_WHILE and SWITCH, node is the node ending in the branch.
+ * Its instructions are output before the condition.
+ * children[n] is the region reached by link_next[n] of that node.
+ */
+#define REGION_TYPE_BLOCK 1		// A single node.
+#define REGION_TYPE_SEQUENCE 2		// The children, one after the other.
+#define REGION_TYPE_IF_THEN_ELSE 3	// One child per link_next. Empty SEQUENCE for no statements.
+#define REGION_TYPE_WHILE 4		// node is the loop head. children[0] is the body.
+#define REGION_TYPE_DO_WHILE 5		// node is the latch, and the last block of children[0].
+#define REGION_TYPE_LOOP 6		// for (;;). Left by break, goto or return.
+#define REGION_TYPE_SWITCH 7		// One child per link_next.
+#define REGION_TYPE_GOTO 8		// node is the target. Used when nothing else fits.
+#define REGION_TYPE_BREAK 9
+#define REGION_TYPE_CONTINUE 10
+
+struct region_s {
+	int type;
+	int node;
+	int label; /* 1 = a GOTO targets the node of this region */
+	int children_size;
+	struct region_s **children;
+};
+
 /* redirect is used for SSA correction, when one needs to rename a variable */
 /* renaming the variable within the log entries would take too long. */
 /* so use log entry value_id -> redirect -> label_s */
@@ -170,6 +199,19 @@ struct label_redirect_s {
 	uint64_t redirect;
 } ;
 
+/* Def-use chains of one function, indexed by label (value_id).
+ * Stored as CSR arrays: the uses of label l are
+ * uses[use_start[l]] to uses[use_start[l + 1] - 1].
+ * Each use is (inst << 1) | operand, operand 0 = srcA (value1), 1 = srcB (value2).
+ */
+struct def_use_s {
+	int labels_size;
+	int *def;	/* The instruction whose value3 defines each label. 0 for phi, param and constant labels */
+	int *use_start;	/* labels_size + 1 entries */
+	int uses_size;
+	int *uses;
+};
+
 struct label_s {
 	/* local = 1, param = 2, data = 3, mem = 4, sp_bp = 5 */
 	uint64_t scope;
@@ -198,6 +240,41 @@ struct label_s {
 #define NODE_TYPE_LOOP_THEN_ELSE 5
 #define NODE_TYPE_JMPT 6
 
+/* A set of path numbers, as a bitmap split into blocks of 64 paths.
+ * Only the blocks holding a member are stored, sorted by block number,
+ * so a node on a few of many thousands of paths stays small.
+ */
+struct path_set_s {
+	int size; /* Blocks used */
+	int max; /* Blocks allocated */
+	int *key; /* Block number, path >> 6 */
+	uint64_t *bits; /* Bit (path & 63) is set for a member */
+};
+
+/* Edge attributes in struct node_csr_s. Copies of the struct node_link_s flags. */
+#define NODE_LINK_NORMAL 1
+#define NODE_LINK_LOOP_EDGE 2
+#define NODE_LINK_LOOP_EXIT 4
+#define NODE_LINK_LOOP_ENTRY 8
+
+/* Compressed sparse row copy of one function's node links, numbered in reverse postorder.
+ * Index i is the i-th node in reverse postorder from node 1, so rpo[0] == 1.
+ * The successors of i are succ[succ_start[i]] to succ[succ_start[i + 1] - 1], in link_next order.
+ * Predecessors are the same with pred_start and pred.
+ * Only nodes reachable from node 1 are included. Built by build_node_csr().
+ */
+struct node_csr_s {
+	int size;
+	int *rpo; /* Index to node */
+	int *rpo_index; /* Node to index. -1 = not reachable. One entry per node */
+	int *succ_start;
+	int *succ;
+	uint8_t *succ_flags; /* NODE_LINK_* */
+	int *pred_start;
+	int *pred;
+	uint8_t *pred_flags; /* NODE_LINK_* */
+};
+
 struct control_flow_node_s {
 	int valid; /* 0 == invalid/un-used, 1 == valid/used */
 	int entry_point; /* Can use this to find the name on the node. */
@@ -209,6 +286,7 @@ struct control_flow_node_s {
 	int next_size;
 	struct node_link_s *link_next;
 	int dominator; /* Node that dominates this node */
+	int post_dominator; /* Immediate post-dominator. 0 = the virtual exit */
 	int type; /* 0 =  Normal, 1 =  Part of a loop, 2 = normal if statement */
 	int loop_head; /* 0 = Normal, 1 = Loop head */
 	int if_tail; /* 0 = no tail, > 0 points to the tail of the if...then...else */
@@ -216,6 +294,8 @@ struct control_flow_node_s {
 	int *path; /* The list of paths that touch this node */
 	int looped_path_size; /* Number of path entries in the list */
 	int *looped_path; /* The list of paths that touch this node */
+	struct path_set_s path_set; /* The paths in path[], so that none is added twice */
+	struct path_set_s looped_path_set; /* The paths in looped_path[] */
 	int member_of_loop_size; /* Number of member_of_loop entries in the list */
 	int *member_of_loop; /* The list of member_of_loop entries. One entry for each loop this node belongs to */
 	struct ast_type_index_s parent; /* This is filled in once the AST is being built */
@@ -241,6 +321,8 @@ struct external_entry_point_s {
 	int params_size;
 	int *params;
 	int *params_order;
+	/* labels[params[n]], so callers can be built after the labels are freed. See params_labels_fill() */
+	struct label_s *params_labels;
 	int param_reg_label[0xa0];
 	int locals_size;
 	int *locals;
@@ -260,8 +342,25 @@ struct external_entry_point_s {
 	/* FIXME: add function return type and param types */
 	struct label_redirect_s *label_redirect;
 	struct label_s *labels;
+	int labels_size; /* Number of label_redirect and labels entries allocated */
 	int variable_id;
-	int *search_back_seen;
+	/* Which instruction defines and which use each label. Built by build_def_use_chains() */
+	struct def_use_s *def_use;
+	/* Where each register and stack slot is defined. Built by search_back_index_build() */
+	struct search_back_index_s *search_back_index;
+	/* The node links in reverse postorder. Built by build_node_csr() */
+	struct node_csr_s *node_csr;
+	/* Structured AST of the function. Built by build_regions() */
+	struct region_s *region;
+	/* Scratch and results of the analysis of this function. Released in one go. */
+	struct arena_s *arena;
+	/* 1 = params, labels, C and bitcode were loaded by cache_load(), so the function is not analysed */
+	int cached;
+	char *cached_bitcode;
+	size_t cached_bitcode_size;
+	/* The C written for this function to test.c. Kept with --cache, for cache_store() */
+	char *c_text;
+	size_t c_text_size;
 };
 
 /* Memory and Registers are a list of accessed stores. */
@@ -322,6 +421,8 @@ struct memory_s {
 	uint64_t valid;
 	/* The instruction that assigned the value within SSA scope */
 	/* If size > 1 there is more than one path between there and here */
+	/* prev and next point into the def-use chains in the function's arena.
+	 * Set by build_def_use_chains() and cleared by function_arena_free(). Do not free or realloc them. */
 	int prev_size;
 	int *prev;
 	/* The instruction that uses the value within SSA scope */
@@ -330,6 +431,47 @@ struct memory_s {
 	int *next;
 };
 
+/* The stack and data stores.
+ * One entry per (start_address, length) accessed, sorted by start_address then length,
+ * so lookups are a binary search. Entries overlap when the same bytes are accessed
+ * with different sizes.
+ * The entries are held in chunks of up to MEMORY_MAP_CHUNK, in order.
+ * Chunks are shared between maps and copied on write, so a write to a shared map
+ * copies one chunk, not the whole map.
+ * Entry pointers are only valid until the next memory_map_add(), memory_map_write()
+ * or memory_map_update_overlaps(). Use memory_map_entry() to walk the entries.
+ */
+#define MEMORY_MAP_CHUNK 32
+
+struct memory_map_chunk_s {
+	/* Number of maps sharing this chunk */
+	int refs;
+	int size;
+	struct memory_s memory[MEMORY_MAP_CHUNK];
+};
+
+struct memory_map_s {
+	/* Number of entries */
+	int size;
+	/* Longest entry, in bytes. Bounds the search for overlapping entries. */
+	int max_length;
+	int chunks_size;
+	int chunks_max;
+	struct memory_map_chunk_s **chunk;
+	/* Index in the map of the first entry of each chunk */
+	int *chunk_first;
+};
+
+/* A snapshot of the machine state taken at a branch, for each target to resume from.
+ * The stack and data share their chunks with the live maps until one of them is written.
+ */
+struct machine_state_s {
+	int refcount;
+	struct memory_s *memory_reg;
+	struct memory_map_s memory_stack;
+	struct memory_map_s memory_data;
+};
+
 struct entry_point_s {
 	int used;
 	/* FIXME: Is this enough, or will full register backup be required */
@@ -340,6 +482,11 @@ struct entry_point_s {
 	uint64_t eip_init_value;
 	uint64_t eip_offset_value;
 	uint64_t previous_instuction;
+	/* Other instructions that branch here. Linked by entry_point_link() */
+	int prev_size;
+	uint64_t *prev;
+	/* The rest of the machine state. NULL to carry on with the live state. */
+	struct machine_state_s *state;
 };
 
 struct operand_s {
@@ -405,11 +552,20 @@ struct inst_log_entry_s {
 	struct memory_s value2;		/* Second input value */
 	struct memory_s value3;		/* Result */
 	int node_start;			/* Is this instruction the start of a node 0 == No, 1 == Yes */
-	int node_member;		/* The node this instrustion is a member off */
+	int node_member;		/* The node this instrustion is a member off. 0 == None.
+					 * Global node number until create_function_node_members(),
+					 * then the node number within its function. */
 	int node_end;			/* Is this instruction the end of a node 0 == No, 1 == Yes */
+	int removed;			/* Taken out of the log by rtl_value_numbering() or analyse_merge_nodes(). 0 == No, 1 == Yes */
 	void *extension;		/* Instruction specific extention */
 };
 
+/* inst_log_entry_s.extension for CALL instructions */
+struct extension_call_s {
+	int params_size;
+	int *params;
+};
+
 struct self_s {
 	int *section_number_mapping;
 	void *handle_void;
@@ -424,12 +580,25 @@ struct self_s {
 	struct relocation_s *relocations;
 	struct entry_point_s *entry_point; /* This is used to hold return values from process block */
 	uint64_t entry_point_list_length;  /* Number of entry_point entries allocated */
+	uint64_t entry_point_head;  /* Next entry_point to process */
+	uint64_t entry_point_tail;  /* Next free entry_point */
+	uint64_t *entry_point_hash;  /* index + 1 into entry_point, used to remove duplicates */
+	uint64_t entry_point_hash_size;
 	int nodes_size;
 	struct control_flow_node_s *nodes;
 	int flag_dependency_size;
 	int *flag_dependency;
 	int *flag_dependency_opcode;
 	int *flag_result_users;
+	int flag_live_size;
+	uint8_t *flag_live;  /* 1 if the flags set by the instruction are used. Built by flag_liveness_build() */
+	const char *filename;  /* The input .o file */
+	int llvm_per_function;  /* 0 = one .bc file for all functions, 1 = one .bc file per function */
+	int llvm_threads;  /* Threads used to build the LLVM IR. 0 or 1 = serial, -1 = one per CPU */
+	const char *llvm_passes;  /* Comma separated LLVM passes run before writing the .bc. NULL = none */
+	struct stats_s *stats;  /* Phase timing and memory use. NULL = not collected */
+	struct cache_s *cache;  /* Results of earlier runs. NULL = --cache not given */
+	void *llvm_export;  /* The LLVM export in progress. See llvm_export_begin() */
 };
 
 #endif /* __GLOBAL_STRUCT__ */
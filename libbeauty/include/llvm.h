@@ -1,7 +1,10 @@
 #ifdef __cplusplus
-extern "C" int llvm_export(struct self_s *self);
+extern "C" int llvm_export_begin(struct self_s *self);
+extern "C" int llvm_export_function(struct self_s *self, int external_entry);
+extern "C" int llvm_export_end(struct self_s *self);
 #else
-extern int llvm_export(struct self_s *self);
+extern int llvm_export_begin(struct self_s *self);
+extern int llvm_export_function(struct self_s *self, int external_entry);
+extern int llvm_export_end(struct self_s *self);
 #endif
 
-
@@ -24,8 +24,10 @@
 
 #ifdef __cplusplus
 extern "C" int label_to_string(struct label_s *label, char *string, int size);
+extern "C" const char *label_to_name(struct label_s *label);
 #else
 extern int label_to_string(struct label_s *label, char *string, int size);
+extern const char *label_to_name(struct label_s *label);
 #endif
 
 #define __OUTPUT__
@@ -50,10 +50,7 @@ void debug_print(int module, int level, const char *format, ...) __attribute__((
 #define RELOCATION_SIZE 1000
 /* For the .text segment. I.e. Instructions. */
 #define MEMORY_TEXT_SIZE 10000
-#define MEMORY_STACK_SIZE 10000
 #define MEMORY_REG_SIZE 100
-/* For the .data segment. I.e. Static data */
-#define MEMORY_DATA_SIZE 10000
 #define MEMORY_USED_SIZE 10000
 #define INST_LOG_ENTRY_SIZE 10000
 #define ENTRY_POINTS_SIZE 1000
@@ -62,11 +59,6 @@ void debug_print(int module, int level, const char *format, ...) __attribute__((
 /* RDI, RSI, RDX, RCX, R08, R09  */
 extern int reg_params_order[];
 
-struct extension_call_s {
-	int params_size;
-	int *params;
-};
-
 /* Params order:
  * int test30(int64_t param_reg0040, int64_t param_reg0038, int64_t param_reg0018, int64_t param_reg0010, int64_t param_reg0050, int64_t param_reg0058, int64_t param_stack0008, int64_t param_stack0010)
  */
@@ -191,6 +183,19 @@ struct ast_s {
 
 extern int execute_instruction(struct self_s *self, struct process_state_s *process_state, struct inst_log_entry_s *inst);
 extern int process_block(struct self_s *self, struct process_state_s *process_state, uint64_t inst_log_prev, uint64_t eip_offset_limit);
+extern int process_block_link(struct self_s *self, uint64_t inst_log_prev, int inst_this);
+extern int entry_point_init(struct self_s *self, uint64_t size);
+extern int entry_point_reset(struct self_s *self);
+extern int entry_point_add(struct self_s *self, uint64_t esp_init_value, uint64_t esp_offset_value,
+		uint64_t ebp_init_value, uint64_t ebp_offset_value,
+		uint64_t eip_init_value, uint64_t eip_offset_value,
+		uint64_t previous_instuction, struct machine_state_s *state);
+extern int entry_point_next(struct self_s *self, struct entry_point_s *entry);
+extern int entry_point_link(struct self_s *self, struct process_state_s *process_state);
+extern struct machine_state_s *machine_state_snapshot(struct process_state_s *process_state);
+extern int machine_state_restore(struct process_state_s *process_state, struct machine_state_s *state);
+extern void machine_state_ref(struct machine_state_s *state);
+extern void machine_state_release(struct machine_state_s *state);
 int output_function_body(struct self_s *self, struct process_state_s *process_state,
 			 FILE *fd, int start, int end, struct label_redirect_s *label_redirect, struct label_s *labels);
 uint32_t output_function_name(FILE *fd,
@@ -206,6 +211,10 @@ extern void disassemble_callback_start(struct self_s *self);
 extern void disassemble_callback_end(struct self_s *self);
 
 #include <bfl.h>
+#include <arena.h>
+#include <stats.h>
+#include <cache.h>
+#include <checkpoint.h>
 #include <analyse.h>
 #include <llvm.h>
 #include <output.h>
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __STATS__
+#define __STATS__
+
+/* Per phase and per function instrumentation.
+ * Take a stats_mark() at the start of a phase, then stats_record() at the end.
+ * A phase run one function at a time records each function, then stats_record_total().
+ * All the stats_ functions do nothing if stats == NULL, so they can be left in place.
+ */
+
+struct stats_mark_s {
+	double wall;		/* Seconds, CLOCK_MONOTONIC */
+	double cpu;		/* Seconds, CLOCK_PROCESS_CPUTIME_ID */
+	long max_rss;		/* Peak RSS so far, in KB */
+};
+
+struct stats_record_s {
+	const char *phase;
+	int function;		/* external_entry_points index, or -1 for the whole phase */
+	double wall;
+	double cpu;
+	long max_rss_delta;	/* Growth of the peak RSS during the phase, in KB */
+	const char *items_name;	/* e.g. "instructions", "nodes", "paths", "phis" */
+	uint64_t items;
+};
+
+struct stats_s {
+	int records_size;
+	int records_max;
+	struct stats_record_s *records;
+	struct stats_mark_s start;	/* When stats_create() was called */
+	int failed;			/* A record was dropped, so no stats are written */
+};
+
+extern struct stats_s *stats_create(void);
+extern void stats_mark(struct stats_s *stats, struct stats_mark_s *mark);
+extern int stats_record(struct stats_s *stats, struct stats_mark_s *mark, const char *phase,
+		int function, const char *items_name, uint64_t items);
+extern int stats_record_total(struct stats_s *stats, const char *phase, const char *items_name);
+extern int stats_write_json(struct self_s *self, struct stats_s *stats, const char *filename);
+extern void stats_free(struct stats_s *stats);
+
+#endif /* __STATS__ */
@@ -24,6 +24,7 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -99,25 +100,424 @@ int tidy_inst_log(struct self_s *self)
 	return 0;
 }
 
-int find_node_from_inst(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, int inst)
+/* Value numbering state for rtl_value_numbering().
+ * An operand is a register read, a constant or anything else (opaque).
+ */
+#define VN_OPERAND_NONE 0
+#define VN_OPERAND_VALUE 1
+#define VN_OPERAND_CONST 2
+#define VN_EXPRESSIONS_MAX 256
+
+struct vn_operand_s {
+	int kind;
+	uint64_t value;	/* value number or constant */
+	int size;
+};
+
+struct vn_expression_s {
+	int opcode;
+	struct vn_operand_s a;
+	struct vn_operand_s b;
+	int size;
+	int vn;
+};
+
+struct vn_state_s {
+	int reg_vn[MAX_REG];		/* Value number each register holds. 0 = not known yet */
+	int reg_size[MAX_REG];		/* Size it was written at */
+	int vn_next;
+	int vn_holder_size;
+	int *vn_holder;			/* The first register given each value number */
+	int expressions_size;
+	struct vn_expression_s expressions[VN_EXPRESSIONS_MAX];
+	int tmp_def[MAX_REG];		/* Instruction that last wrote REG_TMP1/2, if still unread */
+};
+
+static int vn_new(struct vn_state_s *vn_state, int reg)
+{
+	int vn = vn_state->vn_next;
+
+	if (vn >= vn_state->vn_holder_size) {
+		vn_state->vn_holder_size = vn_state->vn_holder_size ? vn_state->vn_holder_size * 2 : 1024;
+		vn_state->vn_holder = realloc(vn_state->vn_holder, vn_state->vn_holder_size * sizeof(int));
+	}
+	vn_state->vn_holder[vn] = reg;
+	vn_state->vn_next++;
+	return vn;
+}
+
+static void vn_reset(struct vn_state_s *vn_state)
+{
+	memset(vn_state->reg_vn, 0, sizeof(vn_state->reg_vn));
+	memset(vn_state->reg_size, 0, sizeof(vn_state->reg_size));
+	memset(vn_state->tmp_def, 0, sizeof(vn_state->tmp_def));
+	vn_state->vn_next = 1;
+	vn_state->expressions_size = 0;
+}
+
+static int vn_is_tmp(uint64_t reg)
+{
+	return (reg == REG_TMP1) || (reg == REG_TMP2);
+}
+
+/* The value number of a register operand. A register not yet seen in this run gets a new one. */
+static void vn_operand(struct vn_state_s *vn_state, struct operand_s *operand, struct vn_operand_s *vn_operand)
+{
+	vn_operand->kind = VN_OPERAND_NONE;
+	vn_operand->value = 0;
+	vn_operand->size = operand->value_size;
+	if ((operand->indirect != IND_DIRECT) || (operand->index >= MAX_REG)) {
+		return;
+	}
+	if ((operand->store == STORE_DIRECT) && !operand->relocated) {
+		vn_operand->kind = VN_OPERAND_CONST;
+		vn_operand->value = operand->index;
+	} else if (operand->store == STORE_REG) {
+		if (!vn_state->reg_vn[operand->index]) {
+			vn_state->reg_vn[operand->index] = vn_new(vn_state, operand->index);
+			vn_state->reg_size[operand->index] = operand->value_size;
+		}
+		/* A read at another size than the write is not the same value */
+		if (vn_state->reg_size[operand->index] != operand->value_size) {
+			return;
+		}
+		vn_operand->kind = VN_OPERAND_VALUE;
+		vn_operand->value = vn_state->reg_vn[operand->index];
+	}
+}
+
+static int vn_operand_equal(struct vn_operand_s *a, struct vn_operand_s *b)
+{
+	return (a->kind == b->kind) && (a->value == b->value) && (a->size == b->size);
+}
+
+/* Copy propagation. If a read of REG_TMP1 or REG_TMP2 can be replaced by a real register
+ * holding the same value, do so. Otherwise note the temporary as read. */
+static void vn_propagate_tmp(struct vn_state_s *vn_state, struct operand_s *operand, int *changed)
+{
+	uint64_t reg = operand->index;
+	int vn;
+	int holder;
+
+	if ((operand->store != STORE_REG) || !vn_is_tmp(reg)) {
+		return;
+	}
+	vn = vn_state->reg_vn[reg];
+	if (vn) {
+		holder = vn_state->vn_holder[vn];
+		/* A base address is read at 64 bits */
+		if (!vn_is_tmp(holder) &&
+			(vn_state->reg_vn[holder] == vn) &&
+			(vn_state->reg_size[holder] == vn_state->reg_size[reg]) &&
+			((operand->indirect != IND_DIRECT) ?
+				(vn_state->reg_size[reg] == 64) :
+				(operand->value_size == vn_state->reg_size[reg]))) {
+			operand->index = holder;
+			(*changed)++;
+			return;
+		}
+	}
+	vn_state->tmp_def[reg] = 0;
+}
+
+/* Instructions that must never be taken out of the log: function entry and end instructions.
+ * Returns a calloc'ed array of inst_log entries, or NULL. */
+uint8_t *inst_log_keep_build(struct self_s *self)
+{
+	uint8_t *keep;
+	int l;
+
+	keep = calloc(inst_log + 1, sizeof(uint8_t));
+	if (!keep) {
+		return NULL;
+	}
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (self->external_entry_points[l].valid) {
+			if (self->external_entry_points[l].inst_log < inst_log) {
+				keep[self->external_entry_points[l].inst_log] = 1;
+			}
+			if (self->external_entry_points[l].inst_log_end < inst_log) {
+				keep[self->external_entry_points[l].inst_log_end] = 1;
+			}
+		}
+	}
+	return keep;
+}
+
+/* Take inst out of the prev/next links and mark it removed.
+ * Only a straight line instruction that does not set or use flags can go.
+ * Returns 0 if removed, 1 if it had to stay. */
+int inst_log_unlink(struct self_s *self, int inst, uint8_t *keep)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1 = &inst_log_entry[inst];
+	struct inst_log_entry_s *inst_log_prev;
+	struct inst_log_entry_s *inst_log_next;
+	int prev;
+	int next;
+	int m;
+
+	if (keep[inst] || inst_log1->instruction.flags ||
+		(inst_log1->prev_size != 1) || (inst_log1->next_size != 1)) {
+		return 1;
+	}
+	if (self->flag_dependency && (inst < self->flag_dependency_size) &&
+		(self->flag_dependency[inst] || self->flag_result_users[inst])) {
+		return 1;
+	}
+	prev = inst_log1->prev[0];
+	next = inst_log1->next[0];
+	if ((prev <= 0) || (next <= 0)) {
+		return 1;
+	}
+	inst_log_prev = &inst_log_entry[prev];
+	inst_log_next = &inst_log_entry[next];
+	/* Do not make duplicate links */
+	for (m = 0; m < inst_log_prev->next_size; m++) {
+		if (inst_log_prev->next[m] == next) {
+			return 1;
+		}
+	}
+	for (m = 0; m < inst_log_next->prev_size; m++) {
+		if (inst_log_next->prev[m] == prev) {
+			return 1;
+		}
+	}
+	for (m = 0; m < inst_log_prev->next_size; m++) {
+		if (inst_log_prev->next[m] == inst) {
+			inst_log_prev->next[m] = next;
+		}
+	}
+	for (m = 0; m < inst_log_next->prev_size; m++) {
+		if (inst_log_next->prev[m] == inst) {
+			inst_log_next->prev[m] = prev;
+		}
+	}
+	debug_print(DEBUG_ANALYSE, 1, "inst_log_unlink: removed inst 0x%x\n", inst);
+	inst_log1->instruction.opcode = NOP;
+	inst_log1->prev_size = 0;
+	inst_log1->next_size = 0;
+	inst_log1->removed = 1;
+	return 0;
+}
+
+/* Local value numbering and copy propagation over the RTL instruction log.
+ * Runs over each straight line run of instructions, before nodes and labels exist.
+ * - An instruction that puts into a register the value it already holds is removed.
+ *   E.g. a second "MOV TMP1, RSP", or the same sum computed again into the same register.
+ * - Reads of REG_TMP1/REG_TMP2 are replaced by the real register holding the same value,
+ *   e.g. the base register that convert_base() copied into REG_TMP1.
+ * - A write to a temporary that is overwritten before anything reads it is removed.
+ * Removed instructions are unlinked, marked removed, and ignored by build_control_flow_nodes().
+ * Instructions that set or use flags, and function entry and end instructions, are kept.
+ * *removed is set to the number of instructions removed.
+ */
+int rtl_value_numbering(struct self_s *self, int *removed)
 {
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
 	struct inst_log_entry_s *inst_log1;
-	int found = 0;
+	struct instruction_s *instruction;
+	struct vn_state_s *vn_state;
+	struct vn_expression_s expression;
+	uint8_t *keep;
+	int last = 0;
+	int changed = 0;
+	int pure;
+	int dst_reg;
+	int prev;
+	int vn;
+	int m, n;
+
+	*removed = 0;
+	vn_state = calloc(1, sizeof(struct vn_state_s));
+	keep = inst_log_keep_build(self);
+	if (!vn_state || !keep) {
+		free(vn_state);
+		free(keep);
+		return 1;
+	}
+	vn_reset(vn_state);
 
-	do {
-		inst_log1 = &inst_log_entry[inst];
-		if (inst_log1->node_start) {
-			found = inst_log1->node_member;
+	for (n = 1; n < inst_log; n++) {
+		inst_log1 = &inst_log_entry[n];
+		instruction = &inst_log1->instruction;
+		if (inst_log1->removed) {
+			continue;
+		}
+		/* Start again at every join or split */
+		if ((inst_log1->prev_size != 1) || (inst_log1->prev[0] != last) ||
+			(inst_log_entry[last].next_size != 1)) {
+			vn_reset(vn_state);
+		}
+		last = n;
+
+		pure = 0;
+		dst_reg = -1;
+		if ((instruction->dstA.store == STORE_REG) &&
+			(instruction->dstA.indirect == IND_DIRECT) &&
+			(instruction->dstA.index < MAX_REG)) {
+			dst_reg = instruction->dstA.index;
+		}
+		switch (instruction->opcode) {
+		case MOV:
+		case ADD:
+		case SUB:
+		case MUL:
+		case OR:
+		case XOR:
+		case rAND:
+		case NOT:
+		case NEG:
+		case SHL:
+		case SHR:
+		case SAL:
+		case SAR:
+		case SEX:
+			pure = 1;
+			/* Fall through */
+		case LOAD:
+		case STORE:
+		case CMP:
+		case TEST:
+			vn_propagate_tmp(vn_state, &instruction->srcA, &changed);
+			vn_propagate_tmp(vn_state, &instruction->srcB, &changed);
+			if (instruction->dstA.indirect != IND_DIRECT) {
+				/* The address register of a store is a read */
+				vn_propagate_tmp(vn_state, &instruction->dstA, &changed);
+			}
 			break;
+		case CALL:
+			vn_reset(vn_state);
+			continue;
+		default:
+			/* Anything else may read the temporaries */
+			vn_state->tmp_def[REG_TMP1] = 0;
+			vn_state->tmp_def[REG_TMP2] = 0;
+			break;
+		}
+		if (dst_reg < 0) {
+			continue;
 		}
-		if (0 == inst_log1->prev_size) {
+		if (!pure || (dst_reg == REG_IP)) {
+			/* A new value, e.g. loaded from memory */
+			vn_state->reg_vn[dst_reg] = vn_new(vn_state, dst_reg);
+			vn_state->reg_size[dst_reg] = instruction->dstA.value_size;
+			vn_state->tmp_def[dst_reg] = 0;
+			continue;
+		}
+		memset(&expression, 0, sizeof(expression));
+		expression.opcode = instruction->opcode;
+		vn_operand(vn_state, &instruction->srcA, &expression.a);
+		if (instruction->opcode != MOV) {
+			vn_operand(vn_state, &instruction->srcB, &expression.b);
+		}
+		expression.size = instruction->dstA.value_size;
+		vn = 0;
+		if ((instruction->opcode == MOV) && (expression.a.kind == VN_OPERAND_VALUE) &&
+			(expression.a.size == expression.size)) {
+			/* A copy has the value number of its source */
+			vn = expression.a.value;
+		} else if ((expression.a.kind != VN_OPERAND_NONE) &&
+			((instruction->opcode == MOV) || (expression.b.kind != VN_OPERAND_NONE))) {
+			for (m = 0; m < vn_state->expressions_size; m++) {
+				struct vn_expression_s *e = &vn_state->expressions[m];
+				if ((e->opcode == expression.opcode) && (e->size == expression.size) &&
+					vn_operand_equal(&e->a, &expression.a) &&
+					vn_operand_equal(&e->b, &expression.b)) {
+					vn = e->vn;
+					break;
+				}
+			}
+			if (!vn) {
+				vn = vn_new(vn_state, dst_reg);
+				if (vn_state->expressions_size >= VN_EXPRESSIONS_MAX) {
+					vn_state->expressions_size = 0;
+				}
+				expression.vn = vn;
+				vn_state->expressions[vn_state->expressions_size] = expression;
+				vn_state->expressions_size++;
+			}
+		}
+		if (!vn) {
+			vn_state->reg_vn[dst_reg] = vn_new(vn_state, dst_reg);
+			vn_state->reg_size[dst_reg] = instruction->dstA.value_size;
+			vn_state->tmp_def[dst_reg] = 0;
+			continue;
+		}
+		/* Identical recomputation: the register already holds this value */
+		if ((vn_state->reg_vn[dst_reg] == vn) &&
+			(vn_state->reg_size[dst_reg] == expression.size)) {
+			prev = inst_log1->prev[0];
+			if (!inst_log_unlink(self, n, keep)) {
+				(*removed)++;
+				/* The run carries on from the previous instruction */
+				last = prev;
+				continue;
+			}
+		}
+		/* A temporary overwritten before it was read */
+		if (vn_is_tmp(dst_reg) && vn_state->tmp_def[dst_reg]) {
+			if (!inst_log_unlink(self, vn_state->tmp_def[dst_reg], keep)) {
+				(*removed)++;
+			}
+		}
+		vn_state->reg_vn[dst_reg] = vn;
+		vn_state->reg_size[dst_reg] = expression.size;
+		/* Prefer a real register as the holder, so temporaries can be propagated away */
+		if ((vn_state->reg_vn[vn_state->vn_holder[vn]] != vn) ||
+			(vn_is_tmp(vn_state->vn_holder[vn]) && !vn_is_tmp(dst_reg))) {
+			vn_state->vn_holder[vn] = dst_reg;
+		}
+		vn_state->tmp_def[dst_reg] = vn_is_tmp(dst_reg) ? n : 0;
+	}
+	debug_print(DEBUG_ANALYSE, 1, "value_numbering: 0x%x operands propagated, 0x%x instructions removed\n",
+		changed, *removed);
+	free(vn_state->vn_holder);
+	free(vn_state);
+	free(keep);
+	return 0;
+}
+
+/* Set node_member for each instruction from inst_start to inst_end, following next[0].
+ * Every place that changes which instructions are in a node must call this,
+ * so that find_node_from_inst() can simply read node_member. */
+int node_member_set(struct self_s *self, int inst_start, int inst_end, int node)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1;
+	int inst = inst_start;
+
+	while ((inst > 0) && (inst < inst_log)) {
+		inst_log1 = &inst_log_entry[inst];
+		inst_log1->node_member = node;
+		if ((inst == inst_end) || (inst_log1->next_size == 0)) {
 			break;
 		}
-		inst = inst_log1->prev[0];
-	} while (inst);
+		inst = inst_log1->next[0];
+	}
+	return 0;
+}
+
+/* Returns 1 if test_node is in the loop headed by loop_node */
+int is_member_of_loop(struct control_flow_node_s *nodes, int loop_node, int test_node)
+{
+	int n;
+
+	for (n = 0; n < nodes[test_node].member_of_loop_size; n++) {
+		if (loop_node == nodes[test_node].member_of_loop[n]) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	return found;
+/* Returns the node inst is a member of, or 0 if it is not in a node. */
+int find_node_from_inst(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, int inst)
+{
+	if ((inst <= 0) || (inst >= inst_log)) {
+		return 0;
+	}
+	return self->inst_log_entry[inst].node_member;
 }
 
 int node_mid_start_add(struct control_flow_node_s *node, struct node_mid_start_s *node_mid_start, int path, int step)
@@ -127,7 +527,7 @@ int node_mid_start_add(struct control_flow_node_s *node, struct node_mid_start_s
 	int index = 1;
 	int used = 0;
 
-	for (n = 0; n < 1000; n++) {
+	for (n = 0; n < NODE_MID_START_MAX; n++) {
 		if (node_mid_start[n].node == 0) {
 			node_mid_start[n].node = node->link_next[index].node;
 			node_mid_start[n].path_prev = path;
@@ -142,12 +542,16 @@ int node_mid_start_add(struct control_flow_node_s *node, struct node_mid_start_s
 			}
 		}
 	}
-	for (n = 0; n < 1000; n++) {
+	for (n = 0; n < NODE_MID_START_MAX; n++) {
 		if (node_mid_start[n].node != 0) {
 			used++;
 		}
 	}
 	debug_print(DEBUG_ANALYSE_PATHS, 1, "JCD1: node_mid_start_add: node_mid_start used 0x%x\n", used);
+	if (index < limit) {
+		debug_print(DEBUG_ANALYSE_PATHS, 1, "node_mid_start_add: node_mid_start full\n");
+		return 1;
+	}
 	return 0;
 }
 
@@ -390,25 +794,82 @@ int print_control_flow_loops(struct self_s *self, struct loop_s *loops, int *loo
 	return 0;
 }
 
+/* Add path to set. Returns 0 if added, 1 if already there. */
+int path_set_add(struct path_set_s *set, int path)
+{
+	int key = path >> 6;
+	uint64_t bit = 1ULL << (path & 63);
+	int low = 0;
+	int high = set->size;
+	int mid;
+
+	/* Paths are mostly added in increasing order */
+	if (set->size && (set->key[set->size - 1] <= key)) {
+		low = set->size - 1;
+		if (set->key[low] < key) {
+			low = set->size;
+		}
+	} else {
+		while (low < high) {
+			mid = (low + high) / 2;
+			if (set->key[mid] < key) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+	}
+	if ((low < set->size) && (set->key[low] == key)) {
+		if (set->bits[low] & bit) {
+			return 1;
+		}
+		set->bits[low] |= bit;
+		return 0;
+	}
+	if (set->size >= set->max) {
+		set->max = set->max ? set->max * 2 : 4;
+		set->key = realloc(set->key, set->max * sizeof(int));
+		set->bits = realloc(set->bits, set->max * sizeof(uint64_t));
+		if (!set->key || !set->bits) {
+			debug_print(DEBUG_ANALYSE, 1, "path_set_add: out of memory\n");
+			exit(1);
+		}
+	}
+	memmove(&(set->key[low + 1]), &(set->key[low]), (set->size - low) * sizeof(int));
+	memmove(&(set->bits[low + 1]), &(set->bits[low]), (set->size - low) * sizeof(uint64_t));
+	set->key[low] = key;
+	set->bits[low] = bit;
+	set->size++;
+	return 0;
+}
+
+void path_set_free(struct path_set_s *set)
+{
+	free(set->key);
+	free(set->bits);
+	set->key = NULL;
+	set->bits = NULL;
+	set->size = 0;
+	set->max = 0;
+}
+
+/* The path[] list keeps the order the paths were added in, for the phi code.
+ * The path_set is used to not add a path twice.
+ */
 int add_path_to_node(struct control_flow_node_s *node, int path)
 {
 	int size;
-	int n;
 
-	size = node->path_size;
 	/* Don't add path twice */
-	if (size > 0) {
-		for (n = 0; n < size; n++) {
-			if (node->path[n] == path) {
-				return 1;
-			}
-		}
+	if (path_set_add(&(node->path_set), path)) {
+		return 1;
 	}
-
-	size++;
-	node->path = realloc(node->path, size * sizeof(int));
-	node->path[size - 1] = path;
-	node->path_size = size;
+	size = node->path_size;
+	if ((size == 0) || !(size & (size - 1))) {
+		node->path = realloc(node->path, (size ? size * 2 : 1) * sizeof(int));
+	}
+	node->path[size] = path;
+	node->path_size = size + 1;
 
 	return 0;
 }
@@ -416,22 +877,17 @@ int add_path_to_node(struct control_flow_node_s *node, int path)
 int add_looped_path_to_node(struct control_flow_node_s *node, int path)
 {
 	int size;
-	int n;
 
-	size = node->looped_path_size;
 	/* Don't add path twice */
-	if (size > 0) {
-		for (n = 0; n < size; n++) {
-			if (node->looped_path[n] == path) {
-				return 1;
-			}
-		}
+	if (path_set_add(&(node->looped_path_set), path)) {
+		return 1;
 	}
-
-	size++;
-	node->looped_path = realloc(node->looped_path, size * sizeof(int));
-	node->looped_path[size - 1] = path;
-	node->looped_path_size = size;
+	size = node->looped_path_size;
+	if ((size == 0) || !(size & (size - 1))) {
+		node->looped_path = realloc(node->looped_path, (size ? size * 2 : 1) * sizeof(int));
+	}
+	node->looped_path[size] = path;
+	node->looped_path_size = size + 1;
 
 	return 0;
 }
@@ -480,45 +936,200 @@ is_subset_exit:
 	return result;
 }
 
-int build_node_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size)
+static uint8_t node_link_flags(struct node_link_s *link)
 {
-	int n,m;
-	int node_b = 1;
-	int tmp;
-	//int type;
+	uint8_t flags = 0;
 
-	for(n = 1; n < nodes_size; n++) {
-		node_b = n;
-		while (node_b != 0) {
-			tmp = 0;
-			/* avoid following loop edge ones */
-			for (m = 0; m < nodes[node_b].prev_size; m++) {
-				int prev_node;
-				int prev_link_index;
-
-				prev_node = nodes[node_b].prev_node[m];
-				if (!prev_node) {
+	if (link->is_normal) {
+		flags |= NODE_LINK_NORMAL;
+	}
+	if (link->is_loop_edge) {
+		flags |= NODE_LINK_LOOP_EDGE;
+	}
+	if (link->is_loop_exit) {
+		flags |= NODE_LINK_LOOP_EXIT;
+	}
+	if (link->is_loop_entry) {
+		flags |= NODE_LINK_LOOP_ENTRY;
+	}
+	return flags;
+}
+
+/* Build external_entry_point->node_csr from the link_next of the nodes.
+ * Run again if the links or their flags change.
+ */
+int build_node_csr(struct self_s *self, struct external_entry_point_s *external_entry_point)
+{
+	struct control_flow_node_s *nodes = external_entry_point->nodes;
+	int nodes_size = external_entry_point->nodes_size;
+	struct arena_s *arena = external_entry_point->arena;
+	struct node_csr_s *csr;
+	int *stack;
+	int *child;
+	int *post;
+	int *fill;
+	int post_size = 0;
+	int sp = 0;
+	int node, next;
+	int edges = 0;
+	int n, m, i;
+
+	external_entry_point->node_csr = NULL;
+	if (nodes_size < 2) {
+		return 1;
+	}
+	csr = arena_alloc(arena, 1, sizeof(struct node_csr_s));
+	if (!csr) {
+		debug_print(DEBUG_ANALYSE, 1, "build_node_csr: out of memory\n");
+		exit(1);
+	}
+	csr->rpo_index = arena_alloc(arena, nodes_size, sizeof(int));
+	stack = calloc(nodes_size, sizeof(int));
+	child = calloc(nodes_size, sizeof(int));
+	post = calloc(nodes_size, sizeof(int));
+	if (!csr->rpo_index || !stack || !child || !post) {
+		debug_print(DEBUG_ANALYSE, 1, "build_node_csr: out of memory\n");
+		exit(1);
+	}
+	for (n = 0; n < nodes_size; n++) {
+		csr->rpo_index[n] = -1;
+	}
+
+	/* Postorder from node 1. -2 marks a node on the stack or done. */
+	csr->rpo_index[1] = -2;
+	stack[sp++] = 1;
+	while (sp > 0) {
+		node = stack[sp - 1];
+		if (child[node] < nodes[node].next_size) {
+			next = nodes[node].link_next[child[node]].node;
+			child[node]++;
+			if ((next > 0) && (next < nodes_size) && (csr->rpo_index[next] == -1)) {
+				csr->rpo_index[next] = -2;
+				stack[sp++] = next;
+			}
+			continue;
+		}
+		post[post_size++] = node;
+		edges += nodes[node].next_size;
+		sp--;
+	}
+
+	csr->size = post_size;
+	csr->rpo = arena_alloc(arena, post_size, sizeof(int));
+	csr->succ_start = arena_alloc(arena, post_size + 1, sizeof(int));
+	csr->succ = arena_alloc(arena, edges, sizeof(int));
+	csr->succ_flags = arena_alloc(arena, edges, sizeof(uint8_t));
+	csr->pred_start = arena_alloc(arena, post_size + 1, sizeof(int));
+	csr->pred = arena_alloc(arena, edges, sizeof(int));
+	csr->pred_flags = arena_alloc(arena, edges, sizeof(uint8_t));
+	if (!csr->rpo || !csr->succ_start || !csr->pred_start ||
+		(edges && (!csr->succ || !csr->succ_flags || !csr->pred || !csr->pred_flags))) {
+		debug_print(DEBUG_ANALYSE, 1, "build_node_csr: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < post_size; i++) {
+		node = post[post_size - 1 - i];
+		csr->rpo[i] = node;
+		csr->rpo_index[node] = i;
+	}
+
+	/* Successors in link_next order */
+	for (i = 0; i < post_size; i++) {
+		node = csr->rpo[i];
+		csr->succ_start[i + 1] = csr->succ_start[i] + nodes[node].next_size;
+		for (m = 0; m < nodes[node].next_size; m++) {
+			csr->succ[csr->succ_start[i] + m] = csr->rpo_index[nodes[node].link_next[m].node];
+			csr->succ_flags[csr->succ_start[i] + m] = node_link_flags(&(nodes[node].link_next[m]));
+		}
+	}
+
+	/* Predecessors, counted then filled in index order */
+	for (m = 0; m < edges; m++) {
+		csr->pred_start[csr->succ[m] + 1]++;
+	}
+	for (i = 0; i < post_size; i++) {
+		csr->pred_start[i + 1] += csr->pred_start[i];
+	}
+	fill = child;
+	for (i = 0; i < post_size; i++) {
+		fill[i] = csr->pred_start[i];
+	}
+	for (i = 0; i < post_size; i++) {
+		for (m = csr->succ_start[i]; m < csr->succ_start[i + 1]; m++) {
+			n = fill[csr->succ[m]]++;
+			csr->pred[n] = i;
+			csr->pred_flags[n] = csr->succ_flags[m];
+		}
+	}
+
+	free(stack);
+	free(child);
+	free(post);
+	external_entry_point->node_csr = csr;
+	return 0;
+}
+
+/* Immediate dominators, by the Cooper, Harvey and Kennedy iteration over the csr.
+ * In reverse postorder a reducible graph settles in two passes.
+ */
+int build_node_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr)
+{
+	int *idom;
+	int changed;
+	int new_idom;
+	int a, b;
+	int i, m;
+
+	for (i = 0; i < nodes_size; i++) {
+		nodes[i].dominator = 0;
+	}
+	if (!csr || (csr->size < 1)) {
+		return 0;
+	}
+	idom = calloc(csr->size, sizeof(int));
+	if (!idom) {
+		debug_print(DEBUG_ANALYSE, 1, "build_node_dominance: out of memory\n");
+		exit(1);
+	}
+	for (i = 1; i < csr->size; i++) {
+		idom[i] = -1;
+	}
+	do {
+		changed = 0;
+		for (i = 1; i < csr->size; i++) {
+			new_idom = -1;
+			for (m = csr->pred_start[i]; m < csr->pred_start[i + 1]; m++) {
+				a = csr->pred[m];
+				if (idom[a] < 0) {
 					continue;
 				}
-				prev_link_index = nodes[node_b].prev_link_index[m];
-				//debug_print(DEBUG_ANALYSE, 1, "dom: prev_node = 0x%x, prev_link_index = 0x%x\n", prev_node, prev_link_index);
-				if (!(nodes[prev_node].link_next[prev_link_index].is_loop_edge)) {
-					tmp = prev_node;
-					break;
+				if (new_idom < 0) {
+					new_idom = a;
+					continue;
 				}
+				b = new_idom;
+				while (a != b) {
+					while (a > b) {
+						a = idom[a];
+					}
+					while (b > a) {
+						b = idom[b];
+					}
+				}
+				new_idom = a;
 			}
-			node_b = tmp;
-			if (0 == node_b) {
-				break;
-			}
-			tmp = is_subset(nodes[n].path_size, nodes[n].path, nodes[node_b].path_size, nodes[node_b].path);
-			//debug_print(DEBUG_ANALYSE, 1, "node_dominance: %d = 0x%x, 0x%x\n", tmp, n, node_b);
-			if (tmp) {
-				nodes[n].dominator = node_b;
-				break;
+			if (idom[i] != new_idom) {
+				idom[i] = new_idom;
+				changed = 1;
 			}
 		}
+	} while (changed);
+
+	for (i = 1; i < csr->size; i++) {
+		nodes[csr->rpo[i]].dominator = csr->rpo[idom[i]];
 	}
+	free(idom);
 	return 0;
 }
 
@@ -660,237 +1271,269 @@ int find_node_at_index_in_path(struct self_s *self, struct path_s *paths, int pa
 	return 0;
 }
 
-int build_node_if_tail(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size)
+/* Lengauer-Tarjan eval() with path compression, in DFS number space.
+ * Returns the vertex with the smallest semi on the forest path above v.
+ */
+static int post_dominator_eval(int v, int *ancestor, int *label, int *semi, int *stack)
 {
-	int n,m;
-	int node_b = 1;
-	int tmp;
+	int sp = 0;
+	int x = v;
+	int a;
+
+	if (ancestor[v] < 0) {
+		return v;
+	}
+	while (ancestor[ancestor[x]] >= 0) {
+		stack[sp++] = x;
+		x = ancestor[x];
+	}
+	while (sp > 0) {
+		x = stack[--sp];
+		a = ancestor[x];
+		if (semi[label[a]] < semi[label[x]]) {
+			label[x] = label[a];
+		}
+		ancestor[x] = ancestor[a];
+	}
+	return label[v];
+}
+
+/* Depth first search from the virtual exit over the reversed edges.
+ * Works on the csr indexes. The virtual exit is index csr->size,
+ * and links to every index with virtual_exit set.
+ * Returns the number of indexes reached.
+ */
+static int post_dominator_dfs(struct node_csr_s *csr,
+	int *virtual_exit, int *dfnum, int *vertex, int *parent, int *stack, int *child)
+{
+	int exit_index = csr->size;
 	int count = 0;
-	// int m;
-	int subset_method = 0;
-	int type = 0;
-	int branch_follow_exit = 0;
-	int follow_path = 0;
-	int start_node;
-	struct path_s *paths;
-	int paths_size;
-	int loops_size;
-	struct loop_s *loops;
+	int sp = 0;
+	int index;
+	int next;
+	int n;
 
-	for(n = 1; n < nodes_size; n++) {
-		start_node = n;
-		if (!nodes[start_node].valid) {
+	for (n = 0; n <= exit_index; n++) {
+		dfnum[n] = -1;
+		child[n] = 0;
+	}
+	dfnum[exit_index] = count;
+	vertex[count] = exit_index;
+	parent[count] = -1;
+	count++;
+	stack[sp++] = exit_index;
+	while (sp > 0) {
+		index = stack[sp - 1];
+		next = -1;
+		if (index == exit_index) {
+			while (child[index] < exit_index) {
+				n = child[index]++;
+				if (virtual_exit[n]) {
+					next = n;
+					break;
+				}
+			}
+		} else if (child[index] < csr->pred_start[index + 1] - csr->pred_start[index]) {
+			next = csr->pred[csr->pred_start[index] + child[index]];
+			child[index]++;
+		}
+		if (next < 0) {
+			sp--;
 			continue;
 		}
-		type = nodes[n].type;
-		//debug_print(DEBUG_ANALYSE, 1, "%s: start_node = 0x%x, nodes[start_node].entry_point = 0x%x\n", __FUNCTION__, start_node, nodes[start_node].entry_point);
-		paths_size = self->external_entry_points[nodes[start_node].entry_point - 1].paths_size;
-		paths = self->external_entry_points[nodes[start_node].entry_point - 1].paths;
-		loops_size = self->external_entry_points[nodes[start_node].entry_point - 1].loops_size;
-		loops = self->external_entry_points[nodes[start_node].entry_point - 1].loops;
-		/* Check that it is a branch statement */
-		if (2 > nodes[n].next_size) {
+		if (dfnum[next] >= 0) {
 			continue;
 		}
-		debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: start_node = 0x%x, type = 0x%x\n", start_node, nodes[start_node].type);
-		switch (nodes[n].type) {
-		case NODE_TYPE_IF_THEN_ELSE:
-			/* A normal IF statement */
-			if (nodes[n].path_size >= 2) {
-				subset_method = 0; /* paths */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
-			} else {
-				subset_method = 1; /* loops */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
+		dfnum[next] = count;
+		vertex[count] = next;
+		parent[count] = dfnum[index];
+		count++;
+		stack[sp++] = next;
+	}
+	return count;
+}
+
+/* Build the post-dominator tree of one function's nodes.
+ * A virtual exit is added, and every node with no next links is joined to it.
+ * If some nodes cannot reach it, i.e. they are in a loop with no exit,
+ * their loop edges are joined to it too.
+ * nodes[n].post_dominator is set to the immediate post-dominator,
+ * 0 being the virtual exit or the node not reaching an exit at all.
+ * Uses Lengauer-Tarjan with path compression, over the csr.
+ */
+int build_node_post_dominance(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr)
+{
+	int *virtual_exit;
+	int *dfnum;
+	int *vertex;
+	int *parent;
+	int *semi;
+	int *idom;
+	int *ancestor;
+	int *label;
+	int *bucket_head;
+	int *bucket_next;
+	int *stack;
+	int *child;
+	int size;
+	int exit_index;
+	int count;
+	int unreached = 0;
+	int w, v, u, p;
+	int n, m;
+
+	for (n = 0; n < nodes_size; n++) {
+		nodes[n].post_dominator = 0;
+	}
+	if (!csr || (csr->size < 1)) {
+		return 0;
+	}
+	exit_index = csr->size;
+	size = csr->size + 1;
+	virtual_exit = calloc(size, sizeof(int));
+	dfnum = calloc(size, sizeof(int));
+	vertex = calloc(size, sizeof(int));
+	parent = calloc(size, sizeof(int));
+	semi = calloc(size, sizeof(int));
+	idom = calloc(size, sizeof(int));
+	ancestor = calloc(size, sizeof(int));
+	label = calloc(size, sizeof(int));
+	bucket_head = calloc(size, sizeof(int));
+	bucket_next = calloc(size, sizeof(int));
+	stack = calloc(size, sizeof(int));
+	child = calloc(size, sizeof(int));
+	if (!virtual_exit || !dfnum || !vertex || !parent || !semi || !idom ||
+		!ancestor || !label || !bucket_head || !bucket_next || !stack || !child) {
+		debug_print(DEBUG_ANALYSE, 1, "build_node_post_dominance: out of memory\n");
+		exit(1);
+	}
+
+	for (n = 0; n < csr->size; n++) {
+		if (csr->succ_start[n] == csr->succ_start[n + 1]) {
+			virtual_exit[n] = 1;
+		}
+	}
+	count = post_dominator_dfs(csr, virtual_exit, dfnum, vertex, parent, stack, child);
+	for (n = 0; n < csr->size; n++) {
+		if (dfnum[n] >= 0) {
+			continue;
+		}
+		for (m = csr->succ_start[n]; m < csr->succ_start[n + 1]; m++) {
+			if (csr->succ_flags[m] & NODE_LINK_LOOP_EDGE) {
+				virtual_exit[n] = 1;
+				unreached++;
+				break;
 			}
-			break;
-		case NODE_TYPE_JMPT:
-			/* A normal IF statement */
-			if (nodes[n].path_size >= 2) {
-				subset_method = 0; /* paths */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
+		}
+	}
+	if (unreached) {
+		debug_print(DEBUG_ANALYSE, 1, "post_dominance: joining %d loop edges with no exit to the virtual exit\n", unreached);
+		count = post_dominator_dfs(csr, virtual_exit, dfnum, vertex, parent, stack, child);
+	}
+
+	for (n = 0; n < count; n++) {
+		semi[n] = n;
+		label[n] = n;
+		ancestor[n] = -1;
+		bucket_head[n] = -1;
+		idom[n] = 0;
+	}
+	for (w = count - 1; w > 0; w--) {
+		n = vertex[w];
+		/* Predecessors in the reversed graph are the successors in the CFG */
+		for (m = csr->succ_start[n]; m <= csr->succ_start[n + 1]; m++) {
+			if (m < csr->succ_start[n + 1]) {
+				v = csr->succ[m];
+			} else if (virtual_exit[n]) {
+				v = exit_index;
 			} else {
-				subset_method = 1; /* loops */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
+				break;
 			}
-			break;
-		case NODE_TYPE_IF_THEN_GOTO:
-			/* Control flow within a loop */
-			subset_method = 0; /* paths */
-			branch_follow_exit = 1;  /* 0 = non-exit link, 1 = exit_links */
-			follow_path = 0;
-			break;
-		case NODE_TYPE_LOOP:
-			/* A loop_head statement */
-			if (nodes[n].multi_exit > 1) {
-				subset_method = 0; /* paths */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
-			} else {
-				subset_method = 0; /* paths */
-				branch_follow_exit = 1;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 0;
+			if (dfnum[v] < 0) {
+				continue;
 			}
-			break;
-		case NODE_TYPE_LOOP_THEN_ELSE:
-			/* Loop head with both links of type is_normal */
-			if (nodes[n].multi_exit > 1) {
-				subset_method = 0; /* paths */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 1;
-			} else {
-				subset_method = 1; /* loops */
-				branch_follow_exit = 0;  /* 0 = non-exit link, 1 = exit_links */
-				follow_path = 0;
+			u = post_dominator_eval(dfnum[v], ancestor, label, semi, stack);
+			if (semi[u] < semi[w]) {
+				semi[w] = semi[u];
 			}
-			break;
-		default:
-			debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail node type 0x%x unknown\n", nodes[n].type);
-			exit(1);
 		}
+		bucket_next[w] = bucket_head[semi[w]];
+		bucket_head[semi[w]] = w;
+		p = parent[w];
+		ancestor[w] = p;
+		for (v = bucket_head[p]; v >= 0; v = bucket_next[v]) {
+			u = post_dominator_eval(v, ancestor, label, semi, stack);
+			idom[v] = (semi[u] < semi[v]) ? u : p;
+		}
+		bucket_head[p] = -1;
+	}
+	for (w = 1; w < count; w++) {
+		if (idom[w] != semi[w]) {
+			idom[w] = idom[idom[w]];
+		}
+	}
 
-		debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: subset_method = 0x%x, branch_follow_exit = 0x%x, follow_path = 0x%x\n",
-			subset_method, branch_follow_exit, follow_path);
-		node_b = n;
-		while ((node_b != 0) ) {
-			struct node_link_s *link;
-			struct node_link_s *link_exit;
-
-			tmp = 0;
-			if (follow_path && !subset_method) {
-				int path;
-				int index;
-				int next_node;
-
-				if (nodes[start_node].path_size >= 2) {
-					path = nodes[start_node].path[0];
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "Folling path 0x%x, size 0x%x, looking for node 0x%x\n", path, paths[path].path_size, node_b);
-					tmp = find_node_in_path(self, paths, paths_size, path, node_b, &index);
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "find_node_in_path=%d, index=%d\n", tmp, index);
-					tmp = find_node_at_index_in_path(self, paths, paths_size, path, index + 1, &next_node);
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "find_node_in_path next_node = 0x%x\n", next_node);
-					if (!tmp) {
-						tmp = next_node;
-					} else {
-						tmp = 0;
-					}
-				} else if (nodes[start_node].path_size == 1) {
-					path = nodes[start_node].path[0];
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "Folling path 0x%x, size 0x%x, looking for node 0x%x\n", path, paths[path].path_size, node_b);
-					tmp = find_node_in_path(self, paths, paths_size, path, node_b, &index);
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "find_node_in_path=%d, index=%d\n", tmp, index);
-					tmp = find_node_at_index_in_path(self, paths, paths_size, path, index + 1, &next_node);
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "find_node_in_path next_node = 0x%x\n", next_node);
-					if (!tmp) {
-						tmp = next_node;
-					} else {
-						tmp = 0;
-					}
-				} else {
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "follow path failed1 path_size = 0x%x\n", nodes[start_node].path_size);
-					exit(1);
-				}
-			} else if (follow_path && subset_method) {
-				int path;
-
-				debug_print(DEBUG_ANALYSE_PATHS, 1, "follow if...then...else in loop. looped_path_size = 0x%x\n",
-					nodes[start_node].looped_path_size);
-				if (nodes[start_node].looped_path_size >= 2) {
-					path = nodes[start_node].looped_path[0];
-					for (m = 0; m < paths[path].path_size; m++) {
-						debug_print(DEBUG_ANALYSE_PATHS, 1, "node_b = 0x%x, looped_path = 0x%x, m = 0x%x\n",
-							node_b, path, m);
-						if (paths[path].path[m] == node_b) {
-							if ((m + 1) < paths[path].path_size) {
-								tmp = paths[path].path[m + 1];
-								debug_print(DEBUG_ANALYSE_PATHS, 1, "follow path next = 0x%x\n", tmp);
-								break;
-							} else {
-								debug_print(DEBUG_ANALYSE_PATHS, 1, "follow path failed2/n");
-								exit(1);
-							}
-						}
-					}
-				} else {
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "follow path failed3 path_size = 0x%x\n", nodes[start_node].path_size);
-					exit(1);
-				}
-			} else {
-				if (nodes[node_b].next_size == 0) {
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: end of function()\n");
-					break;
-				} else if (nodes[node_b].next_size == 1) {
-					link = &(nodes[node_b].link_next[0]);
-					if (link->is_loop_edge) {
-						debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: not following loop edge\n");
-						break;
-					}
-				} else if (nodes[node_b].next_size == 2) {
-				/* FIXME: preferred is only valid the first time round the loop */
-				/* FIXME: what to do if the node is a loop edge and no other links */
-					link_exit = NULL;
-					if (nodes[node_b].link_next[0].is_loop_exit == 1) {
-						link_exit = &(nodes[node_b].link_next[0]);
-					} else if (nodes[node_b].link_next[1].is_loop_exit == 1) {
-						link_exit = &(nodes[node_b].link_next[1]);
-					} if ((nodes[node_b].link_next[0].is_loop_exit == 1) &&
-						(nodes[node_b].link_next[1].is_loop_exit == 1)) {
-						break;
-					}
+	for (n = 0; n < csr->size; n++) {
+		if (dfnum[n] <= 0) {
+			continue;
+		}
+		v = vertex[idom[dfnum[n]]];
+		if (v != exit_index) {
+			nodes[csr->rpo[n]].post_dominator = csr->rpo[v];
+		}
+	}
 
-					link = NULL;
-					if (nodes[node_b].link_next[0].is_normal == 1) {
-						link = &(nodes[node_b].link_next[0]);
-					} else if (nodes[node_b].link_next[1].is_normal == 1) {
-						link = &(nodes[node_b].link_next[1]);
-					}
-					if (link) debug_print(DEBUG_ANALYSE_PATHS, 1, "link node = 0x%x\n", link->node);
-					if (link_exit) debug_print(DEBUG_ANALYSE_PATHS, 1, "link_exit node = 0x%x\n", link_exit->node);
-					if (branch_follow_exit) {
-						link = link_exit;
-					}
-					if (!link) {
-						debug_print(DEBUG_ANALYSE_PATHS, 1, "node_if_tail: empty link\n");
-						break;
-					}
-					/* Do not follow loop edges */
-					if (link->is_loop_edge) {
-						break;
-					}
-					debug_print(DEBUG_ANALYSE_PATHS, 1, "node = 0x%x, is_norm = %d, is_loop_edge = %d, is_loop_exit = %d, is_loop_entry = %d\n",
-						node_b, link->is_normal, link->is_loop_edge, link->is_loop_exit, link->is_loop_entry);
-					tmp = link->node;
-				}
-			}
-			debug_print(DEBUG_ANALYSE_PATHS, 1, "next node=0x%x\n", tmp);
+	free(virtual_exit);
+	free(dfnum);
+	free(vertex);
+	free(parent);
+	free(semi);
+	free(idom);
+	free(ancestor);
+	free(label);
+	free(bucket_head);
+	free(bucket_next);
+	free(stack);
+	free(child);
+	return 0;
+}
 
-			node_b = tmp;
-			if (0 == node_b) {
-				break;
-			}
-			if (subset_method == 0) {
-				tmp = is_subset(nodes[start_node].path_size, nodes[start_node].path, nodes[node_b].path_size, nodes[node_b].path);
-			} else {
-				tmp = is_subset(nodes[start_node].looped_path_size, nodes[start_node].looped_path, nodes[node_b].looped_path_size, nodes[node_b].looped_path);
-			}
-			debug_print(DEBUG_ANALYSE_PATHS, 1, "node_if_tail: %d = 0x%x, 0x%x\n", tmp, start_node, node_b);
-			count++;
-			if (count > 1000) {
-				debug_print(DEBUG_ANALYSE_PATHS, 1, "node_if_tail: failed, too many if_tails\n");
-				debug_print(DEBUG_ANALYSE_PATHS, 1, "Start node: 0x%x is_norm = %d, is_loop_edge = %d is_loop_exit = %d is_loop_entry = %d\n",
-					n, link->is_normal, link->is_loop_edge, link->is_loop_exit, link->is_loop_entry);
-				exit(1);
-			}
-			if (tmp) {
-				nodes[n].if_tail = node_b;
+/* The if_tail of a branch node is its immediate post-dominator: the first node
+ * every path out of the branch goes through.
+ * If that is the head of a loop the branch is in, the branches only meet again
+ * by going round the loop, so there is no if_tail inside the loop body.
+ */
+int build_node_if_tail(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size,
+	struct node_csr_s *csr)
+{
+	int n, m;
+	int tail;
+	int tmp;
+
+	tmp = build_node_post_dominance(self, nodes, nodes_size, csr);
+	if (tmp) {
+		return tmp;
+	}
+	for (n = 1; n < nodes_size; n++) {
+		if (!nodes[n].valid) {
+			continue;
+		}
+		/* Check that it is a branch statement */
+		if (2 > nodes[n].next_size) {
+			continue;
+		}
+		tail = nodes[n].post_dominator;
+		for (m = 0; m < nodes[n].member_of_loop_size; m++) {
+			if ((tail == nodes[n].member_of_loop[m]) && (tail != n)) {
+				debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: node 0x%x only joins at loop head 0x%x\n", n, tail);
+				tail = 0;
 				break;
 			}
 		}
-		debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail:function end\n");
+		nodes[n].if_tail = tail;
+		debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail: start_node = 0x%x, type = 0x%x, if_tail = 0x%x\n",
+			n, nodes[n].type, tail);
 	}
 	debug_print(DEBUG_ANALYSE_PATHS, 1, "if_tail:end\n");
 	return 0;
@@ -932,6 +1575,106 @@ int build_node_paths(struct self_s *self, struct control_flow_node_s *nodes, int
 	return 0;
 }
 
+/* Cheaply work out how many paths build_control_flow_paths() would create, without creating them.
+ * A depth first search from node_start finds the loop edges, i.e. edges back to a node
+ * still on the search stack. build_control_flow_paths() ends a path when it follows one,
+ * so over the remaining DAG:
+ *   paths(node) = 1 if node has no next nodes
+ *   paths(node) = sum over next nodes of (loop edge ? 1 : paths(next))
+ * path_length is the longest path in nodes, including the repeated loop head.
+ * Counts stop growing once they pass budget, so this cannot overflow.
+ * Returns 0 on success, 1 on error.
+ */
+int estimate_control_flow_paths(struct control_flow_node_s *nodes, int nodes_size, int node_start,
+	uint64_t budget, uint64_t *paths_count, int *path_length)
+{
+	uint64_t *count;
+	int *length;
+	int *state;		/* 0 = not seen, 1 = on the search stack, 2 = done */
+	int *stack;
+	int *stack_index;	/* Next link_next[] to look at for the node at the same stack level */
+	int stack_size = 0;
+	int node;
+	int next;
+	int n;
+
+	*paths_count = 0;
+	*path_length = 0;
+	if ((node_start < 1) || (node_start >= nodes_size)) {
+		return 1;
+	}
+	count = calloc(nodes_size, sizeof(uint64_t));
+	length = calloc(nodes_size, sizeof(int));
+	state = calloc(nodes_size, sizeof(int));
+	stack = calloc(nodes_size, sizeof(int));
+	stack_index = calloc(nodes_size, sizeof(int));
+	if (!count || !length || !state || !stack || !stack_index) {
+		free(count);
+		free(length);
+		free(state);
+		free(stack);
+		free(stack_index);
+		return 1;
+	}
+
+	stack[0] = node_start;
+	stack_index[0] = 0;
+	state[node_start] = 1;
+	stack_size = 1;
+	while (stack_size > 0) {
+		node = stack[stack_size - 1];
+		n = stack_index[stack_size - 1];
+		if (n < nodes[node].next_size) {
+			stack_index[stack_size - 1]++;
+			next = nodes[node].link_next[n].node;
+			if ((next > 0) && (next < nodes_size) && (state[next] == 0)) {
+				state[next] = 1;
+				stack[stack_size] = next;
+				stack_index[stack_size] = 0;
+				stack_size++;
+			}
+			continue;
+		}
+		/* All next nodes done, so this one can be counted */
+		if (nodes[node].next_size == 0) {
+			count[node] = 1;
+		}
+		for (n = 0; n < nodes[node].next_size; n++) {
+			next = nodes[node].link_next[n].node;
+			if ((next < 1) || (next >= nodes_size)) {
+				continue;
+			}
+			if (state[next] == 1) {
+				/* Loop edge. The path ends at the loop head. */
+				count[node] += 1;
+				if (length[node] < 1) {
+					length[node] = 1;
+				}
+			} else {
+				count[node] += count[next];
+				if (length[node] < length[next]) {
+					length[node] = length[next];
+				}
+			}
+			if (count[node] > budget) {
+				count[node] = budget + 1;
+			}
+		}
+		length[node]++;
+		state[node] = 2;
+		stack_size--;
+	}
+	*paths_count = count[node_start];
+	*path_length = length[node_start];
+
+	free(count);
+	free(length);
+	free(state);
+	free(stack);
+	free(stack_index);
+	return 0;
+}
+
 int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *nodes, int nodes_size, struct path_s *paths, int *paths_size, int *paths_used, int node_start)
 {
 	struct node_mid_start_s *node_mid_start;
@@ -945,7 +1688,7 @@ int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *no
 	int tmp;
 	int loop = 0;
 
-	node_mid_start = calloc(1000, sizeof(struct node_mid_start_s));
+	node_mid_start = calloc(NODE_MID_START_MAX, sizeof(struct node_mid_start_s));
 
 	node_mid_start[0].node = node_start;
 	node_mid_start[0].path_prev = 0;
@@ -953,7 +1696,7 @@ int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *no
 
 	do {
 		found = 0;
-		for (n = 0; n < 1000; n++) {
+		for (n = 0; n < NODE_MID_START_MAX; n++) {
 			if (node_mid_start[n].node != 0) {
 				found = 1;
 				break;
@@ -1015,6 +1758,10 @@ int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *no
 						}
 						break;
 					}
+				} else if (step >= PATH_LENGTH_MAX) {
+					debug_print(DEBUG_ANALYSE_PATHS, 1, "PATH TOO LONG, path 0x%x\n", path);
+					free(node_mid_start);
+					return 1;
 				} else if (nodes[node].next_size == 1) {
 					debug_print(DEBUG_ANALYSE_PATHS, 1, "JCD2: path 0x%x:0x%x, 0x%x -> 0x%x\n", path, step, node, nodes[node].link_next[0].node);
 					node = nodes[node].link_next[0].node;
@@ -1022,6 +1769,10 @@ int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *no
 					step++;
 				} else if (nodes[node].next_size > 1) {
 					tmp = node_mid_start_add(&nodes[node], node_mid_start, path, step - 1);
+					if (tmp) {
+						free(node_mid_start);
+						return 1;
+					}
 					debug_print(DEBUG_ANALYSE_PATHS, 1, "JCD3: node_mid_start added: path 0x%x:0x%x, 0x%x -> 0x%x\n", path, step, node, nodes[node].link_next[0].node);
 					node = nodes[node].link_next[0].node;
 					paths[path].path[step] = node;
@@ -1033,6 +1784,7 @@ int build_control_flow_paths(struct self_s *self, struct control_flow_node_s *no
 			debug_print(DEBUG_ANALYSE_PATHS, 1, "end path = 0x%x\n", path);
 			if (path >= *paths_size) {
 				debug_print(DEBUG_ANALYSE_PATHS, 1, "TOO MANY PATHS, %d\n", path);
+				free(node_mid_start);
 				return 1;
 			}
 		}
@@ -1111,6 +1863,9 @@ int build_control_flow_nodes(struct self_s *self, struct control_flow_node_s *no
 	/* Start by scanning all the inst_log for node_start and node_end. */
 	for (n = 1; n < inst_log; n++) {
 		inst_log1 = &inst_log_entry[n];
+		if (inst_log1->removed) {
+			continue;
+		}
 		debug_print(DEBUG_ANALYSE, 1, "inst 0x%x prev_size = %d, next_size = %d\n", n, inst_log1->prev_size, inst_log1->next_size);	
 		if (inst_log1->prev_size > 0) {
 			debug_print(DEBUG_ANALYSE, 1, "inst 0x%x prev = 0x%x\n", n, inst_log1->prev[0]);
@@ -1162,6 +1917,9 @@ int build_control_flow_nodes(struct self_s *self, struct control_flow_node_s *no
 		}
 	}
 	node = 1;
+	for (n = 1; n < inst_log; n++) {
+		inst_log_entry[n].node_member = 0;
+	}
 	for (n = 1; n < inst_log; n++) {
 		inst_log1 = &inst_log_entry[n];
 		if (inst_log1->node_start) {
@@ -1394,59 +2152,6 @@ int analyse_control_flow_node_links(struct self_s *self, struct control_flow_nod
 	return 0;
 }
 
-int analyse_multi_ret(struct self_s *self, struct path_s *paths, int *paths_size, int *multi_ret_size, int **multi_ret)
-{
-	int n,m;
-	int first_node = 0;
-	int found;
-	int *ret_list = NULL;
-	int size = 0;
-
-	for (n = 0; n < *paths_size; n++) {
-		if ((paths[n].used == 1) && (!paths[n].loop_head)) {
-			//debug_print(DEBUG_ANALYSE, 1, "multi_ret2: 0x%x: path_end = 0x%x\n", n, paths[n].path[paths[n].path_size - 1]);
-			if (!first_node) {
-				first_node = paths[n].path[paths[n].path_size - 1];
-			} else {
-				if (paths[n].path[paths[n].path_size - 1] != first_node) {
-					//debug_print(DEBUG_ANALYSE, 1, "multi_ret: 0x%x: path_size = 0x%x, multi_ret_size = 0x%x\n",
-					//	n, paths[n].path_size, size);
-					//debug_print(DEBUG_ANALYSE, 1, "multi_ret: 0x%x: 0x%x 0x%x\n", n, first_node, paths[n].path[paths[n].path_size - 1]);
-					found = 0;
-					for (m = 0; m < size; m++) {
-						//debug_print(DEBUG_ANALYSE, 1, "multi_ret3: 0x%x: path_end = 0x%x multi_ret = 0x%x\n", m, paths[n].path[paths[n].path_size - 1], ret_list[m]);
-						if (paths[n].path[paths[n].path_size - 1] == ret_list[m]) {
-							found = 1;
-							break;
-						}
-					}
-					if (found) {
-						//debug_print(DEBUG_ANALYSE, 1, "found\n");
-						continue;
-					}	
-					//debug_print(DEBUG_ANALYSE, 1, "multi_ret2: 0x%x: path_size = 0x%x\n", n, paths[n].path_size);
-					//debug_print(DEBUG_ANALYSE, 1, "multi_ret2: 0x%x: 0x%x\n", n, paths[n].path[paths[n].path_size - 1]);
-					if (size == 0) {
-						ret_list = malloc(sizeof(int));
-					} else {
-						ret_list = realloc(ret_list, (size + 1) * sizeof(int));
-					}
-					ret_list[size] = paths[n].path[paths[n].path_size - 1];
-					size++;
-				}
-			}
-		}
-	}
-	if (size > 0) {
-		ret_list = realloc(ret_list, (size + 1) * sizeof(int));
-		ret_list[size] = first_node;
-		size++;
-	}
-	*multi_ret_size = size;
-	*multi_ret = ret_list;
-	return 0;
-}
-
 int compare_inst(struct self_s *self, int inst_a, int inst_b)
 {
 	struct instruction_s *instruction_a;
@@ -1475,137 +2180,454 @@ int compare_inst(struct self_s *self, int inst_a, int inst_b)
 			} else {
 				debug_print(DEBUG_ANALYSE, 1, "compare_inst: failed at dstA\n");
 			}
-		} else {
-			debug_print(DEBUG_ANALYSE, 1, "compare_inst: failed at srcA\n");
+		} else {
+			debug_print(DEBUG_ANALYSE, 1, "compare_inst: failed at srcA\n");
+		}
+	} else {
+		debug_print(DEBUG_ANALYSE, 1, "compare_inst: failed at opcode/flags\n");
+	}
+	return ret;
+}
+
+/* The instruction before inst in node, or 0 if inst is the first.
+ * Follows prev[0], so entries taken out by rtl_value_numbering() are not seen. */
+static int node_inst_prev(struct self_s *self, struct control_flow_node_s *node, int inst)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+
+	while (inst != node->inst_start) {
+		if (inst_log_entry[inst].prev_size == 0) {
+			return 0;
+		}
+		inst = inst_log_entry[inst].prev[0];
+		if ((inst <= 0) || (inst >= inst_log)) {
+			return 0;
+		}
+		if (!inst_log_entry[inst].removed) {
+			return inst;
+		}
+	}
+	return 0;
+}
+
+/* The number of instructions in node */
+static int node_inst_count(struct self_s *self, struct control_flow_node_s *node)
+{
+	int inst = node->inst_end;
+	int count = 0;
+
+	while (inst) {
+		count++;
+		inst = node_inst_prev(self, node, inst);
+	}
+	return count;
+}
+
+/* Take the instructions from inst_start to inst_end out of the log, as inst_log_unlink() does.
+ * Used for the tail of a node that has been merged into another. */
+static void inst_log_drop(struct self_s *self, int inst_start, int inst_end)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1;
+	int inst = inst_start;
+	int next;
+
+	while ((inst > 0) && (inst < inst_log)) {
+		inst_log1 = &inst_log_entry[inst];
+		next = (inst_log1->next_size > 0) ? inst_log1->next[0] : 0;
+		inst_log1->instruction.opcode = NOP;
+		inst_log1->prev_size = 0;
+		inst_log1->next_size = 0;
+		inst_log1->node_member = 0;
+		inst_log1->node_start = 0;
+		inst_log1->node_end = 0;
+		inst_log1->removed = 1;
+		if (inst == inst_end) {
+			break;
+		}
+		inst = next;
+	}
+}
+
+/* Make inst_from flow to inst_new instead of inst_old, keeping the prev lists in step. */
+static int inst_link_redirect(struct self_s *self, int inst_from, int inst_old, int inst_new)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log_from = &inst_log_entry[inst_from];
+	struct inst_log_entry_s *inst_log_old = &inst_log_entry[inst_old];
+	struct inst_log_entry_s *inst_log_new = &inst_log_entry[inst_new];
+	int *prev;
+	int m, l;
+
+	for (m = 0; m < inst_log_from->next_size; m++) {
+		if (inst_log_from->next[m] == inst_old) {
+			inst_log_from->next[m] = inst_new;
+		}
+	}
+	l = 0;
+	for (m = 0; m < inst_log_old->prev_size; m++) {
+		if (inst_log_old->prev[m] != inst_from) {
+			inst_log_old->prev[l] = inst_log_old->prev[m];
+			l++;
+		}
+	}
+	inst_log_old->prev_size = l;
+	prev = realloc(inst_log_new->prev, (inst_log_new->prev_size + 1) * sizeof(int));
+	if (!prev) {
+		return 1;
+	}
+	inst_log_new->prev = prev;
+	inst_log_new->prev[inst_log_new->prev_size] = inst_from;
+	inst_log_new->prev_size++;
+	return 0;
+}
+
+/* The nearest node that dominates both node_a and node_b, or 0 if the dominators are not built */
+static int node_dominator_common(struct control_flow_node_s *nodes, int nodes_size, int node_a, int node_b)
+{
+	int a, b;
+	int limit_a, limit_b;
+
+	for (a = node_a, limit_a = nodes_size; (a > 0) && (limit_a > 0); a = nodes[a].dominator, limit_a--) {
+		for (b = node_b, limit_b = nodes_size; (b > 0) && (limit_b > 0); b = nodes[b].dominator, limit_b--) {
+			if (a == b) {
+				return a;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Only the entry node has no dominator, once build_node_dominance() has run */
+static int node_dominators_built(struct control_flow_node_s *nodes, int nodes_size)
+{
+	int n;
+
+	for (n = 1; n < nodes_size; n++) {
+		if (nodes[n].valid && nodes[n].dominator) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Add an edge from node_from, which has no successors yet, to node_to, an exit node.
+ * The node links, the instruction links and the dominator of node_to are updated.
+ * node_to has no successors, so it dominates no other node and nothing else changes. */
+static int node_link_exit(struct self_s *self, int function, int node_from, int node_to)
+{
+	struct control_flow_node_s *nodes = self->external_entry_points[function].nodes;
+	int nodes_size = self->external_entry_points[function].nodes_size;
+	int size = nodes[node_to].prev_size;
+
+	nodes[node_to].prev_node = realloc(nodes[node_to].prev_node, (size + 1) * sizeof(int));
+	nodes[node_to].prev_link_index = realloc(nodes[node_to].prev_link_index, (size + 1) * sizeof(int));
+	nodes[node_from].link_next = calloc(1, sizeof(struct node_link_s));
+	if (!nodes[node_to].prev_node || !nodes[node_to].prev_link_index || !nodes[node_from].link_next) {
+		return 1;
+	}
+	nodes[node_to].prev_node[size] = node_from;
+	nodes[node_to].prev_link_index[size] = 0;
+	nodes[node_to].prev_size++;
+	nodes[node_from].next_size = 1;
+	nodes[node_from].link_next[0].node = node_to;
+	nodes[node_from].link_next[0].is_normal = 1;
+	if (nodes[node_to].dominator) {
+		nodes[node_to].dominator = node_dominator_common(nodes, nodes_size,
+			nodes[node_to].dominator, node_from);
+	}
+	return 0;
+}
+
+/* Split node after inst. The instructions after inst go to a new node, which takes over
+ * the successors of node. node then just flows into the new node.
+ * The dominators, post dominators and loop membership are updated if they have been built.
+ * Returns the new node, or 0 on failure. */
+static int node_split(struct self_s *self, int function, int node, int inst)
+{
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[function]);
+	struct control_flow_node_s *nodes = external_entry_point->nodes;
+	int nodes_size = external_entry_point->nodes_size;
+	int node_new = nodes_size;
+	int inst_next;
+	int next;
+	int m, l;
+
+	if (self->inst_log_entry[inst].next_size == 0) {
+		return 0;
+	}
+	inst_next = self->inst_log_entry[inst].next[0];
+	nodes = realloc(nodes, (nodes_size + 1) * sizeof(struct control_flow_node_s));
+	if (!nodes) {
+		return 0;
+	}
+	nodes_size++;
+	external_entry_point->nodes = nodes;
+	external_entry_point->nodes_size = nodes_size;
+	/* The node graph changed */
+	external_entry_point->node_csr = NULL;
+	memset(&nodes[node_new], 0, sizeof(struct control_flow_node_s));
+	debug_print(DEBUG_ANALYSE, 1, "node_split: node 0x%x after inst 0x%x, new node 0x%x\n", node, inst, node_new);
+
+	nodes[node_new].valid = 1;
+	nodes[node_new].entry_point = nodes[node].entry_point;
+	nodes[node_new].inst_start = inst_next;
+	nodes[node_new].inst_end = nodes[node].inst_end;
+	nodes[node].inst_end = inst;
+	self->inst_log_entry[inst].node_end = 1;
+	self->inst_log_entry[inst_next].node_start = 1;
+	node_member_set(self, inst_next, nodes[node_new].inst_end, node_new);
+
+	/* The successors move to the new node */
+	nodes[node_new].next_size = nodes[node].next_size;
+	nodes[node_new].link_next = nodes[node].link_next;
+	for (m = 0; m < nodes[node_new].next_size; m++) {
+		next = nodes[node_new].link_next[m].node;
+		for (l = 0; l < nodes[next].prev_size; l++) {
+			if ((nodes[next].prev_node[l] == node) &&
+				(nodes[next].prev_link_index[l] == m)) {
+				nodes[next].prev_node[l] = node_new;
+			}
 		}
-	} else {
-		debug_print(DEBUG_ANALYSE, 1, "compare_inst: failed at opcode/flags\n");
 	}
-	return ret;
+	nodes[node].next_size = 0;
+	nodes[node].link_next = NULL;
+	nodes[node_new].prev_node = calloc(1, sizeof(int));
+	nodes[node_new].prev_link_index = calloc(1, sizeof(int));
+	nodes[node].link_next = calloc(1, sizeof(struct node_link_s));
+	if (!nodes[node_new].prev_node || !nodes[node_new].prev_link_index || !nodes[node].link_next) {
+		return 0;
+	}
+	nodes[node_new].prev_size = 1;
+	nodes[node_new].prev_node[0] = node;
+	nodes[node].next_size = 1;
+	nodes[node].link_next[0].node = node_new;
+	nodes[node].link_next[0].is_normal = 1;
+
+	/* Everything that node dominated is now reached through the new node */
+	if (node_dominators_built(nodes, node_new)) {
+		for (m = 1; m < node_new; m++) {
+			if (nodes[m].dominator == node) {
+				nodes[m].dominator = node_new;
+			}
+		}
+		nodes[node_new].dominator = node;
+	}
+	if (nodes[node].post_dominator) {
+		nodes[node_new].post_dominator = nodes[node].post_dominator;
+		nodes[node].post_dominator = node_new;
+	}
+
+	/* The new node is in the same loops as node, but is not a loop head */
+	nodes[node_new].type = nodes[node].type;
+	if (nodes[node].member_of_loop_size) {
+		nodes[node_new].member_of_loop = calloc(nodes[node].member_of_loop_size, sizeof(int));
+		if (!nodes[node_new].member_of_loop) {
+			return 0;
+		}
+		memcpy(nodes[node_new].member_of_loop, nodes[node].member_of_loop,
+			nodes[node].member_of_loop_size * sizeof(int));
+		nodes[node_new].member_of_loop_size = nodes[node].member_of_loop_size;
+	}
+	for (m = 0; m < external_entry_point->loops_size; m++) {
+		struct loop_s *loop = &(external_entry_point->loops[m]);
+		int *list;
+		for (l = 0; l < loop->size; l++) {
+			if (loop->list[l] == node) {
+				break;
+			}
+		}
+		if (l == loop->size) {
+			continue;
+		}
+		list = arena_alloc(external_entry_point->arena, loop->size + 1, sizeof(int));
+		if (!list) {
+			return 0;
+		}
+		memcpy(list, loop->list, loop->size * sizeof(int));
+		list[loop->size] = node_new;
+		loop->list = list;
+		loop->size++;
+	}
+	return node_new;
 }
 
-int analyse_merge_nodes(struct self_s *self, int function, int node_a, int node_b) {
+/* Merge the common tail of node_a and node_b, which must both be exit nodes.
+ * If the tail is only part of both nodes, it is split off into a new node.
+ * The copy of the tail in the other node is taken out of the inst_log.
+ * Returns 1 if merged, with *node_merged set to the node that is now the shared exit.
+ * Returns 0 if they have nothing in common, and -1 on failure. */
+int analyse_merge_nodes(struct self_s *self, int function, int node_a, int node_b, int *node_merged) {
 	int inst_a, inst_b;
-	int offset;
-	int ret;
-	int n,m;
+	int match_a, match_b;
+	int m;
 	struct control_flow_node_s *nodes = self->external_entry_points[function].nodes;
 	int nodes_size = self->external_entry_points[function].nodes_size;
-	int node_new = nodes_size;
-	int new_inst_start;
+	int node_to;
+	int node_b_inst_end;
 	int node_a_size;
 	int node_b_size;
 	int tmp;
 
 	debug_print(DEBUG_ANALYSE, 1, "merge_nodes:  node_a = 0x%x, node_b = 0x%x\n", node_a, node_b);
-	node_a_size = nodes[node_a].inst_end - nodes[node_a].inst_start;
-	node_b_size = nodes[node_b].inst_end - nodes[node_b].inst_start;
+	*node_merged = 0;
+	node_a_size = node_inst_count(self, &nodes[node_a]);
+	node_b_size = node_inst_count(self, &nodes[node_b]);
 	if (node_a_size > node_b_size) {
 		debug_print(DEBUG_ANALYSE, 1, "merge_nodes: swap node_a and node_b\n");
 		// Swap node_a and node_b
 		tmp = node_a;
 		node_a = node_b;
 		node_b = tmp;
+		tmp = node_a_size;
+		node_a_size = node_b_size;
+		node_b_size = tmp;
 	}
 	debug_print(DEBUG_ANALYSE, 1, "merge_nodes: last a is inst 0x%x\n", nodes[node_a].inst_end);
 	debug_print(DEBUG_ANALYSE, 1, "merge_nodes: last b is inst 0x%x\n", nodes[node_b].inst_end);
+	/* Walk both nodes backwards together, while the instructions are the same.
+	 * match_a and match_b end up at the first instructions of the common tail. */
+	match_a = 0;
+	match_b = 0;
 	inst_a = nodes[node_a].inst_end;
 	inst_b = nodes[node_b].inst_end;
-	offset = inst_b - inst_a;
-	for (n = inst_a; n >= nodes[node_a].inst_start; n--) {
-		if (!compare_inst(self, n, n + offset)) {
-			debug_print(DEBUG_ANALYSE, 1, "Merge0 compare failed at 0x%x\n", n);
+	while (inst_a && inst_b) {
+		if (!compare_inst(self, inst_a, inst_b)) {
+			debug_print(DEBUG_ANALYSE, 1, "Merge0 compare failed at 0x%x\n", inst_a);
 			break;
 		}
+		match_a = inst_a;
+		match_b = inst_b;
+		inst_a = node_inst_prev(self, &nodes[node_a], inst_a);
+		inst_b = node_inst_prev(self, &nodes[node_b], inst_b);
 	}
-	new_inst_start = n + 1;
-	debug_print(DEBUG_ANALYSE, 1, "Merge inst_a 0x%x, n 0x%x, new_inst_start 0x%x, inst_start 0x%x\n", inst_a, n, new_inst_start, nodes[node_a].inst_start);
-	if (n == inst_a) {
+	inst_a = nodes[node_a].inst_end;
+	inst_b = nodes[node_b].inst_end;
+	debug_print(DEBUG_ANALYSE, 1, "Merge inst_a 0x%x, match_a 0x%x, inst_start 0x%x\n", inst_a, match_a, nodes[node_a].inst_start);
+	if (!match_a) {
 		debug_print(DEBUG_ANALYSE, 1, "Merge1 no match found\n");
-		ret = 0;
-	} else if (new_inst_start == nodes[node_a].inst_start) {
-		if (node_a_size == node_b_size) {
-			int size = nodes[node_a].prev_size;
-			int size_node_b = nodes[node_b].prev_size;
-			// node_a identical to node_b
-			debug_print(DEBUG_ANALYSE, 1, "merge_nodes: node_a identical to node_b\n");
-			ret = 1;
-			debug_print(DEBUG_ANALYSE, 1, "Merge2  inst_a = 0x%x, n = 0x%x\n", inst_a, n);
-			debug_print(DEBUG_ANALYSE, 1, "Merge2  node_a = 0x%x, node_b = 0x%x\n", node_a, node_b);
-			debug_print(DEBUG_ANALYSE, 1, "Merge2  node_a prev size = 0x%x, size_node_b prev = 0x%x\n", size, size_node_b);
-			nodes[node_a].prev_node = realloc(nodes[node_a].prev_node, (size + size_node_b) * sizeof(int));
-			nodes[node_a].prev_link_index = realloc(nodes[node_a].prev_link_index, (size + size_node_b) * sizeof(int));
-			for (m = 0; m < size_node_b; m++) {
-				int node_b_prev_node = nodes[node_b].prev_node[m];
-				int node_b_prev_link_index = nodes[node_b].prev_link_index[m];
-				nodes[node_a].prev_node[size + m] = node_b_prev_node;
-				nodes[node_a].prev_link_index[size + m] = node_b_prev_link_index;
-				nodes[node_b_prev_node].link_next[node_b_prev_link_index].node = node_a;
-			}
-			nodes[node_a].prev_size += size_node_b;
-			/* Mark the node_b as un-used */
-			debug_print(DEBUG_ANALYSE, 1, "merge_nodes: Mark the node_b as un-used\n");
-			nodes[node_b].inst_end = new_inst_start + offset - 1;
-			nodes[node_b].prev_size = 0;
-			nodes[node_b].valid = 0;
-			free (nodes[node_b].prev_node);
-			free (nodes[node_b].prev_link_index);
-			free (nodes[node_b].link_next);
-		} else {
-			int size = nodes[node_a].prev_size;
-			// Whole of node a contained in node b
-			debug_print(DEBUG_ANALYSE, 1, "merge_nodes: Whole of node_a contained in node_b\n");
-			ret = 1;
-			debug_print(DEBUG_ANALYSE, 1, "Merge3  inst_a = 0x%x, n = 0x%x\n", inst_a, n);
-			nodes[node_a].prev_node = realloc(nodes[node_a].prev_node, (size + 1) * sizeof(int));
-			nodes[node_a].prev_link_index = realloc(nodes[node_a].prev_link_index, (size + 1) * sizeof(int));
-			nodes[node_a].prev_node[size] = node_b;
-			nodes[node_a].prev_link_index[size] = 0;
-			nodes[node_a].prev_size++;
-			nodes[node_b].inst_end = new_inst_start + offset - 1;
-			self->inst_log_entry[nodes[node_b].inst_end].node_end = 1;
-			nodes[node_b].link_next = calloc(1, sizeof(struct node_link_s));
-			nodes[node_b].next_size = 1;
-			nodes[node_b].link_next[0].node = node_a;
-		}
+		return 0;
+	}
+	if ((match_a == nodes[node_a].inst_start) && (node_a_size == node_b_size)) {
+		int size = nodes[node_a].prev_size;
+		int size_node_b = nodes[node_b].prev_size;
+		// node_a identical to node_b
+		debug_print(DEBUG_ANALYSE, 1, "Merge2  node_a = 0x%x, node_b = 0x%x\n", node_a, node_b);
+		nodes[node_a].prev_node = realloc(nodes[node_a].prev_node, (size + size_node_b) * sizeof(int));
+		nodes[node_a].prev_link_index = realloc(nodes[node_a].prev_link_index, (size + size_node_b) * sizeof(int));
+		if (!nodes[node_a].prev_node || !nodes[node_a].prev_link_index) {
+			return -1;
+		}
+		for (m = 0; m < size_node_b; m++) {
+			int node_b_prev_node = nodes[node_b].prev_node[m];
+			int node_b_prev_link_index = nodes[node_b].prev_link_index[m];
+			nodes[node_a].prev_node[size + m] = node_b_prev_node;
+			nodes[node_a].prev_link_index[size + m] = node_b_prev_link_index;
+			nodes[node_b_prev_node].link_next[node_b_prev_link_index].node = node_a;
+			if (inst_link_redirect(self, nodes[node_b_prev_node].inst_end,
+					nodes[node_b].inst_start, nodes[node_a].inst_start)) {
+				return -1;
+			}
+		}
+		nodes[node_a].prev_size += size_node_b;
+		if (nodes[node_a].dominator) {
+			nodes[node_a].dominator = node_dominator_common(nodes, nodes_size,
+				nodes[node_a].dominator, nodes[node_b].dominator);
+		}
+		/* Mark the node_b as un-used */
+		debug_print(DEBUG_ANALYSE, 1, "merge_nodes: Mark the node_b as un-used\n");
+		inst_log_drop(self, nodes[node_b].inst_start, inst_b);
+		nodes[node_b].prev_size = 0;
+		nodes[node_b].valid = 0;
+		free (nodes[node_b].prev_node);
+		free (nodes[node_b].prev_link_index);
+		free (nodes[node_b].link_next);
+		nodes[node_b].prev_node = NULL;
+		nodes[node_b].prev_link_index = NULL;
+		nodes[node_b].link_next = NULL;
+		*node_merged = node_a;
+		return 1;
+	}
+	if (match_a == nodes[node_a].inst_start) {
+		// Whole of node a contained in node b
+		debug_print(DEBUG_ANALYSE, 1, "Merge3  inst_a = 0x%x, match_a = 0x%x\n", inst_a, match_a);
+		node_to = node_a;
 	} else {
-		ret = 1;
-		debug_print(DEBUG_ANALYSE, 1, "Merge4 inst_a = 0x%x, n = 0x%x\n", inst_a, n);
-		// FIXME: Now create a new node, and merge node_a and node_b into it.
-		//	This will create a single ret node for the function. 
-		debug_print(DEBUG_ANALYSE, 1, "merge_nodes: Create a node_new: 0x%x\n", node_new);
-
-		nodes_size++;
-		debug_print(DEBUG_ANALYSE, 1, "merge_nodes: 0x%x = nodes_size++\n", nodes_size);
-		nodes = realloc(nodes, nodes_size * sizeof(struct control_flow_node_s));
-		self->external_entry_points[function].nodes = nodes;
-		self->external_entry_points[function].nodes_size = nodes_size;
-		if (node_new >= nodes_size) {
-			debug_print(DEBUG_ANALYSE, 1, "merge_nodes: failure, trying to write an extra node before having realloced it. node_new = 0x%x, nodes_size = 0x%x\n", node_new, nodes_size);
-			exit(1);
+		/* Only a tail is shared. Split it off node_a into a new node, the shared exit. */
+		debug_print(DEBUG_ANALYSE, 1, "Merge4 inst_a = 0x%x, match_a = 0x%x\n", inst_a, match_a);
+		node_to = node_split(self, function, node_a, node_inst_prev(self, &nodes[node_a], match_a));
+		if (!node_to) {
+			return -1;
 		}
-
-		nodes[node_new].inst_start = new_inst_start;
-		nodes[node_new].inst_end = inst_a;
-		nodes[node_a].inst_end = new_inst_start - 1;
-		nodes[node_b].inst_end = new_inst_start + offset - 1;
-		nodes[node_new].prev_node = calloc(2, sizeof(int));
-		nodes[node_new].prev_link_index = calloc(2, sizeof(int));
-		nodes[node_new].prev_size = 2;
-		nodes[node_new].prev_node[0] = node_a;
-		nodes[node_new].prev_node[1] = node_b;
-		nodes[node_new].prev_link_index[0] = 0;
-		nodes[node_new].prev_link_index[1] = 0;
-		nodes[node_new].valid = 1;
-		nodes[node_a].link_next = calloc(1, sizeof(struct node_link_s));
-		nodes[node_a].next_size = 1;
-		nodes[node_a].link_next[0].node = node_new;
-		nodes[node_b].link_next = calloc(1, sizeof(struct node_link_s));
-		nodes[node_b].next_size = 1;
-		nodes[node_b].link_next[0].node = node_new;
+		nodes = self->external_entry_points[function].nodes;
 	}
+	/* node_b now ends before its copy of the tail, and flows into the shared one */
+	node_b_inst_end = node_inst_prev(self, &nodes[node_b], match_b);
+	nodes[node_b].inst_end = node_b_inst_end;
+	self->inst_log_entry[node_b_inst_end].node_end = 1;
+	if (inst_link_redirect(self, node_b_inst_end, match_b, match_a)) {
+		return -1;
+	}
+	inst_log_drop(self, match_b, inst_b);
+	if (node_link_exit(self, function, node_b, node_to)) {
+		return -1;
+	}
+	*node_merged = node_to;
+	return 1;
+}
 
-	return ret;
+/* Merge all the exit nodes of a function into one, where their tails allow it.
+ * The exits are found with one pass over the nodes, and each is merged into the
+ * shared exit built so far, so nothing depends on the paths.
+ * Run it before build_control_flow_paths() so the paths only need building once.
+ * Exits that have no tail in common with the others are left as they are. */
+int analyse_merge_exit_nodes(struct self_s *self, int function)
+{
+	struct control_flow_node_s *nodes = self->external_entry_points[function].nodes;
+	int nodes_size = self->external_entry_points[function].nodes_size;
+	int *exits;
+	int exits_size = 0;
+	int exit_node;
+	int merged;
+	int left = 1;
+	int n;
+	int tmp;
+
+	exits = calloc(nodes_size, sizeof(int));
+	if (!exits) {
+		return 1;
+	}
+	for (n = 1; n < nodes_size; n++) {
+		if (nodes[n].valid && (nodes[n].next_size == 0)) {
+			exits[exits_size] = n;
+			exits_size++;
+		}
+	}
+	debug_print(DEBUG_ANALYSE, 1, "merge_exit_nodes: %s has 0x%x exits\n",
+		self->external_entry_points[function].name, exits_size);
+	if (exits_size < 2) {
+		free(exits);
+		return 0;
+	}
+	exit_node = exits[0];
+	for (n = 1; n < exits_size; n++) {
+		tmp = analyse_merge_nodes(self, function, exit_node, exits[n], &merged);
+		if (tmp < 0) {
+			free(exits);
+			return 1;
+		}
+		if (tmp) {
+			exit_node = merged;
+		} else {
+			debug_print(DEBUG_ANALYSE, 1, "merge_exit_nodes: exit 0x%x cannot be merged with 0x%x\n",
+				exits[n], exit_node);
+			left++;
+		}
+	}
+	debug_print(DEBUG_ANALYSE, 1, "merge_exit_nodes: %s now has 0x%x exits\n",
+		self->external_entry_points[function].name, left);
+	free(exits);
+	return 0;
 }
 
 int get_value_from_index(struct operand_s *operand, uint64_t *index)
@@ -1756,6 +2778,74 @@ int log_to_label(int store, int indirect, uint64_t index, uint64_t size, uint64_
 	return 0;
 }
 
+/* Make sure label_redirect[] and labels[] can be indexed by label.
+ * The tables double in size each time, so growth is amortised O(1) per label.
+ * Any pointers to the old tables are invalid after this returns. */
+int label_table_reserve(struct external_entry_point_s *entry_point, int label)
+{
+	struct label_redirect_s *label_redirect;
+	struct label_s *labels;
+	int size = entry_point->labels_size;
+
+	if (label < size) {
+		return 0;
+	}
+	if (size < 0x400) {
+		size = 0x400;
+	}
+	while (size <= label) {
+		size = size * 2;
+	}
+	label_redirect = arena_realloc(entry_point->arena, entry_point->label_redirect,
+		entry_point->labels_size * sizeof(struct label_redirect_s),
+		size * sizeof(struct label_redirect_s));
+	labels = arena_realloc(entry_point->arena, entry_point->labels,
+		entry_point->labels_size * sizeof(struct label_s),
+		size * sizeof(struct label_s));
+	if (!label_redirect || !labels) {
+		debug_print(DEBUG_ANALYSE, 1, "label_table_reserve: failed. size = 0x%x\n", size);
+		return 1;
+	}
+	debug_print(DEBUG_ANALYSE, 1, "label_table_reserve: %s: 0x%x -> 0x%x\n",
+		entry_point->name, entry_point->labels_size, size);
+	entry_point->label_redirect = label_redirect;
+	entry_point->labels = labels;
+	entry_point->labels_size = size;
+	return 0;
+}
+
+/* Follow the redirect chain to the label at its end, union-find style.
+ * Every label on the way is pointed straight at the end, so the next lookup is one step. */
+int label_redirect_find(struct label_redirect_s *label_redirect, int label)
+{
+	int root = label;
+	int next;
+
+	while (label_redirect[root].redirect != root) {
+		root = label_redirect[root].redirect;
+	}
+	while (label_redirect[label].redirect != root) {
+		next = label_redirect[label].redirect;
+		label_redirect[label].redirect = root;
+		label = next;
+	}
+	return root;
+}
+
+/* After this every label_redirect[n].redirect is the end of its chain,
+ * so the output code only ever needs a single lookup. */
+int label_redirect_flatten(struct external_entry_point_s *entry_point)
+{
+	int n;
+
+	for (n = 0; n < entry_point->variable_id; n++) {
+		if (entry_point->label_redirect[n].redirect) {
+			label_redirect_find(entry_point->label_redirect, n);
+		}
+	}
+	return 0;
+}
+
 int register_label(struct external_entry_point_s *entry_point, uint64_t value_id,
 	struct memory_s *value, struct label_redirect_s *label_redirect, struct label_s *labels)
 {
@@ -1998,28 +3088,259 @@ int scan_for_labels_in_function_body(struct self_s *self, struct external_entry_
 	}
 	return 0;
 }
+/* Does this instruction define the register (reg_stack == 1) or stack slot (reg_stack == 2) being searched for? */
+static int search_back_is_def(struct inst_log_entry_s *inst_log1, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value)
+{
+	struct instruction_s *instruction = &inst_log1->instruction;
+
+	if (instruction->dstA.store != STORE_REG) {
+		return 0;
+	}
+	/* STACK */
+	if ((reg_stack == 2) &&
+		(inst_log1->value3.value_scope == 2) &&
+		(instruction->dstA.indirect == IND_STACK) &&
+		(inst_log1->value3.indirect_init_value == indirect_init_value) &&
+		(inst_log1->value3.indirect_offset_value == indirect_offset_value)) {
+		return 1;
+	}
+	/* REGISTER */
+	if ((reg_stack == 1) &&
+		(instruction->dstA.indirect == IND_DIRECT) &&
+		(instruction->dstA.index == indirect_init_value)) {
+		return 1;
+	}
+	return 0;
+}
+
+static int search_back_def_compare(const void *a, const void *b)
+{
+	const struct search_back_def_s *def_a = a;
+	const struct search_back_def_s *def_b = b;
+
+	if (def_a->reg_stack != def_b->reg_stack) {
+		return (def_a->reg_stack < def_b->reg_stack) ? -1 : 1;
+	}
+	if (def_a->init_value != def_b->init_value) {
+		return (def_a->init_value < def_b->init_value) ? -1 : 1;
+	}
+	if (def_a->offset_value != def_b->offset_value) {
+		return (def_a->offset_value < def_b->offset_value) ? -1 : 1;
+	}
+	return def_a->inst - def_b->inst;
+}
+
+/* Registers are dstA.index values, all well below this */
+#define SEARCH_BACK_REGS_MAX 0x10000
+
+static uint64_t search_back_stack_hash(uint64_t init_value, uint64_t offset_value)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = (hash ^ init_value) * 0x100000001b3ULL;
+	hash = (hash ^ offset_value) * 0x100000001b3ULL;
+	return hash ^ (hash >> 32);
+}
+
+/* Returns the first def after defs[first] that is for a different register or stack slot */
+static int search_back_def_next(struct search_back_index_s *index, int first)
+{
+	int n;
+
+	for (n = first + 1; n < index->defs_size; n++) {
+		if ((index->defs[n].reg_stack != index->defs[first].reg_stack) ||
+			(index->defs[n].init_value != index->defs[first].init_value) ||
+			(index->defs[n].offset_value != index->defs[first].offset_value)) {
+			break;
+		}
+	}
+	return n;
+}
+
+/* Build the index of every register and stack slot definition in the function, once.
+ * Registers are looked up directly by number, stack slots in a hash, both in O(1).
+ * It is kept in the function's arena, so it goes when the function's analysis does.
+ * Must be built again if instructions are added to or removed from the function's nodes.
+ */
+int search_back_index_build(struct self_s *self, struct external_entry_point_s *entry_point)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct control_flow_node_s *nodes = entry_point->nodes;
+	struct search_back_index_s *index;
+	struct inst_log_entry_s *inst_log1;
+	struct instruction_s *instruction;
+	struct search_back_range_s *range;
+	int defs_max = 0;
+	int stack_keys;
+	int first;
+	int next;
+	int inst;
+	int node;
+	int pass;
+	uint64_t mask;
+	uint64_t slot;
+
+	index = arena_alloc(entry_point->arena, 1, sizeof(struct search_back_index_s));
+	if (!index) {
+		return 1;
+	}
+	/* Pass 0 counts the definitions, pass 1 fills them in */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			index->defs = arena_alloc(entry_point->arena, defs_max, sizeof(struct search_back_def_s));
+			if (!index->defs) {
+				return 1;
+			}
+		}
+		for (node = 1; node < entry_point->nodes_size; node++) {
+			if (!nodes[node].valid) {
+				continue;
+			}
+			inst = nodes[node].inst_start;
+			while ((inst > 0) && (inst < inst_log)) {
+				inst_log1 = &inst_log_entry[inst];
+				instruction = &inst_log1->instruction;
+				if (search_back_is_def(inst_log1, 1, instruction->dstA.index, 0)) {
+					if (pass == 1) {
+						index->defs[index->defs_size].reg_stack = 1;
+						index->defs[index->defs_size].init_value = instruction->dstA.index;
+						index->defs[index->defs_size].offset_value = 0;
+						index->defs[index->defs_size].inst = inst;
+						index->defs_size++;
+					} else {
+						defs_max++;
+					}
+				} else if (search_back_is_def(inst_log1, 2, inst_log1->value3.indirect_init_value,
+						inst_log1->value3.indirect_offset_value)) {
+					if (pass == 1) {
+						index->defs[index->defs_size].reg_stack = 2;
+						index->defs[index->defs_size].init_value = inst_log1->value3.indirect_init_value;
+						index->defs[index->defs_size].offset_value = inst_log1->value3.indirect_offset_value;
+						index->defs[index->defs_size].inst = inst;
+						index->defs_size++;
+					} else {
+						defs_max++;
+					}
+				}
+				if ((inst == nodes[node].inst_end) || (inst_log1->next_size == 0)) {
+					break;
+				}
+				inst = inst_log1->next[0];
+			}
+		}
+	}
+	qsort(index->defs, index->defs_size, sizeof(struct search_back_def_s), search_back_def_compare);
+
+	/* Size the lookup tables. The register defs come first, in register order,
+	 * so regs_size ends up set by the last of them. */
+	index->regs_size = 0;
+	stack_keys = 0;
+	for (first = 0; first < index->defs_size; first = next) {
+		next = search_back_def_next(index, first);
+		if (index->defs[first].reg_stack == 1) {
+			if (index->defs[first].init_value >= SEARCH_BACK_REGS_MAX) {
+				debug_print(DEBUG_ANALYSE, 1, "search_back_index_build: register 0x%"PRIx64" too big\n",
+					index->defs[first].init_value);
+				return 1;
+			}
+			index->regs_size = index->defs[first].init_value + 1;
+		} else {
+			stack_keys++;
+		}
+	}
+	index->stack_size = 16;
+	while (index->stack_size < stack_keys * 2) {
+		index->stack_size *= 2;
+	}
+	index->regs = arena_alloc(entry_point->arena, index->regs_size, sizeof(struct search_back_range_s));
+	index->stack = arena_alloc(entry_point->arena, index->stack_size, sizeof(struct search_back_range_s));
+	if (!index->regs || !index->stack) {
+		return 1;
+	}
+	mask = index->stack_size - 1;
+	for (first = 0; first < index->defs_size; first = next) {
+		next = search_back_def_next(index, first);
+		if (index->defs[first].reg_stack == 1) {
+			range = &(index->regs[index->defs[first].init_value]);
+		} else {
+			slot = search_back_stack_hash(index->defs[first].init_value,
+				index->defs[first].offset_value) & mask;
+			while (index->stack[slot].count) {
+				slot = (slot + 1) & mask;
+			}
+			range = &(index->stack[slot]);
+		}
+		range->first = first;
+		range->count = next - first;
+	}
+
+	index->seen_size = inst_log;
+	index->seen = arena_alloc(entry_point->arena, index->seen_size, sizeof(int));
+	if (!index->seen) {
+		return 1;
+	}
+	index->epoch = 0;
+	entry_point->search_back_index = index;
+	debug_print(DEBUG_ANALYSE, 1, "search_back_index_build: 0x%x definitions\n", index->defs_size);
+	return 0;
+}
+
+/* Returns the number of definitions of the register or stack slot in the function.
+ * *first is set to the first of them in index->defs. */
+int search_back_index_find(struct search_back_index_s *index, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, int *first)
+{
+	struct search_back_def_s *def;
+	uint64_t mask = index->stack_size - 1;
+	uint64_t slot;
+
+	*first = 0;
+	if (reg_stack == 1) {
+		if (indirect_init_value >= index->regs_size) {
+			return 0;
+		}
+		*first = index->regs[indirect_init_value].first;
+		return index->regs[indirect_init_value].count;
+	}
+	slot = search_back_stack_hash(indirect_init_value, indirect_offset_value) & mask;
+	while (index->stack[slot].count) {
+		def = &(index->defs[index->stack[slot].first]);
+		if ((def->init_value == indirect_init_value) &&
+			(def->offset_value == indirect_offset_value)) {
+			*first = index->stack[slot].first;
+			return index->stack[slot].count;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
 /***********************************************************************************
  * This is a complex routine. It utilises dynamic lists in order to reduce 
  * memory usage.
+ * Finds the definitions of a register or stack slot that reach the mid_start instructions.
+ * The function's search_back_index says up front how many definitions there are,
+ * so the search ends at once if there are none, and as soon as all have been found.
+ * Visited instructions are marked with the index's epoch, which moves on at each call,
+ * so nothing has to be cleared between calls.
  **********************************************************************************/
-int search_back_local_reg_stack(struct self_s *self, uint64_t mid_start_size, struct mid_start_s *mid_start, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, uint64_t *size, int *search_back_seen, uint64_t **inst_list)
+int search_back_local_reg_stack(struct self_s *self, struct search_back_index_s *index, uint64_t mid_start_size, struct mid_start_s *mid_start, int reg_stack, uint64_t indirect_init_value, uint64_t indirect_offset_value, uint64_t *size, uint64_t **inst_list)
 {
-	struct instruction_s *instruction;
 	struct inst_log_entry_s *inst_log1;
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
-	//uint64_t value_id;
 	uint64_t inst_num;
 	uint64_t tmp;
 	int found = 0;
+	int defs_size;
+	int defs_first;
 	int n;
 
 	*size = 0;
-	/* FIXME: This could be optimized out if the "seen" value just increased on each call */
-	for (n = 0; n < INST_LOG_ENTRY_SIZE; n++) {
-		search_back_seen[n] = 0;
-	}
-
 	debug_print(DEBUG_ANALYSE, 1, "search_back_local_stack: 0x%"PRIx64", 0x%"PRIx64"\n", indirect_init_value, indirect_offset_value);
+	if (!index) {
+		debug_print(DEBUG_ANALYSE, 1, "search_back: no index, search_back_index_build() not run\n");
+		free(mid_start);
+		return 1;
+	}
 	if (0 < mid_start_size) {
 		debug_print(DEBUG_ANALYSE, 1, "search_back:prev_size=0x%"PRIx64"\n", mid_start_size);
 	}
@@ -2027,6 +3348,16 @@ int search_back_local_reg_stack(struct self_s *self, uint64_t mid_start_size, st
 		debug_print(DEBUG_ANALYSE, 1, "search_back ended\n");
 		return 1;
 	}
+	defs_size = search_back_index_find(index, reg_stack, indirect_init_value, indirect_offset_value, &defs_first);
+	if (0 == defs_size) {
+		debug_print(DEBUG_ANALYSE, 1, "search_back: no definitions in this function\n");
+		goto search_back_exit_free;
+	}
+	index->epoch++;
+	if (index->epoch == INT_MAX) {
+		memset(index->seen, 0, index->seen_size * sizeof(int));
+		index->epoch = 1;
+	}
 
 	do {
 		found = 0;
@@ -2043,47 +3374,34 @@ int search_back_local_reg_stack(struct self_s *self, uint64_t mid_start_size, st
 			debug_print(DEBUG_ANALYSE, 1, "mid_start not found, exiting\n");
 			goto search_back_exit_free;
 		}
-		if (search_back_seen[inst_num]) {
+		if (inst_num >= index->seen_size) {
+			/* The inst_log changed after search_back_index_build() */
+			debug_print(DEBUG_ANALYSE, 1, "search_back: inst 0x%"PRIx64" is newer than the index\n", inst_num);
+			free(mid_start);
+			return 1;
+		}
+		if (index->seen[inst_num] == index->epoch) {
 			continue;
 		}
-		search_back_seen[inst_num] = 1;
+		index->seen[inst_num] = index->epoch;
 		inst_log1 =  &inst_log_entry[inst_num];
-		instruction =  &inst_log1->instruction;
-		//value_id = inst_log1->value3.value_id;
 		debug_print(DEBUG_ANALYSE, 1, "inst_num:0x%"PRIx64"\n", inst_num);
-		/* STACK */
-		if ((reg_stack == 2) &&
-			(instruction->dstA.store == STORE_REG) &&
-			(inst_log1->value3.value_scope == 2) &&
-			(instruction->dstA.indirect == IND_STACK) &&
-			(inst_log1->value3.indirect_init_value == indirect_init_value) &&
-			(inst_log1->value3.indirect_offset_value == indirect_offset_value)) {
-			tmp = *size;
-			tmp++;
-			*size = tmp;
-			if (tmp == 1) {
-				*inst_list = malloc(sizeof(*inst_list));
-				(*inst_list)[0] = inst_num;
-			} else {
-				*inst_list = realloc(*inst_list, tmp * sizeof(*inst_list));
-				(*inst_list)[tmp - 1] = inst_num;
-			}
-		/* REGISTER */
-		} else if ((reg_stack == 1) &&
-			(instruction->dstA.store == STORE_REG) &&
-			(instruction->dstA.indirect == IND_DIRECT) &&
-			(instruction->dstA.index == indirect_init_value)) {
+		if (search_back_is_def(inst_log1, reg_stack, indirect_init_value, indirect_offset_value)) {
 			tmp = *size;
 			tmp++;
 			*size = tmp;
 			if (tmp == 1) {
-				*inst_list = malloc(sizeof(*inst_list));
+				*inst_list = malloc(sizeof(**inst_list));
 				(*inst_list)[0] = inst_num;
 				debug_print(DEBUG_ANALYSE, 1, "JCD2: inst_list[0] = 0x%"PRIx64"\n", inst_num);
 			} else {
-				*inst_list = realloc(*inst_list, tmp * sizeof(*inst_list));
+				*inst_list = realloc(*inst_list, tmp * sizeof(**inst_list));
 				(*inst_list)[tmp - 1] = inst_num;
 			}
+			if (tmp >= defs_size) {
+				debug_print(DEBUG_ANALYSE, 1, "search_back: all 0x%x definitions found\n", defs_size);
+				goto search_back_exit_free;
+			}
 		} else {
 			if ((inst_log1->prev_size > 0) &&
 				(inst_log1->prev[0] != 0)) {
@@ -2130,3 +3448,191 @@ search_back_exit_free:
 	return 0;
 }
 
+/* Copy the param labels out of labels[], so that callers can be built after the labels are freed.
+ * The name is not copied, because it may point into the arena. */
+int params_labels_fill(struct external_entry_point_s *external_entry_point)
+{
+	int m;
+
+	if (external_entry_point->params_labels) {
+		return 0;
+	}
+	external_entry_point->params_labels = calloc(external_entry_point->params_size + 1, sizeof(struct label_s));
+	if (!external_entry_point->params_labels) {
+		return 1;
+	}
+	for (m = 0; m < external_entry_point->params_size; m++) {
+		external_entry_point->params_labels[m] =
+			external_entry_point->labels[external_entry_point->params[m]];
+		external_entry_point->params_labels[m].name = NULL;
+	}
+	return 0;
+}
+
+/* Find the local that holds each param of a call.
+ * Search back from the CALL for the last definition of the register or stack slot of each param
+ * of the callee, and record its label in an extension_call_s on the CALL.
+ * A param that is not defined in this function is a param of this function passed on.
+ * A call is left without an extension if any param cannot be found, e.g. a call back
+ * to a function whose params are not known yet. */
+int call_params_fill(struct self_s *self, struct external_entry_point_s *external_entry_point)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1;
+	struct instruction_s *instruction;
+	struct external_entry_point_s *callee;
+	struct extension_call_s *call;
+	struct label_s *label;
+	struct mid_start_s *mid_start;
+	uint64_t *inst_list;
+	uint64_t size;
+	uint64_t n;
+	int m, l;
+	int tmp;
+
+	for (n = external_entry_point->inst_log; n <= external_entry_point->inst_log_end; n++) {
+		inst_log1 = &inst_log_entry[n];
+		instruction = &inst_log1->instruction;
+		if ((instruction->opcode != CALL) ||
+			(inst_log1->removed) ||
+			(inst_log1->extension) ||
+			(instruction->srcA.relocated != 1) ||
+			(instruction->srcA.indirect != IND_DIRECT) ||
+			(instruction->srcA.index >= EXTERNAL_ENTRY_POINTS_MAX)) {
+			continue;
+		}
+		callee = &self->external_entry_points[instruction->srcA.index];
+		if (!callee->valid || !callee->params_labels || (0 == inst_log1->prev_size)) {
+			debug_print(DEBUG_ANALYSE, 1, "PARAM: no params for the CALL at inst 0x%"PRIx64"\n", n);
+			continue;
+		}
+		call = calloc(1, sizeof(struct extension_call_s));
+		if (!call) {
+			return 1;
+		}
+		call->params_size = callee->params_size;
+		call->params = calloc(call->params_size + 1, sizeof(int));
+		if (!call->params) {
+			free(call);
+			return 1;
+		}
+		for (m = 0; m < callee->params_size; m++) {
+			label = &callee->params_labels[m];
+			mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
+			if (!mid_start) {
+				break;
+			}
+			for (l = 0; l < inst_log1->prev_size; l++) {
+				mid_start[l].mid_start = inst_log1->prev[l];
+				mid_start[l].valid = 1;
+			}
+			size = 0;
+			inst_list = NULL;
+			if ((2 == label->scope) && (1 == label->type)) {
+				/* param_regXXX */
+				tmp = search_back_local_reg_stack(self, external_entry_point->search_back_index,
+					inst_log1->prev_size, mid_start, 1, label->value, 0, &size, &inst_list);
+			} else {
+				/* param_stackXXX. The SP at the CALL is held in value1 */
+				tmp = search_back_local_reg_stack(self, external_entry_point->search_back_index,
+					inst_log1->prev_size, mid_start, 2, inst_log1->value1.init_value,
+					inst_log1->value1.offset_value + label->value - 8, &size, &inst_list);
+			}
+			if (tmp) {
+				free(inst_list);
+				break;
+			}
+			if (size > 1) {
+				/* FIXME: Needs a phi, so that all of the definitions reach the call */
+				debug_print(DEBUG_ANALYSE, 1, "PARAM: 0x%"PRIx64" definitions of param 0x%x at inst 0x%"PRIx64"\n",
+					size, m, n);
+			}
+			if (size > 0) {
+				call->params[m] = inst_log_entry[inst_list[size - 1]].value3.value_id;
+			} else if ((2 == label->scope) && (1 == label->type) &&
+				(label->value < 0xa0) &&
+				external_entry_point->param_reg_label[label->value]) {
+				call->params[m] = external_entry_point->param_reg_label[label->value];
+			} else {
+				free(inst_list);
+				break;
+			}
+			free(inst_list);
+			debug_print(DEBUG_ANALYSE, 1, "PARAM: inst 0x%"PRIx64" param 0x%x = label 0x%x\n", n, m, call->params[m]);
+		}
+		if (m < callee->params_size) {
+			debug_print(DEBUG_ANALYSE, 1, "PARAM: param 0x%x of the CALL at inst 0x%"PRIx64" not found\n", m, n);
+			free(call->params);
+			free(call);
+			continue;
+		}
+		inst_log1->extension = call;
+	}
+	return 0;
+}
+
+
+/* Release the analysis of one function once its output has been written.
+ * Everything in the arena goes, so the pointers to it are cleared. That includes the
+ * value prev and next of the function's instructions, which point into the def-use chains.
+ * The phi lists of the nodes also point into it and must not be used after this.
+ * The path lists and path sets of the nodes are on the heap and go too.
+ */
+void function_arena_free(struct self_s *self, struct external_entry_point_s *external_entry_point)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct def_use_s *def_use = external_entry_point->def_use;
+	struct inst_log_entry_s *inst_log1;
+	struct control_flow_node_s *node;
+	int n;
+
+	if (!external_entry_point->arena) {
+		return;
+	}
+	if (def_use) {
+		for (n = 0; n < def_use->labels_size; n++) {
+			if (def_use->def[n]) {
+				inst_log1 = &inst_log_entry[def_use->def[n]];
+				inst_log1->value3.next = NULL;
+				inst_log1->value3.next_size = 0;
+			}
+		}
+		for (n = 0; n < def_use->uses_size; n++) {
+			/* (inst << 1) | operand, see build_def_use_chains() */
+			inst_log1 = &inst_log_entry[def_use->uses[n] >> 1];
+			if (def_use->uses[n] & 1) {
+				inst_log1->value2.prev = NULL;
+				inst_log1->value2.prev_size = 0;
+			} else {
+				inst_log1->value1.prev = NULL;
+				inst_log1->value1.prev_size = 0;
+			}
+		}
+	}
+	for (n = 1; n < external_entry_point->nodes_size; n++) {
+		node = &(external_entry_point->nodes[n]);
+		free(node->path);
+		free(node->looped_path);
+		node->path = NULL;
+		node->looped_path = NULL;
+		node->path_size = 0;
+		node->looped_path_size = 0;
+		path_set_free(&(node->path_set));
+		path_set_free(&(node->looped_path_set));
+	}
+	debug_print(DEBUG_ANALYSE, 1, "arena: %s used 0x%zx bytes\n",
+		external_entry_point->name, external_entry_point->arena->total);
+	arena_free(external_entry_point->arena);
+	external_entry_point->arena = NULL;
+	external_entry_point->paths = NULL;
+	external_entry_point->paths_size = 0;
+	external_entry_point->loops = NULL;
+	external_entry_point->loops_size = 0;
+	external_entry_point->label_redirect = NULL;
+	external_entry_point->labels = NULL;
+	external_entry_point->labels_size = 0;
+	external_entry_point->def_use = NULL;
+	external_entry_point->search_back_index = NULL;
+	external_entry_point->node_csr = NULL;
+	external_entry_point->region = NULL;
+}
@@ -0,0 +1,166 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rev.h>
+
+/* All allocations are aligned to this */
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+/* Keep the data of each block aligned */
+#define ARENA_HEADER_SIZE ARENA_ROUND(sizeof(struct arena_block_s))
+
+static struct arena_block_s *arena_block_new(struct arena_block_s *prev, size_t size)
+{
+	struct arena_block_s *block;
+
+	block = malloc(ARENA_HEADER_SIZE + size);
+	if (!block) {
+		return NULL;
+	}
+	block->prev = prev;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+struct arena_s *arena_create(size_t block_size)
+{
+	struct arena_s *arena;
+
+	if (block_size < ARENA_ALIGN) {
+		block_size = ARENA_BLOCK_SIZE;
+	}
+	arena = calloc(1, sizeof(struct arena_s));
+	if (!arena) {
+		return NULL;
+	}
+	arena->block_size = ARENA_ROUND(block_size);
+	arena->block = arena_block_new(NULL, arena->block_size);
+	if (!arena->block) {
+		free(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+/* Returns zeroed memory, like calloc. */
+void *arena_alloc(struct arena_s *arena, size_t nmemb, size_t size)
+{
+	struct arena_block_s *block = arena->block;
+	size_t length;
+	uint8_t *ptr;
+
+	/* nmemb * size, or rounding it up, must not wrap */
+	if (size && ((nmemb > (SIZE_MAX / size)) ||
+		((nmemb * size) > (SIZE_MAX - ARENA_HEADER_SIZE - ARENA_ALIGN)))) {
+		debug_print(DEBUG_ANALYSE, 1, "arena_alloc: size overflow. nmemb = 0x%zx, size = 0x%zx\n", nmemb, size);
+		return NULL;
+	}
+	length = ARENA_ROUND(nmemb * size);
+	if (0 == length) {
+		length = ARENA_ALIGN;
+	}
+	if ((block->used + length) > block->size) {
+		size_t new_size = arena->block_size;
+		/* Large requests get a block of their own */
+		if (length > new_size) {
+			new_size = length;
+		}
+		block = arena_block_new(block, new_size);
+		if (!block) {
+			debug_print(DEBUG_ANALYSE, 1, "arena_alloc: out of memory. length = 0x%zx\n", length);
+			return NULL;
+		}
+		arena->block = block;
+	}
+	ptr = (uint8_t *)block + ARENA_HEADER_SIZE + block->used;
+	block->used += length;
+	arena->total += length;
+	memset(ptr, 0, length);
+	return ptr;
+}
+
+/* If ptr was the last allocation and there is room, grow it in place.
+ * Otherwise copy to a new allocation. The old space is only reclaimed by arena_reset().
+ * Any new space is zeroed. */
+void *arena_realloc(struct arena_s *arena, void *ptr, size_t old_size, size_t new_size)
+{
+	struct arena_block_s *block = arena->block;
+	size_t old_length = ARENA_ROUND(old_size);
+	size_t new_length = ARENA_ROUND(new_size);
+	uint8_t *new_ptr;
+
+	if (!ptr) {
+		return arena_alloc(arena, 1, new_size);
+	}
+	if (new_size <= old_size) {
+		return ptr;
+	}
+	if (new_size > (SIZE_MAX - ARENA_HEADER_SIZE - ARENA_ALIGN)) {
+		return NULL;
+	}
+	if (((uint8_t *)ptr + old_length == (uint8_t *)block + ARENA_HEADER_SIZE + block->used) &&
+		((block->used - old_length + new_length) <= block->size)) {
+		memset((uint8_t *)ptr + old_size, 0, new_length - old_size);
+		block->used += new_length - old_length;
+		arena->total += new_length - old_length;
+		return ptr;
+	}
+	new_ptr = arena_alloc(arena, 1, new_size);
+	if (!new_ptr) {
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, old_size);
+	return new_ptr;
+}
+
+/* Release everything except the first block, which is kept for reuse. */
+void arena_reset(struct arena_s *arena)
+{
+	struct arena_block_s *block = arena->block;
+	struct arena_block_s *prev;
+
+	while (block->prev) {
+		prev = block->prev;
+		free(block);
+		block = prev;
+	}
+	block->used = 0;
+	arena->block = block;
+	arena->total = 0;
+}
+
+void arena_free(struct arena_s *arena)
+{
+	struct arena_block_s *block;
+	struct arena_block_s *prev;
+
+	if (!arena) {
+		return;
+	}
+	block = arena->block;
+	while (block) {
+		prev = block->prev;
+		free(block);
+		block = prev;
+	}
+	free(arena);
+}
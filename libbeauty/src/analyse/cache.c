@@ -0,0 +1,516 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <rev.h>
+
+/* FNV-1a, 64 bit. Only used to name the entry files, the full key is compared on load. */
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+#define CACHE_HASH_PRIME 0x100000001b3ULL
+
+/* Longest params list accepted from an entry file */
+#define CACHE_PARAMS_MAX 0xa0
+
+static uint64_t cache_hash(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	size_t n;
+
+	for (n = 0; n < size; n++) {
+		hash ^= bytes[n];
+		hash *= CACHE_HASH_PRIME;
+	}
+	return hash;
+}
+
+static int cache_key_append(struct cache_key_s *key, const void *data, size_t size)
+{
+	uint8_t *tmp;
+	size_t max;
+
+	if (key->size + size > key->max) {
+		max = key->max ? key->max : 256;
+		while (max < key->size + size) {
+			max *= 2;
+		}
+		tmp = realloc(key->data, max);
+		if (!tmp) {
+			return 1;
+		}
+		key->data = tmp;
+		key->max = max;
+	}
+	memcpy(key->data + key->size, data, size);
+	key->size += size;
+	return 0;
+}
+
+static int cache_key_append_u64(struct cache_key_s *key, uint64_t value)
+{
+	return cache_key_append(key, &value, sizeof(value));
+}
+
+static int cache_key_append_string(struct cache_key_s *key, const char *string)
+{
+	if (!string) {
+		string = "";
+	}
+	return cache_key_append(key, string, strlen(string) + 1);
+}
+
+/* Addresses are relative to base, so moving a function within .text does not change its key */
+static int cache_key_append_reloc(struct cache_key_s *key, struct reloc_table_s *reloc, uint64_t base)
+{
+	int tmp = 0;
+
+	tmp |= cache_key_append_u64(key, reloc->address - base);
+	tmp |= cache_key_append_u64(key, reloc->size);
+	tmp |= cache_key_append_u64(key, reloc->value);
+	tmp |= cache_key_append_string(key, reloc->section_name);
+	tmp |= cache_key_append_string(key, reloc->symbol_name);
+	return tmp;
+}
+
+struct cache_s *cache_create(const char *dir)
+{
+	struct cache_s *cache;
+
+	if (mkdir(dir, 0777) && (errno != EEXIST)) {
+		debug_print(DEBUG_MAIN, 1, "cache: cannot create %s: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+	cache = calloc(1, sizeof(struct cache_s));
+	if (!cache) {
+		return NULL;
+	}
+	cache->dir = strdup(dir);
+	cache->global_hash = CACHE_HASH_INIT;
+	cache->key = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(struct cache_key_s));
+	if (!cache->dir || !cache->key) {
+		cache_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* Add bytes every function can read, e.g. .data and .rodata, to all the keys.
+ * Must be called before cache_build_keys(). */
+void cache_key_global(struct cache_s *cache, const void *data, size_t size)
+{
+	uint64_t size64 = size;
+
+	cache->global_hash = cache_hash(cache->global_hash, &size64, sizeof(size64));
+	cache->global_hash = cache_hash(cache->global_hash, data, size);
+}
+
+void cache_key_global_relocs(struct cache_s *cache, struct reloc_table_s *reloc_table, uint64_t reloc_table_size)
+{
+	struct cache_key_s key;
+	uint64_t n;
+
+	memset(&key, 0, sizeof(key));
+	for (n = 0; n < reloc_table_size; n++) {
+		cache_key_append_reloc(&key, &(reloc_table[n]), 0);
+	}
+	cache_key_global(cache, key.data, key.size);
+	free(key.data);
+}
+
+/* Mark each function starting at target as called */
+static void cache_mark_call(struct self_s *self, uint8_t *calls, int section_id, uint64_t target)
+{
+	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	int l;
+
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (external_entry_points[l].valid &&
+			(external_entry_points[l].type == 1) &&
+			(external_entry_points[l].section_id == section_id) &&
+			(external_entry_points[l].value == target)) {
+			calls[l] = 1;
+		}
+	}
+}
+
+/* Build the key of every internal function.
+ * A function's own part is its name, its bytes up to the next symbol and the relocations in them.
+ * The params and so the code of a caller depend on its callees,
+ * so the own part of every function reachable through calls is added as well.
+ * Calls are found from the relocations and from E8/E9 rel32 bytes that land on a function start.
+ * A false match only costs a cache miss.
+ * Returns 0 on success, 1 on error.
+ */
+int cache_build_keys(struct self_s *self, struct cache_s *cache, uint8_t *inst, uint64_t inst_size,
+		struct reloc_table_s *reloc_table, uint64_t reloc_table_size)
+{
+	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	struct external_entry_point_s *external_entry_point;
+	struct cache_key_s own;
+	struct cache_key_s *key;
+	struct reloc_table_s *reloc;
+	uint64_t *own_hash;
+	uint64_t *end;
+	uint64_t start;
+	uint64_t n;
+	uint8_t *calls;
+	uint8_t *reached;
+	int *stack;
+	int stack_size;
+	int32_t rel;
+	int ret = 0;
+	int l;
+	int m;
+
+	own_hash = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(uint64_t));
+	end = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(uint64_t));
+	calls = calloc(EXTERNAL_ENTRY_POINTS_MAX * EXTERNAL_ENTRY_POINTS_MAX, sizeof(uint8_t));
+	reached = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(uint8_t));
+	stack = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(int));
+	memset(&own, 0, sizeof(own));
+	if (!own_hash || !end || !calls || !reached || !stack) {
+		ret = 1;
+	}
+
+	/* A function ends where the next symbol in its section starts */
+	for (l = 0; !ret && (l < EXTERNAL_ENTRY_POINTS_MAX); l++) {
+		external_entry_point = &(external_entry_points[l]);
+		if (!external_entry_point->valid || (external_entry_point->type != 1)) {
+			continue;
+		}
+		start = external_entry_point->value;
+		end[l] = (start < inst_size) ? inst_size : start;
+		for (m = 0; m < EXTERNAL_ENTRY_POINTS_MAX; m++) {
+			if (external_entry_points[m].valid &&
+				(external_entry_points[m].section_id == external_entry_point->section_id) &&
+				(external_entry_points[m].value > start) &&
+				(external_entry_points[m].value < end[l])) {
+				end[l] = external_entry_points[m].value;
+			}
+		}
+	}
+
+	for (l = 0; !ret && (l < EXTERNAL_ENTRY_POINTS_MAX); l++) {
+		external_entry_point = &(external_entry_points[l]);
+		if (!external_entry_point->valid || (external_entry_point->type != 1)) {
+			continue;
+		}
+		start = external_entry_point->value;
+		own.size = 0;
+		ret |= cache_key_append_string(&own, external_entry_point->name);
+		ret |= cache_key_append_u64(&own, end[l] - start);
+		ret |= cache_key_append(&own, inst + start, end[l] - start);
+		for (n = 0; n < reloc_table_size; n++) {
+			reloc = &(reloc_table[n]);
+			if ((reloc->address < start) || (reloc->address >= end[l])) {
+				continue;
+			}
+			ret |= cache_key_append_reloc(&own, reloc, start);
+			if ((reloc->type == 1) && (reloc->external_functions_index < EXTERNAL_ENTRY_POINTS_MAX)) {
+				calls[(l * EXTERNAL_ENTRY_POINTS_MAX) + reloc->external_functions_index] = 1;
+			} else if (reloc->section_index == external_entry_point->section_index) {
+				/* Relative to the section, e.g. a call to a static function. */
+				/* The addend of a PC relative rel32 is target - 4 */
+				cache_mark_call(self, &calls[l * EXTERNAL_ENTRY_POINTS_MAX],
+					external_entry_point->section_id, reloc->value);
+				cache_mark_call(self, &calls[l * EXTERNAL_ENTRY_POINTS_MAX],
+					external_entry_point->section_id, reloc->value + 4);
+			}
+		}
+		/* Calls resolved by the assembler have no relocation */
+		for (n = start; (n + 5) <= end[l]; n++) {
+			if ((inst[n] == 0xe8) || (inst[n] == 0xe9)) {
+				rel = inst[n + 1] | (inst[n + 2] << 8) | (inst[n + 3] << 16) | ((uint32_t)inst[n + 4] << 24);
+				cache_mark_call(self, &calls[l * EXTERNAL_ENTRY_POINTS_MAX],
+					external_entry_point->section_id, n + 5 + rel);
+			}
+		}
+		own_hash[l] = cache_hash(CACHE_HASH_INIT, own.data, own.size);
+
+		key = &(cache->key[l]);
+		key->size = 0;
+		ret |= cache_key_append_string(key, CACHE_VERSION);
+		ret |= cache_key_append_string(key, self->llvm_passes);
+		ret |= cache_key_append_u64(key, cache->global_hash);
+		ret |= cache_key_append(key, own.data, own.size);
+	}
+
+	/* Add every function reachable from each function, in external_entry_points order */
+	for (l = 0; !ret && (l < EXTERNAL_ENTRY_POINTS_MAX); l++) {
+		if (!cache->key[l].size) {
+			continue;
+		}
+		memset(reached, 0, EXTERNAL_ENTRY_POINTS_MAX * sizeof(uint8_t));
+		reached[l] = 1;
+		stack[0] = l;
+		stack_size = 1;
+		while (stack_size > 0) {
+			stack_size--;
+			n = stack[stack_size];
+			for (m = 0; m < EXTERNAL_ENTRY_POINTS_MAX; m++) {
+				if (calls[(n * EXTERNAL_ENTRY_POINTS_MAX) + m] && !reached[m]) {
+					reached[m] = 1;
+					stack[stack_size] = m;
+					stack_size++;
+				}
+			}
+		}
+		for (m = 0; m < EXTERNAL_ENTRY_POINTS_MAX; m++) {
+			if (reached[m] && (m != l)) {
+				ret |= cache_key_append_string(&(cache->key[l]), external_entry_points[m].name);
+				ret |= cache_key_append_u64(&(cache->key[l]), own_hash[m]);
+			}
+		}
+	}
+
+	free(own.data);
+	free(own_hash);
+	free(end);
+	free(calls);
+	free(reached);
+	free(stack);
+	return ret;
+}
+
+static void cache_file_name(struct cache_s *cache, int entry, char *filename, size_t size)
+{
+	struct cache_key_s *key = &(cache->key[entry]);
+
+	snprintf(filename, size, "%s/%016"PRIx64".lbc", cache->dir,
+		cache_hash(CACHE_HASH_INIT, key->data, key->size));
+}
+
+static int cache_read(FILE *fd, void *data, size_t size)
+{
+	if (size && (fread(data, size, 1, fd) != 1)) {
+		return 1;
+	}
+	return 0;
+}
+
+static int cache_write(FILE *fd, const void *data, size_t size)
+{
+	if (size && (fwrite(data, size, 1, fd) != 1)) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Entry file layout, native byte order:
+ *	CACHE_MAGIC
+ *	uint64_t key size, key
+ *	uint64_t params size, then scope, type, value, size_bits, lab_pointer, lab_signed
+ *		and lab_unsigned of each param label
+ *	uint64_t bitcode size, bitcode
+ *	uint64_t C size, C
+ */
+
+/* On a hit fill in the params, labels, bitcode and C of the function and set cached.
+ * Returns 0 on a hit, 1 on a miss. */
+int cache_load(struct self_s *self, struct cache_s *cache, int entry)
+{
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[entry]);
+	struct cache_key_s *key = &(cache->key[entry]);
+	char filename[1024];
+	char magic[8];
+	uint64_t key_size = 0;
+	uint64_t params_size = 0;
+	uint64_t bitcode_size = 0;
+	uint64_t c_text_size = 0;
+	uint64_t fields[7];
+	uint8_t *key_data = NULL;
+	struct label_s *labels = NULL;
+	int *params = NULL;
+	char *bitcode = NULL;
+	char *c_text = NULL;
+	FILE *fd;
+	int tmp;
+	int m;
+
+	if (!key->size) {
+		return 1;
+	}
+	cache_file_name(cache, entry, filename, sizeof(filename));
+	fd = fopen(filename, "rb");
+	if (!fd) {
+		cache->misses++;
+		return 1;
+	}
+	tmp = cache_read(fd, magic, sizeof(magic));
+	if (!tmp && memcmp(magic, CACHE_MAGIC, sizeof(magic))) {
+		tmp = 1;
+	}
+	if (!tmp) {
+		tmp = cache_read(fd, &key_size, sizeof(key_size));
+	}
+	if (!tmp && (key_size != key->size)) {
+		tmp = 1;
+	}
+	if (!tmp) {
+		key_data = malloc(key_size);
+		tmp = !key_data || cache_read(fd, key_data, key_size) ||
+			memcmp(key_data, key->data, key_size);
+	}
+	if (!tmp) {
+		tmp = cache_read(fd, &params_size, sizeof(params_size));
+	}
+	if (!tmp && (params_size > CACHE_PARAMS_MAX)) {
+		tmp = 1;
+	}
+	if (!tmp) {
+		params = calloc(params_size + 1, sizeof(int));
+		labels = calloc(params_size + 1, sizeof(struct label_s));
+		tmp = !params || !labels;
+	}
+	for (m = 0; !tmp && (m < params_size); m++) {
+		tmp = cache_read(fd, fields, sizeof(fields));
+		params[m] = m;
+		labels[m].scope = fields[0];
+		labels[m].type = fields[1];
+		labels[m].value = fields[2];
+		labels[m].size_bits = fields[3];
+		labels[m].lab_pointer = fields[4];
+		labels[m].lab_signed = fields[5];
+		labels[m].lab_unsigned = fields[6];
+	}
+	if (!tmp) {
+		tmp = cache_read(fd, &bitcode_size, sizeof(bitcode_size));
+	}
+	if (!tmp) {
+		bitcode = malloc(bitcode_size + 1);
+		tmp = !bitcode || cache_read(fd, bitcode, bitcode_size);
+	}
+	if (!tmp) {
+		tmp = cache_read(fd, &c_text_size, sizeof(c_text_size));
+	}
+	if (!tmp) {
+		c_text = malloc(c_text_size + 1);
+		tmp = !c_text || cache_read(fd, c_text, c_text_size);
+	}
+	fclose(fd);
+	free(key_data);
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "cache: ignoring bad or colliding entry %s\n", filename);
+		free(params);
+		free(labels);
+		free(bitcode);
+		free(c_text);
+		cache->misses++;
+		return 1;
+	}
+	external_entry_point->params_size = params_size;
+	external_entry_point->params = params;
+	external_entry_point->labels = labels;
+	external_entry_point->labels_size = params_size;
+	external_entry_point->cached = 1;
+	external_entry_point->cached_bitcode = bitcode;
+	external_entry_point->cached_bitcode_size = bitcode_size;
+	external_entry_point->c_text = c_text;
+	external_entry_point->c_text_size = c_text_size;
+	cache->hits++;
+	debug_print(DEBUG_MAIN, 1, "cache: hit %s for %s\n", filename, external_entry_point->name);
+	return 0;
+}
+
+/* Write the params, labels, bitcode and C of a freshly analysed function.
+ * Nothing is stored if its C was not kept, as a hit must give the same test.c.
+ * The entry is written to a temporary file and renamed, so a reader never sees half an entry.
+ * Does not change cache, so it can be called from the LLVM export threads.
+ * Returns 0 on success, 1 on error. */
+int cache_store(struct self_s *self, struct cache_s *cache, int entry, const char *bitcode, size_t bitcode_size)
+{
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[entry]);
+	struct cache_key_s *key = &(cache->key[entry]);
+	struct label_s *label;
+	char filename[1024];
+	char tmp_filename[1100];
+	uint64_t size;
+	uint64_t fields[7];
+	FILE *fd;
+	int tmp;
+	int m;
+
+	if (!key->size || external_entry_point->cached || !external_entry_point->c_text) {
+		return 0;
+	}
+	cache_file_name(cache, entry, filename, sizeof(filename));
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d.tmp", filename, (int)getpid());
+	fd = fopen(tmp_filename, "wb");
+	if (!fd) {
+		debug_print(DEBUG_MAIN, 1, "cache: cannot write %s: %s\n", tmp_filename, strerror(errno));
+		return 1;
+	}
+	tmp = cache_write(fd, CACHE_MAGIC, 8);
+	size = key->size;
+	tmp |= cache_write(fd, &size, sizeof(size));
+	tmp |= cache_write(fd, key->data, key->size);
+	size = external_entry_point->params_size;
+	tmp |= cache_write(fd, &size, sizeof(size));
+	for (m = 0; m < external_entry_point->params_size; m++) {
+		label = &(external_entry_point->labels[external_entry_point->params[m]]);
+		fields[0] = label->scope;
+		fields[1] = label->type;
+		fields[2] = label->value;
+		fields[3] = label->size_bits;
+		fields[4] = label->lab_pointer;
+		fields[5] = label->lab_signed;
+		fields[6] = label->lab_unsigned;
+		tmp |= cache_write(fd, fields, sizeof(fields));
+	}
+	size = bitcode_size;
+	tmp |= cache_write(fd, &size, sizeof(size));
+	tmp |= cache_write(fd, bitcode, bitcode_size);
+	size = external_entry_point->c_text_size;
+	tmp |= cache_write(fd, &size, sizeof(size));
+	tmp |= cache_write(fd, external_entry_point->c_text, external_entry_point->c_text_size);
+	if (fclose(fd)) {
+		tmp = 1;
+	}
+	if (!tmp && rename(tmp_filename, filename)) {
+		tmp = 1;
+	}
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "cache: cannot write %s\n", filename);
+		unlink(tmp_filename);
+		return 1;
+	}
+	return 0;
+}
+
+void cache_free(struct cache_s *cache)
+{
+	int l;
+
+	if (!cache) {
+		return;
+	}
+	if (cache->key) {
+		for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+			free(cache->key[l].data);
+		}
+	}
+	free(cache->key);
+	free(cache->dir);
+	free(cache);
+}
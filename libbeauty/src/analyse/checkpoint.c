@@ -0,0 +1,499 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <rev.h>
+
+static const struct memory_s checkpoint_memory_zero;
+
+/* Entry n of an area, in order. NULL past the end of the area */
+static struct memory_s *checkpoint_memory_entry(struct process_state_s *process_state, int area, int n)
+{
+	if (n < 0) {
+		return NULL;
+	}
+	switch (area) {
+	case CHECKPOINT_MEMORY_TEXT:
+		return (n < MEMORY_TEXT_SIZE) ? &(process_state->memory_text[n]) : NULL;
+	case CHECKPOINT_MEMORY_STACK:
+		return memory_map_entry(process_state->memory_stack, n);
+	case CHECKPOINT_MEMORY_REG:
+		return (n < MEMORY_REG_SIZE) ? &(process_state->memory_reg[n]) : NULL;
+	case CHECKPOINT_MEMORY_DATA:
+		return memory_map_entry(process_state->memory_data, n);
+	}
+	return NULL;
+}
+
+static struct memory_map_s *checkpoint_memory_map(struct process_state_s *process_state, int area)
+{
+	switch (area) {
+	case CHECKPOINT_MEMORY_STACK:
+		return process_state->memory_stack;
+	case CHECKPOINT_MEMORY_DATA:
+		return process_state->memory_data;
+	}
+	return NULL;
+}
+
+static void checkpoint_memory_clear_links(struct memory_s *memory)
+{
+	memory->prev_size = 0;
+	memory->prev = NULL;
+	memory->next_size = 0;
+	memory->next = NULL;
+}
+
+/* Count the memory entries that are not all zero */
+static uint64_t checkpoint_memory_count(struct external_entry_point_s *external_entry_points, uint64_t *used_count)
+{
+	struct memory_s *memory;
+	struct memory_s entry;
+	uint64_t count = 0;
+	int area;
+	int l;
+	int n;
+
+	*used_count = 0;
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (!external_entry_points[l].valid) {
+			continue;
+		}
+		for (area = 0; area <= CHECKPOINT_MEMORY_DATA; area++) {
+			for (n = 0; (memory = checkpoint_memory_entry(&(external_entry_points[l].process_state), area, n)); n++) {
+				entry = *memory;
+				checkpoint_memory_clear_links(&entry);
+				if (memcmp(&entry, &checkpoint_memory_zero, sizeof(entry))) {
+					count++;
+				}
+			}
+		}
+		for (n = 0; n < MEMORY_USED_SIZE; n++) {
+			if (external_entry_points[l].process_state.memory_used[n]) {
+				(*used_count)++;
+			}
+		}
+	}
+	return count;
+}
+
+static int checkpoint_fwrite(FILE *fd, const void *data, size_t size, uint64_t *offset)
+{
+	if (size && (fwrite(data, size, 1, fd) != 1)) {
+		return 1;
+	}
+	*offset += size;
+	return 0;
+}
+
+/* Write zeros up to the start of the next section */
+static int checkpoint_pad(FILE *fd, uint64_t *offset, uint64_t to)
+{
+	static const uint8_t zero[64];
+	uint64_t size;
+	int tmp = 0;
+
+	while (!tmp && (*offset < to)) {
+		size = to - *offset;
+		if (size > sizeof(zero)) {
+			size = sizeof(zero);
+		}
+		tmp = checkpoint_fwrite(fd, zero, size, offset);
+	}
+	return tmp;
+}
+
+/* Write the inst_log, its links, the functions and their memory after emulation.
+ * The file is written under a temporary name and renamed, so a reader never sees half of it.
+ * Returns 0 on success, 1 on error. */
+int checkpoint_write(struct self_s *self, const char *filename, uint64_t inst_log,
+		uint8_t *inst, uint64_t inst_size)
+{
+	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct checkpoint_header_s header;
+	struct checkpoint_function_s function;
+	struct checkpoint_memory_s memory_record;
+	struct checkpoint_memory_used_s used_record;
+	struct inst_log_entry_s entry;
+	struct memory_s *memory;
+	char tmp_filename[1100];
+	uint64_t section_size[CHECKPOINT_SECTIONS];
+	uint64_t memory_count;
+	uint64_t used_count;
+	uint64_t links = 0;
+	uint64_t offset;
+	uint64_t n;
+	FILE *fd;
+	int area;
+	int tmp = 0;
+	int l;
+	int m;
+
+	for (n = 0; n < inst_log; n++) {
+		links += inst_log_entry[n].prev_size + inst_log_entry[n].next_size;
+	}
+	memory_count = checkpoint_memory_count(external_entry_points, &used_count);
+	section_size[CHECKPOINT_SECTION_TEXT] = inst_size;
+	section_size[CHECKPOINT_SECTION_FUNCTIONS] = EXTERNAL_ENTRY_POINTS_MAX * sizeof(struct checkpoint_function_s);
+	section_size[CHECKPOINT_SECTION_INST_LOG] = inst_log * sizeof(struct inst_log_entry_s);
+	section_size[CHECKPOINT_SECTION_LINKS] = links * sizeof(int);
+	section_size[CHECKPOINT_SECTION_MEMORY] = memory_count * sizeof(struct checkpoint_memory_s);
+	section_size[CHECKPOINT_SECTION_MEMORY_USED] = used_count * sizeof(struct checkpoint_memory_used_s);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.byte_order = CHECKPOINT_BYTE_ORDER;
+	header.inst_log_entry_size = sizeof(struct inst_log_entry_s);
+	header.memory_size = sizeof(struct memory_s);
+	header.inst_log = inst_log;
+	offset = sizeof(header);
+	for (m = 0; m < CHECKPOINT_SECTIONS; m++) {
+		offset = (offset + CHECKPOINT_ALIGN - 1) & ~((uint64_t)CHECKPOINT_ALIGN - 1);
+		header.section[m].offset = offset;
+		header.section[m].size = section_size[m];
+		offset += section_size[m];
+	}
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d.tmp", filename, (int)getpid());
+	fd = fopen(tmp_filename, "wb");
+	if (!fd) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: cannot write %s: %s\n", tmp_filename, strerror(errno));
+		return 1;
+	}
+	offset = 0;
+	tmp |= checkpoint_fwrite(fd, &header, sizeof(header), &offset);
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_TEXT].offset);
+	tmp |= checkpoint_fwrite(fd, inst, inst_size, &offset);
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_FUNCTIONS].offset);
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		memset(&function, 0, sizeof(function));
+		function.valid = external_entry_points[l].valid;
+		function.type = external_entry_points[l].type;
+		function.section_id = external_entry_points[l].section_id;
+		function.section_index = external_entry_points[l].section_index;
+		function.value = external_entry_points[l].value;
+		function.inst_log = external_entry_points[l].inst_log;
+		function.inst_log_end = external_entry_points[l].inst_log_end;
+		tmp |= checkpoint_fwrite(fd, &function, sizeof(function), &offset);
+	}
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_INST_LOG].offset);
+	for (n = 0; n < inst_log; n++) {
+		entry = inst_log_entry[n];
+		entry.prev = NULL;
+		entry.next = NULL;
+		entry.extension = NULL;
+		checkpoint_memory_clear_links(&(entry.value1));
+		checkpoint_memory_clear_links(&(entry.value2));
+		checkpoint_memory_clear_links(&(entry.value3));
+		tmp |= checkpoint_fwrite(fd, &entry, sizeof(entry), &offset);
+	}
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_LINKS].offset);
+	for (n = 0; n < inst_log; n++) {
+		tmp |= checkpoint_fwrite(fd, inst_log_entry[n].prev, inst_log_entry[n].prev_size * sizeof(int), &offset);
+		tmp |= checkpoint_fwrite(fd, inst_log_entry[n].next, inst_log_entry[n].next_size * sizeof(int), &offset);
+	}
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_MEMORY].offset);
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (!external_entry_points[l].valid) {
+			continue;
+		}
+		for (area = 0; area <= CHECKPOINT_MEMORY_DATA; area++) {
+			for (m = 0; (memory = checkpoint_memory_entry(&(external_entry_points[l].process_state), area, m)); m++) {
+				memset(&memory_record, 0, sizeof(memory_record));
+				memory_record.function = l;
+				memory_record.area = area;
+				memory_record.index = m;
+				memory_record.memory = *memory;
+				checkpoint_memory_clear_links(&(memory_record.memory));
+				if (!memcmp(&(memory_record.memory), &checkpoint_memory_zero, sizeof(struct memory_s))) {
+					continue;
+				}
+				tmp |= checkpoint_fwrite(fd, &memory_record, sizeof(memory_record), &offset);
+			}
+		}
+	}
+
+	tmp |= checkpoint_pad(fd, &offset, header.section[CHECKPOINT_SECTION_MEMORY_USED].offset);
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (!external_entry_points[l].valid) {
+			continue;
+		}
+		for (m = 0; m < MEMORY_USED_SIZE; m++) {
+			if (!external_entry_points[l].process_state.memory_used[m]) {
+				continue;
+			}
+			memset(&used_record, 0, sizeof(used_record));
+			used_record.function = l;
+			used_record.index = m;
+			used_record.value = external_entry_points[l].process_state.memory_used[m];
+			tmp |= checkpoint_fwrite(fd, &used_record, sizeof(used_record), &offset);
+		}
+	}
+
+	if (fclose(fd)) {
+		tmp = 1;
+	}
+	if (!tmp && rename(tmp_filename, filename)) {
+		tmp = 1;
+	}
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: cannot write %s\n", filename);
+		unlink(tmp_filename);
+		return 1;
+	}
+	debug_print(DEBUG_MAIN, 1, "checkpoint: wrote %s, 0x%"PRIx64" instructions\n", filename, inst_log);
+	return 0;
+}
+
+/* Check the header against this build and the file size */
+static int checkpoint_check_header(struct checkpoint_header_s *header, uint64_t file_size)
+{
+	struct checkpoint_section_s *section;
+	int m;
+
+	if (file_size < sizeof(struct checkpoint_header_s)) {
+		return 1;
+	}
+	if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) ||
+		(header->version != CHECKPOINT_VERSION) ||
+		(header->byte_order != CHECKPOINT_BYTE_ORDER) ||
+		(header->inst_log_entry_size != sizeof(struct inst_log_entry_s)) ||
+		(header->memory_size != sizeof(struct memory_s))) {
+		return 1;
+	}
+	for (m = 0; m < CHECKPOINT_SECTIONS; m++) {
+		section = &(header->section[m]);
+		if ((section->offset % CHECKPOINT_ALIGN) ||
+			(section->offset > file_size) ||
+			(section->size > file_size - section->offset)) {
+			return 1;
+		}
+	}
+	if ((header->inst_log < 1) ||
+		(header->inst_log > INST_LOG_ENTRY_SIZE) ||
+		(header->section[CHECKPOINT_SECTION_FUNCTIONS].size !=
+			EXTERNAL_ENTRY_POINTS_MAX * sizeof(struct checkpoint_function_s)) ||
+		(header->section[CHECKPOINT_SECTION_INST_LOG].size !=
+			header->inst_log * sizeof(struct inst_log_entry_s)) ||
+		(header->section[CHECKPOINT_SECTION_LINKS].size % sizeof(int)) ||
+		(header->section[CHECKPOINT_SECTION_MEMORY].size % sizeof(struct checkpoint_memory_s)) ||
+		(header->section[CHECKPOINT_SECTION_MEMORY_USED].size % sizeof(struct checkpoint_memory_used_s))) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Copy the links of one direction out of the mapped links section */
+static int checkpoint_read_links(int **links, int size, int *pool, uint64_t pool_size, uint64_t *used, uint64_t inst_log)
+{
+	int n;
+
+	*links = NULL;
+	if (size < 0) {
+		return 1;
+	}
+	if (!size) {
+		return 0;
+	}
+	if (size > pool_size - *used) {
+		return 1;
+	}
+	*links = malloc(size * sizeof(int));
+	if (!*links) {
+		return 1;
+	}
+	for (n = 0; n < size; n++) {
+		(*links)[n] = pool[*used + n];
+		if (((*links)[n] < 0) || ((*links)[n] >= inst_log)) {
+			return 1;
+		}
+	}
+	*used += size;
+	return 0;
+}
+
+/* Load a checkpoint written by checkpoint_write() for the same .o.
+ * external_entry_points_init() must have been run, so the process_state memory exists.
+ * The file is mapped and copied out, because later passes realloc the links.
+ * Returns 0 on success, 1 on error. */
+int checkpoint_read(struct self_s *self, const char *filename, uint64_t *inst_log,
+		uint8_t *inst, uint64_t inst_size)
+{
+	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct checkpoint_header_s *header;
+	struct checkpoint_function_s *functions;
+	struct checkpoint_memory_s *memory_records;
+	struct checkpoint_memory_used_s *used_records;
+	struct process_state_s *process_state;
+	struct memory_s *memory;
+	struct memory_map_s *memory_map;
+	struct stat st;
+	uint8_t *map;
+	int *links;
+	uint64_t links_size;
+	uint64_t links_used = 0;
+	uint64_t records_size;
+	uint64_t n;
+	int tmp = 0;
+	int fd;
+	int l;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: cannot open %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &st) || (st.st_size < sizeof(struct checkpoint_header_s))) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: %s is not a checkpoint\n", filename);
+		close(fd);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: cannot map %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+	header = (struct checkpoint_header_s *)map;
+	if (checkpoint_check_header(header, st.st_size)) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: %s is not a checkpoint from this version of dis64\n", filename);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	/* It must be from the same .o */
+	functions = (struct checkpoint_function_s *)(map + header->section[CHECKPOINT_SECTION_FUNCTIONS].offset);
+	if ((header->section[CHECKPOINT_SECTION_TEXT].size != inst_size) ||
+		memcmp(map + header->section[CHECKPOINT_SECTION_TEXT].offset, inst, inst_size)) {
+		tmp = 1;
+	}
+	for (l = 0; !tmp && (l < EXTERNAL_ENTRY_POINTS_MAX); l++) {
+		if ((functions[l].valid != external_entry_points[l].valid) ||
+			(functions[l].valid &&
+			((functions[l].type != external_entry_points[l].type) ||
+			(functions[l].section_id != external_entry_points[l].section_id) ||
+			(functions[l].value != external_entry_points[l].value) ||
+			(functions[l].inst_log > header->inst_log) ||
+			(functions[l].inst_log_end > header->inst_log)))) {
+			tmp = 1;
+		}
+	}
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: %s was made from a different .o\n", filename);
+		munmap(map, st.st_size);
+		return 1;
+	}
+
+	memcpy(inst_log_entry, map + header->section[CHECKPOINT_SECTION_INST_LOG].offset,
+		header->section[CHECKPOINT_SECTION_INST_LOG].size);
+	links = (int *)(map + header->section[CHECKPOINT_SECTION_LINKS].offset);
+	links_size = header->section[CHECKPOINT_SECTION_LINKS].size / sizeof(int);
+	for (n = 0; n < header->inst_log; n++) {
+		tmp |= checkpoint_read_links(&(inst_log_entry[n].prev), inst_log_entry[n].prev_size,
+			links, links_size, &links_used, header->inst_log);
+		tmp |= checkpoint_read_links(&(inst_log_entry[n].next), inst_log_entry[n].next_size,
+			links, links_size, &links_used, header->inst_log);
+		if (tmp) {
+			break;
+		}
+	}
+	if (links_used != links_size) {
+		tmp = 1;
+	}
+
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (functions[l].valid) {
+			external_entry_points[l].inst_log = functions[l].inst_log;
+			external_entry_points[l].inst_log_end = functions[l].inst_log_end;
+		}
+	}
+	memory_records = (struct checkpoint_memory_s *)(map + header->section[CHECKPOINT_SECTION_MEMORY].offset);
+	records_size = header->section[CHECKPOINT_SECTION_MEMORY].size / sizeof(struct checkpoint_memory_s);
+	for (n = 0; !tmp && (n < records_size); n++) {
+		l = memory_records[n].function;
+		if ((memory_records[n].function >= EXTERNAL_ENTRY_POINTS_MAX) || !external_entry_points[l].valid) {
+			tmp = 1;
+			break;
+		}
+		/* Stack and data entries are keyed by address, not by index */
+		memory_map = checkpoint_memory_map(&(external_entry_points[l].process_state), memory_records[n].area);
+		if (memory_map) {
+			memory = memory_map_write(memory_map,
+				memory_records[n].memory.start_address,
+				memory_records[n].memory.length * 8);
+			if (!memory) {
+				memory = memory_map_add(memory_map,
+					memory_records[n].memory.start_address,
+					memory_records[n].memory.length * 8);
+			}
+			if (!memory) {
+				tmp = 1;
+				break;
+			}
+			*memory = memory_records[n].memory;
+			checkpoint_memory_clear_links(memory);
+			continue;
+		}
+		memory = checkpoint_memory_entry(&(external_entry_points[l].process_state),
+			memory_records[n].area, memory_records[n].index);
+		if (!memory) {
+			tmp = 1;
+			break;
+		}
+		*memory = memory_records[n].memory;
+		checkpoint_memory_clear_links(memory);
+	}
+	used_records = (struct checkpoint_memory_used_s *)(map + header->section[CHECKPOINT_SECTION_MEMORY_USED].offset);
+	records_size = header->section[CHECKPOINT_SECTION_MEMORY_USED].size / sizeof(struct checkpoint_memory_used_s);
+	for (n = 0; !tmp && (n < records_size); n++) {
+		l = used_records[n].function;
+		if ((used_records[n].function >= EXTERNAL_ENTRY_POINTS_MAX) || !external_entry_points[l].valid ||
+			(used_records[n].index >= MEMORY_USED_SIZE)) {
+			tmp = 1;
+			break;
+		}
+		process_state = &(external_entry_points[l].process_state);
+		process_state->memory_used[used_records[n].index] = used_records[n].value;
+	}
+
+	*inst_log = header->inst_log;
+	munmap(map, st.st_size);
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "checkpoint: %s is damaged\n", filename);
+		return 1;
+	}
+	debug_print(DEBUG_MAIN, 1, "checkpoint: read %s, 0x%"PRIx64" instructions\n", filename, *inst_log);
+	return 0;
+}
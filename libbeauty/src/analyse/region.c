@@ -0,0 +1,338 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Region based structuring.
+ * Turns the nodes of one function into a tree of struct region_s:
+ * if...then...else, while, do...while, for (;;), switch, break, continue and goto.
+ * Needs the loop heads, member_of_loop[], post_dominator and if_tail of the nodes.
+ * Each node is structured once. Reaching a node a second time gives a GOTO to it,
+ * so any CFG can be structured, and the cost is linear in the number of nodes and links.
+ * All regions are allocated in the function's arena, so there is no size limit.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rev.h>
+
+struct region_build_s {
+	struct arena_s *arena;
+	struct control_flow_node_s *nodes;
+	int nodes_size;
+	uint8_t *visited;
+	struct region_s **block; /* The region of each visited node, for labels */
+	int regions_size;
+};
+
+/* The loop being structured. break and continue refer to it. */
+struct region_loop_s {
+	int head;
+	int follow; /* First node after the loop. 0 = none */
+	int latch; /* Node with the do...while condition. 0 = none */
+};
+
+static struct region_s *region_new(struct region_build_s *build, int type, int node)
+{
+	struct region_s *region;
+
+	region = arena_alloc(build->arena, 1, sizeof(struct region_s));
+	if (!region) {
+		debug_print(DEBUG_ANALYSE, 1, "region_new: out of memory\n");
+		exit(1);
+	}
+	region->type = type;
+	region->node = node;
+	build->regions_size++;
+	return region;
+}
+
+/* children grows by doubling, whenever children_size reaches a power of two. */
+static void region_add(struct region_build_s *build, struct region_s *parent, struct region_s *child)
+{
+	int size = parent->children_size;
+
+	if ((size == 0) || !(size & (size - 1))) {
+		parent->children = arena_realloc(build->arena, parent->children,
+			size * sizeof(struct region_s *),
+			(size ? size * 2 : 1) * sizeof(struct region_s *));
+		if (!parent->children) {
+			debug_print(DEBUG_ANALYSE, 1, "region_add: out of memory\n");
+			exit(1);
+		}
+	}
+	parent->children[size] = child;
+	parent->children_size = size + 1;
+}
+
+static struct region_s *region_jump(struct region_build_s *build, struct region_loop_s *loop, int target)
+{
+	if (loop && (target == loop->head)) {
+		return region_new(build, REGION_TYPE_CONTINUE, target);
+	}
+	if (loop && (target == loop->follow)) {
+		return region_new(build, REGION_TYPE_BREAK, target);
+	}
+	if (build->block[target]) {
+		build->block[target]->label = 1;
+	}
+	return region_new(build, REGION_TYPE_GOTO, target);
+}
+
+static struct region_s *region_sequence(struct region_build_s *build, struct region_loop_s *loop, int node, int stop);
+
+static struct region_s *region_arm(struct region_build_s *build, struct region_loop_s *loop, int node, int stop)
+{
+	if (node == stop) {
+		return region_new(build, REGION_TYPE_SEQUENCE, 0);
+	}
+	return region_sequence(build, loop, node, stop);
+}
+
+static struct region_s *region_loop(struct region_build_s *build, int head, int *next)
+{
+	struct control_flow_node_s *nodes = build->nodes;
+	struct region_loop_s loop;
+	struct region_s *region;
+	int body = 0;
+	int node;
+	int n;
+
+	loop.head = head;
+	loop.follow = 0;
+	loop.latch = 0;
+	/* The follow is the first post-dominator of the head outside the loop */
+	node = nodes[head].post_dominator;
+	while (node && is_member_of_loop(nodes, head, node)) {
+		node = nodes[node].post_dominator;
+	}
+	loop.follow = node;
+
+	if ((nodes[head].next_size == 2) && loop.follow &&
+		((nodes[head].link_next[0].node == loop.follow) ||
+		(nodes[head].link_next[1].node == loop.follow))) {
+		/* while (condition) { body } */
+		body = (nodes[head].link_next[0].node == loop.follow) ?
+			nodes[head].link_next[1].node : nodes[head].link_next[0].node;
+		region = region_new(build, REGION_TYPE_WHILE, head);
+		build->visited[head] = 1;
+		build->block[head] = region;
+		region_add(build, region, region_arm(build, &loop, body, head));
+		*next = loop.follow;
+		return region;
+	}
+
+	/* do { body } while (condition), if the only latch tests the loop exit */
+	for (n = 0; n < nodes[head].prev_size; n++) {
+		node = nodes[head].prev_node[n];
+		if (!is_member_of_loop(nodes, head, node)) {
+			continue;
+		}
+		if (loop.latch) {
+			loop.latch = 0;
+			break;
+		}
+		if ((nodes[node].next_size == 2) && loop.follow &&
+			((nodes[node].link_next[0].node == loop.follow) ||
+			(nodes[node].link_next[1].node == loop.follow))) {
+			loop.latch = node;
+		} else {
+			break;
+		}
+	}
+	if (loop.latch) {
+		region = region_new(build, REGION_TYPE_DO_WHILE, loop.latch);
+	} else {
+		region = region_new(build, REGION_TYPE_LOOP, head);
+	}
+	region_add(build, region, region_sequence(build, &loop, head, head));
+	*next = loop.follow;
+	return region;
+}
+
+/* Structure the nodes from node onwards, until stop, a return or a jump. */
+static struct region_s *region_sequence(struct region_build_s *build, struct region_loop_s *loop, int node, int stop)
+{
+	struct control_flow_node_s *nodes = build->nodes;
+	struct region_s *sequence;
+	struct region_s *region;
+	int next;
+	int tail;
+	int n;
+
+	sequence = region_new(build, REGION_TYPE_SEQUENCE, node);
+	while (node) {
+		if (build->visited[node] || (loop && (node == loop->follow))) {
+			region_add(build, sequence, region_jump(build, loop, node));
+			break;
+		}
+		if (nodes[node].loop_head && (!loop || (node != loop->head))) {
+			region = region_loop(build, node, &next);
+			region_add(build, sequence, region);
+		} else {
+			build->visited[node] = 1;
+			next = 0;
+			if ((nodes[node].next_size < 2) || (loop && (node == loop->latch))) {
+				build->block[node] = region_new(build, REGION_TYPE_BLOCK, node);
+				region_add(build, sequence, build->block[node]);
+				if ((nodes[node].next_size == 1) && !(loop && (node == loop->latch))) {
+					next = nodes[node].link_next[0].node;
+				}
+			} else {
+				tail = nodes[node].if_tail;
+				/* Leaving the loop is a break, not a join */
+				if (loop && tail && !is_member_of_loop(nodes, loop->head, tail)) {
+					tail = 0;
+				}
+				if ((nodes[node].type == NODE_TYPE_JMPT) || (nodes[node].next_size > 2)) {
+					region = region_new(build, REGION_TYPE_SWITCH, node);
+				} else {
+					region = region_new(build, REGION_TYPE_IF_THEN_ELSE, node);
+				}
+				build->block[node] = region;
+				for (n = 0; n < nodes[node].next_size; n++) {
+					region_add(build, region, region_arm(build, loop,
+						nodes[node].link_next[n].node, tail ? tail : stop));
+				}
+				region_add(build, sequence, region);
+				next = tail;
+			}
+		}
+		if (!next || (next == stop)) {
+			break;
+		}
+		node = next;
+	}
+	return sequence;
+}
+
+/* Build external_entry_point->region. Node 1 is the entry of the function. */
+int build_regions(struct self_s *self, struct external_entry_point_s *external_entry_point, int *regions_size)
+{
+	struct region_build_s build;
+
+	*regions_size = 0;
+	external_entry_point->region = NULL;
+	if (external_entry_point->nodes_size < 2) {
+		return 1;
+	}
+	build.arena = external_entry_point->arena;
+	build.nodes = external_entry_point->nodes;
+	build.nodes_size = external_entry_point->nodes_size;
+	build.visited = arena_alloc(build.arena, build.nodes_size, sizeof(uint8_t));
+	build.block = arena_alloc(build.arena, build.nodes_size, sizeof(struct region_s *));
+	build.regions_size = 0;
+	if (!build.visited || !build.block) {
+		debug_print(DEBUG_ANALYSE, 1, "build_regions: out of memory\n");
+		return 1;
+	}
+	external_entry_point->region = region_sequence(&build, NULL, 1, 0);
+	*regions_size = build.regions_size;
+	return 0;
+}
+
+static void print_regions_indent(int depth, FILE *fd)
+{
+	int n;
+
+	for (n = 0; n < depth; n++) {
+		fprintf(fd, "\t");
+	}
+}
+
+int print_regions(struct self_s *self, struct region_s *region, int depth, FILE *fd)
+{
+	int n;
+
+	if (!region) {
+		return 1;
+	}
+	if (region->label) {
+		print_regions_indent(depth, fd);
+		fprintf(fd, "label_0x%x:\n", region->node);
+	}
+	switch (region->type) {
+	case REGION_TYPE_BLOCK:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "node 0x%x;\n", region->node);
+		break;
+	case REGION_TYPE_SEQUENCE:
+		for (n = 0; n < region->children_size; n++) {
+			print_regions(self, region->children[n], depth, fd);
+		}
+		break;
+	case REGION_TYPE_IF_THEN_ELSE:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "if (node 0x%x) {\n", region->node);
+		print_regions(self, region->children[0], depth + 1, fd);
+		print_regions_indent(depth, fd);
+		fprintf(fd, "} else {\n");
+		print_regions(self, region->children[1], depth + 1, fd);
+		print_regions_indent(depth, fd);
+		fprintf(fd, "}\n");
+		break;
+	case REGION_TYPE_WHILE:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "while (node 0x%x) {\n", region->node);
+		print_regions(self, region->children[0], depth + 1, fd);
+		print_regions_indent(depth, fd);
+		fprintf(fd, "}\n");
+		break;
+	case REGION_TYPE_DO_WHILE:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "do {\n");
+		print_regions(self, region->children[0], depth + 1, fd);
+		print_regions_indent(depth, fd);
+		fprintf(fd, "} while (node 0x%x);\n", region->node);
+		break;
+	case REGION_TYPE_LOOP:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "for (;;) {\n");
+		print_regions(self, region->children[0], depth + 1, fd);
+		print_regions_indent(depth, fd);
+		fprintf(fd, "}\n");
+		break;
+	case REGION_TYPE_SWITCH:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "switch (node 0x%x) {\n", region->node);
+		for (n = 0; n < region->children_size; n++) {
+			print_regions_indent(depth, fd);
+			fprintf(fd, "case %d:\n", n);
+			print_regions(self, region->children[n], depth + 1, fd);
+		}
+		print_regions_indent(depth, fd);
+		fprintf(fd, "}\n");
+		break;
+	case REGION_TYPE_GOTO:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "goto label_0x%x;\n", region->node);
+		break;
+	case REGION_TYPE_BREAK:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "break;\n");
+		break;
+	case REGION_TYPE_CONTINUE:
+		print_regions_indent(depth, fd);
+		fprintf(fd, "continue;\n");
+		break;
+	default:
+		debug_print(DEBUG_ANALYSE, 1, "print_regions: unknown region type 0x%x\n", region->type);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ *  Copyright (C) 2004-2012 The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <rev.h>
+
+static double stats_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+struct stats_s *stats_create(void)
+{
+	struct stats_s *stats;
+
+	stats = calloc(1, sizeof(struct stats_s));
+	if (!stats) {
+		return NULL;
+	}
+	stats_mark(stats, &(stats->start));
+	return stats;
+}
+
+void stats_mark(struct stats_s *stats, struct stats_mark_s *mark)
+{
+	struct rusage usage;
+
+	if (!stats) {
+		return;
+	}
+	mark->wall = stats_clock(CLOCK_MONOTONIC);
+	mark->cpu = stats_clock(CLOCK_PROCESS_CPUTIME_ID);
+	getrusage(RUSAGE_SELF, &usage);
+	mark->max_rss = usage.ru_maxrss;
+}
+
+/* Returns a new record at the end of stats->records, or NULL if it could not be added. */
+static struct stats_record_s *stats_record_add(struct stats_s *stats)
+{
+	struct stats_record_s *record;
+	int size;
+
+	if (stats->failed) {
+		return NULL;
+	}
+	if (stats->records_size >= stats->records_max) {
+		size = stats->records_max ? stats->records_max * 2 : 256;
+		record = realloc(stats->records, size * sizeof(struct stats_record_s));
+		if (!record) {
+			/* Stop here. Incomplete stats would be misleading */
+			debug_print(DEBUG_MAIN, 1, "stats_record: out of memory, no stats will be written\n");
+			stats->failed = 1;
+			return NULL;
+		}
+		stats->records = record;
+		stats->records_max = size;
+	}
+	record = &(stats->records[stats->records_size]);
+	stats->records_size++;
+	return record;
+}
+
+/* Record the time and memory used since mark. Returns 0 on success, 1 on error. */
+int stats_record(struct stats_s *stats, struct stats_mark_s *mark, const char *phase,
+		int function, const char *items_name, uint64_t items)
+{
+	struct stats_mark_s now;
+	struct stats_record_s *record;
+
+	if (!stats) {
+		return 0;
+	}
+	stats_mark(stats, &now);
+	record = stats_record_add(stats);
+	if (!record) {
+		return 1;
+	}
+	record->phase = phase;
+	record->function = function;
+	record->wall = now.wall - mark->wall;
+	record->cpu = now.cpu - mark->cpu;
+	record->max_rss_delta = now.max_rss - mark->max_rss;
+	record->items_name = items_name;
+	record->items = items;
+	return 0;
+}
+
+/* Record the whole phase as the sum of its per function records.
+ * For phases that run one function at a time, interleaved with the other phases.
+ * Returns 0 on success, 1 on error. */
+int stats_record_total(struct stats_s *stats, const char *phase, const char *items_name)
+{
+	struct stats_record_s total;
+	struct stats_record_s *record;
+	int n;
+
+	if (!stats) {
+		return 0;
+	}
+	memset(&total, 0, sizeof(total));
+	total.phase = phase;
+	total.function = -1;
+	total.items_name = items_name;
+	for (n = 0; n < stats->records_size; n++) {
+		record = &(stats->records[n]);
+		if ((record->function < 0) || strcmp(record->phase, phase)) {
+			continue;
+		}
+		total.wall += record->wall;
+		total.cpu += record->cpu;
+		total.max_rss_delta += record->max_rss_delta;
+		total.items += record->items;
+	}
+	record = stats_record_add(stats);
+	if (!record) {
+		return 1;
+	}
+	*record = total;
+	return 0;
+}
+
+static void stats_json_string(FILE *fd, const char *string)
+{
+	const char *p;
+
+	fputc('"', fd);
+	for (p = string; *p; p++) {
+		if ((*p == '"') || (*p == '\\')) {
+			fprintf(fd, "\\%c", *p);
+		} else if ((unsigned char)*p < 0x20) {
+			fprintf(fd, "\\u%04x", *p);
+		} else {
+			fputc(*p, fd);
+		}
+	}
+	fputc('"', fd);
+}
+
+static void stats_json_record(FILE *fd, struct self_s *self, struct stats_record_s *record)
+{
+	fprintf(fd, "{\"phase\": ");
+	stats_json_string(fd, record->phase);
+	if (record->function >= 0) {
+		fprintf(fd, ", \"function\": ");
+		stats_json_string(fd, self->external_entry_points[record->function].name);
+	}
+	fprintf(fd, ", \"wall_s\": %.6f, \"cpu_s\": %.6f, \"max_rss_delta_kb\": %ld",
+		record->wall, record->cpu, record->max_rss_delta);
+	if (record->items_name) {
+		fprintf(fd, ", ");
+		stats_json_string(fd, record->items_name);
+		fprintf(fd, ": %"PRIu64, record->items);
+	}
+	fprintf(fd, "}");
+}
+
+/* Write all the records as JSON.
+ * "phases" has the whole phase records and "functions" the per function ones, both in the order recorded. */
+int stats_write_json(struct self_s *self, struct stats_s *stats, const char *filename)
+{
+	struct stats_record_s total;
+	struct stats_mark_s now;
+	FILE *fd;
+	int first;
+	int n;
+
+	if (!stats) {
+		return 0;
+	}
+	if (stats_record(stats, &(stats->start), "total", -1, NULL, 0)) {
+		debug_print(DEBUG_MAIN, 1, "Stats not written to %s, some records were dropped\n", filename);
+		return 1;
+	}
+	fd = fopen(filename, "w");
+	if (!fd) {
+		debug_print(DEBUG_MAIN, 1, "Failed to open stats file %s\n", filename);
+		stats->records_size--;
+		return 1;
+	}
+	total = stats->records[stats->records_size - 1];
+	stats->records_size--;
+
+	fprintf(fd, "{\n\"input\": ");
+	stats_json_string(fd, self->filename ? self->filename : "");
+	fprintf(fd, ",\n\"total\": ");
+	stats_json_record(fd, self, &total);
+	stats_mark(stats, &now);
+	fprintf(fd, ",\n\"max_rss_kb\": %ld", now.max_rss);
+	fprintf(fd, ",\n\"phases\": [");
+	first = 1;
+	for (n = 0; n < stats->records_size; n++) {
+		if (stats->records[n].function >= 0) {
+			continue;
+		}
+		fprintf(fd, "%s\n\t", first ? "" : ",");
+		stats_json_record(fd, self, &(stats->records[n]));
+		first = 0;
+	}
+	fprintf(fd, "\n],\n\"functions\": [");
+	first = 1;
+	for (n = 0; n < stats->records_size; n++) {
+		if (stats->records[n].function < 0) {
+			continue;
+		}
+		fprintf(fd, "%s\n\t", first ? "" : ",");
+		stats_json_record(fd, self, &(stats->records[n]));
+		first = 0;
+	}
+	fprintf(fd, "\n]\n}\n");
+	fclose(fd);
+	return 0;
+}
+
+void stats_free(struct stats_s *stats)
+{
+	if (!stats) {
+		return;
+	}
+	free(stats->records);
+	free(stats);
+}
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2004-2012  The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The entry_point worklist.
+ * process_block() adds the targets of IF and JMPT here and main() pops
+ * them in FIFO order until the worklist is empty.
+ * Entries between entry_point_head and entry_point_tail are pending.
+ * Entries before entry_point_head have already been processed, but are
+ * kept so that the hash can reject the same target being added again.
+ * The key is eip, esp and ebp. The first instruction to branch to a target is
+ * its previous_instuction, which process_block() links to. Any later ones go on
+ * the entry's prev list, and entry_point_link() links them once the worklist is empty.
+ * Each pending entry holds a reference to the machine state to resume from.
+ * entry_point_next() passes that reference on to the caller.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rev.h>
+
+static uint64_t entry_point_hash_key(struct entry_point_s *entry)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = (hash ^ entry->eip_init_value) * 0x100000001b3ULL;
+	hash = (hash ^ entry->eip_offset_value) * 0x100000001b3ULL;
+	hash = (hash ^ entry->esp_init_value) * 0x100000001b3ULL;
+	hash = (hash ^ entry->esp_offset_value) * 0x100000001b3ULL;
+	hash = (hash ^ entry->ebp_init_value) * 0x100000001b3ULL;
+	hash = (hash ^ entry->ebp_offset_value) * 0x100000001b3ULL;
+	return hash ^ (hash >> 32);
+}
+
+static int entry_point_equal(struct entry_point_s *a, struct entry_point_s *b)
+{
+	return (a->eip_init_value == b->eip_init_value) &&
+		(a->eip_offset_value == b->eip_offset_value) &&
+		(a->esp_init_value == b->esp_init_value) &&
+		(a->esp_offset_value == b->esp_offset_value) &&
+		(a->ebp_init_value == b->ebp_init_value) &&
+		(a->ebp_offset_value == b->ebp_offset_value);
+}
+
+/* The hash holds index + 1 into self->entry_point. 0 == empty slot.
+ * entry_point_hash_size is always a power of 2. */
+static void entry_point_hash_insert(struct self_s *self, uint64_t index)
+{
+	uint64_t mask = self->entry_point_hash_size - 1;
+	uint64_t slot = entry_point_hash_key(&(self->entry_point[index])) & mask;
+
+	while (self->entry_point_hash[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	self->entry_point_hash[slot] = index + 1;
+}
+
+static int entry_point_hash_grow(struct self_s *self)
+{
+	uint64_t n;
+	uint64_t size = self->entry_point_hash_size * 2;
+
+	if (size < 64) {
+		size = 64;
+	}
+	free(self->entry_point_hash);
+	self->entry_point_hash = calloc(size, sizeof(uint64_t));
+	if (!self->entry_point_hash) {
+		return 1;
+	}
+	self->entry_point_hash_size = size;
+	for (n = 0; n < self->entry_point_tail; n++) {
+		entry_point_hash_insert(self, n);
+	}
+	return 0;
+}
+
+int entry_point_init(struct self_s *self, uint64_t size)
+{
+	if (size < 1) {
+		size = 1;
+	}
+	self->entry_point = calloc(size, sizeof(struct entry_point_s));
+	if (!self->entry_point) {
+		return 1;
+	}
+	self->entry_point_list_length = size;
+	self->entry_point_head = 0;
+	self->entry_point_tail = 0;
+	self->entry_point_hash = NULL;
+	self->entry_point_hash_size = 0;
+	return entry_point_hash_grow(self);
+}
+
+/* Forget all entries, processed or not. Used at the start of each function. */
+int entry_point_reset(struct self_s *self)
+{
+	uint64_t n;
+
+	for (n = self->entry_point_head; n < self->entry_point_tail; n++) {
+		machine_state_release(self->entry_point[n].state);
+	}
+	for (n = 0; n < self->entry_point_tail; n++) {
+		free(self->entry_point[n].prev);
+	}
+	memset(self->entry_point, 0, self->entry_point_tail * sizeof(struct entry_point_s));
+	memset(self->entry_point_hash, 0, self->entry_point_hash_size * sizeof(uint64_t));
+	self->entry_point_head = 0;
+	self->entry_point_tail = 0;
+	return 0;
+}
+
+/* Add previous_instuction to the instructions that branch to entry.
+ * Returns 0 on success, 1 on error. */
+static int entry_point_add_prev(struct entry_point_s *entry, uint64_t previous_instuction)
+{
+	uint64_t *prev;
+	int n;
+
+	if (entry->previous_instuction == previous_instuction) {
+		return 0;
+	}
+	for (n = 0; n < entry->prev_size; n++) {
+		if (entry->prev[n] == previous_instuction) {
+			return 0;
+		}
+	}
+	prev = realloc(entry->prev, (entry->prev_size + 1) * sizeof(uint64_t));
+	if (!prev) {
+		return 1;
+	}
+	prev[entry->prev_size] = previous_instuction;
+	entry->prev = prev;
+	entry->prev_size++;
+	return 0;
+}
+
+/* Returns 0 if added, 1 on error, 2 if the same target was already seen.
+ * For 2, previous_instuction is kept on that entry's prev list and state is not used.
+ * If added, the entry takes its own reference to state. state may be NULL. */
+int entry_point_add(struct self_s *self, uint64_t esp_init_value, uint64_t esp_offset_value,
+		uint64_t ebp_init_value, uint64_t ebp_offset_value,
+		uint64_t eip_init_value, uint64_t eip_offset_value,
+		uint64_t previous_instuction, struct machine_state_s *state)
+{
+	struct entry_point_s new_entry;
+	struct entry_point_s *entry;
+	uint64_t mask = self->entry_point_hash_size - 1;
+	uint64_t slot;
+	int tmp;
+
+	memset(&new_entry, 0, sizeof(struct entry_point_s));
+	new_entry.used = 1;
+	new_entry.esp_init_value = esp_init_value;
+	new_entry.esp_offset_value = esp_offset_value;
+	new_entry.ebp_init_value = ebp_init_value;
+	new_entry.ebp_offset_value = ebp_offset_value;
+	new_entry.eip_init_value = eip_init_value;
+	new_entry.eip_offset_value = eip_offset_value;
+	new_entry.previous_instuction = previous_instuction;
+
+	slot = entry_point_hash_key(&new_entry) & mask;
+	while (self->entry_point_hash[slot]) {
+		entry = &(self->entry_point[self->entry_point_hash[slot] - 1]);
+		if (entry_point_equal(entry, &new_entry)) {
+			debug_print(DEBUG_EXE, 1, "entry_point_add: duplicate eip = 0x%"PRIx64", prev_inst = 0x%"PRIx64"\n",
+				eip_offset_value, previous_instuction);
+			if (entry_point_add_prev(entry, previous_instuction)) {
+				return 1;
+			}
+			return 2;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (self->entry_point_tail >= self->entry_point_list_length) {
+		uint64_t size = self->entry_point_list_length * 2;
+		entry = realloc(self->entry_point, size * sizeof(struct entry_point_s));
+		if (!entry) {
+			return 1;
+		}
+		memset(&entry[self->entry_point_list_length], 0,
+			(size - self->entry_point_list_length) * sizeof(struct entry_point_s));
+		self->entry_point = entry;
+		self->entry_point_list_length = size;
+	}
+	if (state) {
+		machine_state_ref(state);
+		new_entry.state = state;
+	}
+	memcpy(&(self->entry_point[self->entry_point_tail]), &new_entry, sizeof(struct entry_point_s));
+	self->entry_point_tail++;
+	/* Keep the load factor below 1/2 */
+	if ((self->entry_point_tail * 2) > self->entry_point_hash_size) {
+		tmp = entry_point_hash_grow(self);
+		if (tmp) {
+			return 1;
+		}
+	} else {
+		entry_point_hash_insert(self, self->entry_point_tail - 1);
+	}
+	return 0;
+}
+
+/* Pops the oldest pending entry into *entry. Returns 0 if one was found, 1 if empty.
+ * A copy is returned because process_block() may realloc self->entry_point.
+ * The caller must machine_state_release() entry->state. */
+int entry_point_next(struct self_s *self, struct entry_point_s *entry)
+{
+	if (self->entry_point_head >= self->entry_point_tail) {
+		return 1;
+	}
+	memcpy(entry, &(self->entry_point[self->entry_point_head]), sizeof(struct entry_point_s));
+	self->entry_point[self->entry_point_head].used = 0;
+	self->entry_point[self->entry_point_head].state = NULL;
+	self->entry_point_head++;
+	return 0;
+}
+
+/* Link the other instructions that branch to each target, once the worklist is empty.
+ * Each is linked to the first instruction run at that target, as process_block()
+ * does when it reaches code that has already been run. */
+int entry_point_link(struct self_s *self, struct process_state_s *process_state)
+{
+	struct entry_point_s *entry;
+	int *memory_used = process_state->memory_used;
+	uint64_t n;
+	int m;
+
+	for (n = 0; n < self->entry_point_tail; n++) {
+		entry = &(self->entry_point[n]);
+		if (!entry->prev_size) {
+			continue;
+		}
+		if ((entry->eip_offset_value >= MEMORY_USED_SIZE) ||
+			(memory_used[entry->eip_offset_value] <= 0)) {
+			debug_print(DEBUG_EXE, 1, "entry_point_link: eip = 0x%"PRIx64" was not run\n",
+				entry->eip_offset_value);
+			return 1;
+		}
+		for (m = 0; m < entry->prev_size; m++) {
+			process_block_link(self, entry->prev[m], memory_used[entry->eip_offset_value]);
+		}
+	}
+	return 0;
+}
@@ -167,6 +167,499 @@ int print_store(struct memory_s *memory) {
 	return 0;
 }
 
+/* Compare an entry with (start, length). Same order as the map. */
+static int memory_map_compare(struct memory_s *memory, uint64_t start, int length)
+{
+	if (memory->start_address != start) {
+		return (memory->start_address < start) ? -1 : 1;
+	}
+	if (memory->length != length) {
+		return (memory->length < length) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Chunk holding entry n. n must be < map->size */
+static int memory_map_chunk_of(struct memory_map_s *map, int n)
+{
+	int low = 0;
+	int high = map->chunks_size - 1;
+	int mid;
+
+	/* Last chunk whose first entry is not after n */
+	while (low < high) {
+		mid = low + ((high - low + 1) >> 1);
+		if (map->chunk_first[mid] <= n) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+/* Entry n of the map, in order. NULL if there is no entry n.
+ * Do not change it, use memory_map_write() for that. */
+struct memory_s *memory_map_entry(struct memory_map_s *map, int n)
+{
+	int c;
+
+	if ((n < 0) || (n >= map->size)) {
+		return NULL;
+	}
+	c = memory_map_chunk_of(map, n);
+	return &(map->chunk[c]->memory[n - map->chunk_first[c]]);
+}
+
+/* Move (*c, *i) on to the next entry. Returns 0 at the end of the map. */
+static int memory_map_next(struct memory_map_s *map, int *c, int *i)
+{
+	(*i)++;
+	if (*i >= map->chunk[*c]->size) {
+		(*c)++;
+		*i = 0;
+	}
+	return *c < map->chunks_size;
+}
+
+/* Index of the first entry that is not before (start, length) */
+static int memory_map_lower_bound(struct memory_map_s *map, uint64_t start, int length)
+{
+	struct memory_map_chunk_s *chunk;
+	int low = 0;
+	int high = map->chunks_size;
+	int mid;
+	int c;
+
+	/* First chunk whose last entry is not before (start, length) */
+	while (low < high) {
+		mid = low + ((high - low) >> 1);
+		chunk = map->chunk[mid];
+		if (memory_map_compare(&(chunk->memory[chunk->size - 1]), start, length) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == map->chunks_size) {
+		return map->size;
+	}
+	c = low;
+	chunk = map->chunk[c];
+	low = 0;
+	high = chunk->size - 1;
+	while (low < high) {
+		mid = low + ((high - low) >> 1);
+		if (memory_map_compare(&(chunk->memory[mid]), start, length) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return map->chunk_first[c] + low;
+}
+
+/* Index of the first entry that might overlap bytes from start onwards */
+static int memory_map_first_overlap(struct memory_map_s *map, uint64_t start)
+{
+	uint64_t low = 0;
+
+	if (start >= (uint64_t)map->max_length) {
+		low = start - map->max_length + 1;
+	}
+	return memory_map_lower_bound(map, low, 0);
+}
+
+/* Mask for the value of an entry length bytes long */
+static uint64_t memory_map_mask(int length)
+{
+	if (length >= 8) {
+		return ~(uint64_t)0;
+	}
+	return ((uint64_t)1 << (length * 8)) - 1;
+}
+
+/* Value of an entry, if it is known and fits in 64 bits */
+static int memory_map_value(struct memory_s *memory, uint64_t *value)
+{
+	if ((memory->init_value_type != 1) || (memory->length > 8)) {
+		return 0;
+	}
+	*value = (memory->init_value + memory->offset_value) & memory_map_mask(memory->length);
+	return 1;
+}
+
+/* Make chunk c of the map its own before it is changed.
+ * It is copied if another map shares it. Only this chunk is copied. */
+static int memory_map_chunk_unshare(struct memory_map_s *map, int c)
+{
+	struct memory_map_chunk_s *chunk = map->chunk[c];
+	struct memory_map_chunk_s *copy;
+
+	if (chunk->refs == 1) {
+		return 0;
+	}
+	copy = malloc(sizeof(struct memory_map_chunk_s));
+	if (!copy) {
+		return 1;
+	}
+	copy->refs = 1;
+	copy->size = chunk->size;
+	memcpy(copy->memory, chunk->memory, chunk->size * sizeof(struct memory_s));
+	debug_print(DEBUG_EXE, 1, "memory_map_chunk_unshare: copied %d entries\n", chunk->size);
+	chunk->refs--;
+	map->chunk[c] = copy;
+	return 0;
+}
+
+static int memory_map_chunks_grow(struct memory_map_s *map)
+{
+	struct memory_map_chunk_s **chunk;
+	int *chunk_first;
+	int chunks_max = map->chunks_max ? (map->chunks_max * 2) : 4;
+
+	chunk = realloc(map->chunk, chunks_max * sizeof(struct memory_map_chunk_s *));
+	if (!chunk) {
+		return 1;
+	}
+	map->chunk = chunk;
+	chunk_first = realloc(map->chunk_first, chunks_max * sizeof(int));
+	if (!chunk_first) {
+		return 1;
+	}
+	map->chunk_first = chunk_first;
+	map->chunks_max = chunks_max;
+	return 0;
+}
+
+struct memory_s *memory_map_search(
+	struct memory_map_s *map, uint64_t index, int size_bits)
+{
+	/* Convert bits to bytes. Round up. Make sure 1 bit turns into 1 byte */
+	int size = (size_bits + 7) >> 3;
+	struct memory_s *memory;
+	int n;
+
+	debug_print(DEBUG_EXE, 1, "memory_map_search: map=%p, index=0x%"PRIx64", size=%d\n", map, index, size);
+	n = memory_map_lower_bound(map, index, size);
+	memory = memory_map_entry(map, n);
+	if (memory && !memory_map_compare(memory, index, size)) {
+		debug_print(DEBUG_EXE, 1, "Found entry %d in map %p\n", n, map);
+		return memory;
+	}
+	return NULL;
+}
+
+/* As memory_map_search(), for an entry that is about to be changed.
+ * Its chunk is copied first if another map shares it.
+ * Returns NULL if the entry is not there, or if the copy fails.
+ */
+struct memory_s *memory_map_write(
+	struct memory_map_s *map, uint64_t index, int size_bits)
+{
+	int size = (size_bits + 7) >> 3;
+	int n;
+	int c;
+
+	n = memory_map_lower_bound(map, index, size);
+	if ((n >= map->size) || memory_map_compare(memory_map_entry(map, n), index, size)) {
+		return NULL;
+	}
+	c = memory_map_chunk_of(map, n);
+	if (memory_map_chunk_unshare(map, c)) {
+		return NULL;
+	}
+	return &(map->chunk[c]->memory[n - map->chunk_first[c]]);
+}
+
+/* Add a new entry, as add_new_store() does.
+ * If a known entry already holds all of its bytes, e.g. the low 4 bytes of an
+ * 8 byte store, the new entry starts with that part of its value.
+ * Only the chunk it goes into is copied, if shared. A full chunk is split in two.
+ * Returns NULL if the entry already exists, or on failure.
+ */
+struct memory_s *memory_map_add(
+	struct memory_map_s *map, uint64_t index, int size_bits)
+{
+	/* Convert bits to bytes. Round up. Make sure 1 bit turns into 1 byte */
+	int size = (size_bits + 7) >> 3;
+	struct memory_map_chunk_s *chunk;
+	struct memory_map_chunk_s *new_chunk;
+	struct memory_s *result;
+	struct memory_s *memory;
+	uint64_t value;
+	int shift;
+	int half;
+	int n;
+	int c;
+	int i;
+
+	debug_print(DEBUG_EXE, 1, "memory_map_add: map=%p, index=0x%"PRIx64", size=%d\n", map, index, size);
+	n = memory_map_lower_bound(map, index, size);
+	if ((n < map->size) && !memory_map_compare(memory_map_entry(map, n), index, size)) {
+		/* Store already existed */
+		return NULL;
+	}
+	if (!map->chunks_size) {
+		if ((map->chunks_max < 1) && memory_map_chunks_grow(map)) {
+			return NULL;
+		}
+		chunk = malloc(sizeof(struct memory_map_chunk_s));
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->refs = 1;
+		chunk->size = 0;
+		map->chunk[0] = chunk;
+		map->chunk_first[0] = 0;
+		map->chunks_size = 1;
+	}
+	if (n == map->size) {
+		/* Onto the end of the last chunk */
+		c = map->chunks_size - 1;
+		i = map->chunk[c]->size;
+	} else {
+		c = memory_map_chunk_of(map, n);
+		i = n - map->chunk_first[c];
+	}
+	if (memory_map_chunk_unshare(map, c)) {
+		return NULL;
+	}
+	if (map->chunk[c]->size == MEMORY_MAP_CHUNK) {
+		/* Split it, the top half going into a new chunk after it */
+		if ((map->chunks_size >= map->chunks_max) && memory_map_chunks_grow(map)) {
+			return NULL;
+		}
+		new_chunk = malloc(sizeof(struct memory_map_chunk_s));
+		if (!new_chunk) {
+			return NULL;
+		}
+		chunk = map->chunk[c];
+		half = MEMORY_MAP_CHUNK / 2;
+		new_chunk->refs = 1;
+		new_chunk->size = MEMORY_MAP_CHUNK - half;
+		memcpy(new_chunk->memory, &(chunk->memory[half]), new_chunk->size * sizeof(struct memory_s));
+		chunk->size = half;
+		memmove(&(map->chunk[c + 2]), &(map->chunk[c + 1]),
+			(map->chunks_size - c - 1) * sizeof(struct memory_map_chunk_s *));
+		memmove(&(map->chunk_first[c + 2]), &(map->chunk_first[c + 1]),
+			(map->chunks_size - c - 1) * sizeof(int));
+		map->chunk[c + 1] = new_chunk;
+		map->chunk_first[c + 1] = map->chunk_first[c] + half;
+		map->chunks_size++;
+		if (i > half) {
+			c++;
+			i -= half;
+		}
+	}
+	chunk = map->chunk[c];
+	memmove(&(chunk->memory[i + 1]), &(chunk->memory[i]), (chunk->size - i) * sizeof(struct memory_s));
+	chunk->size++;
+	for (n = c + 1; n < map->chunks_size; n++) {
+		map->chunk_first[n]++;
+	}
+	map->size++;
+	if (size > map->max_length) {
+		map->max_length = size;
+	}
+	result = &(chunk->memory[i]);
+	memset(result, 0, sizeof(struct memory_s));
+	result->start_address = index;
+	result->length = size;
+	/* Each time a new value is assigned, this value_id increases */
+	result->value_id = 1;
+	/* 1 - Entry Used */
+	result->valid = 1;
+
+	if (size > 8) {
+		return result;
+	}
+	n = memory_map_first_overlap(map, index);
+	if (n >= map->size) {
+		return result;
+	}
+	c = memory_map_chunk_of(map, n);
+	i = n - map->chunk_first[c];
+	do {
+		memory = &(map->chunk[c]->memory[i]);
+		if (memory->start_address > index) {
+			break;
+		}
+		if ((memory == result) ||
+			(memory->start_address + memory->length < index + size) ||
+			!memory_map_value(memory, &value)) {
+			continue;
+		}
+		shift = (index - memory->start_address) * 8;
+		result->init_value_type = 1;
+		result->init_value = (value >> shift) & memory_map_mask(size);
+		debug_print(DEBUG_EXE, 1, "memory_map_add: value 0x%"PRIx64" from entry 0x%"PRIx64"\n",
+			result->init_value, memory->start_address);
+		break;
+	} while (memory_map_next(map, &c, &i));
+	return result;
+}
+
+/* After a write to one entry, bring the entries that overlap it up to date.
+ * Entries wholly inside or wholly around the written bytes get the new bytes
+ * when both values are known. Any other overlap leaves the value unknown.
+ * written must come from memory_map_write() or memory_map_add().
+ * Returns 0 on success, 1 if a shared chunk could not be copied.
+ */
+int memory_map_update_overlaps(
+	struct memory_map_s *map, struct memory_s *written)
+{
+	uint64_t start = written->start_address;
+	uint64_t end = start + written->length;
+	uint64_t memory_end;
+	uint64_t value = 0;
+	uint64_t memory_value;
+	uint64_t mask;
+	struct memory_s *memory;
+	int known;
+	int shift;
+	int n;
+	int c;
+	int i;
+
+	known = memory_map_value(written, &value);
+	n = memory_map_first_overlap(map, start);
+	if (n >= map->size) {
+		return 0;
+	}
+	c = memory_map_chunk_of(map, n);
+	i = n - map->chunk_first[c];
+	do {
+		memory = &(map->chunk[c]->memory[i]);
+		if (memory->start_address >= end) {
+			break;
+		}
+		memory_end = memory->start_address + memory->length;
+		if ((memory == written) || (memory_end <= start)) {
+			continue;
+		}
+		/* written's own chunk is not shared, so this does not move it */
+		if (memory_map_chunk_unshare(map, c)) {
+			return 1;
+		}
+		memory = &(map->chunk[c]->memory[i]);
+		if (known && (memory->start_address <= start) && (memory_end >= end) &&
+			memory_map_value(memory, &memory_value)) {
+			/* The written bytes are part of this entry */
+			shift = (start - memory->start_address) * 8;
+			mask = memory_map_mask(written->length) << shift;
+			memory->init_value = (memory_value & ~mask) | ((value << shift) & mask);
+			memory->offset_value = 0;
+		} else if (known && (memory->start_address >= start) && (memory_end <= end)) {
+			/* This entry is part of the written bytes */
+			shift = (memory->start_address - start) * 8;
+			memory->init_value_type = 1;
+			memory->init_value = (value >> shift) & memory_map_mask(memory->length);
+			memory->offset_value = 0;
+		} else {
+			memory->init_value_type = 0;
+		}
+		debug_print(DEBUG_EXE, 1, "memory_map_update_overlaps: entry 0x%"PRIx64" len %d now type %d value 0x%"PRIx64"\n",
+			memory->start_address, memory->length,
+			memory->init_value_type, memory->init_value);
+	} while (memory_map_next(map, &c, &i));
+	return 0;
+}
+
+/* Make dst a map with the same entries as src, sharing all their chunks.
+ * Only the list of chunks is copied. A chunk is copied when either map first changes it.
+ * dst is overwritten, so it must be empty or released.
+ */
+int memory_map_share(struct memory_map_s *dst, struct memory_map_s *src)
+{
+	int c;
+
+	memset(dst, 0, sizeof(struct memory_map_s));
+	if (src->chunks_size) {
+		dst->chunk = malloc(src->chunks_size * sizeof(struct memory_map_chunk_s *));
+		dst->chunk_first = malloc(src->chunks_size * sizeof(int));
+		if (!dst->chunk || !dst->chunk_first) {
+			free(dst->chunk);
+			free(dst->chunk_first);
+			memset(dst, 0, sizeof(struct memory_map_s));
+			return 1;
+		}
+		memcpy(dst->chunk, src->chunk, src->chunks_size * sizeof(struct memory_map_chunk_s *));
+		memcpy(dst->chunk_first, src->chunk_first, src->chunks_size * sizeof(int));
+		for (c = 0; c < src->chunks_size; c++) {
+			src->chunk[c]->refs++;
+		}
+	}
+	dst->size = src->size;
+	dst->max_length = src->max_length;
+	dst->chunks_size = src->chunks_size;
+	dst->chunks_max = src->chunks_size;
+	return 0;
+}
+
+/* Drop this map's entries, freeing each chunk no other map shares. */
+void memory_map_release(struct memory_map_s *map)
+{
+	int c;
+
+	for (c = 0; c < map->chunks_size; c++) {
+		map->chunk[c]->refs--;
+		if (!map->chunk[c]->refs) {
+			free(map->chunk[c]);
+		}
+	}
+	free(map->chunk);
+	free(map->chunk_first);
+	memset(map, 0, sizeof(struct memory_map_s));
+}
+
+/* Copy an entry from a path's map into the map of the whole function.
+ * A written entry replaces the one there. An entry only read is added if missing,
+ * so that a read on one path does not hide a write on another.
+ */
+int memory_map_record(struct memory_map_s *map, struct memory_s *entry, int written)
+{
+	struct memory_s *memory;
+
+	if (written) {
+		memory = memory_map_write(map, entry->start_address, entry->length * 8);
+	} else {
+		memory = memory_map_search(map, entry->start_address, entry->length * 8);
+		if (memory) {
+			return 0;
+		}
+	}
+	if (!memory) {
+		memory = memory_map_add(map, entry->start_address, entry->length * 8);
+	}
+	if (!memory) {
+		return 1;
+	}
+	*memory = *entry;
+	if (written) {
+		return memory_map_update_overlaps(map, memory);
+	}
+	return 0;
+}
+
+int memory_map_print(struct memory_map_s *map) {
+	struct memory_s *memory;
+	int n = 0;
+	int c;
+	int i;
+
+	for (c = 0; c < map->chunks_size; c++) {
+		for (i = 0; i < map->chunk[c]->size; i++) {
+			memory = &(map->chunk[c]->memory[i]);
+			debug_print(DEBUG_EXE, 1, "looping print 0x%x: start_address = 0x%"PRIx64", length = %d\n",
+				n, memory->start_address, memory->length);
+			n++;
+		}
+	}
+	debug_print(DEBUG_EXE, 1, "looping print 0x%x: finished\n", n);
+	return 0;
+}
+
 static int source_equals_dest(struct operand_s *srcA, struct operand_s *dstA)
 {
 	int ret;
@@ -196,15 +689,15 @@ static int get_value_RTL_instruction(
 	uint64_t data_index;
 	char *info = NULL;
 	//struct memory_s *memory_text;
-	struct memory_s *memory_stack;
+	struct memory_map_s *memory_stack;
 	struct memory_s *memory_reg;
-	struct memory_s *memory_data;
+	struct memory_map_s *memory_data;
 	//int *memory_used;
 
 	//memory_text = process_state->memory_text;
-	memory_stack = process_state->memory_stack;
+	memory_stack = process_state->live_stack;
 	memory_reg = process_state->memory_reg;
-	memory_data = process_state->memory_data;
+	memory_data = process_state->live_data;
 	//memory_used = process_state->memory_used;
 
 	if (info_id == 0) info = "srcA";
@@ -342,21 +835,32 @@ static int get_value_RTL_instruction(
 			return 1;
 			break;
 		}
-		value_data = search_store(memory_data,
+		value_data = memory_map_search(memory_data,
 				data_index,
 				source->value_size);
 		debug_print(DEBUG_EXE, 1, "EXE2 value_data=%p, %p\n", value_data, &value_data);
 		if (!value_data) {
-			value_data = add_new_store(memory_data,
+			value_data = memory_map_add(memory_data,
 				data_index,
 				source->value_size);
-			value_data->init_value = read_data(self, data_index, 32); 
+			if (!value_data) {
+				debug_print(DEBUG_EXE, 1, "GET CASE2:STORE_REG2 ERROR!\n");
+				return 1;
+			}
+			/* Unless part of a value already stored, start with the file contents */
+			if (!value_data->init_value_type) {
+				value_data->init_value = read_data(self, data_index, 32);
+			}
 			debug_print(DEBUG_EXE, 1, "EXE3 value_data=%p, %p\n", value_data, &value_data);
 			debug_print(DEBUG_EXE, 1, "EXE3 value_data->init_value=%"PRIx64"\n", value_data->init_value);
 			/* Data */
 			value_data->value_scope = 3;
 			/* Param number */
 			value_data->value_id = 0;
+			if (memory_map_record(process_state->memory_data, value_data, 0)) {
+				debug_print(DEBUG_EXE, 1, "GET CASE2:STORE_REG2 record ERROR!\n");
+				return 1;
+			}
 		}
 		debug_print(DEBUG_EXE, 1, "variable on data:0x%"PRIx64"\n",
 			data_index);
@@ -416,17 +920,21 @@ static int get_value_RTL_instruction(
 			return 1;
 			break;
 		}
-		value_stack = search_store(memory_stack,
+		value_stack = memory_map_search(memory_stack,
 				value->init_value +
 					value->offset_value,
 					source->value_size);
 		debug_print(DEBUG_EXE, 1, "EXE2 value_stack=%p, %p\n", value_stack, &value_stack);
 		if (!value_stack) {
-			value_stack = add_new_store(memory_stack,
+			value_stack = memory_map_add(memory_stack,
 				value->init_value +
 					value->offset_value,
 					source->value_size);
 			debug_print(DEBUG_EXE, 1, "EXE3 value_stack=%p, %p\n", value_stack, &value_stack);
+			if (!value_stack) {
+				debug_print(DEBUG_EXE, 1, "GET CASE2:STORE_REG2 ERROR!\n");
+				return 1;
+			}
 			/* Only do this init on new stores */
 			/* FIXME: 0x10000 should be a global variable */
 			/* because it should match the ESP entry value */
@@ -444,6 +952,10 @@ static int get_value_RTL_instruction(
 				/* Local number */
 				value_stack->value_id = 0;
 			}
+			if (memory_map_record(process_state->memory_stack, value_stack, 0)) {
+				debug_print(DEBUG_EXE, 1, "GET CASE2:STORE_REG2 record ERROR!\n");
+				return 1;
+			}
 /* Section ends */
 		}
 		debug_print(DEBUG_EXE, 1, "variable on stack:0x%"PRIx64"\n",
@@ -486,7 +998,7 @@ static int get_value_RTL_instruction(
 		return 1;
 	}
 	print_store(memory_reg);
-	print_store(memory_stack);
+	memory_map_print(memory_stack);
 	return 0;
 }
 
@@ -502,16 +1014,16 @@ static int put_value_RTL_instruction(
 	struct memory_s *value_stack;
 	uint64_t data_index;
 	//struct memory_s *memory_text;
-	struct memory_s *memory_stack;
+	struct memory_map_s *memory_stack;
 	struct memory_s *memory_reg;
-	struct memory_s *memory_data;
+	struct memory_map_s *memory_data;
 	//int *memory_used;
 	int result = 1;
 
 	//memory_text = process_state->memory_text;
-	memory_stack = process_state->memory_stack;
+	memory_stack = process_state->live_stack;
 	memory_reg = process_state->memory_reg;
-	memory_data = process_state->memory_data;
+	memory_data = process_state->live_data;
 	//memory_used = process_state->memory_used;
 
 	/* Put result in dstA */
@@ -654,12 +1166,12 @@ static int put_value_RTL_instruction(
 			goto exit_put_value;
 			break;
 		}
-		value_data = search_store(memory_data,
+		value_data = memory_map_write(memory_data,
 				data_index,
 				instruction->dstA.value_size);
 		debug_print(DEBUG_EXE, 1, "EXE2 value_data=%p\n", value_data);
 		if (!value_data) {
-			value_data = add_new_store(memory_data,
+			value_data = memory_map_add(memory_data,
 				data_index,
 				instruction->dstA.value_size);
 		}
@@ -693,6 +1205,16 @@ static int put_value_RTL_instruction(
 			value_data->value_id);
 		/* 1 - Entry Used */
 		value_data->valid = 1;
+		if (memory_map_update_overlaps(memory_data, value_data)) {
+			debug_print(DEBUG_EXE, 1, "PUT CASE2:STORE_REG2 ERROR!\n");
+			result = 1;
+			goto exit_put_value;
+		}
+		if (memory_map_record(process_state->memory_data, value_data, 1)) {
+			debug_print(DEBUG_EXE, 1, "PUT CASE2:STORE_REG2 record ERROR!\n");
+			result = 1;
+			goto exit_put_value;
+		}
 		debug_print(DEBUG_EXE, 1, "value_data=0x%"PRIx64"+0x%"PRIx64"=0x%"PRIx64"\n",
 			value_data->init_value,
 			value_data->offset_value,
@@ -709,7 +1231,6 @@ static int put_value_RTL_instruction(
 		value = search_store(memory_reg,
 				instruction->dstA.index,
 				instruction->dstA.indirect_size);
-		debug_print(DEBUG_EXE, 1, "dstA reg 0x%"PRIx64" value = 0x%"PRIx64" + 0x%"PRIx64"\n", instruction->dstA.index, value->init_value, value->offset_value);
 		/* FIXME what to do in NULL */
 		if (!value) {
 			value = add_new_store(memory_reg,
@@ -722,19 +1243,20 @@ static int put_value_RTL_instruction(
 			goto exit_put_value;
 			break;
 		}
+		debug_print(DEBUG_EXE, 1, "dstA reg 0x%"PRIx64" value = 0x%"PRIx64" + 0x%"PRIx64"\n", instruction->dstA.index, value->init_value, value->offset_value);
 		if (value->start_address != instruction->dstA.index) {
 			debug_print(DEBUG_EXE, 1, "STORE failure\n");
 			result = 1;
 			goto exit_put_value;
 			break;
 		}
-		value_stack = search_store(memory_stack,
+		value_stack = memory_map_write(memory_stack,
 				value->init_value +
 					value->offset_value,
 					instruction->dstA.value_size);
 		debug_print(DEBUG_EXE, 1, "EXE2 value_stack=%p\n", value_stack);
 		if (!value_stack) {
-			value_stack = add_new_store(memory_stack,
+			value_stack = memory_map_add(memory_stack,
 				value->init_value +
 					value->offset_value,
 					instruction->dstA.value_size);
@@ -763,6 +1285,16 @@ static int put_value_RTL_instruction(
 			value_stack->value_id);
 		/* 1 - Entry Used */
 		value_stack->valid = 1;
+		if (memory_map_update_overlaps(memory_stack, value_stack)) {
+			debug_print(DEBUG_EXE, 1, "PUT CASE2:STORE_REG2 ERROR!\n");
+			result = 1;
+			goto exit_put_value;
+		}
+		if (memory_map_record(process_state->memory_stack, value_stack, 1)) {
+			debug_print(DEBUG_EXE, 1, "PUT CASE2:STORE_REG2 record ERROR!\n");
+			result = 1;
+			goto exit_put_value;
+		}
 		debug_print(DEBUG_EXE, 1, "value_stack=0x%"PRIx64"+0x%"PRIx64"=0x%"PRIx64"\n",
 			value_stack->init_value,
 			value_stack->offset_value,
@@ -778,7 +1310,7 @@ static int put_value_RTL_instruction(
 
 exit_put_value:
 	print_store(memory_reg);
-	print_store(memory_stack);
+	memory_map_print(memory_stack);
 	return result;
 }
 
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2004-2012  The libbeauty Team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Machine state snapshots for the entry_point worklist.
+ * When process_block() reaches an IF or a JMPT it takes a snapshot, and each
+ * target added to the worklist holds a reference to it. When the target is
+ * popped, the registers, stack and data are restored from the snapshot, so
+ * each path resumes from the state it branched with, whatever order the
+ * worklist is processed in.
+ * The register file is small and fixed in size, so it is copied. The stack
+ * and data maps grow with the function, so the snapshot shares their entries
+ * with the live maps and whichever is written first makes its own copy.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rev.h>
+
+/* Returns a snapshot with a refcount of 1, or NULL on error. */
+struct machine_state_s *machine_state_snapshot(struct process_state_s *process_state)
+{
+	struct machine_state_s *state;
+
+	state = calloc(1, sizeof(struct machine_state_s));
+	if (!state) {
+		return NULL;
+	}
+	state->refcount = 1;
+	state->memory_reg = malloc(MEMORY_REG_SIZE * sizeof(struct memory_s));
+	if (!state->memory_reg) {
+		free(state);
+		return NULL;
+	}
+	memcpy(state->memory_reg, process_state->memory_reg, MEMORY_REG_SIZE * sizeof(struct memory_s));
+	if (memory_map_share(&(state->memory_stack), process_state->live_stack) ||
+		memory_map_share(&(state->memory_data), process_state->live_data)) {
+		memory_map_release(&(state->memory_stack));
+		free(state->memory_reg);
+		free(state);
+		return NULL;
+	}
+	return state;
+}
+
+/* Make the live state of process_state equal to the snapshot. */
+int machine_state_restore(struct process_state_s *process_state, struct machine_state_s *state)
+{
+	struct memory_map_s memory_stack;
+	struct memory_map_s memory_data;
+
+	if (memory_map_share(&memory_stack, &(state->memory_stack))) {
+		return 1;
+	}
+	if (memory_map_share(&memory_data, &(state->memory_data))) {
+		memory_map_release(&memory_stack);
+		return 1;
+	}
+	memcpy(process_state->memory_reg, state->memory_reg, MEMORY_REG_SIZE * sizeof(struct memory_s));
+	memory_map_release(process_state->live_stack);
+	memory_map_release(process_state->live_data);
+	*(process_state->live_stack) = memory_stack;
+	*(process_state->live_data) = memory_data;
+	return 0;
+}
+
+void machine_state_ref(struct machine_state_s *state)
+{
+	state->refcount++;
+}
+
+void machine_state_release(struct machine_state_s *state)
+{
+	if (!state) {
+		return;
+	}
+	state->refcount--;
+	if (state->refcount > 0) {
+		return;
+	}
+	memory_map_release(&(state->memory_stack));
+	memory_map_release(&(state->memory_data));
+	free(state->memory_reg);
+	free(state);
+}
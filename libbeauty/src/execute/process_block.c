@@ -70,12 +70,60 @@ int search_for_jump_table_base(struct self_s *self, uint64_t inst_log, uint64_t
 	return 1;
 }
 
+/* Link inst_log_prev to inst_this, an instruction already in the log,
+ * as the branch from inst_log_prev arrives at code that has already been run. */
+int process_block_link(struct self_s *self, uint64_t inst_log_prev, int inst_this)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_exe_prev;
+	struct inst_log_entry_s *inst_exe;
+	int found;
+	int l;
+
+	inst_exe_prev = &inst_log_entry[inst_log_prev];
+	inst_exe = &inst_log_entry[inst_this];
+	debug_print(DEBUG_EXE, 1, "inst_exe_prev=%p, inst_exe=%p\n",
+		inst_exe_prev, inst_exe);
+	inst_exe->prev_size++;
+	if (inst_exe->prev_size == 1) {
+		inst_exe->prev = malloc(sizeof(inst_exe->prev));
+	} else {
+		inst_exe->prev = realloc(inst_exe->prev, sizeof(inst_exe->prev) * inst_exe->prev_size);
+	}
+	inst_exe->prev[inst_exe->prev_size - 1] = inst_log_prev;
+	if (inst_exe_prev->next_size > 0) {
+		debug_print(DEBUG_EXE, 1, "JCD8a: next_size = 0x%x\n", inst_exe_prev->next_size);
+	}
+	if (inst_exe_prev->next_size == 0) {
+		inst_exe_prev->next_size++;
+		inst_exe_prev->next = malloc(sizeof(inst_exe_prev->next));
+		inst_exe_prev->next[inst_exe_prev->next_size - 1] = inst_this;
+	} else {
+		found = 0;
+		for (l = 0; l < inst_exe_prev->next_size; l++) {
+			if (inst_exe_prev->next[l] == inst_this) {
+				found = 1;
+				break;
+			}
+		}
+		if (!found) {
+			inst_exe_prev->next_size++;
+			if (inst_exe_prev->next_size > 2) {
+				debug_print(DEBUG_EXE, 1, "process_block: next_size = %d, inst = 0x%x\n", inst_exe_prev->next_size, inst_this);
+			}
+			inst_exe_prev->next = realloc(inst_exe_prev->next, sizeof(inst_exe_prev->next) * inst_exe_prev->next_size);
+			inst_exe_prev->next[inst_exe_prev->next_size - 1] = inst_this;
+		}
+	}
+	return 0;
+}
+
 int process_block(struct self_s *self, struct process_state_s *process_state, uint64_t inst_log_prev, uint64_t eip_offset_limit) {
 	uint64_t offset = 0;
 	int result;
-	int n, m, l;
+	int n;
 	int err;
-	int found;
+	int tmp;
 	struct inst_log_entry_s *inst_exe_prev;
 	struct inst_log_entry_s *inst_exe;
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
@@ -87,9 +135,8 @@ int process_block(struct self_s *self, struct process_state_s *process_state, ui
 	struct memory_s *memory_reg;
 	//struct memory_s *memory_data;
 	struct dis_instructions_s dis_instructions;
+	struct machine_state_s *state;
 	int *memory_used;
-	struct entry_point_s *entry = self->entry_point;
-	uint64_t list_length = self->entry_point_list_length;
 	void *handle_void = self->handle_void;
 
 	//memory_text = process_state->memory_text;
@@ -140,41 +187,7 @@ int process_block(struct self_s *self, struct process_state_s *process_state, ui
 			/* But I need to separate the instruction flows */
 			/* A jump/branch inst should create a new instruction tree */
 			debug_print(DEBUG_EXE, 1, "Memory already used\n");
-			inst_exe_prev = &inst_log_entry[inst_log_prev];
-			inst_exe = &inst_log_entry[inst_this];
-			debug_print(DEBUG_EXE, 1, "inst_exe_prev=%p, inst_exe=%p\n",
-				inst_exe_prev, inst_exe);
-			inst_exe->prev_size++;
-			if (inst_exe->prev_size == 1) {
-				inst_exe->prev = malloc(sizeof(inst_exe->prev));
-			} else {
-				inst_exe->prev = realloc(inst_exe->prev, sizeof(inst_exe->prev) * inst_exe->prev_size);
-			}
-			inst_exe->prev[inst_exe->prev_size - 1] = inst_log_prev;
-			if (inst_exe_prev->next_size > 0) {
-				debug_print(DEBUG_EXE, 1, "JCD8a: next_size = 0x%x\n", inst_exe_prev->next_size);
-			}
-			if (inst_exe_prev->next_size == 0) {
-				inst_exe_prev->next_size++;
-				inst_exe_prev->next = malloc(sizeof(inst_exe_prev->next));
-				inst_exe_prev->next[inst_exe_prev->next_size - 1] = inst_this;
-			} else {
-				found = 0;
-				for (l = 0; l < inst_exe_prev->next_size; l++) {
-					if (inst_exe_prev->next[inst_exe_prev->next_size - 1] == inst_this) {
-						found = 1;
-						break;
-					}
-				}
-				if (!found) {
-					inst_exe_prev->next_size++;
-					if (inst_exe_prev->next_size > 2) {
-						debug_print(DEBUG_EXE, 1, "process_block: next_size = %d, inst = 0x%x\n", inst_exe_prev->next_size, inst_this);
-					}
-					inst_exe_prev->next = realloc(inst_exe_prev->next, sizeof(inst_exe_prev->next) * inst_exe_prev->next_size);
-					inst_exe_prev->next[inst_exe_prev->next_size - 1] = inst_this;
-				}
-			}
+			process_block_link(self, inst_log_prev, inst_this);
 			break;
 		}	
 		//debug_print(DEBUG_EXE, 1, "disassemble_fn\n");
@@ -257,35 +270,32 @@ int process_block(struct self_s *self, struct process_state_s *process_state, ui
 					inst_exe->value3.offset_value);
 				debug_print(DEBUG_EXE, 1, "IF: inst_log = %"PRId64"\n",
 					inst_log);
-				for (m = 0; m < list_length; m++ ) {
-					if (0 == entry[m].used) {
-						entry[m].esp_init_value = memory_reg[0].init_value;
-						entry[m].esp_offset_value = memory_reg[0].offset_value;
-						entry[m].ebp_init_value = memory_reg[1].init_value;
-						entry[m].ebp_offset_value = memory_reg[1].offset_value;
-						entry[m].eip_init_value = memory_reg[2].init_value;
-						entry[m].eip_offset_value = memory_reg[2].offset_value;
-						entry[m].previous_instuction = inst_log;
-						entry[m].used = 1;
-						debug_print(DEBUG_EXE, 1, "JCD:8 used 1\n");
-						
-						break;
-					}
+				/* Both paths resume from the state at the IF */
+				state = machine_state_snapshot(process_state);
+				if (!state) {
+					debug_print(DEBUG_EXE, 1, "IF: machine_state_snapshot failed\n");
+					return 1;
 				}
-				/* FIXME: Would starting a "m" be better here? */
-				for (m = 0; m < list_length; m++ ) {
-					if (0 == entry[m].used) {
-						entry[m].esp_init_value = memory_reg[0].init_value;
-						entry[m].esp_offset_value = memory_reg[0].offset_value;
-						entry[m].ebp_init_value = memory_reg[1].init_value;
-						entry[m].ebp_offset_value = memory_reg[1].offset_value;
-						entry[m].eip_init_value = inst_exe->value3.init_value;
-						entry[m].eip_offset_value = inst_exe->value3.offset_value;
-						entry[m].previous_instuction = inst_log;
-						entry[m].used = 1;
-						debug_print(DEBUG_EXE, 1, "JCD:8 used 2\n");
-						break;
-					}
+				/* The fall through path, then the jump path */
+				tmp = entry_point_add(self,
+					memory_reg[0].init_value, memory_reg[0].offset_value,
+					memory_reg[1].init_value, memory_reg[1].offset_value,
+					memory_reg[2].init_value, memory_reg[2].offset_value,
+					inst_log, state);
+				if (1 == tmp) {
+					debug_print(DEBUG_EXE, 1, "IF: entry_point_add failed\n");
+					machine_state_release(state);
+					return 1;
+				}
+				tmp = entry_point_add(self,
+					memory_reg[0].init_value, memory_reg[0].offset_value,
+					memory_reg[1].init_value, memory_reg[1].offset_value,
+					inst_exe->value3.init_value, inst_exe->value3.offset_value,
+					inst_log, state);
+				machine_state_release(state);
+				if (1 == tmp) {
+					debug_print(DEBUG_EXE, 1, "IF: entry_point_add failed\n");
+					return 1;
 				}
 			}
 			if (JMPT == instruction->opcode) {
@@ -310,6 +320,12 @@ int process_block(struct self_s *self, struct process_state_s *process_state, ui
 				if (2 == instruction->srcA.relocated_area) {
 					uint64_t index = instruction->srcA.relocated_index;
 					tmp = 0;
+					/* Every case resumes from the state at the JMPT */
+					state = machine_state_snapshot(process_state);
+					if (!state) {
+						debug_print(DEBUG_EXE, 1, "JMPT: machine_state_snapshot failed\n");
+						return 1;
+					}
 					
 					do {
 						tmp = bf_find_relocation_rodata(handle_void, index, &relocation_area, &relocation_index);
@@ -318,25 +334,23 @@ int process_block(struct self_s *self, struct process_state_s *process_state, ui
 								debug_print(DEBUG_EXE, 1, "JMPT Relocation area not to code\n");
 								exit(1);
 							}
-							for (m = 0; m < list_length; m++ ) {
-								if (0 == entry[m].used) {
-									entry[m].esp_init_value = memory_reg[0].init_value;
-									entry[m].esp_offset_value = memory_reg[0].offset_value;
-									entry[m].ebp_init_value = memory_reg[1].init_value;
-									entry[m].ebp_offset_value = memory_reg[1].offset_value;
-									entry[m].eip_init_value = 0;
-									entry[m].eip_offset_value = relocation_index;
-									entry[m].previous_instuction = inst_log;
-									entry[m].used = 1;
-									debug_print(DEBUG_EXE, 1, "JMPT new entry \n");
-									break;
-								}
+							tmp = entry_point_add(self,
+								memory_reg[0].init_value, memory_reg[0].offset_value,
+								memory_reg[1].init_value, memory_reg[1].offset_value,
+								0, relocation_index,
+								inst_log, state);
+							if (1 == tmp) {
+								debug_print(DEBUG_EXE, 1, "JMPT: entry_point_add failed\n");
+								machine_state_release(state);
+								return 1;
 							}
+							debug_print(DEBUG_EXE, 1, "JMPT new entry \n");
 						} else {
 							debug_print(DEBUG_EXE, 1, "JMPT index, 0x%"PRIx64", not found in rodata relocation table\n", index);
 						}
 						index += 8;
 					} while (!tmp);
+					machine_state_release(state);
 				}
 			}
 			inst_log_prev = inst_log;
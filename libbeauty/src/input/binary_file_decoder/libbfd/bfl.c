@@ -227,6 +227,34 @@ int bf_get_reloc_table_size_code_section(void *handle_void, uint64_t *size)
 	return 1;
 }
 
+/* The relocation tables read by bf_get_reloc_table_*_section(). Used to build the cache keys. */
+int bf_get_reloc_table_code(void *handle_void, struct reloc_table_s **reloc_table, uint64_t *reloc_table_size)
+{
+	struct rev_eng *handle = (struct rev_eng*) handle_void;
+
+	*reloc_table = handle->reloc_table_code;
+	*reloc_table_size = handle->reloc_table_code_sz;
+	return 0;
+}
+
+int bf_get_reloc_table_data(void *handle_void, struct reloc_table_s **reloc_table, uint64_t *reloc_table_size)
+{
+	struct rev_eng *handle = (struct rev_eng*) handle_void;
+
+	*reloc_table = handle->reloc_table_data;
+	*reloc_table_size = handle->reloc_table_data_sz;
+	return 0;
+}
+
+int bf_get_reloc_table_rodata(void *handle_void, struct reloc_table_s **reloc_table, uint64_t *reloc_table_size)
+{
+	struct rev_eng *handle = (struct rev_eng*) handle_void;
+
+	*reloc_table = handle->reloc_table_rodata;
+	*reloc_table_size = handle->reloc_table_rodata_sz;
+	return 0;
+}
+
 uint32_t bf_relocated_code(void *handle_void, uint8_t *base_address, uint64_t offset, uint64_t size, struct reloc_table_s **reloc_table_entry)
 {
 	int n;
@@ -21,6 +21,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <rev.h>
 
 extern int reg_params_order[];
@@ -44,7 +47,7 @@ const char *condition_table[] = {
 	"GREATER_15"	/* Signed */
 };
 
-int label_to_string(struct label_s *label, char *string, int size) {
+static int label_format(struct label_s *label, char *string, int size) {
 	int tmp;
 	int offset = 0;
 
@@ -175,6 +178,122 @@ int label_to_string(struct label_s *label, char *string, int size) {
 	return 0;
 }
 
+/* Label names only depend on scope, type and value.
+ * Each name is built once and kept in this table for the rest of the run. */
+struct label_name_s {
+	uint64_t scope;
+	uint64_t type;
+	uint64_t value;
+	char *name;
+};
+
+static struct label_name_s *label_name_table = NULL;
+static int label_name_table_size = 0; /* Always a power of 2 */
+static int label_name_table_used = 0;
+/* The LLVM export can name labels from several threads at once */
+static pthread_mutex_t label_name_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int label_name_hash(uint64_t scope, uint64_t type, uint64_t value)
+{
+	uint64_t hash;
+
+	hash = (value * 0x9e3779b97f4a7c15ULL) ^ (type << 8) ^ (scope << 16);
+	hash ^= hash >> 29;
+	return (int)(hash & (label_name_table_size - 1));
+}
+
+static int label_name_table_grow(void)
+{
+	struct label_name_s *old_table = label_name_table;
+	int old_size = label_name_table_size;
+	int n;
+	int slot;
+
+	label_name_table_size = old_size ? old_size * 2 : 1024;
+	label_name_table = calloc(label_name_table_size, sizeof(struct label_name_s));
+	if (!label_name_table) {
+		label_name_table = old_table;
+		label_name_table_size = old_size;
+		return 1;
+	}
+	for (n = 0; n < old_size; n++) {
+		if (!old_table[n].name) {
+			continue;
+		}
+		slot = label_name_hash(old_table[n].scope, old_table[n].type, old_table[n].value);
+		while (label_name_table[slot].name) {
+			slot = (slot + 1) & (label_name_table_size - 1);
+		}
+		label_name_table[slot] = old_table[n];
+	}
+	free(old_table);
+	return 0;
+}
+
+static const char *label_to_name_locked(struct label_s *label)
+{
+	char buffer[1024];
+	int slot;
+	int tmp;
+
+	if ((label_name_table_used * 2) >= label_name_table_size) {
+		tmp = label_name_table_grow();
+		if (tmp) {
+			return NULL;
+		}
+	}
+	slot = label_name_hash(label->scope, label->type, label->value);
+	while (label_name_table[slot].name) {
+		if ((label_name_table[slot].scope == label->scope) &&
+			(label_name_table[slot].type == label->type) &&
+			(label_name_table[slot].value == label->value)) {
+			return label_name_table[slot].name;
+		}
+		slot = (slot + 1) & (label_name_table_size - 1);
+	}
+	tmp = label_format(label, buffer, 1023);
+	if (tmp) {
+		return NULL;
+	}
+	label_name_table[slot].scope = label->scope;
+	label_name_table[slot].type = label->type;
+	label_name_table[slot].value = label->value;
+	label_name_table[slot].name = strdup(buffer);
+	if (!label_name_table[slot].name) {
+		return NULL;
+	}
+	label_name_table_used++;
+	return label_name_table[slot].name;
+}
+
+/* Returns the name of the label. The string is shared and must not be freed or changed.
+ * Returns NULL if the label cannot be named. */
+const char *label_to_name(struct label_s *label)
+{
+	const char *name;
+
+	pthread_mutex_lock(&label_name_lock);
+	name = label_to_name_locked(label);
+	pthread_mutex_unlock(&label_name_lock);
+	return name;
+}
+
+int label_to_string(struct label_s *label, char *string, int size) {
+	const char *name;
+	int length;
+
+	name = label_to_name(label);
+	if (!name) {
+		return 1;
+	}
+	length = strlen(name);
+	if (length >= size) {
+		return 1;
+	}
+	memcpy(string, name, length + 1);
+	return 0;
+}
+
 int output_label_redirect(int offset, struct label_s *labels, struct label_redirect_s *label_redirect, FILE *fd) {
 	int tmp;
 	struct label_s *label;
@@ -5,17 +5,31 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <string>
 #include <sstream>
 #include <global_struct.h>
 #include <output.h>
+extern "C" {
+#include <cache.h>
+void function_arena_free(struct self_s *self, struct external_entry_point_s *external_entry_point);
+}
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Linker.h"
+#include "llvm/PassManager.h"
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/Transforms/Scalar.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
 using namespace llvm;
 
@@ -23,14 +37,57 @@ class LLVM_ir_export
 {
 	public:
 		int find_function_member_node(struct self_s *self, struct external_entry_point_s *external_entry_point, int node_to_find, int *member_node);
-		int add_instruction(struct self_s *self, Value **value, BasicBlock *bb, int external_entry, int inst);
-		int add_node_instructions(struct self_s *self, Value **value, BasicBlock *bb, int node, int external_entry);
+		int add_instruction(struct self_s *self, Module *M, Value **value, BasicBlock *bb, int external_entry, int inst);
+		int add_node_instructions(struct self_s *self, Module *M, Value **value, BasicBlock *bb, int node, int external_entry);
+		Value *add_condition(struct self_s *self, Value **value, BasicBlock *bb, int external_entry, int inst);
+		int add_node_terminator(struct self_s *self, Value **value, BasicBlock **bb, int node, int external_entry);
 		int fill_value(struct self_s *self, Value **value, int value_id, int external_entry);
-		int output(struct self_s *self);
+		Function *get_function(struct self_s *self, Module *M, int external_entry, std::vector<Type*> *call_args);
+		int add_function_body(struct self_s *self, Module *M, int external_entry);
+		Module *new_module(const char *name);
+		int optimise_module(struct self_s *self, Module *M);
+		int write_module(Module *M, const char *filename);
+		int output_function(struct self_s *self, int external_entry, std::string *bitcode);
+		int link_modules(struct self_s *self, std::string *bitcode, const char *module_name, const char *filename);
+		int module_start(const char *name);
+		int module_add(struct self_s *self, int external_entry);
+		int module_finish(struct self_s *self, const char *filename);
+		LLVM_ir_export() : functions(NULL), module(NULL) {}
+		~LLVM_ir_export() { free(functions); delete module; }
 	private:
 		LLVMContext Context;
+		/* The Function for each external_entry_point in the current Module */
+		Function **functions;
+		/* The Module that module_add() adds to */
+		Module *module;
 };
 
+/* Cached functions have no nodes, but their params are known so callers can declare them */
+static int is_exported(struct external_entry_point_s *external_entry_point)
+{
+	return ((external_entry_point->valid != 0) &&
+		(external_entry_point->type == 1) &&
+		(external_entry_point->nodes_size || external_entry_point->cached));
+}
+
+static int write_bitcode_file(const char *filename, const char *bitcode, size_t bitcode_size)
+{
+	FILE *fd;
+	int tmp = 0;
+
+	fd = fopen(filename, "wb");
+	if (!fd) {
+		return -1;
+	}
+	if (bitcode_size && (fwrite(bitcode, bitcode_size, 1, fd) != 1)) {
+		tmp = -1;
+	}
+	if (fclose(fd)) {
+		tmp = -1;
+	}
+	return tmp;
+}
+
 int LLVM_ir_export::find_function_member_node(struct self_s *self, struct external_entry_point_s *external_entry_point, int node_to_find, int *member_node)
 {
 	int found = 1;
@@ -47,7 +104,7 @@ int LLVM_ir_export::find_function_member_node(struct self_s *self, struct extern
 	return found;
 }
 
-int LLVM_ir_export::add_instruction(struct self_s *self, Value **value, BasicBlock *bb, int external_entry, int inst)
+int LLVM_ir_export::add_instruction(struct self_s *self, Module *M, Value **value, BasicBlock *bb, int external_entry, int inst)
 {
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
 	struct inst_log_entry_s *inst_log1 = &inst_log_entry[inst];
@@ -57,7 +114,7 @@ int LLVM_ir_export::add_instruction(struct self_s *self, Value **value, BasicBlo
 	Value *dstA;
 	int value_id;
 	int tmp;
-	char buffer[1024];
+	const char *name;
 
 	switch (inst_log1->instruction.opcode) {
 	case 1:  // MOV
@@ -109,10 +166,60 @@ int LLVM_ir_export::add_instruction(struct self_s *self, Value **value, BasicBlo
 		}
 		srcB = value[value_id];
 		printf("srcA = %p, srcB = %p\n", srcA, srcB);
-		tmp = label_to_string(&external_entry_point->labels[inst_log1->value3.value_id], buffer, 1023);
-		dstA = BinaryOperator::CreateAdd(srcA, srcB, buffer, bb);
+		name = label_to_name(&external_entry_point->labels[inst_log1->value3.value_id]);
+		dstA = BinaryOperator::CreateAdd(srcA, srcB, name ? name : "", bb);
 		value[inst_log1->value3.value_id] = dstA;
 		break;
+	case 0x12:  // CALL
+		printf("LLVM 0x%x: OPCODE = 0x%x:CALL\n", inst, inst_log1->instruction.opcode);
+		if ((inst_log1->instruction.srcA.relocated == 1) &&
+			(inst_log1->instruction.srcA.indirect == 0) &&  /* IND_DIRECT */
+			(inst_log1->extension) &&
+			(inst_log1->instruction.srcA.index < EXTERNAL_ENTRY_POINTS_MAX)) {
+			struct extension_call_s *call = (struct extension_call_s *)inst_log1->extension;
+			int callee = inst_log1->instruction.srcA.index;
+			std::vector<Value*> call_args;
+			std::vector<Type*> call_args_type;
+			Function *F;
+			int n;
+
+			if (!self->external_entry_points[callee].valid) {
+				printf("LLVM CALL: callee 0x%x not valid. Not yet handled.\n", callee);
+				break;
+			}
+			for (n = 0; n < call->params_size; n++) {
+				value_id = external_entry_point->label_redirect[call->params[n]].redirect;
+				if (!value[value_id]) {
+					tmp = LLVM_ir_export::fill_value(self, value, value_id, external_entry);
+					if (tmp) {
+						printf("LLVM CALL: param value_id = 0x%x not available. Not yet handled.\n", value_id);
+						break;
+					}
+				}
+				call_args.push_back(value[value_id]);
+				call_args_type.push_back(value[value_id]->getType());
+			}
+			if (n < call->params_size) {
+				break;
+			}
+			F = get_function(self, M, callee, &call_args_type);
+			if (!F) {
+				break;
+			}
+			if (F->getFunctionType()->getNumParams() != call_args.size()) {
+				printf("LLVM CALL: %s takes %d params, call has %d. Not yet handled.\n",
+					self->external_entry_points[callee].name,
+					F->getFunctionType()->getNumParams(),
+					(int)call_args.size());
+				break;
+			}
+			name = label_to_name(&external_entry_point->labels[inst_log1->value3.value_id]);
+			dstA = CallInst::Create(F, call_args, name ? name : "", bb);
+			value[inst_log1->value3.value_id] = dstA;
+		} else {
+			printf("LLVM 0x%x: indirect CALL. Not yet handled.\n", inst);
+		}
+		break;
 	case 0x1e:  // RET
 		printf("LLVM 0x%x: OPCODE = 0x%x:RET\n", inst, inst_log1->instruction.opcode);
 		value_id = external_entry_point->label_redirect[inst_log1->value1.value_id].redirect;
@@ -134,13 +241,11 @@ int LLVM_ir_export::add_instruction(struct self_s *self, Value **value, BasicBlo
 	return 0;
 } 
 
-int LLVM_ir_export::add_node_instructions(struct self_s *self, Value** value, BasicBlock *bb, int node, int external_entry) 
+int LLVM_ir_export::add_node_instructions(struct self_s *self, Module *M, Value** value, BasicBlock *bb, int node, int external_entry) 
 {
 	struct inst_log_entry_s *inst_log1;
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
-	struct control_flow_node_s *nodes = self->nodes;
-	int nodes_size = self->nodes_size;
-	int l,m,n;
+	struct control_flow_node_s *nodes = self->external_entry_points[external_entry].nodes;
 	int inst;
 	int inst_next;
 
@@ -151,7 +256,7 @@ int LLVM_ir_export::add_node_instructions(struct self_s *self, Value** value, Ba
 	do {
 		inst = inst_next;
 		inst_log1 =  &inst_log_entry[inst];
-		add_instruction(self, value, bb, external_entry, inst);
+		add_instruction(self, M, value, bb, external_entry, inst);
 		if (inst_log1->next_size > 0) {
 			inst_next = inst_log1->next[0];
 		}
@@ -160,6 +265,157 @@ int LLVM_ir_export::add_node_instructions(struct self_s *self, Value** value, Ba
 	return 0;
 }
 
+/* Build the i1 condition of the IF at inst, from the instruction that set the flags.
+ * Returns NULL if the condition is not handled yet. */
+Value *LLVM_ir_export::add_condition(struct self_s *self, Value **value, BasicBlock *bb, int external_entry, int inst)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1 = &inst_log_entry[inst];
+	struct inst_log_entry_s *inst_log1_flags = NULL;
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
+	CmpInst::Predicate predicate;
+	Value *lhs;
+	Value *rhs;
+	int value_id[2];
+	int limit = 30; /* Limit the scan backwards, as output_label.c does */
+	int l;
+	int n;
+
+	l = (inst_log1->prev_size > 0) ? inst_log1->prev[0] : 0;
+	while ((l != 0) && (limit > 0)) {
+		if (inst_log_entry[l].instruction.flags == 1) {
+			inst_log1_flags = &inst_log_entry[l];
+			break;
+		}
+		l = (inst_log_entry[l].prev_size > 0) ? inst_log_entry[l].prev[0] : 0;
+		limit--;
+	}
+	if (!inst_log1_flags ||
+		(inst_log1_flags->instruction.srcA.indirect != 0) ||  /* IND_DIRECT */
+		(inst_log1_flags->instruction.srcB.indirect != 0)) {
+		printf("LLVM 0x%x: IF flags not found or not direct. Not yet handled.\n", inst);
+		return NULL;
+	}
+	switch (inst_log1->instruction.srcA.index) {
+	case 5:  // EQUAL
+		predicate = CmpInst::ICMP_EQ;
+		break;
+	case 6:  // NOT_EQUAL
+		predicate = CmpInst::ICMP_NE;
+		break;
+	case 3:  // BELOW
+		predicate = CmpInst::ICMP_ULT;
+		break;
+	case 4:  // NOT_BELOW
+		predicate = CmpInst::ICMP_UGE;
+		break;
+	case 7:  // BELOW_EQUAL
+		predicate = CmpInst::ICMP_ULE;
+		break;
+	case 8:  // ABOVE
+		predicate = CmpInst::ICMP_UGT;
+		break;
+	case 13:  // LESS
+		predicate = CmpInst::ICMP_SLT;
+		break;
+	case 14:  // GREATER_EQUAL
+		predicate = CmpInst::ICMP_SGE;
+		break;
+	case 15:  // LESS_EQUAL
+		predicate = CmpInst::ICMP_SLE;
+		break;
+	case 16:  // GREATER
+		predicate = CmpInst::ICMP_SGT;
+		break;
+	default:
+		printf("LLVM 0x%x: IF condition 0x%lx. Not yet handled.\n", inst, inst_log1->instruction.srcA.index);
+		return NULL;
+	}
+	/* The same operands as if_expression(): srcB is on the left */
+	value_id[0] = external_entry_point->label_redirect[inst_log1_flags->value2.value_id].redirect;
+	value_id[1] = external_entry_point->label_redirect[inst_log1_flags->value1.value_id].redirect;
+	for (n = 0; n < 2; n++) {
+		if (!value[value_id[n]] &&
+			LLVM_ir_export::fill_value(self, value, value_id[n], external_entry)) {
+			printf("LLVM 0x%x: IF value_id = 0x%x not available. Not yet handled.\n", inst, value_id[n]);
+			return NULL;
+		}
+	}
+	lhs = value[value_id[0]];
+	rhs = value[value_id[1]];
+	switch (inst_log1_flags->instruction.opcode) {
+	case 0x0c:  // CMP
+	case 0x23:  // ICMP
+		break;
+	case 0x0a:  // TEST
+		if ((predicate != CmpInst::ICMP_EQ) &&
+			(predicate != CmpInst::ICMP_NE) &&
+			(predicate != CmpInst::ICMP_SLE)) {
+			printf("LLVM 0x%x: IF condition of TEST. Not yet handled.\n", inst);
+			return NULL;
+		}
+		if (lhs->getType() != rhs->getType()) {
+			break;
+		}
+		lhs = BinaryOperator::CreateAnd(lhs, rhs, "", bb);
+		rhs = ConstantInt::get(lhs->getType(), 0);
+		break;
+	default:
+		printf("LLVM 0x%x: IF flags set by opcode 0x%x. Not yet handled.\n",
+			inst, inst_log1_flags->instruction.opcode);
+		return NULL;
+	}
+	if (lhs->getType() != rhs->getType()) {
+		printf("LLVM 0x%x: IF operands of different sizes. Not yet handled.\n", inst);
+		return NULL;
+	}
+	return new ICmpInst(*bb, predicate, lhs, rhs, "");
+}
+
+/* End the block of node with a branch to the nodes that follow it.
+ * A node ending in RET already has its ReturnInst. Nodes with no successors that do not
+ * return, e.g. after a call to exit(), end in unreachable.
+ * Returns 1 if the terminator is not handled yet. */
+int LLVM_ir_export::add_node_terminator(struct self_s *self, Value **value, BasicBlock **bb, int node, int external_entry)
+{
+	struct control_flow_node_s *nodes = self->external_entry_points[external_entry].nodes;
+	struct inst_log_entry_s *inst_log1 = &(self->inst_log_entry[nodes[node].inst_end]);
+	Value *condition;
+
+	if (bb[node]->getTerminator()) {
+		return 0;
+	}
+	if (!nodes[node].valid) {
+		/* Merged into another node, so nothing branches here */
+		new UnreachableInst(Context, bb[node]);
+		return 0;
+	}
+	switch (nodes[node].next_size) {
+	case 0:
+		new UnreachableInst(Context, bb[node]);
+		return 0;
+	case 1:
+		BranchInst::Create(bb[nodes[node].link_next[0].node], bb[node]);
+		return 0;
+	case 2:
+		if (inst_log1->instruction.opcode != 0x13) {  /* IF */
+			break;
+		}
+		condition = add_condition(self, value, bb[node], external_entry, nodes[node].inst_end);
+		if (!condition) {
+			return 1;
+		}
+		/* As output_label.c: next[1] is taken if the condition holds */
+		BranchInst::Create(bb[nodes[node].link_next[1].node], bb[nodes[node].link_next[0].node],
+			condition, bb[node]);
+		return 0;
+	default:
+		break;
+	}
+	printf("LLVM: node 0x%x with 0x%x successors. Not yet handled.\n", node, nodes[node].next_size);
+	return 1;
+}
+
 int LLVM_ir_export::fill_value(struct self_s *self, Value **value, int value_id, int external_entry)
 {
 	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
@@ -186,176 +442,612 @@ int LLVM_ir_export::fill_value(struct self_s *self, Value **value, int value_id,
 	return 1;
 }
 
-int LLVM_ir_export::output(struct self_s *self)
+/* Returns the Function for external_entry in Module M, declaring it on first use.
+ * Functions implemented in this .o file get their type from the params.
+ * Other functions, e.g. in libc, get their type from the first call seen. */
+Function *LLVM_ir_export::get_function(struct self_s *self, Module *M, int external_entry, std::vector<Type*> *call_args)
 {
-	const char *function_name = "test123";
-	char output_filename[512];
-	int n;
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
+	std::vector<Type*>FuncTy_0_args;
+	int index;
 	int m;
-	int l;
-	int tmp;
-	struct control_flow_node_s *nodes;
-	int nodes_size;
-	int node;
-	struct label_s *labels;
-	int labels_size;
-	char buffer[1024];
+
+	if (functions[external_entry]) {
+		return functions[external_entry];
+	}
+	if (is_exported(external_entry_point) && external_entry_point->params_labels) {
+		/* The labels of another function may already be freed, so use params_labels.
+		 * It is not filled in yet for a function that calls back to this one. */
+		for (m = 0; m < external_entry_point->params_size; m++) {
+			index = external_entry_point->params[m];
+			int size = external_entry_point->params_labels[m].size_bits;
+			printf("Label 0x%x: size_bits = 0x%x\n", index, size);
+			FuncTy_0_args.push_back(IntegerType::get(M->getContext(), size));
+		}
+	} else if (call_args) {
+		FuncTy_0_args = *call_args;
+	} else {
+		printf("LLVM get_function: no type for %s\n", external_entry_point->name);
+		return NULL;
+	}
+
+	FunctionType *FT =
+		FunctionType::get(Type::getInt32Ty(Context),
+			FuncTy_0_args,
+			false); /*not vararg*/
+
+	functions[external_entry] = Function::Create(FT, Function::ExternalLinkage, external_entry_point->name, M);
+	return functions[external_entry];
+}
+
+int LLVM_ir_export::add_function_body(struct self_s *self, Module *M, int external_entry)
+{
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
+	struct control_flow_node_s *nodes = external_entry_point->nodes;
+	int nodes_size = external_entry_point->nodes_size;
+	struct label_s *labels = external_entry_point->labels;
+	const char *name;
 	int index;
-	
-	struct external_entry_point_s *external_entry_points = self->external_entry_points;
-	
-	for (n = 0; n < EXTERNAL_ENTRY_POINTS_MAX; n++) {
-		if ((external_entry_points[n].valid != 0) &&
-			(external_entry_points[n].type == 1) && 
-			(external_entry_points[n].nodes_size)) {
-			Value** value = (Value**) calloc(external_entry_points[n].variable_id, sizeof(Value*));
-			nodes = external_entry_points[n].nodes;
-			nodes_size = external_entry_points[n].nodes_size;
-			labels = external_entry_points[n].labels;
-			labels_size = external_entry_points[n].variable_id;
-			Module *M = new Module("test_llvm_export", Context);
- 			M->setDataLayout("e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64-S128");
-			M->setTargetTriple("x86_64-pc-linux-gnu");
-
-			function_name = external_entry_points[n].name;
-			snprintf(output_filename, 500, "./llvm/%s.bc", function_name);
-			std::vector<Type*>FuncTy_0_args;
-			for (m = 0; m < external_entry_points[n].params_size; m++) {
-				index = external_entry_points[n].params[m];
-				int size = labels[index].size_bits;
-				printf("Label 0x%x: size_bits = 0x%x\n", index, size);
-				FuncTy_0_args.push_back(IntegerType::get(M->getContext(), size));
-			}
+	int node;
+	int failed = 0;
+	int m;
 
-			FunctionType *FT =
-				FunctionType::get(Type::getInt32Ty(Context),
-					FuncTy_0_args,
-					false); /*not vararg*/
+	Function *F = get_function(self, M, external_entry, NULL);
+	if (!F) {
+		return 1;
+	}
+	Value** value = (Value**) calloc(external_entry_point->variable_id, sizeof(Value*));
 
-			Function *F = Function::Create(FT, Function::ExternalLinkage, function_name, M);
+	Function::arg_iterator args = F->arg_begin();
+	for (m = 0; m < external_entry_point->params_size; m++) {
+		index = external_entry_point->params[m];
+		value[index] = args;
+		args++;
+		name = label_to_name(&(labels[index]));
+		if (name) {
+			value[index]->setName(name);
+		}
+	}
 
-			Function::arg_iterator args = F->arg_begin();
-			for (m = 0; m < external_entry_points[n].params_size; m++) {
-				index = external_entry_points[n].params[m];
-				value[index] = args;
-				args++;
-				tmp = label_to_string(&(labels[index]), buffer, 1023);
-				value[index]->setName(buffer);
-			}
+	BasicBlock **bb = (BasicBlock **)calloc(nodes_size + 1, sizeof (BasicBlock *));
+	for (m = 1; m < nodes_size; m++) {
+		std::string node_string;
+		std::stringstream tmp_str;
+		tmp_str << "Node_0x" << std::hex << m;
+		node_string = tmp_str.str();
+		printf("LLVM: %s\n", node_string.c_str());
+		bb[m] = BasicBlock::Create(Context, node_string, F);
+	}
 
-			BasicBlock **bb = (BasicBlock **)calloc(nodes_size + 1, sizeof (BasicBlock *));
-			for (m = 1; m < nodes_size; m++) {
-				std::string node_string;
-				std::stringstream tmp_str;
-				tmp_str << "Node_0x" << std::hex << m;
-				node_string = tmp_str.str();
-				printf("LLVM: %s\n", node_string.c_str());
-				bb[m] = BasicBlock::Create(Context, node_string, F);
-			}
+	/* FIXME: this needs the node to follow paths so the value[] is filled in the correct order */
+	for (node = 1; node < nodes_size; node++) {
+		printf("LLVM: node=0x%x\n", node);
+		/* FIXME: Output PHI instructions first */
+		if (nodes[node].valid) {
+			LLVM_ir_export::add_node_instructions(self, M, value, bb[node], node, external_entry);
+		}
+	}
+	for (node = 1; node < nodes_size; node++) {
+		if (add_node_terminator(self, value, bb, node, external_entry)) {
+			failed = 1;
+			break;
+		}
+	}
+	/* Leave a declaration rather than a body that does not verify,
+	 * so that the rest of the module can still be optimised. */
+	if (failed || verifyFunction(*F, ReturnStatusAction)) {
+		fprintf(stderr, "Warning: LLVM export: %s does not verify, only declared\n",
+			external_entry_point->name);
+		F->deleteBody();
+	}
+	free(bb);
+	free(value);
+	return 0;
+}
 
-			Value *Two = ConstantInt::get(Type::getInt32Ty(Context), 2);
-			Value *Three = ConstantInt::get(Type::getInt32Ty(Context), 3);
-			Value *Four = value[external_entry_points[n].params[0]];
-
-			/* FIXME: this needs the node to follow paths so the value[] is filled in the correct order */
-			for (node = 1; node < nodes_size; node++) {
-				printf("LLVM: node=0x%x\n", node);
-				/* FIXME: Output PHI instructions first */
-				/* FIXME: Output instuctions within the node */
-				LLVM_ir_export::add_node_instructions(self, value, bb[node], node, n);
-#if 0
-				/* FIXME: Output terminator instructions */
-				if (nodes[node].next_size == 0) {
-					printf("NEXT0 FOUND Add, Ret3\n");
-					//Value *Add = BinaryOperator::CreateAdd(Two, value[external_entry_points[n].params[0]], "addresult3", bb[node]);
-					Value *Add = BinaryOperator::CreateAdd(Two, Four, "addresult3", bb[node]);
-					/* FIXME: get the return correct, using value[]. */
-					ReturnInst::Create(Context, Add, bb[node]);
-				} else if (nodes[node].next_size == 1) {
-					int found = 0;
-					int branch_to_node = nodes[node].link_next[0].node;
-					printf("NEXT1 FOUND add ret2 branch_to_node = 0x%x\n", branch_to_node);
-					//tmp = find_function_member_node(self, &(external_entry_points[n]), branch_to_node, &l);
-					//if (!tmp) {
-					printf("Branch1 create: branch_to_node = 0x%x, node = 0x%x\n", branch_to_node, node);
-					Value *Add = BinaryOperator::CreateAdd(Two, Three, "addresult2", bb[node]);
-					BranchInst::Create(bb[branch_to_node], bb[node]);
-					//} else {
-					//	printf("NEXT NOT FOUND\n");
-					//}
-				} else if (nodes[node].next_size == 2) {
-					int node_false;
-					int node_true;
-					int found1 = 0;
-					int found2 = 0;
-					int branch_to_node;
-					branch_to_node = nodes[node].link_next[0].node;
-					node_false = branch_to_node;
-					//found1 = find_function_member_node(self, &(external_entry_points[n]), branch_to_node, &node_false);
-					branch_to_node = nodes[node].link_next[1].node;
-					node_true = branch_to_node;
-					//found2 = find_function_member_node(self, &(external_entry_points[n]), branch_to_node, &node_true);
-					//if ((!found1) && (!found2)) {
-					//	printf("Branch1 create: l = 0x%x, m = 0x%x\n", l, m);
-					//	printf("NEXT2 FOUND add ret1\n");
-					Value *cmpInst = BinaryOperator::CreateAdd(Two, Three, "addresult1", bb[node]);
-					BranchInst::Create(bb[node_false], bb[node_true], cmpInst, bb[node]);
-					//} else {
-					//	printf("NEXT2 NOT FOUND\n");
-					//}
-				} else {
-					int found1 = 0;
-					int branch_to_node;
-					int node_case;
-					branch_to_node = nodes[node].link_next[0].node;
-					printf("NEXT3+ HANDLED YET\n");
-					branch_to_node = nodes[node].link_next[0].node;
-					node_case = branch_to_node;
-					//found1 = find_function_member_node(self, &(external_entry_points[n]), branch_to_node, &node_case);
-					Value *Add = BinaryOperator::CreateAdd(Two, Three, "addresult", bb[1]);
-					Value *cmpInst = BinaryOperator::CreateAdd(Two, Three, "addresult1", bb[node]);
-					SwitchInst *switch_inst = SwitchInst::Create(cmpInst, bb[node_case], nodes[node].next_size, bb[node]);
-					for (l = 0; l < nodes[node].next_size; l++) {
-						branch_to_node = nodes[node].link_next[l].node;
-						node_case = branch_to_node;
-						//found1 = find_function_member_node(self, &(external_entry_points[n]), branch_to_node, &node_case);
-						const APInt ap_int1 = APInt::APInt(32, l, false);
-						ConstantInt *const_int1 = ConstantInt::get(Context, ap_int1);
-						switch_inst->addCase(const_int1, bb[node_case]);
-					}
-				}
-#endif
+Module *LLVM_ir_export::new_module(const char *name)
+{
+	Module *M = new Module(name, Context);
+	M->setDataLayout("e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-v64:64:64-v128:128:128-a0:0:64-s0:64:64-f80:128:128-n8:16:32:64-S128");
+	M->setTargetTriple("x86_64-pc-linux-gnu");
+	return M;
+}
+
+/* The passes that --llvm-passes can select, in the order given by the user.
+ * There is no mem2reg: the labels are already in SSA form, so the IR has no allocas to promote. */
+#define LLVM_PASSES_MAX 32
+enum llvm_pass_e {
+	LLVM_PASS_INSTCOMBINE,
+	LLVM_PASS_SIMPLIFYCFG,
+	LLVM_PASS_GVN,
+	LLVM_PASS_TABLE_SIZE
+};
+
+static const char *llvm_pass_names[LLVM_PASS_TABLE_SIZE] = {
+	"instcombine",
+	"simplifycfg",
+	"gvn"
+};
+
+/* Total time spent in each pass, summed over all modules and threads. */
+static pthread_mutex_t llvm_pass_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static double llvm_pass_time[LLVM_PASS_TABLE_SIZE];
+static int llvm_pass_runs[LLVM_PASS_TABLE_SIZE];
+/* Modules the passes were not run on, because they did not verify */
+static int llvm_pass_skipped;
+
+static Pass *llvm_pass_create(int pass)
+{
+	switch (pass) {
+	case LLVM_PASS_INSTCOMBINE:
+		return createInstructionCombiningPass();
+	case LLVM_PASS_SIMPLIFYCFG:
+		return createCFGSimplificationPass();
+	case LLVM_PASS_GVN:
+		return createGVNPass();
+	}
+	return NULL;
+}
+
+/* Parse a comma separated list, e.g. "instcombine,simplifycfg,gvn".
+ * "default" selects all of them in that order.
+ * Returns the number of passes, or -1 if a name is not known. */
+static int llvm_passes_parse(const char *list, int *passes, int passes_max)
+{
+	const char *start = list;
+	const char *end;
+	size_t len;
+	int count = 0;
+	int n;
+
+	if (!strcmp(list, "default")) {
+		for (n = 0; n < LLVM_PASS_TABLE_SIZE; n++) {
+			passes[n] = n;
+		}
+		return LLVM_PASS_TABLE_SIZE;
+	}
+	while (*start) {
+		end = strchr(start, ',');
+		len = end ? (size_t)(end - start) : strlen(start);
+		for (n = 0; n < LLVM_PASS_TABLE_SIZE; n++) {
+			if ((strlen(llvm_pass_names[n]) == len) &&
+				!strncmp(llvm_pass_names[n], start, len)) {
+				break;
 			}
-			std::string ErrorInfo;
-			raw_fd_ostream OS(output_filename, ErrorInfo, sys::fs::F_Binary);
+		}
+		if ((n == LLVM_PASS_TABLE_SIZE) || (count >= passes_max)) {
+			printf("LLVM passes: unknown pass or too many passes: %.*s\n", (int)len, start);
+			return -1;
+		}
+		passes[count] = n;
+		count++;
+		start += len;
+		if (*start == ',') {
+			start++;
+		}
+	}
+	return count;
+}
+
+static double llvm_pass_time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void llvm_pass_time_print(void)
+{
+	int n;
+
+	for (n = 0; n < LLVM_PASS_TABLE_SIZE; n++) {
+		if (llvm_pass_runs[n]) {
+			printf("LLVM pass %-12s runs = %d, time = %.6f s\n",
+				llvm_pass_names[n], llvm_pass_runs[n], llvm_pass_time[n]);
+		}
+	}
+	if (llvm_pass_skipped) {
+		fprintf(stderr, "Warning: --llvm-passes was not run on %d modules, because they did not verify\n",
+			llvm_pass_skipped);
+	}
+}
+
+/* Run the --llvm-passes pipeline over M.
+ * Each pass gets its own PassManager so that it can be timed on its own.
+ * Nothing is done if the module does not verify, because the passes assume valid IR.
+ * add_function_body() only keeps the bodies that verify, so this is a safety net. */
+int LLVM_ir_export::optimise_module(struct self_s *self, Module *M)
+{
+	std::string ErrorInfo;
+	int passes[LLVM_PASSES_MAX];
+	int passes_size;
+	double start;
+	double elapsed;
+	int n;
 
-			if (!ErrorInfo.empty())
-				return -1;
+	if (!self->llvm_passes) {
+		return 0;
+	}
+	passes_size = llvm_passes_parse(self->llvm_passes, passes, LLVM_PASSES_MAX);
+	if (passes_size < 0) {
+		return -1;
+	}
+	if (verifyModule(*M, ReturnStatusAction, &ErrorInfo)) {
+		fprintf(stderr, "Warning: LLVM passes: module %s does not verify, not optimised: %s\n",
+			M->getModuleIdentifier().c_str(), ErrorInfo.c_str());
+		pthread_mutex_lock(&llvm_pass_time_lock);
+		llvm_pass_skipped++;
+		pthread_mutex_unlock(&llvm_pass_time_lock);
+		return 0;
+	}
+	for (n = 0; n < passes_size; n++) {
+		PassManager PM;
+
+		PM.add(llvm_pass_create(passes[n]));
+		start = llvm_pass_time_now();
+		PM.run(*M);
+		elapsed = llvm_pass_time_now() - start;
+		pthread_mutex_lock(&llvm_pass_time_lock);
+		llvm_pass_time[passes[n]] += elapsed;
+		llvm_pass_runs[passes[n]]++;
+		pthread_mutex_unlock(&llvm_pass_time_lock);
+	}
+	return 0;
+}
 
+int LLVM_ir_export::write_module(Module *M, const char *filename)
+{
+	std::string ErrorInfo;
+	raw_fd_ostream OS(filename, ErrorInfo, sys::fs::F_Binary);
+
+	if (!ErrorInfo.empty())
+		return -1;
+
+	WriteBitcodeToFile(M, OS);
+	return 0;
+}
+
+/* Emit a single function into its own module.
+ * If bitcode is NULL write ./llvm/<function>.bc, otherwise serialise the bitcode into it.
+ * With --cache the bitcode is also stored in the cache, and a cached function is not built again. */
+int LLVM_ir_export::output_function(struct self_s *self, int external_entry, std::string *bitcode)
+{
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
+	char output_filename[512];
+	std::string cache_bitcode;
+	Module *M;
+	int tmp;
+
+	snprintf(output_filename, 500, "./llvm/%s.bc", external_entry_point->name);
+	if (external_entry_point->cached) {
+		if (bitcode) {
+			bitcode->assign(external_entry_point->cached_bitcode, external_entry_point->cached_bitcode_size);
+			return 0;
+		}
+		return write_bitcode_file(output_filename, external_entry_point->cached_bitcode,
+			external_entry_point->cached_bitcode_size);
+	}
+	if (!bitcode && self->cache) {
+		bitcode = &cache_bitcode;
+	}
+
+	if (!functions) {
+		functions = (Function **)calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(Function *));
+	}
+	memset(functions, 0, EXTERNAL_ENTRY_POINTS_MAX * sizeof(Function *));
+	M = new_module("test_llvm_export");
+	tmp = add_function_body(self, M, external_entry);
+	if (!tmp) {
+		tmp = optimise_module(self, M);
+	}
+	if (!tmp) {
+		if (bitcode) {
+			raw_string_ostream OS(*bitcode);
 			WriteBitcodeToFile(M, OS);
-			delete M;
+			OS.flush();
+		} else {
+			tmp = write_module(M, output_filename);
+		}
+	}
+	delete M;
+	if (!tmp && self->cache) {
+		/* A failed store only costs a miss next time */
+		cache_store(self, self->cache, external_entry, bitcode->data(), bitcode->size());
+	}
+	/* This function's analysis is not needed any more */
+	function_arena_free(self, external_entry_point);
+	if (!tmp && (bitcode == &cache_bitcode)) {
+		tmp = write_bitcode_file(output_filename, bitcode->data(), bitcode->size());
+	}
+	return tmp;
+}
 
-			//Value *Add = BinaryOperator::CreateAdd(Two, Three, "addresult", bb[1]);
-			//BranchInst::Create(bb[2], bb[1]);			
-			//ReturnInst::Create(Context, Add, bb[2]);
+/* Load each function's bitcode into this Context and link them in external_entry_points order.
+ * The order does not depend on which thread finished first, so the output is reproducible. */
+int LLVM_ir_export::link_modules(struct self_s *self, std::string *bitcode, const char *module_name, const char *filename)
+{
+	std::string ErrorInfo;
+	Module *M;
+	Module *Src;
+	MemoryBuffer *buffer;
+	int ret = 0;
+	int n;
+
+	M = new_module(module_name);
+	for (n = 0; n < EXTERNAL_ENTRY_POINTS_MAX; n++) {
+		if (bitcode[n].empty()) {
+			continue;
+		}
+		buffer = MemoryBuffer::getMemBuffer(bitcode[n], self->external_entry_points[n].name, false);
+		Src = ParseBitcodeFile(buffer, Context, &ErrorInfo);
+		delete buffer;
+		if (!Src) {
+			printf("LLVM link: failed to read %s: %s\n", self->external_entry_points[n].name, ErrorInfo.c_str());
+			ret = -1;
+			break;
+		}
+		if (Linker::LinkModules(M, Src, Linker::DestroySource, &ErrorInfo)) {
+			printf("LLVM link: failed to link %s: %s\n", self->external_entry_points[n].name, ErrorInfo.c_str());
+			delete Src;
+			ret = -1;
+			break;
 		}
+		delete Src;
+	}
+	if (!ret) {
+		ret = write_module(M, filename);
 	}
+	delete M;
+	return ret;
+}
 
+/* Start a module that functions are added to one at a time by module_add() */
+int LLVM_ir_export::module_start(const char *name)
+{
+	functions = (Function **)calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(Function *));
+	if (!functions) {
+		return -1;
+	}
+	module = new_module(name);
 	return 0;
 }
 
-int LLVM_ir_export_entry(struct self_s *self)
+/* Add one function to the module. Calls between functions refer to the real Function.
+ * Its analysis is released once its body is in the module. */
+int LLVM_ir_export::module_add(struct self_s *self, int external_entry)
+{
+	int tmp;
+
+	tmp = add_function_body(self, module, external_entry);
+	function_arena_free(self, &(self->external_entry_points[external_entry]));
+	return tmp ? -1 : 0;
+}
+
+int LLVM_ir_export::module_finish(struct self_s *self, const char *filename)
 {
 	int tmp;
+
+	tmp = optimise_module(self, module);
+	if (!tmp) {
+		tmp = write_module(module, filename);
+	}
+	delete module;
+	module = NULL;
+	free(functions);
+	functions = NULL;
+	return tmp ? -1 : 0;
+}
+
+/* The export in progress, from llvm_export_begin() to llvm_export_end().
+ * With more than one thread, or with --cache, each function is built into a module
+ * of its own by the export threads and the modules are linked at the end.
+ * Otherwise each function is built by the caller's thread as it is handed over. */
+struct llvm_export_s {
+	struct self_s *self;
+	char output_filename[512];
+	const char *module_name;
+	LLVM_ir_export *object;	/* Used by the caller's thread */
+	int threaded;		/* 1 = one module per function, built by the export threads */
+	int threads_size;
+	int threads_started;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int *queue;		/* Functions waiting for a thread, a ring of threads_size */
+	int queue_head;
+	int queue_size;
+	int done;		/* No more functions will be handed over */
+	std::string *bitcode;	/* One per external_entry_point, or NULL for per function files */
+	int failed;
+};
+
+/* Each thread has its own LLVM_ir_export and so its own LLVMContext.
+ * Functions are taken one at a time so a large function does not hold up a whole batch. */
+static void *llvm_export_worker(void *arg)
+{
+	struct llvm_export_s *job = (struct llvm_export_s *)arg;
 	LLVM_ir_export object;
-	tmp = object.output(self);
+	int n;
+	int tmp;
+
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+		while (!job->queue_size && !job->done) {
+			pthread_cond_wait(&job->cond, &job->lock);
+		}
+		if (!job->queue_size) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		n = job->queue[job->queue_head];
+		job->queue_head = (job->queue_head + 1) % job->threads_size;
+		job->queue_size--;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+		tmp = object.output_function(job->self, n, job->bitcode ? &(job->bitcode[n]) : NULL);
+		if (tmp) {
+			pthread_mutex_lock(&job->lock);
+			job->failed = 1;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+	return NULL;
+}
+
+/* Start an export. Then hand each function to llvm_export_function() and finish with llvm_export_end(). */
+int LLVM_ir_export_begin(struct self_s *self)
+{
+	struct llvm_export_s *job;
+	const char *module_name;
+	int threads_size;
+	int tmp;
+	int n;
+
+	job = new llvm_export_s();
+	job->self = self;
+	job->object = new LLVM_ir_export;
+	module_name = "test_llvm_export";
+	if (self->filename) {
+		module_name = strrchr(self->filename, '/');
+		module_name = module_name ? module_name + 1 : self->filename;
+	}
+	job->module_name = module_name;
+	snprintf(job->output_filename, 500, "./llvm/%s.bc", module_name);
+	self->llvm_export = job;
+
+	threads_size = self->llvm_threads;
+	if (threads_size < 0) {
+		threads_size = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if ((threads_size > 1) && !llvm_start_multithreaded()) {
+		printf("LLVM export: LLVM not built with thread support, using 1 thread\n");
+		threads_size = 1;
+	}
+	if (threads_size < 1) {
+		threads_size = 1;
+	}
+	job->threads_size = threads_size;
+	/* The cache stores the bitcode of each function on its own, so build them one module each and link */
+	if ((threads_size == 1) && !self->cache) {
+		if (!self->llvm_per_function) {
+			return job->object->module_start(module_name);
+		}
+		return 0;
+	}
+	job->threaded = 1;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+	if (!self->llvm_per_function) {
+		job->bitcode = new std::string[EXTERNAL_ENTRY_POINTS_MAX];
+	}
+	if (threads_size == 1) {
+		/* Only for --cache. Do it all in the caller's thread */
+		return 0;
+	}
+	job->queue = (int *)calloc(threads_size, sizeof(int));
+	job->threads = (pthread_t *)calloc(threads_size, sizeof(pthread_t));
+	if (!job->queue || !job->threads) {
+		printf("LLVM export: out of memory, using 1 thread\n");
+		return 0;
+	}
+	for (n = 0; n < threads_size; n++) {
+		tmp = pthread_create(&job->threads[n], NULL, llvm_export_worker, job);
+		if (tmp) {
+			printf("LLVM export: pthread_create failed, using %d threads\n", n);
+			break;
+		}
+		job->threads_started++;
+	}
+	return 0;
+}
+
+/* Export one function, then release its analysis.
+ * With export threads the function is queued. This waits while threads_size functions are
+ * already queued, so only a few functions' analysis is kept at any one time. */
+int LLVM_ir_export_function(struct self_s *self, int external_entry)
+{
+	struct llvm_export_s *job = (struct llvm_export_s *)self->llvm_export;
+	struct external_entry_point_s *external_entry_point = &(self->external_entry_points[external_entry]);
+	int tmp;
+
+	if (!is_exported(external_entry_point)) {
+		function_arena_free(self, external_entry_point);
+		return 0;
+	}
+	if (job->threads_started) {
+		pthread_mutex_lock(&job->lock);
+		while (job->queue_size >= job->threads_size) {
+			pthread_cond_wait(&job->cond, &job->lock);
+		}
+		job->queue[(job->queue_head + job->queue_size) % job->threads_size] = external_entry;
+		job->queue_size++;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+		return 0;
+	}
+	if (job->threaded) {
+		tmp = job->object->output_function(self, external_entry,
+			job->bitcode ? &(job->bitcode[external_entry]) : NULL);
+	} else if (self->llvm_per_function) {
+		/* One module and .bc file per function. Calls to other functions are declarations. */
+		tmp = job->object->output_function(self, external_entry, NULL);
+	} else {
+		tmp = job->object->module_add(self, external_entry);
+	}
+	if (tmp) {
+		job->failed = 1;
+	}
 	return tmp;
 }
 
-extern "C" int llvm_export(struct self_s *self)
+/* Wait for the export threads, then write the module. */
+int LLVM_ir_export_end(struct self_s *self)
 {
+	struct llvm_export_s *job = (struct llvm_export_s *)self->llvm_export;
 	int tmp;
-	tmp = LLVM_ir_export_entry(self);
+	int n;
+
+	if (job->threads_started) {
+		pthread_mutex_lock(&job->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+		for (n = 0; n < job->threads_started; n++) {
+			pthread_join(job->threads[n], NULL);
+		}
+	}
+	tmp = job->failed ? -1 : 0;
+	if (job->threaded) {
+		if (!tmp && job->bitcode) {
+			tmp = job->object->link_modules(self, job->bitcode, job->module_name, job->output_filename);
+		}
+		pthread_mutex_destroy(&job->lock);
+		pthread_cond_destroy(&job->cond);
+	} else if (!self->llvm_per_function && !tmp) {
+		tmp = job->object->module_finish(self, job->output_filename);
+	}
+	llvm_pass_time_print();
+	free(job->threads);
+	free(job->queue);
+	delete [] job->bitcode;
+	delete job->object;
+	delete job;
+	self->llvm_export = NULL;
 	return tmp;
 }
 
+extern "C" int llvm_export_begin(struct self_s *self)
+{
+	return LLVM_ir_export_begin(self);
+}
+
+extern "C" int llvm_export_function(struct self_s *self, int external_entry)
+{
+	return LLVM_ir_export_function(self, external_entry);
+}
+
+extern "C" int llvm_export_end(struct self_s *self)
+{
+	return LLVM_ir_export_end(self);
+}
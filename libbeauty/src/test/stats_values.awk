@@ -0,0 +1,21 @@
+# Print "name value" for each number in one dis64 --stats JSON file:
+# total_s, max_rss_kb, instructions and the wall time of each phase in pipeline order.
+# Used by benchmark and scaling.
+/"total":/ {
+	match($0, /"wall_s": [0-9.]+/);
+	print "total_s", substr($0, RSTART + 10, RLENGTH - 10);
+}
+/^"max_rss_kb":/ {
+	sub(/^"max_rss_kb": /, ""); sub(/,$/, "");
+	print "max_rss_kb", $0;
+}
+/^\t\{"phase":/ && !/"function":/ {
+	match($0, /"phase": "[a-z_0-9]+"/);
+	phase = substr($0, RSTART + 10, RLENGTH - 11);
+	match($0, /"wall_s": [0-9.]+/);
+	print phase, substr($0, RSTART + 10, RLENGTH - 10);
+	if (phase == "emulation") {
+		match($0, /"instructions": [0-9]+/);
+		print "instructions", substr($0, RSTART + 16, RLENGTH - 16);
+	}
+}
@@ -0,0 +1,16 @@
+/* Tests a function with four returns, merged into a single exit node. */
+/* gcc -c -g -O0 -o test72.o test72.c */
+
+int test72(int var1, int var2)
+{
+	if (var1 == 1) {
+		return var2 + 11;
+	}
+	if (var1 == 2) {
+		return var2 + 22;
+	}
+	if (var2 > var1) {
+		return var1;
+	}
+	return var2;
+}
@@ -153,7 +153,6 @@ void debug_print(int module, int level, const char *format, ...)
  * so that a single list can store all program flow.
  */
 // struct inst_log_entry_s inst_log_entry[INST_LOG_ENTRY_SIZE];
-// int search_back_seen[INST_LOG_ENTRY_SIZE];
 
 /* Used to keep record of where we have been before.
  * Used to identify program flow, branches, and joins.
@@ -276,7 +275,7 @@ int print_dis_instructions(struct self_s *self)
 	return 0;
 }
 
-int ram_init(struct memory_s *memory_data)
+int ram_init(struct memory_map_s *memory_data)
 {
 	return 0;
 }
@@ -392,19 +391,24 @@ int reg_init(struct memory_s *memory_reg)
 	return 0;
 }
 
-int stack_init(struct memory_s *memory_stack)
+int stack_init(struct memory_map_s *memory_stack)
 {
-	int n = 0;
+	struct memory_s *memory;
+
 	/* eip on the stack */
-	memory_stack[n].start_address = 0x10000;
+	memory = memory_map_add(memory_stack, 0x10000, 64);
+	if (!memory) {
+		return 1;
+	}
+	memory->start_address = 0x10000;
 	/* 4 bytes */
-	memory_stack[n].length = 8;
+	memory->length = 8;
 	/* 1 - Known */
-	memory_stack[n].init_value_type = 1;
+	memory->init_value_type = 1;
 	/* Initial value when first accessed */
-	memory_stack[n].init_value = 0x0;
+	memory->init_value = 0x0;
 	/* No offset yet */
-	memory_stack[n].offset_value = 0;
+	memory->offset_value = 0;
 	/* 0 - unknown,
 	 * 1 - unsigned,
 	 * 2 - signed,
@@ -413,35 +417,35 @@ int stack_init(struct memory_s *memory_stack)
 	 * 5 - Instruction pointer(EIP),
 	 * 6 - Stack pointer.
 	 */
-	memory_stack[n].value_type = 5;
-	memory_stack[n].value_unsigned = 0;
-	memory_stack[n].value_signed = 0;
-	memory_stack[n].value_instruction = 0;
-	memory_stack[n].value_pointer = 1;
-	memory_stack[n].value_normal = 0;
+	memory->value_type = 5;
+	memory->value_unsigned = 0;
+	memory->value_signed = 0;
+	memory->value_instruction = 0;
+	memory->value_pointer = 1;
+	memory->value_normal = 0;
 	/* Index into the various structure tables */
-	memory_stack[n].value_struct = 0;
-	memory_stack[n].ref_memory = 0;
-	memory_stack[n].ref_log = 0;
+	memory->value_struct = 0;
+	memory->ref_memory = 0;
+	memory->ref_log = 0;
 	/* value_scope: 0 - unknown, 1 - Param, 2 - Local, 3 - Mem */
-	memory_stack[n].value_scope = 2;
+	memory->value_scope = 2;
 	/* Each time a new value is assigned, this value_id increases */
-	memory_stack[n].value_id = 3;
+	memory->value_id = 3;
 	/* valid: 0 - Not used yet, 1 - Used */
-	memory_stack[n].valid = 1;
-	n++;
+	memory->valid = 1;
 
 #if 0
 	/* Param1 */
-	memory_stack[n].start_address = 0x10004;
+	memory = memory_map_add(memory_stack, 0x10004, 32);
+	memory->start_address = 0x10004;
 	/* 4 bytes */
-	memory_stack[n].length = 4;
+	memory->length = 4;
 	/* 1 - Known */
-	memory_stack[n].init_value_type = 1;
+	memory->init_value_type = 1;
 	/* Initial value when first accessed */
-	memory_stack[n].init_value = 0x321;
+	memory->init_value = 0x321;
 	/* No offset yet */
-	memory_stack[n].offset_value = 0;
+	memory->offset_value = 0;
 	/* 0 - unknown,
 	 * 1 - unsigned,
 	 * 2 - signed,
@@ -450,20 +454,16 @@ int stack_init(struct memory_s *memory_stack)
 	 * 5 - Instruction pointer(EIP),
 	 * 6 - Stack pointer.
 	 */
-	memory_stack[n].value_type = 2;
-	memory_stack[n].ref_memory = 0;
-	memory_stack[n].ref_log = 0;
+	memory->value_type = 2;
+	memory->ref_memory = 0;
+	memory->ref_log = 0;
 	/* value_scope: 0 - unknown, 1 - Param, 2 - Local, 3 - Mem */
-	memory_stack[n].value_scope = 0;
+	memory->value_scope = 0;
 	/* Each time a new value is assigned, this value_id increases */
-	memory_stack[n].value_id = 0;
+	memory->value_id = 0;
 	/* valid: 0 - Not used yet, 1 - Used */
-	memory_stack[n].valid = 1;
-	n++;
+	memory->valid = 1;
 #endif
-	for (;n < MEMORY_STACK_SIZE; n++) {
-		memory_stack[n].valid = 0;
-	}
 	return 0;
 }
 
@@ -501,9 +501,9 @@ int external_entry_points_init(struct external_entry_point_s *external_entry_poi
 {
 	int tmp;
 	int n;
-	struct memory_s *memory_stack;
+	struct memory_map_s *memory_stack;
 	struct memory_s *memory_reg;
-	struct memory_s *memory_data;
+	struct memory_map_s *memory_data;
 
 	tmp = external_entry_points_init_bfl(external_entry_points, handle_void);
 	for (n = 0; n < EXTERNAL_ENTRY_POINTS_MAX; n++) {
@@ -511,13 +511,17 @@ int external_entry_points_init(struct external_entry_point_s *external_entry_poi
 			external_entry_points[n].process_state.memory_text =
 				calloc(MEMORY_TEXT_SIZE, sizeof(struct memory_s));
 			external_entry_points[n].process_state.memory_stack =
-				calloc(MEMORY_STACK_SIZE, sizeof(struct memory_s));
+				calloc(1, sizeof(struct memory_map_s));
 			external_entry_points[n].process_state.memory_reg =
 				calloc(MEMORY_REG_SIZE, sizeof(struct memory_s));
 			external_entry_points[n].process_state.memory_data =
-				calloc(MEMORY_DATA_SIZE, sizeof(struct memory_s));
+				calloc(1, sizeof(struct memory_map_s));
 			external_entry_points[n].process_state.memory_used =
 				calloc(MEMORY_USED_SIZE, sizeof(int));
+			external_entry_points[n].process_state.live_stack =
+				calloc(1, sizeof(struct memory_map_s));
+			external_entry_points[n].process_state.live_data =
+				calloc(1, sizeof(struct memory_map_s));
 			//memory_text = external_entry_points[n].process_state.memory_text;
 			memory_stack = external_entry_points[n].process_state.memory_stack;
 			memory_reg = external_entry_points[n].process_state.memory_reg;
@@ -527,6 +531,7 @@ int external_entry_points_init(struct external_entry_point_s *external_entry_poi
 			ram_init(memory_data);
 			reg_init(memory_reg);
 			stack_init(memory_stack);
+			stack_init(external_entry_points[n].process_state.live_stack);
 			/* Set EIP entry point equal to symbol table entry point */
 			//memory_reg[2].init_value = EIP_START;
 			memory_reg[2].offset_value = external_entry_points[n].value;
@@ -574,19 +579,6 @@ int print_ast_container(struct ast_container_s *ast_container)
 	return 0;
 }
 
-int is_member_of_loop(struct control_flow_node_s *nodes, int loop_node, int test_node) {
-	int n;
-	int found = 0;
-
-	for (n = 0; n < nodes[test_node].member_of_loop_size; n++) {
-		if (loop_node == nodes[test_node].member_of_loop[n]) {
-			found = 1;
-			break;
-		}
-	}
-	return found;
-}
-
 /* Convert Control flow graph to Abstract syntax tree */
 /* One list with just a list of Type, Index pairs.
  * The Type will be one of:
@@ -2694,6 +2686,7 @@ int fill_node_phi_src(struct self_s *self, struct control_flow_node_s *nodes, in
 	int reg = 0;
 	int n, m;
 	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	struct arena_s *arena;
 
 	node_size_limited = nodes_size;
 #if 0
@@ -2712,16 +2705,17 @@ int fill_node_phi_src(struct self_s *self, struct control_flow_node_s *nodes, in
 					external_entry_points[nodes[node].entry_point - 1].name);
 				paths = external_entry_points[nodes[node].entry_point - 1].paths;
 				paths_size = external_entry_points[nodes[node].entry_point - 1].paths_size;
+				arena = external_entry_points[nodes[node].entry_point - 1].arena;
 				debug_print(DEBUG_ANALYSE_PHI, 1, "phi_src:paths = %p, paths_size = 0x%x\n", paths, paths_size);
 				reg = nodes[node].phi[n].reg;
 				if (nodes[node].path_size > 0) {
-					nodes[node].phi[n].path_node = calloc(nodes[node].path_size, sizeof(struct path_node_s));
+					nodes[node].phi[n].path_node = arena_alloc(arena, nodes[node].path_size, sizeof(struct path_node_s));
 					nodes[node].phi[n].path_node_size = nodes[node].path_size;
 				} else {
 					nodes[node].phi[n].path_node_size = 0;
 				}
 				if (nodes[node].looped_path_size > 0) {
-					nodes[node].phi[n].looped_path_node = calloc(nodes[node].looped_path_size, sizeof(struct path_node_s));
+					nodes[node].phi[n].looped_path_node = arena_alloc(arena, nodes[node].looped_path_size, sizeof(struct path_node_s));
 					nodes[node].phi[n].looped_path_node_size = nodes[node].looped_path_size;
 				} else {
 					nodes[node].phi[n].looped_path_node_size = 0;
@@ -2763,6 +2757,7 @@ int fill_phi_node_list(struct self_s *self, struct control_flow_node_s *nodes, i
 	int n;
 	int m;
 	int l;
+	struct arena_s *arena;
 	printf("fill_phi: entered\n");
 
 	for (node = 1; node < nodes_size; node++) {
@@ -2773,8 +2768,9 @@ int fill_phi_node_list(struct self_s *self, struct control_flow_node_s *nodes, i
 		printf("node = 0x%x\n", node);
 		if (nodes[node].phi_size > 0) {
 			printf("phi_size = 0x%x, prev_size = 0x%x\n", nodes[node].phi_size, nodes[node].prev_size);
+			arena = self->external_entry_points[nodes[node].entry_point - 1].arena;
 			for (n = 0; n < nodes[node].phi_size; n++) {
-				nodes[node].phi[n].phi_node = calloc(nodes[node].prev_size, sizeof(struct phi_node_s));
+				nodes[node].phi[n].phi_node = arena_alloc(arena, nodes[node].prev_size, sizeof(struct phi_node_s));
 				nodes[node].phi[n].phi_node_size = nodes[node].prev_size;
 				for (m = 0; m < nodes[node].prev_size; m++) {
 					printf("n = 0x%x, m = 0x%x\n", n, m);
@@ -2931,6 +2927,12 @@ int assign_labels_to_src(struct self_s *self, struct external_entry_point_s *ext
 
 	inst = nodes[node].inst_start;
 	do {
+		/* Each instruction can add at most 2 labels, srcA and srcB */
+		if (label_table_reserve(external_entry_point, variable_id + 2)) {
+			return 1;
+		}
+		label_redirect = external_entry_point->label_redirect;
+		labels = external_entry_point->labels;
 		inst_log1 =  &inst_log_entry[inst];
 		instruction =  &inst_log1->instruction;
 		switch (instruction->opcode) {
@@ -2985,10 +2987,10 @@ int assign_labels_to_src(struct self_s *self, struct external_entry_point_s *ext
 				case IND_STACK:
 					stack_address = inst_log1->value1.indirect_init_value + inst_log1->value1.indirect_offset_value;
 					debug_print(DEBUG_MAIN, 1, "assign_id: stack_address = 0x%"PRIx64"\n", stack_address);
-					memory = search_store(
+					memory = memory_map_search(
 						external_entry_point->process_state.memory_stack,
 						stack_address,
-						inst_log1->instruction.srcA.indirect_size);
+						inst_log1->instruction.srcA.value_size);
 					if (memory) {
 						if (memory->value_id) {
 							inst_log1->value1.indirect_value_id = memory->value_id;
@@ -3078,10 +3080,10 @@ int assign_labels_to_src(struct self_s *self, struct external_entry_point_s *ext
 				case IND_STACK:
 					stack_address = inst_log1->value1.indirect_init_value + inst_log1->value1.indirect_offset_value;
 					debug_print(DEBUG_MAIN, 1, "assign_id: stack_address = 0x%"PRIx64"\n", stack_address);
-					memory = search_store(
+					memory = memory_map_search(
 						external_entry_point->process_state.memory_stack,
 						stack_address,
-						inst_log1->instruction.srcA.indirect_size);
+						inst_log1->instruction.srcA.value_size);
 					if (memory) {
 						if (memory->value_id) {
 							inst_log1->value1.indirect_value_id = memory->value_id;
@@ -3138,10 +3140,10 @@ int assign_labels_to_src(struct self_s *self, struct external_entry_point_s *ext
 				case IND_STACK:
 					stack_address = inst_log1->value2.indirect_init_value + inst_log1->value2.indirect_offset_value;
 					debug_print(DEBUG_MAIN, 1, "assign_id: stack_address = 0x%"PRIx64"\n", stack_address);
-					memory = search_store(
+					memory = memory_map_search(
 						external_entry_point->process_state.memory_stack,
 						stack_address,
-						inst_log1->instruction.srcB.indirect_size);
+						inst_log1->instruction.srcB.value_size);
 					if (memory) {
 						if (memory->value_id) {
 							inst_log1->value2.indirect_value_id = memory->value_id;
@@ -3343,55 +3345,246 @@ int assign_labels_to_src(struct self_s *self, struct external_entry_point_s *ext
 	return 0;
 }
 
-int redirect_mov_reg_reg_labels(struct self_s *self, struct external_entry_point_s *external_entry_point, int node)
+/* Which of srcA and srcB an instruction reads a label from, as set by assign_labels_to_src(),
+ * and whether its value3 defines a label, as set by assign_id_label_dst(). */
+static int def_use_operands(struct instruction_s *instruction, int *src_a, int *src_b, int *dst)
+{
+	*src_a = 0;
+	*src_b = 0;
+	*dst = 0;
+	switch (instruction->opcode) {
+	case MOV:
+	case LOAD:
+	case STORE:
+		*src_a = 1;
+		*dst = 1;
+		break;
+	case ADD:
+	case ADC:
+	case SUB:
+	case SBB:
+	case MUL:
+	case IMUL:
+	case OR:
+	case XOR:
+	case rAND:
+	case NOT:
+	case NEG:
+	case SHL:
+	case SHR:
+	case SAL:
+	case SAR:
+	case SEX:
+	case ICMP:
+		*src_a = 1;
+		*src_b = 1;
+		*dst = 1;
+		break;
+	case TEST:
+	case CMP:
+		*src_a = 1;
+		*src_b = 1;
+		break;
+	case BC:
+	case RET:
+		*src_a = 1;
+		break;
+	case CALL:
+		*dst = 1;
+		break;
+	default:
+		break;
+	}
+	/* Only direct register and constant sources have a value_id. Stack ones use indirect_value_id. */
+	if ((instruction->srcA.store == STORE_REG) && (instruction->srcA.indirect != IND_DIRECT)) {
+		*src_a = 0;
+	}
+	if ((instruction->srcB.store == STORE_REG) && (instruction->srcB.indirect != IND_DIRECT)) {
+		*src_b = 0;
+	}
+	if (instruction->dstA.indirect != IND_DIRECT) {
+		*dst = 0;
+	}
+	return 0;
+}
+
+/* Build the def-use chains of a function, in two linear passes over its instructions.
+ * The first counts the uses of each label and the second fills them in.
+ * Each value1 and value2 prev and value3 next are then pointed into the chains,
+ * so no per value lists are allocated. It all lives in the function's arena.
+ */
+int build_def_use_chains(struct self_s *self, struct external_entry_point_s *external_entry_point)
 {
 	struct control_flow_node_s *nodes = external_entry_point->nodes;
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
-	struct label_redirect_s *label_redirect = external_entry_point->label_redirect;
-	struct label_s *labels = external_entry_point->labels;
-	int m;
 	struct inst_log_entry_s *inst_log1;
-	struct instruction_s *instruction;
-	int variable_id = external_entry_point->variable_id;
-	uint64_t stack_address;
-	struct memory_s *memory;
-	int value_id;
-	int value_id3;
-
+	struct def_use_s *def_use;
+	struct memory_s *value;
+	uint64_t value_id;
+	int labels_size = external_entry_point->variable_id;
+	int src_a, src_b, dst;
+	int *fill;
 	int inst;
-	struct label_s label;
-	int found = 0;
-	debug_print(DEBUG_MAIN, 1, "redirect_mov_reg_reg_labels() node 0x%x\n", node);
+	int node;
+	int operand;
+	int pass;
+	int n;
 
-	inst = nodes[node].inst_start;
-	do {
-		inst_log1 =  &inst_log_entry[inst];
-		instruction =  &inst_log1->instruction;
-		switch (instruction->opcode) {
-		case MOV:
-			if ((IND_DIRECT == instruction->srcA.indirect) &&
-				(STORE_REG == instruction->srcA.store) &&
-				(IND_DIRECT == instruction->dstA.indirect) &&
-				(STORE_REG == instruction->dstA.store)) {
+	def_use = arena_alloc(external_entry_point->arena, 1, sizeof(struct def_use_s));
+	if (!def_use) {
+		return 1;
+	}
+	def_use->labels_size = labels_size;
+	def_use->def = arena_alloc(external_entry_point->arena, labels_size, sizeof(int));
+	def_use->use_start = arena_alloc(external_entry_point->arena, labels_size + 1, sizeof(int));
+	fill = calloc(labels_size + 1, sizeof(int));
+	if (!def_use->def || !def_use->use_start || !fill) {
+		free(fill);
+		return 1;
+	}
 
-				value_id = inst_log1->value1.value_id;
-				value_id3 = inst_log1->value3.value_id;
-				label_redirect[value_id3].redirect = value_id;
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			/* Turn the counts into start offsets */
+			for (n = 0; n < labels_size; n++) {
+				def_use->use_start[n + 1] += def_use->use_start[n];
+				fill[n + 1] = def_use->use_start[n + 1];
+			}
+			def_use->uses_size = def_use->use_start[labels_size];
+			def_use->uses = arena_alloc(external_entry_point->arena, def_use->uses_size, sizeof(int));
+			if (!def_use->uses) {
+				free(fill);
+				return 1;
 			}
-			break;
-		default:
-			break;
 		}
-		if (inst == nodes[node].inst_end) {
-			found = 1;
+		for (node = 1; node < external_entry_point->nodes_size; node++) {
+			if (!nodes[node].valid) {
+				continue;
+			}
+			inst = nodes[node].inst_start;
+			while ((inst > 0) && (inst < inst_log)) {
+				inst_log1 = &inst_log_entry[inst];
+				def_use_operands(&inst_log1->instruction, &src_a, &src_b, &dst);
+				for (operand = 0; operand < 2; operand++) {
+					if (!(operand ? src_b : src_a)) {
+						continue;
+					}
+					value_id = operand ? inst_log1->value2.value_id : inst_log1->value1.value_id;
+					if ((value_id == 0) || (value_id >= labels_size)) {
+						continue;
+					}
+					if (pass == 0) {
+						/* Counted one along, so that the prefix sum gives the starts */
+						def_use->use_start[value_id + 1]++;
+					} else {
+						def_use->uses[fill[value_id]] = (inst << 1) | operand;
+						fill[value_id]++;
+					}
+				}
+				if ((pass == 0) && dst) {
+					value_id = inst_log1->value3.value_id;
+					if ((value_id > 0) && (value_id < labels_size)) {
+						def_use->def[value_id] = inst;
+					}
+				}
+				if ((inst == nodes[node].inst_end) || (inst_log1->next_size == 0)) {
+					break;
+				}
+				inst = inst_log1->next[0];
+			}
 		}
-		if (inst_log1->next_size > 0) {
+	}
+	free(fill);
+
+	/* Link the values to the chains */
+	for (node = 1; node < external_entry_point->nodes_size; node++) {
+		if (!nodes[node].valid) {
+			continue;
+		}
+		inst = nodes[node].inst_start;
+		while ((inst > 0) && (inst < inst_log)) {
+			inst_log1 = &inst_log_entry[inst];
+			def_use_operands(&inst_log1->instruction, &src_a, &src_b, &dst);
+			for (operand = 0; operand < 2; operand++) {
+				value = operand ? &inst_log1->value2 : &inst_log1->value1;
+				if (!(operand ? src_b : src_a) ||
+					(value->value_id == 0) || (value->value_id >= labels_size) ||
+					(def_use->def[value->value_id] == 0)) {
+					continue;
+				}
+				value->prev = &(def_use->def[value->value_id]);
+				value->prev_size = 1;
+			}
+			value_id = inst_log1->value3.value_id;
+			if (dst && (value_id > 0) && (value_id < labels_size)) {
+				inst_log1->value3.next = &(def_use->uses[def_use->use_start[value_id]]);
+				inst_log1->value3.next_size = def_use->use_start[value_id + 1] - def_use->use_start[value_id];
+			}
+			if ((inst == nodes[node].inst_end) || (inst_log1->next_size == 0)) {
+				break;
+			}
 			inst = inst_log1->next[0];
-		} else {
-			/* Exit here */
-			found = 1;
 		}
-	} while (!found);
+	}
+	external_entry_point->def_use = def_use;
+	return 0;
+}
+
+int print_def_use_chains(struct self_s *self, struct external_entry_point_s *external_entry_point)
+{
+	struct def_use_s *def_use = external_entry_point->def_use;
+	int l;
+	int n;
+
+	if (!def_use) {
+		return 0;
+	}
+	for (l = 1; l < def_use->labels_size; l++) {
+		if (!def_use->def[l] && (def_use->use_start[l] == def_use->use_start[l + 1])) {
+			continue;
+		}
+		debug_print(DEBUG_MAIN, 1, "def_use: label 0x%x def inst 0x%x uses:", l, def_use->def[l]);
+		for (n = def_use->use_start[l]; n < def_use->use_start[l + 1]; n++) {
+			debug_print(DEBUG_MAIN, 1, " 0x%x.%c", def_use->uses[n] >> 1, (def_use->uses[n] & 1) ? 'B' : 'A');
+		}
+		debug_print(DEBUG_MAIN, 1, "\n");
+	}
+	return 0;
+}
+
+/* Turn "MOV reg, reg" into a NOP from the SSA perspective, by making the dst label redirect to the src label.
+ * Walks the def-use chains, so it is one pass over the labels defined by a MOV. Labels are numbered in
+ * node and instruction order, so they are redirected in the same order as a walk of the nodes would.
+ */
+int redirect_mov_reg_reg_labels(struct self_s *self, struct external_entry_point_s *external_entry_point)
+{
+	struct def_use_s *def_use = external_entry_point->def_use;
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct label_redirect_s *label_redirect = external_entry_point->label_redirect;
+	struct inst_log_entry_s *inst_log1;
+	struct instruction_s *instruction;
+	int value_id;
+	int value_id3;
+
+	if (!def_use) {
+		return 1;
+	}
+	debug_print(DEBUG_MAIN, 1, "redirect_mov_reg_reg_labels()\n");
+	for (value_id3 = 1; value_id3 < def_use->labels_size; value_id3++) {
+		if (!def_use->def[value_id3]) {
+			continue;
+		}
+		inst_log1 =  &inst_log_entry[def_use->def[value_id3]];
+		instruction =  &inst_log1->instruction;
+		if ((MOV == instruction->opcode) &&
+			(IND_DIRECT == instruction->srcA.indirect) &&
+			(STORE_REG == instruction->srcA.store) &&
+			(IND_DIRECT == instruction->dstA.indirect) &&
+			(STORE_REG == instruction->dstA.store)) {
+			value_id = inst_log1->value1.value_id;
+			label_redirect[value_id3].redirect = label_redirect_find(label_redirect, value_id);
+		}
+	}
 
 	return 0;
 }
@@ -3446,22 +3639,118 @@ int substitute_inst(struct self_s *self, int inst, int new_inst)
 }
 
 
+/* Values of flags_in[] other than the instruction that set the flags */
+#define FLAGS_UNKNOWN 0		/* Not reached by the dataflow yet */
+#define FLAGS_NONE -1		/* No instruction sets the flags on the way here */
+#define FLAGS_CONFLICT -2	/* Different flag setters reach here on different paths */
+
+static int flags_merge(int a, int b)
+{
+	if (a == FLAGS_UNKNOWN) {
+		return b;
+	}
+	if ((b == FLAGS_UNKNOWN) || (a == b)) {
+		return a;
+	}
+	return FLAGS_CONFLICT;
+}
+
+/* The flags an instruction passes on to its next instructions */
+static int flags_out(struct inst_log_entry_s *inst_log_entry, int *flags_in, int n)
+{
+	if (1 == inst_log_entry[n].instruction.flags) {
+		return n;
+	}
+	return flags_in[n];
+}
+
+/* Link each flag user (IF, ADC, SBB, RCL, RCR) to the instruction that set its flags.
+ * flags_in[n] is the flag setter reaching n, found by a forward dataflow over prev/next:
+ *   flags_in[n] = merge of flags_out(p) over all prev p
+ *   flags_out(n) = n if n sets the flags, else flags_in[n]
+ * A value only moves from FLAGS_UNKNOWN to a setter to FLAGS_CONFLICT, so the worklist ends.
+ * A flag user reached by FLAGS_NONE or FLAGS_CONFLICT is an error.
+ * A CMP used by more than one flag user is duplicated, so that each user has its own.
+ * All the duplicates are counted first and the flag side arrays grown once.
+ */
 int build_flag_dependency_table(struct self_s *self)
 {
 	struct inst_log_entry_s *inst_log1;
-	struct inst_log_entry_s *inst_log1_flags;
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
 	struct instruction_s *instruction;
-	int l,n;
+	int *flags_in;
+	int *list;
+	uint8_t *on_list;
+	int list_head = 0;
+	int list_size;
+	int l,m,n;
 	int found;
 	int tmp;
+	int value;
 	int new_inst;
+	int duplicates = 0;
 	int inst_max = self->flag_dependency_size;
 
 	for (n = 1; n < inst_max; n++) {
 		self->flag_result_users[n] = 0;
 	}
+	flags_in = calloc(inst_max, sizeof(int));
+	list = calloc(inst_max, sizeof(int));
+	on_list = calloc(inst_max, sizeof(uint8_t));
+	if (!flags_in || !list || !on_list) {
+		free(flags_in);
+		free(list);
+		free(on_list);
+		return 1;
+	}
+
+	/* Start with every instruction on the list, in order, so most are done in one visit */
+	list_size = 0;
+	for (n = 1; n < inst_max; n++) {
+		list[list_size] = n;
+		list_size++;
+		on_list[n] = 1;
+	}
+	while (list_size > 0) {
+		n = list[list_head];
+		list_head = (list_head + 1) % inst_max;
+		list_size--;
+		on_list[n] = 0;
+		inst_log1 = &inst_log_entry[n];
+		if (inst_log1->prev_size == 0) {
+			value = FLAGS_NONE;
+		} else {
+			value = FLAGS_UNKNOWN;
+			for (m = 0; m < inst_log1->prev_size; m++) {
+				l = inst_log1->prev[m];
+				if ((l <= 0) || (l >= inst_max)) {
+					continue;
+				}
+				value = flags_merge(value, flags_out(inst_log_entry, flags_in, l));
+			}
+		}
+		if (value == flags_in[n]) {
+			continue;
+		}
+		flags_in[n] = value;
+		if (1 == inst_log1->instruction.flags) {
+			/* Its own flags go on to the next instructions, and they have not changed */
+			continue;
+		}
+		for (m = 0; m < inst_log1->next_size; m++) {
+			l = inst_log1->next[m];
+			if ((l <= 0) || (l >= inst_max) || on_list[l]) {
+				continue;
+			}
+			list[(list_head + list_size) % inst_max] = l;
+			list_size++;
+			on_list[l] = 1;
+		}
+	}
+	free(list);
+	free(on_list);
 
+	/* Find the flag setter for each user, and count how many users each one has */
 	for (n = 1; n < inst_max; n++) {
 		inst_log1 =  &inst_log_entry[n];
 		instruction =  &inst_log1->instruction;
@@ -3472,62 +3761,79 @@ int build_flag_dependency_table(struct self_s *self)
 		case SBB:
 		case IF:
 			debug_print(DEBUG_MAIN, 1, "flag user inst 0x%x OP:0x%x\n", n, instruction->opcode);
-			found = 0;
-			tmp = 30; /* Limit the scan backwards */
-			inst_log1_flags =  inst_log1;
-			do {
-				if (inst_log1_flags->prev > 0) {
-					l = inst_log1_flags->prev[0];
-				} else {
-					break;
+			l = flags_in[n];
+			if (l == FLAGS_CONFLICT) {
+				for (m = 0; m < inst_log1->prev_size; m++) {
+					debug_print(DEBUG_MAIN, 1, "Conflicting flags instructions. inst 0x%x from prev 0x%x gets flags from 0x%x\n",
+						n, inst_log1->prev[m], flags_out(inst_log_entry, flags_in, inst_log1->prev[m]));
 				}
-				tmp--;
-				inst_log1_flags =  &inst_log_entry[l];
-				debug_print(DEBUG_MAIN, 1, "Previous opcode 0x%x\n", inst_log1_flags->instruction.opcode);
-				debug_print(DEBUG_MAIN, 1, "Previous flags 0x%x\n", inst_log1_flags->instruction.flags);
-				if (1 == inst_log1_flags->instruction.flags) {
-					found = 1;
-				}
-				debug_print(DEBUG_MAIN, 1, "Previous flags instruction size 0x%x\n", inst_log1_flags->prev_size);
-				tmp--;
-			} while ((0 == found) && (0 < tmp) && (0 != l));
-			if (found == 0) {
-				debug_print(DEBUG_MAIN, 1, "Previous flags instruction not found. found=%d, tmp=%d, l=0x%x\n", found, tmp, l);
+				free(flags_in);
 				return 1;
-			} else {
-				debug_print(DEBUG_MAIN, 1, "Previous flags instruction found. found=%d, tmp=%d, l=0x%x n=0x%x\n", found, tmp, l, n);
-				if (self->flag_result_users[l] > 0) {
-					if (inst_log_entry[l].instruction.opcode != CMP) {
-						debug_print(DEBUG_MAIN, 1, "TOO MANY FLAGGED NON CMP. Opcode = 0x%x\n",
-							inst_log_entry[l].instruction.opcode);
-						exit(1);
-					}
-					/* Use "before" because after will cause a race condition */
-					tmp = insert_nop_before(self, l, &new_inst);
-					/* copy CMP into it */
-					tmp = substitute_inst(self, l, new_inst);
-					self->flag_dependency[n] = new_inst;
-					self->flag_dependency_opcode[n] = inst_log1_flags->instruction.opcode;
-					self->flag_result_users[new_inst]++;
-					if (new_inst > 0xe20) {
-						debug_print(DEBUG_MAIN, 1, "ADDING NEW INST 0x%x, flagged = 0x%x, flag_dep_size = 0x%x\n",
-							new_inst, self->flag_result_users[new_inst], self->flag_dependency_size);
-					}
-				} else {		
-					self->flag_dependency[n] = l;
-					self->flag_dependency_opcode[n] = inst_log1_flags->instruction.opcode;
-					self->flag_result_users[l]++;
-					if (l > 0xe20) {
-						debug_print(DEBUG_MAIN, 1, "ADDING FLAGGED 0x%x, flagged = 0x%x, flag_dep_size = 0x%x\n",
-							l, self->flag_result_users[l], self->flag_dependency_size);
-					}
+			}
+			if (l <= 0) {
+				debug_print(DEBUG_MAIN, 1, "Previous flags instruction not found. inst 0x%x\n", n);
+				free(flags_in);
+				return 1;
+			}
+			debug_print(DEBUG_MAIN, 1, "Previous flags instruction found. l=0x%x n=0x%x\n", l, n);
+			self->flag_dependency[n] = l;
+			self->flag_dependency_opcode[n] = inst_log_entry[l].instruction.opcode;
+			if (self->flag_result_users[l] > 0) {
+				if (inst_log_entry[l].instruction.opcode != CMP) {
+					debug_print(DEBUG_MAIN, 1, "TOO MANY FLAGGED NON CMP. Opcode = 0x%x\n",
+						inst_log_entry[l].instruction.opcode);
+					exit(1);
 				}
+				duplicates++;
 			}
+			self->flag_result_users[l]++;
 			break;
 		default:
 			break;
 		}
 	}
+	free(flags_in);
+
+	if (duplicates) {
+		/* Grow the flag side arrays once for all the CMPs about to be added */
+		if (inst_log + duplicates > INST_LOG_ENTRY_SIZE) {
+			debug_print(DEBUG_MAIN, 1, "build_flag_dependency_table: no room for 0x%x more instructions\n", duplicates);
+			return 1;
+		}
+		tmp = inst_log + duplicates;
+		self->flag_dependency = realloc(self->flag_dependency, tmp * sizeof(int));
+		self->flag_dependency_opcode = realloc(self->flag_dependency_opcode, tmp * sizeof(int));
+		self->flag_result_users = realloc(self->flag_result_users, tmp * sizeof(int));
+		for (n = self->flag_dependency_size; n < tmp; n++) {
+			self->flag_dependency[n] = 0;
+			self->flag_dependency_opcode[n] = 0;
+			self->flag_result_users[n] = 0;
+		}
+		self->flag_dependency_size = tmp;
+
+		/* The first user keeps the CMP. Each other user gets its own copy, just before it. */
+		for (n = 1; n < inst_max; n++) {
+			self->flag_result_users[n] = 0;
+		}
+		for (n = 1; n < inst_max; n++) {
+			l = self->flag_dependency[n];
+			if (!l) {
+				continue;
+			}
+			if (self->flag_result_users[l] > 0) {
+				/* Use "before" because after will cause a race condition */
+				tmp = insert_nop_before(self, l, &new_inst);
+				/* copy CMP into it */
+				tmp = substitute_inst(self, l, new_inst);
+				self->flag_dependency[n] = new_inst;
+				self->flag_result_users[new_inst]++;
+				debug_print(DEBUG_MAIN, 1, "ADDING NEW INST 0x%x for flag user 0x%x\n", new_inst, n);
+			} else {
+				self->flag_result_users[l]++;
+			}
+		}
+	}
+
 	found = 0;
 	for (n = 1; n < inst_max; n++) {
 		if (self->flag_result_users[n] > 1) {
@@ -3547,6 +3853,8 @@ int build_flag_dependency_table(struct self_s *self)
 	return 0;
 }
 
+static int flag_is_live(struct self_s *self, int inst);
+
 int matcher_sbb(struct self_s *self, int inst, int *sbb_match, int *n1, int *n2, int *n3, int *flags_result_used)
 {
 	struct inst_log_entry_s *inst_log1;
@@ -3569,7 +3877,8 @@ int matcher_sbb(struct self_s *self, int inst, int *sbb_match, int *n1, int *n2,
 	int max_log = inst_log;
 	inst_log1 =  &inst_log_entry[inst];
 
-	if (self->flag_result_users[inst] > 0) {
+	/* Only a SBB whose own flags are used needs them kept */
+	if (flag_is_live(self, inst)) {
 		for (m = 1; m < max_log; m++) {
 			if (self->flag_dependency[m] == inst) {
 				debug_print(DEBUG_MAIN, 1, "flag: SBB leaves users. inst 0x%x uses flag from inst 0x%x\n", m, inst);
@@ -3692,6 +4001,10 @@ int fix_flag_dependency_instructions(struct self_s *self)
 		inst_log1 =  &inst_log_entry[n];
 		instruction =  &inst_log1->instruction;
 		prev = self->flag_dependency[n];
+		if (!flag_is_live(self, prev)) {
+			debug_print(DEBUG_MAIN, 1, "flag: inst 0x%x flags from dead setter 0x%x, skipped\n", n, prev);
+			continue;
+		}
 		next1 = 0;
 		next2 = 0;
 		next3 = 0;
@@ -3705,7 +4018,7 @@ int fix_flag_dependency_instructions(struct self_s *self)
 		case SBB:
 			tmp = matcher_sbb(self, n, &sbb_match, &next1, &next2, &next3, &flags_result_used);
 			debug_print(DEBUG_MAIN, 1, "SBB: match 0x%x\n", sbb_match);
-			if (self->flag_result_users[n] > 0) {
+			if (flag_is_live(self, n)) {
 				for (m = 1; m < max_log; m++) {
 					if (self->flag_dependency[m] == n) {
 						debug_print(DEBUG_MAIN, 1, "flag: SBB leaves users. inst 0x%x uses flag from inst 0x%x\n", m, n);
@@ -4045,38 +4358,162 @@ int fix_flag_dependency_instructions(struct self_s *self)
 	return 0;
 }
 
-int print_flag_dependency_table(struct self_s *self)
+/* Instructions added after flag_liveness_build() are taken as live */
+static int flag_is_live(struct self_s *self, int inst)
 {
-	int n;
-	for (n = 1; n < self->flag_dependency_size; n++) {
-		if (self->flag_dependency[n]) {
-			debug_print(DEBUG_MAIN, 1, "FLAGS: Inst 0x%x linked to previous Inst 0x%x:0x%x\n", n, self->flag_dependency[n], self->flag_dependency_opcode[n]);
+	if (inst >= self->flag_live_size) {
+		return 1;
+	}
+	return self->flag_live[inst];
+}
+
+/* Flag liveness. The flags set by an instruction are live if a flag user (IF, ADC, SBB, RCL, RCR)
+ * can be reached from it, along any path, before another instruction sets the flags.
+ * This is found by walking back from each flag user through all its prev instructions,
+ * stopping at the flag setters. Each instruction is walked through at most once.
+ * A setter with flag_result_users is live too. This covers the CMP copies made by
+ * build_flag_dependency_table(), which the walk does not reach.
+ * Run before fix_flag_dependency_instructions(), which rewrites the flag users,
+ * so that it and kill_dead_flags() both see the flags as the emulation left them.
+ */
+int flag_liveness_build(struct self_s *self)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1;
+	uint8_t *live;
+	uint8_t *seen;
+	int *stack;
+	int stack_size;
+	int inst_max = inst_log;
+	int l, m, n;
+
+	live = calloc(inst_max, sizeof(uint8_t));
+	seen = calloc(inst_max, sizeof(uint8_t));
+	stack = calloc(inst_max, sizeof(int));
+	if (!live || !seen || !stack) {
+		free(live);
+		free(seen);
+		free(stack);
+		return 1;
+	}
+	for (n = 1; n < inst_max; n++) {
+		if ((n < self->flag_dependency_size) && (self->flag_result_users[n] > 0)) {
+			live[n] = 1;
+		}
+		inst_log1 = &inst_log_entry[n];
+		switch (inst_log1->instruction.opcode) {
+		case RCR:
+		case RCL:
+		case ADC:
+		case SBB:
+		case IF:
+			break;
+		default:
+			continue;
+		}
+		stack_size = 0;
+		for (m = 0; m < inst_log1->prev_size; m++) {
+			stack[stack_size] = inst_log1->prev[m];
+			stack_size++;
+		}
+		while (stack_size > 0) {
+			stack_size--;
+			l = stack[stack_size];
+			if ((l <= 0) || (l >= inst_max) || seen[l]) {
+				continue;
+			}
+			seen[l] = 1;
+			if (1 == inst_log_entry[l].instruction.flags) {
+				live[l] = 1;
+				continue;
+			}
+			for (m = 0; m < inst_log_entry[l].prev_size; m++) {
+				/* Each instruction is pushed at most once per prev link, so the stack cannot overflow
+				 * unless it has more prev links than instructions. Guard anyway. */
+				if (stack_size < inst_max) {
+					stack[stack_size] = inst_log_entry[l].prev[m];
+					stack_size++;
+				}
+			}
 		}
 	}
+	free(seen);
+	free(stack);
+	free(self->flag_live);
+	self->flag_live = live;
+	self->flag_live_size = inst_max;
 	return 0;
-}	
+}
 
-int insert_nop_before(struct self_s *self, int inst, int *new_inst)
+/* Clear the flags of every setter that flag_liveness_build() found dead.
+ * A CMP or TEST, which only sets flags, is taken out of the log altogether.
+ */
+int kill_dead_flags(struct self_s *self, int *killed, int *removed)
 {
 	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
-	struct inst_log_entry_s *inst_log1 = &inst_log_entry[inst];
-	struct inst_log_entry_s *inst_log1_previous;
-	struct inst_log_entry_s *inst_log1_new;
-	int l,m,n;
+	struct inst_log_entry_s *inst_log1;
+	uint8_t *keep;
+	int n;
+
+	*killed = 0;
+	*removed = 0;
+	keep = inst_log_keep_build(self);
+	if (!keep) {
+		return 1;
+	}
+	for (n = 1; n < inst_log; n++) {
+		inst_log1 = &inst_log_entry[n];
+		if ((1 != inst_log1->instruction.flags) || flag_is_live(self, n) || inst_log1->removed) {
+			continue;
+		}
+		debug_print(DEBUG_MAIN, 1, "kill_dead_flags: inst 0x%x flags not used\n", n);
+		inst_log1->instruction.flags = 0;
+		(*killed)++;
+		if ((CMP == inst_log1->instruction.opcode) ||
+			(TEST == inst_log1->instruction.opcode)) {
+			if (!inst_log_unlink(self, n, keep)) {
+				(*removed)++;
+			}
+		}
+	}
+	free(keep);
+	return 0;
+}
+
+int print_flag_dependency_table(struct self_s *self)
+{
+	int n;
+	for (n = 1; n < self->flag_dependency_size; n++) {
+		if (self->flag_dependency[n]) {
+			debug_print(DEBUG_MAIN, 1, "FLAGS: Inst 0x%x linked to previous Inst 0x%x:0x%x\n", n, self->flag_dependency[n], self->flag_dependency_opcode[n]);
+		}
+	}
+	return 0;
+}	
+
+int insert_nop_before(struct self_s *self, int inst, int *new_inst)
+{
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct inst_log_entry_s *inst_log1 = &inst_log_entry[inst];
+	struct inst_log_entry_s *inst_log1_previous;
+	struct inst_log_entry_s *inst_log1_new;
+	int l,m,n;
 	int inst_new;
 
 	inst_new = inst_log;
 	inst_log1_new = &inst_log_entry[inst_new];
 	inst_log++;
-	self->flag_dependency = realloc(self->flag_dependency, (inst_log) * sizeof(int));
+	/* The flag side arrays may already have been grown, e.g. by build_flag_dependency_table() */
+	if (inst_log > self->flag_dependency_size) {
+		self->flag_dependency = realloc(self->flag_dependency, (inst_log) * sizeof(int));
+		self->flag_dependency_opcode = realloc(self->flag_dependency_opcode, (inst_log) * sizeof(int));
+		self->flag_result_users = realloc(self->flag_result_users, (inst_log) * sizeof(int));
+		debug_print(DEBUG_MAIN, 1, "INFO: Insert nop before: Old dep size = 0x%x, new dep size = 0x%"PRIx64"\n", self->flag_dependency_size, inst_log);
+		self->flag_dependency_size = inst_log;
+	}
 	self->flag_dependency[inst_log - 1] = 0;
-	self->flag_dependency_opcode = realloc(self->flag_dependency_opcode, (inst_log) * sizeof(int));
 	self->flag_dependency_opcode[inst_log - 1] = 0;
-	self->flag_result_users = realloc(self->flag_result_users, (inst_log) * sizeof(int));
 	self->flag_result_users[inst_log - 1] = 0;
-	debug_print(DEBUG_MAIN, 1, "INFO: Insert nop before: Old dep size = 0x%x, new dep size = 0x%"PRIx64"\n", self->flag_dependency_size, inst_log);
-	debug_print(DEBUG_MAIN, 1, "INFO: Setting flag_result_users[0x%"PRIx64"] = 0\n", inst_log - 1);
-	self->flag_dependency_size = inst_log;
 
 	inst_log1_new->instruction.opcode = NOP;
         inst_log1_new->instruction.flags = 0;
@@ -4111,6 +4548,7 @@ int insert_nop_before(struct self_s *self, int inst, int *new_inst)
 	inst_log1_new->next = calloc(1, sizeof(int));
 	inst_log1_new->next_size = 1;
 	inst_log1_new->next[0] = inst;
+	inst_log1_new->node_member = inst_log1->node_member;
 	if (0 == inst_log1->prev_size) {
 		inst_log1->prev = calloc(1, sizeof(int));
 	}
@@ -4137,14 +4575,16 @@ int insert_nop_after(struct self_s *self, int inst, int *new_inst)
 	}
 	inst_log1_new = &inst_log_entry[inst_log];
 	inst_log++;
-	self->flag_dependency = realloc(self->flag_dependency, (inst_log) * sizeof(int));
+	if (inst_log > self->flag_dependency_size) {
+		self->flag_dependency = realloc(self->flag_dependency, (inst_log) * sizeof(int));
+		self->flag_dependency_opcode = realloc(self->flag_dependency_opcode, (inst_log) * sizeof(int));
+		self->flag_result_users = realloc(self->flag_result_users, (inst_log) * sizeof(int));
+		debug_print(DEBUG_MAIN, 1, "INFO: Insert nop after: Old dep size = 0x%x, new dep size = 0x%"PRIx64"\n", self->flag_dependency_size, inst_log);
+		self->flag_dependency_size = inst_log;
+	}
 	self->flag_dependency[inst_log - 1] = 0;
-	self->flag_dependency_opcode = realloc(self->flag_dependency_opcode, (inst_log) * sizeof(int));
 	self->flag_dependency_opcode[inst_log - 1] = 0;
-	self->flag_result_users = realloc(self->flag_result_users, (inst_log) * sizeof(int));
 	self->flag_result_users[inst_log - 1] = 0;
-	debug_print(DEBUG_MAIN, 1, "INFO: Insert nop after: Old dep size = 0x%x, new dep size = 0x%"PRIx64"\n", self->flag_dependency_size, inst_log);
-	self->flag_dependency_size = inst_log;
 
 	inst_log1_new->instruction.opcode = NOP;
         inst_log1_new->instruction.flags = 0;
@@ -4164,6 +4604,7 @@ int insert_nop_after(struct self_s *self, int inst, int *new_inst)
 	inst_log1_new->prev = calloc(1, sizeof(int));
 	inst_log1_new->prev_size = 1;
 	inst_log1_new->prev[0] = inst;
+	inst_log1_new->node_member = inst_log1->node_member;
 	inst_log1->next_size = 1;
 	inst_log1->next[0] = inst_new;
 	*new_inst = inst_new;
@@ -4244,6 +4685,13 @@ int create_function_node_members(struct self_s *self, struct external_entry_poin
 	external_entry_point->member_nodes = member_nodes;
 	external_entry_point->nodes_size = member_nodes_size;
 	external_entry_point->nodes = calloc(member_nodes_size, sizeof(struct control_flow_node_s));
+	if (!external_entry_point->arena) {
+		external_entry_point->arena = arena_create(ARENA_BLOCK_SIZE);
+		if (!external_entry_point->arena) {
+			printf("Failed in create_function_node_members(). arena_create failed.\n");
+			exit(1);
+		}
+	}
 
 	/* node 0 is intentionally not used */
 	for (n = 1; n < member_nodes_size; n++) {
@@ -4260,6 +4708,8 @@ int create_function_node_members(struct self_s *self, struct external_entry_poin
 		for (m = 0; m < external_entry_point->nodes[n].next_size; m++) {
 			external_entry_point->nodes[n].link_next[m].node = node_list[external_entry_point->nodes[n].link_next[m].node];
 		}
+		/* From here on the instructions belong to the function's own node numbers */
+		tmp = node_member_set(self, external_entry_point->nodes[n].inst_start, external_entry_point->nodes[n].inst_end, n);
 	}
 	free(mid_node);
 	free(node_list);
@@ -4356,10 +4806,10 @@ int assign_id_label_dst(struct self_s *self, int function, int n, struct inst_lo
 			debug_print(DEBUG_MAIN, 1, "assign_id_dst: IND_STACK\n");
 			stack_address = inst_log1->value3.indirect_init_value + inst_log1->value3.indirect_offset_value;
 			debug_print(DEBUG_MAIN, 1, "assign_id: stack_address = 0x%"PRIx64"\n", stack_address);
-			memory = search_store(
+			memory = memory_map_write(
 				self->external_entry_points[function].process_state.memory_stack,
 				stack_address,
-				inst_log1->instruction.dstA.indirect_size);
+				inst_log1->instruction.dstA.value_size);
 			if (memory) {
 				if (memory->value_id) {
 					inst_log1->value3.indirect_value_id = memory->value_id;
@@ -4506,6 +4956,9 @@ int fill_reg_dependency_table(struct self_s *self, struct external_entry_point_s
 				/* Build the param to label pointer tables, and use it to not duplicate param labels. */
 				tmp = external_entry_point->param_reg_label[m];
 				if (0 == tmp) {
+					if (label_table_reserve(external_entry_point, external_entry_point->variable_id)) {
+						return 1;
+					}
 					nodes[n].used_register[m].src_first_value_id = external_entry_point->variable_id;
 					nodes[n].used_register[m].src_first_node = 0;
 					nodes[n].used_register[m].src_first_label = 3;
@@ -4538,6 +4991,113 @@ int fill_reg_dependency_table(struct self_s *self, struct external_entry_point_s
 	return 0;
 }
 
+/* Read back the C just written for a function, from c_start to the end of fd, for cache_store().
+ * fd must be open for reading too. It is left at the end, ready for the next function.
+ * Returns 0 on success, 1 on error. */
+int output_c_keep(FILE *fd, long c_start, struct external_entry_point_s *external_entry_point)
+{
+	long c_end;
+	char *c_text;
+
+	c_end = ftell(fd);
+	if ((c_start < 0) || (c_end < c_start)) {
+		return 1;
+	}
+	c_text = malloc(c_end - c_start + 1);
+	if (!c_text) {
+		return 1;
+	}
+	if (fseek(fd, c_start, SEEK_SET) ||
+		((c_end > c_start) && (fread(c_text, c_end - c_start, 1, fd) != 1)) ||
+		fseek(fd, c_end, SEEK_SET)) {
+		debug_print(DEBUG_MAIN, 1, "output_c_keep: cannot read back the C of %s\n", external_entry_point->name);
+		free(c_text);
+		fseek(fd, 0, SEEK_END);
+		return 1;
+	}
+	free(external_entry_point->c_text);
+	external_entry_point->c_text = c_text;
+	external_entry_point->c_text_size = c_end - c_start;
+	return 0;
+}
+
+/* Order the functions so that each one comes after the functions it calls, unless they call
+ * each other. Then when a function is analysed and exported, the params of its callees are known.
+ * Fills order with the external_entry_points index of each valid function.
+ * Returns the number of functions in order, or -1 on error. */
+static int function_order_build(struct self_s *self, int *order)
+{
+	struct external_entry_point_s *external_entry_points = self->external_entry_points;
+	struct inst_log_entry_s *inst_log_entry = self->inst_log_entry;
+	struct instruction_s *instruction;
+	int *state;		/* 0 = not seen, 1 = on the stack, 2 = in order */
+	int *stack;
+	uint64_t *next_inst;	/* The next instruction to scan for calls, of each function on the stack */
+	int stack_size;
+	int order_size = 0;
+	int callee;
+	int l, n;
+
+	state = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(int));
+	stack = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(int));
+	next_inst = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(uint64_t));
+	if (!state || !stack || !next_inst) {
+		free(state);
+		free(stack);
+		free(next_inst);
+		return -1;
+	}
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (!external_entry_points[l].valid ||
+			(external_entry_points[l].type != 1) ||
+			state[l]) {
+			continue;
+		}
+		state[l] = 1;
+		next_inst[l] = external_entry_points[l].inst_log;
+		stack[0] = l;
+		stack_size = 1;
+		while (stack_size) {
+			n = stack[stack_size - 1];
+			callee = -1;
+			/* Cached functions have no instructions to scan */
+			while (!external_entry_points[n].cached &&
+				(next_inst[n] <= external_entry_points[n].inst_log_end)) {
+				instruction = &(inst_log_entry[next_inst[n]].instruction);
+				next_inst[n]++;
+				if ((instruction->opcode != CALL) ||
+					(instruction->srcA.relocated != 1) ||
+					(instruction->srcA.indirect != IND_DIRECT) ||
+					(instruction->srcA.index >= EXTERNAL_ENTRY_POINTS_MAX)) {
+					continue;
+				}
+				callee = instruction->srcA.index;
+				if (external_entry_points[callee].valid &&
+					(external_entry_points[callee].type == 1) &&
+					!state[callee]) {
+					break;
+				}
+				/* Already in order, or a recursive call */
+				callee = -1;
+			}
+			if (callee >= 0) {
+				state[callee] = 1;
+				next_inst[callee] = external_entry_points[callee].inst_log;
+				stack[stack_size] = callee;
+				stack_size++;
+				continue;
+			}
+			state[n] = 2;
+			order[order_size] = n;
+			order_size++;
+			stack_size--;
+		}
+	}
+	free(state);
+	free(stack);
+	free(next_inst);
+	return order_size;
+}
 
 
 
@@ -4560,6 +5120,9 @@ int main(int argc, char *argv[])
 //	size_t inst_size = 0;
 //	uint64_t reloc_size = 0;
 	int l, m;
+	int o;
+	int *order;
+	int order_size;
 	struct instruction_s *instruction;
 //	struct instruction_s *instruction_prev;
 	struct inst_log_entry_s *inst_log1;
@@ -4571,11 +5134,32 @@ int main(int argc, char *argv[])
 	int param_present[100];
 	int param_size[100];
 	char *expression;
-	int not_finished;
+	int llvm_per_function;
+	int llvm_threads;
+	const char *llvm_passes;
+	int stats_failed = 0;
+	const char *stats_filename;
+	const char *regions_filename;
+	FILE *regions_fd = NULL;
+	const char *cache_dir;
+	const char *checkpoint_filename;
+	const char *resume_filename;
+	struct reloc_table_s *reloc_table;
+	uint64_t reloc_table_size;
+	struct stats_mark_s phase_mark;
+	struct stats_mark_s function_mark;
+	int value_numbering_removed = 0;
+	int flags_killed = 0;
+	int regions_size = 0;
+	int flags_removed = 0;
+	uint64_t items;
+	uint64_t paths_estimate;
+	int path_length;
 	struct memory_s *memory_text;
-	struct memory_s *memory_stack;
+	struct memory_map_s *memory_stack;
 	struct memory_s *memory_reg;
-	struct memory_s *memory_data;
+	struct memory_s *memory;
+	struct memory_map_s *memory_data;
 	int *memory_used;
 	struct relocation_s *relocations;
 	struct external_entry_point_s *external_entry_points;
@@ -4591,15 +5175,97 @@ int main(int argc, char *argv[])
 
 	debug_print(DEBUG_MAIN, 1, "Hello loops 0x%x\n", 2000);
 
-	if (argc != 2) {
+	file = NULL;
+	llvm_per_function = 0;
+	llvm_threads = 0;
+	llvm_passes = NULL;
+	stats_filename = NULL;
+	regions_filename = NULL;
+	cache_dir = NULL;
+	checkpoint_filename = NULL;
+	resume_filename = NULL;
+	for (n = 1; n < argc; n++) {
+		if (!strcmp(argv[n], "--llvm-per-function")) {
+			llvm_per_function = 1;
+		} else if (!strcmp(argv[n], "--llvm-threads") && (n + 1 < argc)) {
+			n++;
+			llvm_threads = strtol(argv[n], NULL, 0);
+		} else if (!strcmp(argv[n], "--llvm-passes") && (n + 1 < argc)) {
+			n++;
+			llvm_passes = argv[n];
+		} else if (!strcmp(argv[n], "--stats") && (n + 1 < argc)) {
+			n++;
+			stats_filename = argv[n];
+		} else if (!strcmp(argv[n], "--regions") && (n + 1 < argc)) {
+			n++;
+			regions_filename = argv[n];
+		} else if (!strcmp(argv[n], "--cache") && (n + 1 < argc)) {
+			n++;
+			cache_dir = argv[n];
+		} else if (!strcmp(argv[n], "--checkpoint") && (n + 1 < argc)) {
+			n++;
+			checkpoint_filename = argv[n];
+		} else if (!strcmp(argv[n], "--resume-from") && (n + 1 < argc)) {
+			n++;
+			resume_filename = argv[n];
+		} else if (!file) {
+			file = argv[n];
+		} else {
+			file = NULL;
+			break;
+		}
+	}
+	if (checkpoint_filename && cache_dir) {
+		/* Functions with a cache hit are not emulated, so they would be missing from the checkpoint */
+		debug_print(DEBUG_MAIN, 1, "--checkpoint cannot be used with --cache\n");
+		file = NULL;
+	}
+	if (!file) {
 		debug_print(DEBUG_MAIN, 1, "Syntax error\n");
-		debug_print(DEBUG_MAIN, 1, "Usage: dis64 filename\n");
+		debug_print(DEBUG_MAIN, 1, "Usage: dis64 [--llvm-per-function] [--llvm-threads N] [--llvm-passes LIST] [--stats FILE] [--regions FILE] [--cache DIR]\n");
+		debug_print(DEBUG_MAIN, 1, "             [--checkpoint FILE | --resume-from FILE] filename\n");
 		debug_print(DEBUG_MAIN, 1, "Where \"filename\" is the input .o file\n");
+		debug_print(DEBUG_MAIN, 1, "LLVM IR is written to ./llvm/<filename>.bc\n");
+		debug_print(DEBUG_MAIN, 1, "or to ./llvm/<function>.bc with --llvm-per-function\n");
+		debug_print(DEBUG_MAIN, 1, "--llvm-threads N builds the LLVM IR of N functions at once, -1 = one per CPU\n");
+		debug_print(DEBUG_MAIN, 1, "--llvm-passes LIST runs e.g. \"instcombine,simplifycfg,gvn\" or \"default\" before writing\n");
+		debug_print(DEBUG_MAIN, 1, "    Functions whose IR does not verify are written as declarations only\n");
+		debug_print(DEBUG_MAIN, 1, "--stats FILE writes the time and memory used by each phase and function as JSON\n");
+		debug_print(DEBUG_MAIN, 1, "--regions FILE writes the if, loop, switch and goto structure of each function\n");
+		debug_print(DEBUG_MAIN, 1, "--cache DIR keeps the results of each function in DIR, so unchanged functions are not analysed again\n");
+		debug_print(DEBUG_MAIN, 1, "--checkpoint FILE saves the instruction log after emulation\n");
+		debug_print(DEBUG_MAIN, 1, "--resume-from FILE loads it instead of emulating again. The same .o must be given\n");
 		exit(1);
 	}
-	file = argv[1];
 
 	self = malloc(sizeof(struct self_s));
+	self->filename = file;
+	self->llvm_per_function = llvm_per_function;
+	self->llvm_threads = llvm_threads;
+	self->llvm_passes = llvm_passes;
+	self->flag_live = NULL;
+	self->flag_live_size = 0;
+	self->stats = NULL;
+	if (stats_filename) {
+		self->stats = stats_create();
+	}
+	self->llvm_export = NULL;
+	if (regions_filename) {
+		regions_fd = fopen(regions_filename, "w");
+		if (!regions_fd) {
+			debug_print(DEBUG_MAIN, 1, "Failed to open %s\n", regions_filename);
+			return 1;
+		}
+	}
+	self->cache = NULL;
+	if (cache_dir) {
+		self->cache = cache_create(cache_dir);
+		if (!self->cache) {
+			debug_print(DEBUG_MAIN, 1, "Failed to open the cache %s\n", cache_dir);
+			return 1;
+		}
+	}
+	stats_mark(self->stats, &phase_mark);
 	expression = malloc(1000); /* Buffer for if expressions */
 
 	handle_void = bf_test_open_file(file);
@@ -4667,9 +5333,9 @@ int main(int argc, char *argv[])
 	self->inst_log_entry = inst_log_entry;
 	self->relocations = relocations;
 	self->external_entry_points = external_entry_points;
-	self->entry_point = calloc(ENTRY_POINTS_SIZE, sizeof(struct entry_point_s));
-	self->entry_point_list_length = ENTRY_POINTS_SIZE;
-//	self->search_back_seen = calloc(INST_LOG_ENTRY_SIZE, sizeof(int));
+	/* ENTRY_POINTS_SIZE is only the initial size. The worklist grows as needed. */
+	tmp = entry_point_init(self, ENTRY_POINTS_SIZE);
+	if (tmp) return 1;
 	self->ll_inst = (void *)calloc(1, sizeof(struct instruction_low_level_s));
 	LLVMInitializeX86TargetInfo();
 	LLVMInitializeX86TargetMC();
@@ -4768,12 +5434,49 @@ int main(int argc, char *argv[])
 			handle->reloc_table_code[n].symbol_name);
 	}
 #endif			
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+	stats_record(self->stats, &phase_mark, "load", -1, "text_bytes", inst_size);
+	if (self->cache) {
+		/* Functions with a cache hit get their params, labels, bitcode and C here and are skipped below */
+		stats_mark(self->stats, &phase_mark);
+		cache_key_global(self->cache, data, data_size);
+		cache_key_global(self->cache, rodata, rodata_size);
+		bf_get_reloc_table_data(handle_void, &reloc_table, &reloc_table_size);
+		cache_key_global_relocs(self->cache, reloc_table, reloc_table_size);
+		bf_get_reloc_table_rodata(handle_void, &reloc_table, &reloc_table_size);
+		cache_key_global_relocs(self->cache, reloc_table, reloc_table_size);
+		bf_get_reloc_table_code(handle_void, &reloc_table, &reloc_table_size);
+		tmp = cache_build_keys(self, self->cache, inst, inst_size, reloc_table, reloc_table_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "Failed to build the cache keys\n");
+			return 1;
+		}
+		for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+			if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
+				cache_load(self, self->cache, l);
+			}
+		}
+		debug_print(DEBUG_MAIN, 1, "cache: %d hits, %d misses\n", self->cache->hits, self->cache->misses);
+		stats_record(self->stats, &phase_mark, "cache", -1, "hits", self->cache->hits);
+	}
+	if (resume_filename) {
+		/* The emulation and tidy_inst_log() were done by the run that wrote the checkpoint */
+		stats_mark(self->stats, &phase_mark);
+		tmp = checkpoint_read(self, resume_filename, &inst_log, inst, inst_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "Failed to resume from %s\n", resume_filename);
+			return 1;
+		}
+		stats_record(self->stats, &phase_mark, "resume", -1, "instructions", inst_log);
+	}
+	stats_mark(self->stats, &phase_mark);
+	for (l = 0; !resume_filename && (l < EXTERNAL_ENTRY_POINTS_MAX); l++) {
 		if ((external_entry_points[l].valid != 0) &&
-			(external_entry_points[l].type == 1)) {  /* 1 == Implemented in this .o file */
+			(external_entry_points[l].type == 1) &&  /* 1 == Implemented in this .o file */
+			!external_entry_points[l].cached) {
 			struct process_state_s *process_state;
-			struct entry_point_s *entry_point = self->entry_point;
+			struct entry_point_s entry_point;
 			
+			stats_mark(self->stats, &function_mark);
 			debug_print(DEBUG_MAIN, 1, "Start function block: %s:0x%"PRIx64"\n", external_entry_points[l].name, external_entry_points[l].value);	
 			process_state = &external_entry_points[l].process_state;
 			memory_text = process_state->memory_text;
@@ -4786,46 +5489,70 @@ int main(int argc, char *argv[])
 			/* Update EIP */
 			//memory_reg[2].offset_value = 0;
 			//inst_log_prev = 0;
-			entry_point[0].used = 1;
-			entry_point[0].esp_init_value = memory_reg[0].init_value;
-			entry_point[0].esp_offset_value = memory_reg[0].offset_value;
-			entry_point[0].ebp_init_value = memory_reg[1].init_value;
-			entry_point[0].ebp_offset_value = memory_reg[1].offset_value;
-			entry_point[0].eip_init_value = memory_reg[2].init_value;
-			entry_point[0].eip_offset_value = memory_reg[2].offset_value;
-			entry_point[0].previous_instuction = 0;
+			entry_point_reset(self);
+			tmp = entry_point_add(self,
+				memory_reg[0].init_value, memory_reg[0].offset_value,
+				memory_reg[1].init_value, memory_reg[1].offset_value,
+				memory_reg[2].init_value, memory_reg[2].offset_value,
+				0, NULL);
+			if (tmp) return 1;
 
 			print_mem(memory_reg, 1);
 			debug_print(DEBUG_MAIN, 1, "LOGS: inst_log = 0x%"PRIx64"\n", inst_log);
-			do {
-				not_finished = 0;
-				for (n = 0; n < self->entry_point_list_length; n++ ) {
-					/* EIP is a parameter for process_block */
-					/* Update EIP */
-					//debug_print(DEBUG_MAIN, 1, "entry:%d\n",n);
-					if (entry_point[n].used) {
-						memory_reg[0].init_value = entry_point[n].esp_init_value;
-						memory_reg[0].offset_value = entry_point[n].esp_offset_value;
-						memory_reg[1].init_value = entry_point[n].ebp_init_value;
-						memory_reg[1].offset_value = entry_point[n].ebp_offset_value;
-						memory_reg[2].init_value = entry_point[n].eip_init_value;
-						memory_reg[2].offset_value = entry_point[n].eip_offset_value;
-						inst_log_prev = entry_point[n].previous_instuction;
-						not_finished = 1;
-						debug_print(DEBUG_MAIN, 1, "LOGS: EIPinit = 0x%"PRIx64"\n", memory_reg[2].init_value);
-						debug_print(DEBUG_MAIN, 1, "LOGS: EIPoffset = 0x%"PRIx64"\n", memory_reg[2].offset_value);
-						err = process_block(self, process_state, inst_log_prev, inst_size);
-						/* clear the entry after calling process_block */
-						if (err) {
-							debug_print(DEBUG_MAIN, 1, "process_block failed\n");
-							return err;
-						}
-						entry_point[n].used = 0;
+			/* process_block() adds new entries to the worklist as it finds IF and JMPT */
+			while (0 == entry_point_next(self, &entry_point)) {
+				/* Resume from the state at the branch that added this entry */
+				if (entry_point.state) {
+					tmp = machine_state_restore(process_state, entry_point.state);
+					machine_state_release(entry_point.state);
+					if (tmp) {
+						debug_print(DEBUG_MAIN, 1, "machine_state_restore failed\n");
+						return 1;
 					}
 				}
-			} while (not_finished);	
+				/* EIP is a parameter for process_block */
+				/* Update EIP */
+				memory_reg[0].init_value = entry_point.esp_init_value;
+				memory_reg[0].offset_value = entry_point.esp_offset_value;
+				memory_reg[1].init_value = entry_point.ebp_init_value;
+				memory_reg[1].offset_value = entry_point.ebp_offset_value;
+				memory_reg[2].init_value = entry_point.eip_init_value;
+				memory_reg[2].offset_value = entry_point.eip_offset_value;
+				inst_log_prev = entry_point.previous_instuction;
+				debug_print(DEBUG_MAIN, 1, "LOGS: EIPinit = 0x%"PRIx64"\n", memory_reg[2].init_value);
+				debug_print(DEBUG_MAIN, 1, "LOGS: EIPoffset = 0x%"PRIx64"\n", memory_reg[2].offset_value);
+				err = process_block(self, process_state, inst_log_prev, inst_size);
+				if (err) {
+					debug_print(DEBUG_MAIN, 1, "process_block failed\n");
+					return err;
+				}
+			}
+			debug_print(DEBUG_MAIN, 1, "LOGS: entry points processed = 0x%"PRIx64"\n", self->entry_point_tail);
+			/* Link the other branches to each target, now that every target has been run */
+			tmp = entry_point_link(self, process_state);
+			if (tmp) {
+				debug_print(DEBUG_MAIN, 1, "entry_point_link failed\n");
+				return 1;
+			}
+			/* Only the maps of the whole function are used from here on */
+			memory_map_release(process_state->live_stack);
+			memory_map_release(process_state->live_data);
 			external_entry_points[l].inst_log_end = inst_log - 1;
 			debug_print(DEBUG_MAIN, 1, "LOGS: inst_log_end = 0x%"PRIx64"\n", inst_log);
+			stats_record(self->stats, &function_mark, "emulation", l, "instructions",
+				inst_log - external_entry_points[l].inst_log);
+		}
+	}
+	stats_record(self->stats, &phase_mark, "emulation", -1, "instructions", inst_log);
+	/* The memory printed at the end is that of the last function.
+	 * Set it here as well, as a resume or a cache hit does not go through the loop above. */
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
+			memory_text = external_entry_points[l].process_state.memory_text;
+			memory_stack = external_entry_points[l].process_state.memory_stack;
+			memory_reg = external_entry_points[l].process_state.memory_reg;
+			memory_data = external_entry_points[l].process_state.memory_data;
+			memory_used = external_entry_points[l].process_state.memory_used;
 		}
 	}
 /*
@@ -4848,8 +5575,22 @@ int main(int argc, char *argv[])
 
 	print_dis_instructions(self);
 	debug_print(DEBUG_MAIN, 1, "start tidy\n");
-	tmp = tidy_inst_log(self);
+	stats_mark(self->stats, &phase_mark);
+	if (!resume_filename) {
+		tmp = tidy_inst_log(self);
+	}
+	stats_record(self->stats, &phase_mark, "tidy_inst_log", -1, "instructions", inst_log);
+	if (checkpoint_filename) {
+		stats_mark(self->stats, &phase_mark);
+		tmp = checkpoint_write(self, checkpoint_filename, inst_log, inst, inst_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "Failed to write the checkpoint %s\n", checkpoint_filename);
+			return 1;
+		}
+		stats_record(self->stats, &phase_mark, "checkpoint", -1, "instructions", inst_log);
+	}
 	print_dis_instructions(self);
+	stats_mark(self->stats, &phase_mark);
 	self->flag_dependency = calloc(inst_log, sizeof(int));
 	self->flag_dependency_opcode = calloc(inst_log, sizeof(int));
 	self->flag_result_users = calloc(inst_log, sizeof(int));
@@ -4873,13 +5614,37 @@ int main(int argc, char *argv[])
 		debug_print(DEBUG_MAIN, 1, "INFO: flag_result_users 0xe2c = 0x%x\n", self->flag_result_users[0xe2c]);
 	}
 	debug_print(DEBUG_MAIN, 1, "got here I-4\n");
+	tmp = flag_liveness_build(self);
+	if (tmp) {
+		printf("flag_liveness_build() failed\n");
+		exit(1);
+	}
 	tmp = fix_flag_dependency_instructions(self);
 	if (inst_log > 0xe2c) {
 		debug_print(DEBUG_MAIN, 1, "INFO: flag_result_users 0xe2c = 0x%x\n", self->flag_result_users[0xe2c]);
 	}
+	tmp = kill_dead_flags(self, &flags_killed, &flags_removed);
+	if (tmp) {
+		printf("kill_dead_flags() failed\n");
+		exit(1);
+	}
+	debug_print(DEBUG_MAIN, 1, "kill_dead_flags: 0x%x dead flag setters, 0x%x CMP/TEST removed\n", flags_killed, flags_removed);
+	free(self->flag_live);
+	self->flag_live = NULL;
+	self->flag_live_size = 0;
+	stats_record(self->stats, &phase_mark, "flag_dependency", -1, "dead_flags", flags_killed);
+	stats_mark(self->stats, &phase_mark);
+	tmp = rtl_value_numbering(self, &value_numbering_removed);
+	if (tmp) {
+		printf("rtl_value_numbering() failed\n");
+		exit(1);
+	}
+	debug_print(DEBUG_MAIN, 1, "rtl_value_numbering: removed 0x%x instructions\n", value_numbering_removed);
+	stats_record(self->stats, &phase_mark, "value_numbering", -1, "removed", value_numbering_removed);
 	//tmp = insert_nop_after(self, 4);
 	print_dis_instructions(self);
 	/* Build the control flow nodes from the instructions. */
+	stats_mark(self->stats, &phase_mark);
 	tmp = build_control_flow_nodes(self, nodes, &nodes_size);
 	self->nodes_size = nodes_size;
 	tmp = print_control_flow_nodes(self, nodes, nodes_size);
@@ -4887,7 +5652,7 @@ int main(int argc, char *argv[])
 	debug_print(DEBUG_MAIN, 1, "got here 1\n");
 	/* enter the start node into each external_entry_point */
 	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1)) {
+		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1) && !external_entry_points[l].cached) {
 			tmp = find_node_from_inst(self, nodes, nodes_size, external_entry_points[l].inst_log);
 			if (tmp == 0) {
 				debug_print(DEBUG_MAIN, 1, "find_node_from_inst failed. entry[0x%x:%s]:start inst = 0x%"PRIx64", start node = 0x%x\n",
@@ -4915,27 +5680,28 @@ int main(int argc, char *argv[])
 	 */
 	/* tmp = create_function_node_members() mapping from nodes in externel_entry_point to the global nodes list. */
 	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1)) {
+		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1) && !external_entry_points[l].cached) {
 			tmp = create_function_node_members(self, &external_entry_points[l]);
 		}
 	}
+	stats_record(self->stats, &phase_mark, "build_control_flow_nodes", -1, "nodes", nodes_size);
 	
 	tmp = output_cfg_dot_basic(self, nodes, nodes_size);
 	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
+		if (external_entry_points[l].valid && external_entry_points[l].type == 1 && !external_entry_points[l].cached) {
 			debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes1 for function %x:%s\n", l, external_entry_points[l].name);
 			tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
 		}
 	}
 
 	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1)) {
+		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1) && !external_entry_points[l].cached) {
 			tmp = output_cfg_dot_basic2(self, &external_entry_points[l]);
 		}
 	}
 	paths = calloc(paths_size, sizeof(struct path_s));
 	for (n = 0; n < paths_size; n++) {
-		paths[n].path = calloc(1000, sizeof(int));
+		paths[n].path = calloc(PATH_LENGTH_MAX, sizeof(int));
 	}
 	loops = calloc(loops_size, sizeof(struct loop_s));
 
@@ -4959,202 +5725,6 @@ int main(int argc, char *argv[])
 	ast->loop_then_else_size = 0;
 
 
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-//	for (l = 17; l < 19; l++) {
-//	for (l = 37; l < 38; l++) {
-//		if (external_entry_points[l].valid) {
-//			nodes[external_entry_points[l].start_node].entry_point = l + 1;
-//		}
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			debug_print(DEBUG_MAIN, 1, "Starting external entry point %d:%s\n", l, external_entry_points[l].name);
-			int paths_used = 0;
-			int loops_used = 0;
-			int *multi_ret = NULL;
-			int multi_ret_size;
-
-			for (n = 0; n < paths_size; n++) {
-				paths[n].used = 0;
-				paths[n].path_prev = 0;
-				paths[n].path_prev_index = 0;
-				paths[n].path_size = 0;
-				paths[n].type = PATH_TYPE_UNKNOWN;
-				paths[n].loop_head = 0;
-			}
-			for (n = 0; n < loops_size; n++) {
-				loops[n].size = 0;
-				loops[n].head = 0;
-				loops[n].nest = 0;
-			}
-
-			tmp = build_control_flow_paths(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
-				paths, &paths_size, &paths_used, 1);
-			debug_print(DEBUG_MAIN, 1, "tmp = %d, PATHS used = %d\n", tmp, paths_used);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Failed at external entry point %d:%s\n", l, external_entry_points[l].name);
-				exit(1);
-			}
-			tmp = analyse_multi_ret(self, paths, &paths_size, &multi_ret_size, &multi_ret);
-			if (multi_ret_size) {
-				debug_print(DEBUG_MAIN, 1, "tmp = %d, multi_ret_size = %d\n", tmp, multi_ret_size);
-				for (m = 0; m < multi_ret_size; m++) {
-					debug_print(DEBUG_MAIN, 1, "multi_ret: node 0x%x\n", multi_ret[m]);
-				}
-				if (multi_ret_size == 2) {
-					/* FIXME: disable this temporarily. It is broken */
-					debug_print(DEBUG_MAIN, 1, "analyse_merge_nodes: 0x%x, 0x%x\n", multi_ret[0], multi_ret[1]);
-					tmp = analyse_merge_nodes(self, l, multi_ret[0], multi_ret[1]);
-					tmp = build_control_flow_paths(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
-						paths, &paths_size, &paths_used, 1);
-				} else if (multi_ret_size > 2) {
-					debug_print(DEBUG_MAIN, 1, "multi_ret_size > 2 not yet handled\n");
-					exit(1);
-				}
-			}
-			//tmp = print_control_flow_paths(self, paths, &paths_size);
-
-			tmp = build_control_flow_loops(self, paths, &paths_size, loops, &loops_size);
-			tmp = build_control_flow_loops_node_members(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size, loops, &loops_size);
-			tmp = build_node_paths(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size, paths, &paths_size, l + 1);
-
-			external_entry_points[l].paths_size = paths_used;
-
-			external_entry_points[l].paths = calloc(paths_used, sizeof(struct path_s));
-			if (0 == paths_used) {
-				debug_print(DEBUG_MAIN, 1, "INFO: paths_used = 0, %s, %p\n", external_entry_points[l].name, external_entry_points[l].paths);
-				exit(1);
-			}
-			for (n = 0; n < paths_used; n++) {
-				external_entry_points[l].paths[n].used = paths[n].used;
-				external_entry_points[l].paths[n].path_prev = paths[n].path_prev;
-				external_entry_points[l].paths[n].path_prev_index = paths[n].path_prev_index;
-				external_entry_points[l].paths[n].path_size = paths[n].path_size;
-				external_entry_points[l].paths[n].type = paths[n].type;
-				external_entry_points[l].paths[n].loop_head = paths[n].loop_head;
-
-				external_entry_points[l].paths[n].path = calloc(paths[n].path_size, sizeof(int));
-				for (m = 0; m  < paths[n].path_size; m++) {
-					external_entry_points[l].paths[n].path[m] = paths[n].path[m];
-				}
-
-			}
-			for (n = 0; n < loops_size; n++) {
-				if (loops[n].size != 0) {
-					loops_used = n + 1;
-				}
-			}
-			debug_print(DEBUG_MAIN, 1, "loops_used = 0x%x\n", loops_used);
-			external_entry_points[l].loops_size = loops_used;
-			external_entry_points[l].loops = calloc(loops_used, sizeof(struct loop_s));
-			for (n = 0; n < loops_used; n++) {
-				external_entry_points[l].loops[n].head = loops[n].head;
-				external_entry_points[l].loops[n].size = loops[n].size;
-				external_entry_points[l].loops[n].nest = loops[n].nest;
-				external_entry_points[l].loops[n].list = calloc(loops[n].size, sizeof(int));
-				for (m = 0; m  < loops[n].size; m++) {
-					external_entry_points[l].loops[n].list[m] = loops[n].list[m];
-				}
-			}
-		}
-	}
-	debug_print(DEBUG_MAIN, 1, "got here 2\n");
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %x:%s\n", l, external_entry_points[l].name);
-			tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-	/* Node specific processing */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			debug_print(DEBUG_MAIN, 1, "got here 2a\n");
-			tmp = build_node_dominance(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			debug_print(DEBUG_MAIN, 1, "got here 2b\n");
-			tmp = analyse_control_flow_node_links(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			debug_print(DEBUG_MAIN, 1, "got here 2c\n");
-			tmp = build_node_type(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			debug_print(DEBUG_MAIN, 1, "got here 2d\n");
-			//tmp = build_control_flow_depth(self, nodes, &nodes_size,
-			//		paths, &paths_size, &paths_used, external_entry_points[l].start_node);
-			tmp = build_control_flow_loops_multi_exit(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
-				external_entry_points[l].loops, external_entry_points[l].loops_size);
-			debug_print(DEBUG_MAIN, 1, "got here 2e\n");
-		}
-	}
-	debug_print(DEBUG_MAIN, 1, "got here 3\n");
-
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %x:%s\n", l, external_entry_points[l].name);
-			tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-	debug_print(DEBUG_MAIN, 1, "got here 4\n");
-
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = build_node_if_tail(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			for (n = 0; n < external_entry_points[l].nodes_size; n++) {
-				if (!(external_entry_points[l].nodes[n].valid)) {
-					continue;
-				}
-				if ((external_entry_points[l].nodes[n].type == NODE_TYPE_IF_THEN_ELSE) &&
-					(external_entry_points[l].nodes[n].if_tail == 0)) {
-					debug_print(DEBUG_MAIN, 1, "FAILED: Node 0x%x with no if_tail\n", n);
-				}
-			}
-		}
-	}
-	/* Build the node members list for each function */
-	/* This allows us to output a single function in the .dot output files. */	
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid) {
-			/* Not needed any more */
-			/* tmp = build_entry_point_node_members(self, &external_entry_points[l], nodes_size); */
-			tmp = print_entry_point_node_members(self, &external_entry_points[l]);
-		}
-	}
-	
-#if 1
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-//	for (l = 21; l < 22; l++) {
-//	for (l = 37; l < 38; l++) {
-		if (external_entry_points[l].valid) {
-			debug_print(DEBUG_ANALYSE_PATHS, 1, "External entry point %d: type=%d, name=%s inst_log=0x%lx, start_node=0x%x\n", l, external_entry_points[l].type, external_entry_points[l].name, external_entry_points[l].inst_log, 1);
-			tmp = print_control_flow_paths(self, external_entry_points[l].paths, &(external_entry_points[l].paths_size));
-			tmp = print_control_flow_loops(self, external_entry_points[l].loops, &(external_entry_points[l].loops_size));
-		}
-	}
-#endif
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %s\n", external_entry_points[l].name);
-			tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-
-//	Doing this after SSA now.
-#if 0
-//      Don't bother with the AST output for now 
-//	tmp = output_cfg_dot(self, nodes, nodes_size);
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-//	for (l = 0; l < 21; l++) {
-//	for (l = 21; l < 22; l++) {
-//	for (l = 4; l < 5; l++) {
-//		if (l == 21) continue;
-
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			/* Control flow graph to Abstract syntax tree */
-			debug_print(DEBUG_MAIN, 1, "cfg_to_ast. external entry point %d:%s\n", l, external_entry_points[l].name);
-			external_entry_points[l].start_ast_container = ast->container_size;
-			tmp = cfg_to_ast(self, nodes, &nodes_size, ast, external_entry_points[l].start_node);
-			tmp = print_ast(self, ast);
-		}
-	}
-	tmp = output_ast_dot(self, ast, nodes, &nodes_size);
-	/* FIXME */
-	//goto end_main;
-#endif
-
 #if 1
 
 
@@ -5172,82 +5742,6 @@ int main(int argc, char *argv[])
 	}
 
 
-	/****************************************************************
-	 * This section deals with building the node_used_register table
-	 * The nodes can be processed in any order for this step.
-	 * SRC, DST -> PHI SRC
-	 * DST, SRC -> No PHI needed.
-	 * DST first -> No PHI needed.
-	 * SRC first -> PHI SRC.
-	 * 0 = not seen.
-	 * 1 = SRC first
-	 * 2 = DST first
-	 * If SRC and DST in same instruction, set SRC first.
-	 ****************************************************************/
-	/* FIXME: TODO convert nodes to external_entry_points[l].nodes */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = init_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = fill_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "FIXME: fill node used register table failed\n");
-				exit(1);
-			}
-		}
-	}
-	/* print node_used_register_table */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = print_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "FIXME: print node used register table failed\n");
-				exit(1);
-			}
-		}
-	}
-
-
-	/****************************************************************
-	 * This section deals with building the initial PHI DST instructions
-	 * Create a PHI instruction for each entry in the node_used_register table,
-	 * the PHI instruction DST register is identified and set.
-         * This problem is then reduced to a node level problem, and not an instruction level problem.
-         * The nodes can be processed in any order for this step.
-	 ****************************************************************/
-
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = fill_node_phi_dst(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-
-	/****************************************************************
-	 * Then for each path running through each PHI node, locate the previous node that used that register.
-	 * Enter the path number, previously used node into the phi list for that register.
-	 * The nodes must be processed in path order for this step.
-	 * Optimizations can be made if paths are not unique at the current PHI node or above.
-	 * Start at end of path, search back down the path to the current node,
-	 * return which base path it is on. Only process if not a previous path.
-	 ****************************************************************/
-
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = fill_node_phi_src(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
-	/* Scan each of the list of paths in the src, and reduce the list to
-	 * a list of immediately/first previous nodes with assocated node that assigned the register.
-         * Also do sanity checks on the path nodes lists based on first_prev_node. 
-	 * This reduces the PHI to a format similar to that used in LLVM */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = fill_phi_node_list(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
-		}
-	}
 	/************************************************************
 	 * This section deals with starting true SSA.
 	 * This bit sets the valid_id to 0 for both dst and src.
@@ -5262,447 +5756,730 @@ int main(int argc, char *argv[])
 		inst_log1->value3.indirect_value_id = 0;
 	}
 	
-	/************************************************************
-	 * This bit assigned a variable ID and label to each assignment (dst).
-	 ************************************************************/
+	/***************************************************
+	 * This section deals with outputting the .c file.
+	 ***************************************************/
+	filename = "test.c";
+	/* w+ so that output_c_keep() can read back each function's C for the cache */
+	fd = fopen(filename, "w+");
+	if (!fd) {
+		debug_print(DEBUG_MAIN, 1, "Failed to open file %s, error=%p\n", filename, fd);
+		return 1;
+	}
+	debug_print(DEBUG_MAIN, 1, ".c fd=%p\n", fd);
+	debug_print(DEBUG_MAIN, 1, "writing out to file\n");
+	tmp = fprintf(fd, "#include <stdint.h>\n\n");
+	debug_print(DEBUG_MAIN, 1, "PRINTING MEMORY_DATA\n");
 	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			external_entry_points[l].label_redirect = calloc(10000, sizeof(struct label_redirect_s));
-			external_entry_points[l].labels = calloc(10000, sizeof(struct label_s));
-			external_entry_points[l].variable_id = 0x100;
-			debug_print(DEBUG_MAIN, 1, "NAME DST: 0x%x:%s\n",
-				l, external_entry_points[l].name);
-			for (n = 0; n < MEMORY_STACK_SIZE; n++) {
-				if (external_entry_points[l].process_state.memory_stack[n].valid == 1) {
-					debug_print(DEBUG_MAIN, 1, "0x%x:memory_stack[%d].start_address = 0x%"PRIx64"\n",
-						l, n, external_entry_points[l].process_state.memory_stack[n].start_address);
+		struct process_state_s *process_state;
+		if (external_entry_points[l].valid) {
+			process_state = &external_entry_points[l].process_state;
+			memory_data = process_state->memory_data;
+			for (n = 0; (n < 4) && (n < memory_data->size); n++) {
+				memory = memory_map_entry(memory_data, n);
+				debug_print(DEBUG_MAIN, 1, "memory_data:0x%x: 0x%"PRIx64"\n", n, memory->valid);
+				if (memory->valid) {
+	
+					tmp = bf_relocated_data(handle_void, memory->start_address, 4);
+					if (tmp) {
+						debug_print(DEBUG_MAIN, 1, "int *data%04"PRIx64" = &data%04"PRIx64"\n",
+							memory->start_address,
+							memory->init_value);
+						tmp = fprintf(fd, "int *data%04"PRIx64" = &data%04"PRIx64";\n",
+							memory->start_address,
+							memory->init_value);
+					} else {
+						debug_print(DEBUG_MAIN, 1, "int data%04"PRIx64" = 0x%04"PRIx64"\n",
+							memory->start_address,
+							memory->init_value);
+						tmp = fprintf(fd, "int data%04"PRIx64" = 0x%"PRIx64";\n",
+							memory->start_address,
+							memory->init_value);
+					}
 				}
 			}
-			for (n = 1; n < external_entry_points[l].nodes_size; n++) {
-				if (!(external_entry_points[l].nodes[n].valid)) {
-					continue;
-				}
-				debug_print(DEBUG_ANALYSE, 1, "e1_node[0x%x]_start = inst 0x%x\n", n, external_entry_points[l].nodes[n].inst_start);
-				debug_print(DEBUG_ANALYSE, 1, "e1_node[0x%x]_end = inst 0x%x\n", n, external_entry_points[l].nodes[n].inst_end);
+		}
+	}
+	tmp = fprintf(fd, "\n");
+	debug_print(DEBUG_MAIN, 1, "\n");
+#if 0
+	for (n = 0; n < 100; n++) {
+		param_present[n] = 0;
+	}
+		
+	for (n = 0; n < 10; n++) {
+		if (memory_stack[n].start_address > 0x10000) {
+			uint64_t present_index;
+			present_index = memory_stack[n].start_address - 0x10000;
+			if (present_index >= 100) {
+				debug_print(DEBUG_MAIN, 1, "param limit reached:memory_stack[%d].start_address == 0x%"PRIx64"\n",
+					n, memory_stack[n].start_address);
+				continue;
 			}
+			param_present[present_index] = 1;
+			param_size[present_index] = memory_stack[n].length;
+		}
+	}
+	for (n = 0; n < 100; n++) {
+		if (param_present[n]) {
+			debug_print(DEBUG_MAIN, 1, "param%04x\n", n);
+			tmp = param_size[n];
+			n += tmp;
+		}
+	}
+#endif
 
-			for(m = 1; m < external_entry_points[l].nodes_size; m++) {
-				int next;
-				if (!(external_entry_points[l].nodes[m].valid)) {
-					continue;
-				}
-				next = external_entry_points[l].nodes[m].inst_start;
-				do {
-					struct label_s label;
-					n = next;
-					inst_log1 =  &inst_log_entry[n];
-					instruction =  &inst_log1->instruction;
-					/* returns 0 for id and label set. 1 for error */
-					debug_print(DEBUG_MAIN, 1, "label address = %p\n", &label);
-					tmp  = assign_id_label_dst(self, l, n, inst_log1, &label);
-					debug_print(DEBUG_MAIN, 1, "value to log_to_label:inst = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
-						n,
-						instruction->dstA.indirect,
-						instruction->dstA.index,
-						instruction->dstA.relocated,
-						inst_log1->value3.value_scope,
-						inst_log1->value3.value_id,
-						inst_log1->value3.indirect_offset_value,
-						inst_log1->value3.indirect_value_id);
+	order = calloc(EXTERNAL_ENTRY_POINTS_MAX, sizeof(int));
+	order_size = -1;
+	if (order) {
+		order_size = function_order_build(self, order);
+	}
+	if (order_size < 0) {
+		debug_print(DEBUG_MAIN, 1, "Failed to order the functions\n");
+		return 1;
+	}
+	tmp = llvm_export_begin(self);
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "llvm_export_begin failed\n");
+		return 1;
+	}
+	/* Each function goes through all the phases, and is exported and released, before the next starts.
+	 * So only one function's analysis is held at a time, not that of the whole file. */
+	for (o = 0; o < order_size; o++) {
+		l = order[o];
+		if (external_entry_points[l].cached) {
+			/* The same C as the run that stored it */
+			if (external_entry_points[l].c_text_size &&
+				(fwrite(external_entry_points[l].c_text, external_entry_points[l].c_text_size, 1, fd) != 1)) {
+				debug_print(DEBUG_MAIN, 1, "Failed to write the cached C of %s\n", external_entry_points[l].name);
+				return 1;
+			}
+			if (params_labels_fill(&external_entry_points[l])) {
+				debug_print(DEBUG_MAIN, 1, "PARAM failed for function 0x%x. Out of memory\n", l);
+				return 1;
+			}
+			stats_mark(self->stats, &function_mark);
+			tmp = llvm_export_function(self, l);
+			stats_record(self->stats, &function_mark, "llvm_export", l, "functions", 1);
+			continue;
+		}
+		debug_print(DEBUG_MAIN, 1, "Starting external entry point %d:%s\n", l, external_entry_points[l].name);
+		int paths_used = 0;
+		int loops_used = 0;
 
-					if (!tmp) {
-						debug_print(DEBUG_MAIN, 1, "variable_id = %x\n", external_entry_points[l].variable_id);
-						if (external_entry_points[l].variable_id >= 10000) {
-							debug_print(DEBUG_MAIN, 1, "variable_id overrun 10000 limit. Trying to write to %d\n", external_entry_points[l].variable_id);
-							exit(1);
-						}
-						external_entry_points[l].label_redirect[external_entry_points[l].variable_id].redirect = external_entry_points[l].variable_id;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].scope = label.scope;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].type = label.type;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].lab_pointer += label.lab_pointer;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].value = label.value;
-						external_entry_points[l].variable_id++;
-					} else {
-						debug_print(DEBUG_MAIN, 1, "assign_id_label_dst() failed");
-						exit(1);
-					}
-						
-					if (inst_log1->next_size) {
-						next = inst_log1->next[0];
-					} else if (n != external_entry_points[l].nodes[m].inst_end) {
-						debug_print(DEBUG_MAIN, 1, "DST inst 0x%x, l = 0x%x, m = 0x%x next failure. No inst_end!!! inst_end1 = 0x%x, inst_end2 = 0x%x\n",
-							n, l, m, external_entry_points[l].nodes[m].inst_end, external_entry_points[l].nodes[m - 1].inst_end);
-						exit(1);
-					}
-				} while (n != external_entry_points[l].nodes[m].inst_end);
+		stats_mark(self->stats, &function_mark);
+		for (n = 0; n < paths_size; n++) {
+			paths[n].used = 0;
+			paths[n].path_prev = 0;
+			paths[n].path_prev_index = 0;
+			paths[n].path_size = 0;
+			paths[n].type = PATH_TYPE_UNKNOWN;
+			paths[n].loop_head = 0;
+		}
+		for (n = 0; n < loops_size; n++) {
+			loops[n].size = 0;
+			loops[n].head = 0;
+			loops[n].nest = 0;
+		}
+
+		/* Merge the return nodes into a single exit first, so the paths are only built once */
+		tmp = analyse_merge_exit_nodes(self, l);
+		if (tmp) {
+			printf("SKIPPED function %s: analyse_merge_exit_nodes failed\n", external_entry_points[l].name);
+			external_entry_points[l].valid = 0;
+			function_arena_free(self, &external_entry_points[l]);
+			continue;
+		}
+		/* Check the function will fit before building the paths.
+		 * The number of paths can grow exponentially with the number of branches,
+		 * so skip just this function rather than giving up on the whole file. */
+		tmp = estimate_control_flow_paths(external_entry_points[l].nodes, external_entry_points[l].nodes_size, 1,
+			paths_size, &paths_estimate, &path_length);
+		debug_print(DEBUG_MAIN, 1, "PATHS estimate = %"PRIu64", longest path = %d\n", paths_estimate, path_length);
+		if (tmp || (paths_estimate >= paths_size) || (path_length >= PATH_LENGTH_MAX)) {
+			printf("SKIPPED function %s: about %"PRIu64" paths, longest %d nodes. Limits are %d and %d\n",
+				external_entry_points[l].name, paths_estimate, path_length, paths_size, PATH_LENGTH_MAX);
+			external_entry_points[l].valid = 0;
+			function_arena_free(self, &external_entry_points[l]);
+			continue;
+		}
+		tmp = build_control_flow_paths(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
+			paths, &paths_size, &paths_used, 1);
+		debug_print(DEBUG_MAIN, 1, "tmp = %d, PATHS used = %d\n", tmp, paths_used);
+		if (tmp) {
+			printf("SKIPPED function %s: build_control_flow_paths failed\n", external_entry_points[l].name);
+			external_entry_points[l].valid = 0;
+			function_arena_free(self, &external_entry_points[l]);
+			continue;
+		}
+		//tmp = print_control_flow_paths(self, paths, &paths_size);
+
+		tmp = build_control_flow_loops(self, paths, &paths_size, loops, &loops_size);
+		tmp = build_control_flow_loops_node_members(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size, loops, &loops_size);
+		tmp = build_node_paths(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size, paths, &paths_size, l + 1);
+
+		external_entry_points[l].paths_size = paths_used;
+
+		external_entry_points[l].paths = arena_alloc(external_entry_points[l].arena, paths_used, sizeof(struct path_s));
+		if (0 == paths_used) {
+			debug_print(DEBUG_MAIN, 1, "INFO: paths_used = 0, %s, %p\n", external_entry_points[l].name, external_entry_points[l].paths);
+			exit(1);
+		}
+		for (n = 0; n < paths_used; n++) {
+			external_entry_points[l].paths[n].used = paths[n].used;
+			external_entry_points[l].paths[n].path_prev = paths[n].path_prev;
+			external_entry_points[l].paths[n].path_prev_index = paths[n].path_prev_index;
+			external_entry_points[l].paths[n].path_size = paths[n].path_size;
+			external_entry_points[l].paths[n].type = paths[n].type;
+			external_entry_points[l].paths[n].loop_head = paths[n].loop_head;
+
+			external_entry_points[l].paths[n].path = arena_alloc(external_entry_points[l].arena, paths[n].path_size, sizeof(int));
+			for (m = 0; m  < paths[n].path_size; m++) {
+				external_entry_points[l].paths[n].path[m] = paths[n].path[m];
+			}
+
+		}
+		for (n = 0; n < loops_size; n++) {
+			if (loops[n].size != 0) {
+				loops_used = n + 1;
+			}
+		}
+		debug_print(DEBUG_MAIN, 1, "loops_used = 0x%x\n", loops_used);
+		external_entry_points[l].loops_size = loops_used;
+		external_entry_points[l].loops = arena_alloc(external_entry_points[l].arena, loops_used, sizeof(struct loop_s));
+		for (n = 0; n < loops_used; n++) {
+			external_entry_points[l].loops[n].head = loops[n].head;
+			external_entry_points[l].loops[n].size = loops[n].size;
+			external_entry_points[l].loops[n].nest = loops[n].nest;
+			external_entry_points[l].loops[n].list = arena_alloc(external_entry_points[l].arena, loops[n].size, sizeof(int));
+			for (m = 0; m  < loops[n].size; m++) {
+				external_entry_points[l].loops[n].list[m] = loops[n].list[m];
+			}
+		}
+		stats_record(self->stats, &function_mark, "paths_loops", l, "paths", paths_used);
+
+		debug_print(DEBUG_MAIN, 1, "got here 2\n");
+		debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %x:%s\n", l, external_entry_points[l].name);
+		tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+
+		/* Node specific processing */
+		stats_mark(self->stats, &function_mark);
+		debug_print(DEBUG_MAIN, 1, "got here 2a\n");
+		tmp = analyse_control_flow_node_links(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		debug_print(DEBUG_MAIN, 1, "got here 2b\n");
+		tmp = build_node_csr(self, &external_entry_points[l]);
+		tmp = build_node_dominance(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
+			external_entry_points[l].node_csr);
+		debug_print(DEBUG_MAIN, 1, "got here 2c\n");
+		tmp = build_node_type(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		debug_print(DEBUG_MAIN, 1, "got here 2d\n");
+		//tmp = build_control_flow_depth(self, nodes, &nodes_size,
+		//		paths, &paths_size, &paths_used, external_entry_points[l].start_node);
+		tmp = build_control_flow_loops_multi_exit(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
+			external_entry_points[l].loops, external_entry_points[l].loops_size);
+		debug_print(DEBUG_MAIN, 1, "got here 2e\n");
+		debug_print(DEBUG_MAIN, 1, "got here 3\n");
+
+		debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %x:%s\n", l, external_entry_points[l].name);
+		tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		debug_print(DEBUG_MAIN, 1, "got here 4\n");
+
+		tmp = build_node_if_tail(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size,
+			external_entry_points[l].node_csr);
+		for (n = 0; n < external_entry_points[l].nodes_size; n++) {
+			if (!(external_entry_points[l].nodes[n].valid)) {
+				continue;
+			}
+			if ((external_entry_points[l].nodes[n].type == NODE_TYPE_IF_THEN_ELSE) &&
+				(external_entry_points[l].nodes[n].if_tail == 0)) {
+				debug_print(DEBUG_MAIN, 1, "FAILED: Node 0x%x with no if_tail\n", n);
 			}
 		}
-	}
+		stats_record(self->stats, &function_mark, "node_analysis", l, "nodes", external_entry_points[l].nodes_size);
+		/* Build the node members list for each function */
+		/* This allows us to output a single function in the .dot output files. */	
+		/* Not needed any more */
+		/* tmp = build_entry_point_node_members(self, &external_entry_points[l], nodes_size); */
+		tmp = print_entry_point_node_members(self, &external_entry_points[l]);
+		
+#if 1
+		debug_print(DEBUG_ANALYSE_PATHS, 1, "External entry point %d: type=%d, name=%s inst_log=0x%lx, start_node=0x%x\n", l, external_entry_points[l].type, external_entry_points[l].name, external_entry_points[l].inst_log, 1);
+		tmp = print_control_flow_paths(self, external_entry_points[l].paths, &(external_entry_points[l].paths_size));
+		tmp = print_control_flow_loops(self, external_entry_points[l].loops, &(external_entry_points[l].loops_size));
+#endif
+		debug_print(DEBUG_MAIN, 1, "print_control_flow_nodes for function %s\n", external_entry_points[l].name);
+		tmp = print_control_flow_nodes(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+
+		/* Structure each function into if...then...else, loops, switch and goto regions.
+		 * Nothing else uses them yet, so only with --regions. */
+		if (regions_fd) {
+			stats_mark(self->stats, &function_mark);
+			tmp = build_regions(self, &external_entry_points[l], &regions_size);
+			if (tmp) {
+				debug_print(DEBUG_MAIN, 1, "build_regions failed for function %s\n", external_entry_points[l].name);
+				regions_size = 0;
+			} else {
+				fprintf(regions_fd, "%s:\n", external_entry_points[l].name);
+				tmp = print_regions(self, external_entry_points[l].region, 1, regions_fd);
+			}
+			stats_record(self->stats, &function_mark, "structure", l, "regions", regions_size);
+		}
 
+//		Doing this after SSA now.
 #if 0
-	for (n = 0x100; n < 0x130; n++) {
-		struct label_s *label;
-		tmp = label_redirect[n].redirect;
-		label = &labels[tmp];
-		printf("Label 0x%x:", n);
-		tmp = output_label(label, stdout);
-		printf("\n");
-	}
+//	      Don't bother with the AST output for now 
+//		tmp = output_cfg_dot(self, nodes, nodes_size);
+		for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+//		for (l = 0; l < 21; l++) {
+//		for (l = 21; l < 22; l++) {
+//		for (l = 4; l < 5; l++) {
+//			if (l == 21) continue;
+
+			if (external_entry_points[l].valid && external_entry_points[l].type == 1 && !external_entry_points[l].cached) {
+				/* Control flow graph to Abstract syntax tree */
+				debug_print(DEBUG_MAIN, 1, "cfg_to_ast. external entry point %d:%s\n", l, external_entry_points[l].name);
+				external_entry_points[l].start_ast_container = ast->container_size;
+				tmp = cfg_to_ast(self, nodes, &nodes_size, ast, external_entry_points[l].start_node);
+				tmp = print_ast(self, ast);
+			}
+		}
+		tmp = output_ast_dot(self, ast, nodes, &nodes_size);
+		/* FIXME */
+		//goto end_main;
 #endif
-	/* Assign labels to PHI instructions dst */
 
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			for(n = 1; n < external_entry_points[l].nodes_size; n++) {
-				if (!(external_entry_points[l].nodes[n].valid)) {
-					/* Only output nodes that are valid */
-					continue;
-				}
-				printf("JCD: scanning node phi 0x%x\n", n);
-				if (external_entry_points[l].nodes[n].phi_size) {
-					printf("JCD: phi insts found at node 0x%x\n", n);
-					for (m = 0; m < external_entry_points[l].nodes[n].phi_size; m++) {
-						external_entry_points[l].nodes[n].phi[m].value_id = external_entry_points[l].variable_id;
-						external_entry_points[l].label_redirect[external_entry_points[l].variable_id].redirect = external_entry_points[l].variable_id;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].scope = 1;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].type = 1;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].lab_pointer = 0;
-						external_entry_points[l].labels[external_entry_points[l].variable_id].value = external_entry_points[l].variable_id;
-						external_entry_points[l].variable_id++;
-					}
-				}
+		/****************************************************************
+		 * This section deals with building the node_used_register table
+		 * The nodes can be processed in any order for this step.
+		 * SRC, DST -> PHI SRC
+		 * DST, SRC -> No PHI needed.
+		 * DST first -> No PHI needed.
+		 * SRC first -> PHI SRC.
+		 * 0 = not seen.
+		 * 1 = SRC first
+		 * 2 = DST first
+		 * If SRC and DST in same instruction, set SRC first.
+		 ****************************************************************/
+		stats_mark(self->stats, &function_mark);
+		tmp = init_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		tmp = fill_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "FIXME: fill node used register table failed\n");
+			exit(1);
+		}
+		stats_record(self->stats, &function_mark, "used_register_table", l, "nodes", external_entry_points[l].nodes_size);
+		/* print node_used_register_table */
+		tmp = print_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "FIXME: print node used register table failed\n");
+			exit(1);
+		}
+
+
+		/****************************************************************
+		 * This section deals with building the initial PHI DST instructions
+		 * Create a PHI instruction for each entry in the node_used_register table,
+		 * the PHI instruction DST register is identified and set.
+	         * This problem is then reduced to a node level problem, and not an instruction level problem.
+	         * The nodes can be processed in any order for this step.
+		 ****************************************************************/
+
+		stats_mark(self->stats, &function_mark);
+		tmp = fill_node_phi_dst(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+
+		/****************************************************************
+		 * Then for each path running through each PHI node, locate the previous node that used that register.
+		 * Enter the path number, previously used node into the phi list for that register.
+		 * The nodes must be processed in path order for this step.
+		 * Optimizations can be made if paths are not unique at the current PHI node or above.
+		 * Start at end of path, search back down the path to the current node,
+		 * return which base path it is on. Only process if not a previous path.
+		 ****************************************************************/
+
+		tmp = fill_node_phi_src(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		/* Scan each of the list of paths in the src, and reduce the list to
+		 * a list of immediately/first previous nodes with assocated node that assigned the register.
+	         * Also do sanity checks on the path nodes lists based on first_prev_node. 
+		 * This reduces the PHI to a format similar to that used in LLVM */
+		tmp = fill_phi_node_list(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		items = 0;
+		for (n = 1; n < external_entry_points[l].nodes_size; n++) {
+			items += external_entry_points[l].nodes[n].phi_size;
+		}
+		stats_record(self->stats, &function_mark, "phi", l, "phis", items);
+		stats_mark(self->stats, &function_mark);
+		/************************************************************
+		 * This bit assigned a variable ID and label to each assignment (dst).
+		 ************************************************************/
+		external_entry_points[l].label_redirect = NULL;
+		external_entry_points[l].labels = NULL;
+		external_entry_points[l].labels_size = 0;
+		external_entry_points[l].variable_id = 0x100;
+		tmp = label_table_reserve(&external_entry_points[l], external_entry_points[l].variable_id);
+		if (tmp) {
+			return 1;
+		}
+		debug_print(DEBUG_MAIN, 1, "NAME DST: 0x%x:%s\n",
+			l, external_entry_points[l].name);
+		for (n = 0; n < external_entry_points[l].process_state.memory_stack->size; n++) {
+			debug_print(DEBUG_MAIN, 1, "0x%x:memory_stack[%d].start_address = 0x%"PRIx64"\n",
+				l, n, memory_map_entry(external_entry_points[l].process_state.memory_stack, n)->start_address);
+		}
+		for (n = 1; n < external_entry_points[l].nodes_size; n++) {
+			if (!(external_entry_points[l].nodes[n].valid)) {
+				continue;
 			}
+			debug_print(DEBUG_ANALYSE, 1, "e1_node[0x%x]_start = inst 0x%x\n", n, external_entry_points[l].nodes[n].inst_start);
+			debug_print(DEBUG_ANALYSE, 1, "e1_node[0x%x]_end = inst 0x%x\n", n, external_entry_points[l].nodes[n].inst_end);
 		}
-	}
 
-	/* TODO: add code to process the used_registers to identify registers
-	 * that are assigned dst in a previous node or function param
-	 */
+		for(m = 1; m < external_entry_points[l].nodes_size; m++) {
+			int next;
+			if (!(external_entry_points[l].nodes[m].valid)) {
+				continue;
+			}
+			next = external_entry_points[l].nodes[m].inst_start;
+			do {
+				struct label_s label;
+				n = next;
+				inst_log1 =  &inst_log_entry[n];
+				instruction =  &inst_log1->instruction;
+				/* returns 0 for id and label set. 1 for error */
+				debug_print(DEBUG_MAIN, 1, "label address = %p\n", &label);
+				tmp  = assign_id_label_dst(self, l, n, inst_log1, &label);
+				debug_print(DEBUG_MAIN, 1, "value to log_to_label:inst = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
+					n,
+					instruction->dstA.indirect,
+					instruction->dstA.index,
+					instruction->dstA.relocated,
+					inst_log1->value3.value_scope,
+					inst_log1->value3.value_id,
+					inst_log1->value3.indirect_offset_value,
+					inst_log1->value3.indirect_value_id);
 
-	/* Fill in the reg dependency table */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			for(n = 1; n < external_entry_points[l].nodes_size; n++) {
-				if (!external_entry_points[l].nodes[n].valid) {
-					/* Only output nodes that are valid */
-					continue;
+				if (!tmp) {
+					debug_print(DEBUG_MAIN, 1, "variable_id = %x\n", external_entry_points[l].variable_id);
+					if (label_table_reserve(&external_entry_points[l], external_entry_points[l].variable_id)) {
+						debug_print(DEBUG_MAIN, 1, "label_table_reserve failed. Trying to write to %d\n", external_entry_points[l].variable_id);
+						exit(1);
+					}
+					external_entry_points[l].label_redirect[external_entry_points[l].variable_id].redirect = external_entry_points[l].variable_id;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].scope = label.scope;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].type = label.type;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].lab_pointer += label.lab_pointer;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].value = label.value;
+					external_entry_points[l].variable_id++;
+				} else {
+					debug_print(DEBUG_MAIN, 1, "assign_id_label_dst() failed");
+					exit(1);
 				}
-				tmp = fill_reg_dependency_table(self, &external_entry_points[l], n);
-				if (tmp) {
-					printf("fill_reg_dependency_table() failed\n");
+					
+				if (inst_log1->next_size) {
+					next = inst_log1->next[0];
+				} else if (n != external_entry_points[l].nodes[m].inst_end) {
+					debug_print(DEBUG_MAIN, 1, "DST inst 0x%x, l = 0x%x, m = 0x%x next failure. No inst_end!!! inst_end1 = 0x%x, inst_end2 = 0x%x\n",
+						n, l, m, external_entry_points[l].nodes[m].inst_end, external_entry_points[l].nodes[m - 1].inst_end);
 					exit(1);
 				}
+			} while (n != external_entry_points[l].nodes[m].inst_end);
+		}
+
+#if 0
+		for (n = 0x100; n < 0x130; n++) {
+			struct label_s *label;
+			tmp = label_redirect[n].redirect;
+			label = &labels[tmp];
+			printf("Label 0x%x:", n);
+			tmp = output_label(label, stdout);
+			printf("\n");
+		}
+#endif
+		/* Assign labels to PHI instructions dst */
+
+		for(n = 1; n < external_entry_points[l].nodes_size; n++) {
+			if (!(external_entry_points[l].nodes[n].valid)) {
+				/* Only output nodes that are valid */
+				continue;
+			}
+			printf("JCD: scanning node phi 0x%x\n", n);
+			if (external_entry_points[l].nodes[n].phi_size) {
+				printf("JCD: phi insts found at node 0x%x\n", n);
+				for (m = 0; m < external_entry_points[l].nodes[n].phi_size; m++) {
+					if (label_table_reserve(&external_entry_points[l], external_entry_points[l].variable_id)) {
+						exit(1);
+					}
+					external_entry_points[l].nodes[n].phi[m].value_id = external_entry_points[l].variable_id;
+					external_entry_points[l].label_redirect[external_entry_points[l].variable_id].redirect = external_entry_points[l].variable_id;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].scope = 1;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].type = 1;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].lab_pointer = 0;
+					external_entry_points[l].labels[external_entry_points[l].variable_id].value = external_entry_points[l].variable_id;
+					external_entry_points[l].variable_id++;
+				}
 			}
 		}
-	}
 
-	/* print node_used_register_table */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			tmp = print_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		/* TODO: add code to process the used_registers to identify registers
+		 * that are assigned dst in a previous node or function param
+		 */
+
+		/* Fill in the reg dependency table */
+		for(n = 1; n < external_entry_points[l].nodes_size; n++) {
+			if (!external_entry_points[l].nodes[n].valid) {
+				/* Only output nodes that are valid */
+				continue;
+			}
+			tmp = fill_reg_dependency_table(self, &external_entry_points[l], n);
 			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "FIXME: print node used register table failed\n");
+				printf("fill_reg_dependency_table() failed\n");
 				exit(1);
 			}
 		}
-	}
+
+		/* print node_used_register_table */
+		tmp = print_node_used_register_table(self, external_entry_points[l].nodes, external_entry_points[l].nodes_size);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "FIXME: print node used register table failed\n");
+			exit(1);
+		}
 
 
 
 
 #if 0
-	for (n = 1; n <= nodes_size; n++) {
-		for (m = 0; m < MAX_REG; m++) {
-			if (nodes[n].used_register[m].seen) {
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].seen = 0x%x\n", n, m, 
-					nodes[n].used_register[m].seen);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].size = 0x%x\n", n, m, 
-					nodes[n].used_register[m].size);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src = 0x%x\n", n, m, 
-					nodes[n].used_register[m].src);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].dst = 0x%x\n", n, m, 
-					nodes[n].used_register[m].dst);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_value_id = 0x%x\n", n, m, 
-					nodes[n].used_register[m].src_first_value_id);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_node = 0x%x\n", n, m, 
-					nodes[n].used_register[m].src_first_node);
-				debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_label = 0x%x\n", n, m, 
-					nodes[n].used_register[m].src_first_label);
+		for (n = 1; n <= nodes_size; n++) {
+			for (m = 0; m < MAX_REG; m++) {
+				if (nodes[n].used_register[m].seen) {
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].seen = 0x%x\n", n, m, 
+						nodes[n].used_register[m].seen);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].size = 0x%x\n", n, m, 
+						nodes[n].used_register[m].size);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src = 0x%x\n", n, m, 
+						nodes[n].used_register[m].src);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].dst = 0x%x\n", n, m, 
+						nodes[n].used_register[m].dst);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_value_id = 0x%x\n", n, m, 
+						nodes[n].used_register[m].src_first_value_id);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_node = 0x%x\n", n, m, 
+						nodes[n].used_register[m].src_first_node);
+					debug_print(DEBUG_MAIN, 1, "node[0x%x].user_register[0x%x].src_fist_label = 0x%x\n", n, m, 
+						nodes[n].used_register[m].src_first_label);
+				}
 			}
 		}
-	}
 #endif
-	/* Enter value id/label id of param into phi with src node 0. */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		/* Enter value id/label id of param into phi with src node 0. */
 		for (m = 0; m < MAX_REG; m++) {
 			if (self->external_entry_points[l].param_reg_label[m]) {
 				debug_print(DEBUG_MAIN, 1, "Entry Point 0x%x: Found reg 0x%x as param label 0x%x\n", l, m,
 					self->external_entry_points[l].param_reg_label[m]);
 			}
 		}
-	}
-	/* Enter value id/label id of param into phi with src node 0. */
-	/* TODO */
+		/* Enter value id/label id of param into phi with src node 0. */
+		/* TODO */
 
-	/* Assign labels to instructions src */
-	/* TODO: WIP: Work in progress */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			for(n = 1; n < external_entry_points[l].nodes_size; n++) {
-				if (!external_entry_points[l].nodes[n].valid) {
-					/* Only output nodes that are valid */
-					continue;
-				}
-				tmp = assign_labels_to_src(self, &external_entry_points[l], n);
-				if (tmp) {
-					printf("assign_labels_to_src() failed\n");
-					exit(1);
-				}
+		stats_record(self->stats, &function_mark, "label_assignment", l, "labels", external_entry_points[l].variable_id);
+
+		/* Assign labels to instructions src */
+		/* TODO: WIP: Work in progress */
+		stats_mark(self->stats, &function_mark);
+		for(n = 1; n < external_entry_points[l].nodes_size; n++) {
+			if (!external_entry_points[l].nodes[n].valid) {
+				/* Only output nodes that are valid */
+				continue;
 			}
-		}
-	}
-	/* turn "MOV reg, reg" into a NOP from the SSA perspective. Make the dst = src label */
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			for(n = 1; n < external_entry_points[l].nodes_size; n++) {
-				if (!external_entry_points[l].nodes[n].valid) {
-					/* Only output nodes that are valid */
-					continue;
-				}
-				tmp = redirect_mov_reg_reg_labels(self, &external_entry_points[l], n);
-				if (tmp) {
-					printf("redirect_mov_reg_reg() failed\n");
-					exit(1);
-				}
+			tmp = assign_labels_to_src(self, &external_entry_points[l], n);
+			if (tmp) {
+				printf("assign_labels_to_src() failed\n");
+				exit(1);
 			}
 		}
-	}
+		/* Build the def-use chains, then use them to
+		 * turn "MOV reg, reg" into a NOP from the SSA perspective. Make the dst = src label */
+		tmp = build_def_use_chains(self, &external_entry_points[l]);
+		if (tmp) {
+			printf("build_def_use_chains() failed\n");
+			exit(1);
+		}
+		print_def_use_chains(self, &external_entry_points[l]);
+		tmp = redirect_mov_reg_reg_labels(self, &external_entry_points[l]);
+		if (tmp) {
+			printf("redirect_mov_reg_reg() failed\n");
+			exit(1);
+		}
+		/* Point every label straight at the end of its redirect chain */
+		tmp = label_redirect_flatten(&external_entry_points[l]);
+		stats_record(self->stats, &function_mark, "assign_labels_to_src", l, "labels",
+			external_entry_points[l].variable_id);
+		stats_mark(self->stats, &function_mark);
 
-	print_dis_instructions(self);
 #if 0
-	for (n = 0x100; n < 0x130; n++) {
-		struct label_s *label;
-		tmp = label_redirect[n].redirect;
-		label = &labels[tmp];
-		printf("Label 0x%x:", n);
-		tmp = output_label(label, stdout);
-		printf("\n");
-	}
+		for (n = 0x100; n < 0x130; n++) {
+			struct label_s *label;
+			tmp = label_redirect[n].redirect;
+			label = &labels[tmp];
+			printf("Label 0x%x:", n);
+			tmp = output_label(label, stdout);
+			printf("\n");
+		}
 #endif
 
-	/************************************************************
-	 * This section deals with correcting SSA for branches/joins.
-	 * This bit creates the labels table, ready for the next step.
-	 ************************************************************/
-//	debug_print(DEBUG_MAIN, 1, "Number of labels = 0x%x\n", self->local_counter);
-	/* FIXME: +1 added as a result of running valgrind, but need a proper fix */
-//	label_redirect = calloc(self->local_counter + 1, sizeof(struct label_redirect_s));
-//	labels = calloc(self->local_counter + 1, sizeof(struct label_s));
-//	debug_print(DEBUG_MAIN, 1, "JCD6: self->local_counter=%d\n", self->local_counter);
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid && external_entry_points[l].type == 1) {
-			external_entry_points[l].labels[0].lab_pointer = 1; /* EIP */
-			external_entry_points[l].labels[1].lab_pointer = 1; /* ESP */
-			external_entry_points[l].labels[2].lab_pointer = 1; /* EBP */
-		}
-	}
+		/* The inst_log is final now, so index each function's definitions for search_back.
+		 * Used by call_params_fill(). Without it, the calls of this function get no params. */
+		tmp = search_back_index_build(self, &external_entry_points[l]);
+		if (tmp) {
+			debug_print(DEBUG_MAIN, 1, "search_back_index_build failed for function 0x%x\n", l);
+		}
+
+		/************************************************************
+		 * This section deals with correcting SSA for branches/joins.
+		 * This bit creates the labels table, ready for the next step.
+		 ************************************************************/
+//		debug_print(DEBUG_MAIN, 1, "Number of labels = 0x%x\n", self->local_counter);
+		/* FIXME: +1 added as a result of running valgrind, but need a proper fix */
+//		label_redirect = calloc(self->local_counter + 1, sizeof(struct label_redirect_s));
+//		labels = calloc(self->local_counter + 1, sizeof(struct label_s));
+//		debug_print(DEBUG_MAIN, 1, "JCD6: self->local_counter=%d\n", self->local_counter);
+		external_entry_points[l].labels[0].lab_pointer = 1; /* EIP */
+		external_entry_points[l].labels[1].lab_pointer = 1; /* ESP */
+		external_entry_points[l].labels[2].lab_pointer = 1; /* EBP */
 #if 0	
-	/* n <= inst_log verified to be correct limit */
-	for (n = 1; n <= inst_log; n++) {
-		struct label_s label;
-		uint64_t value_id;
-		uint64_t value_id2;
-		uint64_t value_id3;
-
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
-				n,
-				instruction->srcA.indirect,
-				instruction->srcA.index,
-				instruction->srcA.relocated,
-				inst_log1->value1.value_scope,
-				inst_log1->value1.value_id,
-				inst_log1->value1.indirect_offset_value,
-				inst_log1->value1.indirect_value_id);
+		/* n <= inst_log verified to be correct limit */
+		for (n = 1; n <= inst_log; n++) {
+			struct label_s label;
+			uint64_t value_id;
+			uint64_t value_id2;
+			uint64_t value_id3;
 
-		switch (instruction->opcode) {
-		case MOV:
-		case ADD:
-		case ADC:
-		case SUB:
-		case SBB:
-		case MUL:
-		case IMUL:
-		case OR:
-		case XOR:
-		case rAND:
-		case NOT:
-		case NEG:
-		case SHL:
-		case SHR:
-		case SAL:
-		case SAR:
-		case SEX:
-			if (IND_MEM == instruction->dstA.indirect) {
-				value_id3 = inst_log1->value3.indirect_value_id;
-			} else {
-				value_id3 = inst_log1->value3.value_id;
-			}
-			if (value_id3 > self->local_counter) {
-				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-				return 1;
-			}
-			memset(&label, 0, sizeof(struct label_s));
-			tmp = log_to_label(instruction->dstA.store,
-				instruction->dstA.indirect,
-				instruction->dstA.index,
-				instruction->dstA.relocated,
-				inst_log1->value3.value_scope,
-				inst_log1->value3.value_id,
-				inst_log1->value3.indirect_offset_value,
-				inst_log1->value3.indirect_value_id,
-				&label);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
-			}
-			if (!tmp && value_id3 > 0) {
-				label_redirect[value_id3].redirect = value_id3;
-				labels[value_id3].scope = label.scope;
-				labels[value_id3].type = label.type;
-				labels[value_id3].lab_pointer += label.lab_pointer;
-				labels[value_id3].value = label.value;
-			}
-
-			if (IND_MEM == instruction->srcA.indirect) {
-				value_id = inst_log1->value1.indirect_value_id;
-			} else {
-				value_id = inst_log1->value1.value_id;
-			}
-			if (value_id > self->local_counter) {
-				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-				return 1;
-			}
-			memset(&label, 0, sizeof(struct label_s));
-			tmp = log_to_label(instruction->srcA.store,
-				instruction->srcA.indirect,
-				instruction->srcA.index,
-				instruction->srcA.relocated,
-				inst_log1->value1.value_scope,
-				inst_log1->value1.value_id,
-				inst_log1->value1.indirect_offset_value,
-				inst_log1->value1.indirect_value_id,
-				&label);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Inst:0x, value1 unknown label %x\n", n);
-			}
-			if (!tmp && value_id > 0) {
-				label_redirect[value_id].redirect = value_id;
-				labels[value_id].scope = label.scope;
-				labels[value_id].type = label.type;
-				labels[value_id].lab_pointer += label.lab_pointer;
-				labels[value_id].value = label.value;
-			}
-			break;
-
-		/* Specially handled because value3 is not assigned and writen to a destination. */
-		case TEST:
-		case CMP:
-			if (IND_MEM == instruction->dstA.indirect) {
-				value_id2 = inst_log1->value2.indirect_value_id;
-			} else {
-				value_id2 = inst_log1->value2.value_id;
-			}
-			if (value_id2 > self->local_counter) {
-				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-				return 1;
-			}
-			memset(&label, 0, sizeof(struct label_s));
-			tmp = log_to_label(instruction->dstA.store,
-				instruction->dstA.indirect,
-				instruction->dstA.index,
-				instruction->dstA.relocated,
-				inst_log1->value2.value_scope,
-				inst_log1->value2.value_id,
-				inst_log1->value2.indirect_offset_value,
-				inst_log1->value2.indirect_value_id,
-				&label);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
-			}
-			if (!tmp && value_id2 > 0) {
-				label_redirect[value_id2].redirect = value_id2;
-				labels[value_id2].scope = label.scope;
-				labels[value_id2].type = label.type;
-				labels[value_id2].lab_pointer += label.lab_pointer;
-				labels[value_id2].value = label.value;
-			}
+			inst_log1 =  &inst_log_entry[n];
+			instruction =  &inst_log1->instruction;
+			debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
+					n,
+					instruction->srcA.indirect,
+					instruction->srcA.index,
+					instruction->srcA.relocated,
+					inst_log1->value1.value_scope,
+					inst_log1->value1.value_id,
+					inst_log1->value1.indirect_offset_value,
+					inst_log1->value1.indirect_value_id);
 
-			if (IND_MEM == instruction->srcA.indirect) {
-				value_id = inst_log1->value1.indirect_value_id;
-			} else {
-				value_id = inst_log1->value1.value_id;
-			}
-			if (value_id > self->local_counter) {
-				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-				return 1;
-			}
-			memset(&label, 0, sizeof(struct label_s));
-			tmp = log_to_label(instruction->srcA.store,
-				instruction->srcA.indirect,
-				instruction->srcA.index,
-				instruction->srcA.relocated,
-				inst_log1->value1.value_scope,
-				inst_log1->value1.value_id,
-				inst_log1->value1.indirect_offset_value,
-				inst_log1->value1.indirect_value_id,
-				&label);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Inst:0x, value1 unknown label %x\n", n);
-			}
-			if (!tmp && value_id > 0) {
-				label_redirect[value_id].redirect = value_id;
-				labels[value_id].scope = label.scope;
-				labels[value_id].type = label.type;
-				labels[value_id].lab_pointer += label.lab_pointer;
-				labels[value_id].value = label.value;
-			}
-			break;
+			switch (instruction->opcode) {
+			case MOV:
+			case ADD:
+			case ADC:
+			case SUB:
+			case SBB:
+			case MUL:
+			case IMUL:
+			case OR:
+			case XOR:
+			case rAND:
+			case NOT:
+			case NEG:
+			case SHL:
+			case SHR:
+			case SAL:
+			case SAR:
+			case SEX:
+				if (IND_MEM == instruction->dstA.indirect) {
+					value_id3 = inst_log1->value3.indirect_value_id;
+				} else {
+					value_id3 = inst_log1->value3.value_id;
+				}
+				if (value_id3 > self->local_counter) {
+					debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
+					return 1;
+				}
+				memset(&label, 0, sizeof(struct label_s));
+				tmp = log_to_label(instruction->dstA.store,
+					instruction->dstA.indirect,
+					instruction->dstA.index,
+					instruction->dstA.relocated,
+					inst_log1->value3.value_scope,
+					inst_log1->value3.value_id,
+					inst_log1->value3.indirect_offset_value,
+					inst_log1->value3.indirect_value_id,
+					&label);
+				if (tmp) {
+					debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
+				}
+				if (!tmp && value_id3 > 0) {
+					label_redirect[value_id3].redirect = value_id3;
+					labels[value_id3].scope = label.scope;
+					labels[value_id3].type = label.type;
+					labels[value_id3].lab_pointer += label.lab_pointer;
+					labels[value_id3].value = label.value;
+				}
 
-		case CALL:
-			debug_print(DEBUG_MAIN, 1, "SSA CALL inst_log 0x%x\n", n);
-			if (IND_MEM == instruction->dstA.indirect) {
-				value_id = inst_log1->value3.indirect_value_id;
-			} else {
-				value_id = inst_log1->value3.value_id;
-			}
-			if (value_id > self->local_counter) {
-				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-				return 1;
-			}
-			memset(&label, 0, sizeof(struct label_s));
-			tmp = log_to_label(instruction->dstA.store,
-				instruction->dstA.indirect,
-				instruction->dstA.index,
-				instruction->dstA.relocated,
-				inst_log1->value3.value_scope,
-				inst_log1->value3.value_id,
-				inst_log1->value3.indirect_offset_value,
-				inst_log1->value3.indirect_value_id,
-				&label);
-			if (tmp) {
-				debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
-			}
-			if (!tmp && value_id > 0) {
-				label_redirect[value_id].redirect = value_id;
-				labels[value_id].scope = label.scope;
-				labels[value_id].type = label.type;
-				labels[value_id].lab_pointer += label.lab_pointer;
-				labels[value_id].value = label.value;
-			}
+				if (IND_MEM == instruction->srcA.indirect) {
+					value_id = inst_log1->value1.indirect_value_id;
+				} else {
+					value_id = inst_log1->value1.value_id;
+				}
+				if (value_id > self->local_counter) {
+					debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
+					return 1;
+				}
+				memset(&label, 0, sizeof(struct label_s));
+				tmp = log_to_label(instruction->srcA.store,
+					instruction->srcA.indirect,
+					instruction->srcA.index,
+					instruction->srcA.relocated,
+					inst_log1->value1.value_scope,
+					inst_log1->value1.value_id,
+					inst_log1->value1.indirect_offset_value,
+					inst_log1->value1.indirect_value_id,
+					&label);
+				if (tmp) {
+					debug_print(DEBUG_MAIN, 1, "Inst:0x, value1 unknown label %x\n", n);
+				}
+				if (!tmp && value_id > 0) {
+					label_redirect[value_id].redirect = value_id;
+					labels[value_id].scope = label.scope;
+					labels[value_id].type = label.type;
+					labels[value_id].lab_pointer += label.lab_pointer;
+					labels[value_id].value = label.value;
+				}
+				break;
+
+			/* Specially handled because value3 is not assigned and writen to a destination. */
+			case TEST:
+			case CMP:
+				if (IND_MEM == instruction->dstA.indirect) {
+					value_id2 = inst_log1->value2.indirect_value_id;
+				} else {
+					value_id2 = inst_log1->value2.value_id;
+				}
+				if (value_id2 > self->local_counter) {
+					debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
+					return 1;
+				}
+				memset(&label, 0, sizeof(struct label_s));
+				tmp = log_to_label(instruction->dstA.store,
+					instruction->dstA.indirect,
+					instruction->dstA.index,
+					instruction->dstA.relocated,
+					inst_log1->value2.value_scope,
+					inst_log1->value2.value_id,
+					inst_log1->value2.indirect_offset_value,
+					inst_log1->value2.indirect_value_id,
+					&label);
+				if (tmp) {
+					debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
+				}
+				if (!tmp && value_id2 > 0) {
+					label_redirect[value_id2].redirect = value_id2;
+					labels[value_id2].scope = label.scope;
+					labels[value_id2].type = label.type;
+					labels[value_id2].lab_pointer += label.lab_pointer;
+					labels[value_id2].value = label.value;
+				}
 
-			if (IND_MEM == instruction->srcA.indirect) {
-				value_id = inst_log1->value1.indirect_value_id;
+				if (IND_MEM == instruction->srcA.indirect) {
+					value_id = inst_log1->value1.indirect_value_id;
+				} else {
+					value_id = inst_log1->value1.value_id;
+				}
 				if (value_id > self->local_counter) {
 					debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
 					return 1;
@@ -5727,274 +6504,321 @@ int main(int argc, char *argv[])
 					labels[value_id].lab_pointer += label.lab_pointer;
 					labels[value_id].value = label.value;
 				}
-			}
-			break;
-		case IF:
-		case RET:
-		case JMP:
-		case JMPT:
-			break;
-		default:
-			debug_print(DEBUG_MAIN, 1, "SSA1 failed for Inst:0x%x, OP 0x%x\n", n, instruction->opcode);
-			return 1;
-			break;
-		}
-	}
-	for (n = 0; n < self->local_counter; n++) {
-		debug_print(DEBUG_MAIN, 1, "labels 0x%x: redirect=0x%"PRIx64", scope=0x%"PRIx64", type=0x%"PRIx64", lab_pointer=0x%"PRIx64", value=0x%"PRIx64"\n",
-			n, label_redirect[n].redirect, labels[n].scope, labels[n].type, labels[n].lab_pointer, labels[n].value);
-	}
-	
-	/************************************************************
-	 * This section deals with correcting SSA for branches/joins.
-	 * It build bi-directional links to instruction operands.
-	 * This section does work for local_reg case. FIXME
-	 ************************************************************/
-	for (n = 1; n < inst_log; n++) {
-		uint64_t value_id;
-		uint64_t value_id1;
-		uint64_t value_id2;
-		uint64_t size;
-		uint64_t *inst_list;
-		uint64_t mid_start_size;
-		struct mid_start_s *mid_start;
-
-		size = 0;
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		value_id1 = inst_log1->value1.value_id;
-		value_id2 = inst_log1->value2.value_id;
-		switch (instruction->opcode) {
-		case MOV:
-		case LOAD:
-		case STORE:
-		case ADD:
-		case ADC:
-		case MUL:
-		case OR:
-		case XOR:
-		case rAND:
-		case SHL:
-		case SHR:
-		case CMP:
-		/* FIXME: TODO */
-			value_id = label_redirect[value_id1].redirect;
-			if ((1 == labels[value_id].scope) &&
-				(1 == labels[value_id].type)) {
-				debug_print(DEBUG_MAIN, 1, "Found local_reg Inst:0x%x:value_id:0x%"PRIx64"\n", n, value_id1);
-				if (0 == inst_log1->prev_size) {
-					debug_print(DEBUG_MAIN, 1, "search_back ended\n");
+				break;
+
+			case CALL:
+				debug_print(DEBUG_MAIN, 1, "SSA CALL inst_log 0x%x\n", n);
+				if (IND_MEM == instruction->dstA.indirect) {
+					value_id = inst_log1->value3.indirect_value_id;
+				} else {
+					value_id = inst_log1->value3.value_id;
+				}
+				if (value_id > self->local_counter) {
+					debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
 					return 1;
 				}
-				if (0 < inst_log1->prev_size) {
-					mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
-					mid_start_size = inst_log1->prev_size;
-					for (l = 0; l < inst_log1->prev_size; l++) {
-						mid_start[l].mid_start = inst_log1->prev[l];
-						mid_start[l].valid = 1;
-						debug_print(DEBUG_MAIN, 1, "mid_start added 0x%"PRIx64" at 0x%x\n", mid_start[l].mid_start, l);
+				memset(&label, 0, sizeof(struct label_s));
+				tmp = log_to_label(instruction->dstA.store,
+					instruction->dstA.indirect,
+					instruction->dstA.index,
+					instruction->dstA.relocated,
+					inst_log1->value3.value_scope,
+					inst_log1->value3.value_id,
+					inst_log1->value3.indirect_offset_value,
+					inst_log1->value3.indirect_value_id,
+					&label);
+				if (tmp) {
+					debug_print(DEBUG_MAIN, 1, "Inst:0x, value3 unknown label %x\n", n);
+				}
+				if (!tmp && value_id > 0) {
+					label_redirect[value_id].redirect = value_id;
+					labels[value_id].scope = label.scope;
+					labels[value_id].type = label.type;
+					labels[value_id].lab_pointer += label.lab_pointer;
+					labels[value_id].value = label.value;
+				}
+
+				if (IND_MEM == instruction->srcA.indirect) {
+					value_id = inst_log1->value1.indirect_value_id;
+					if (value_id > self->local_counter) {
+						debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
+						return 1;
 					}
-					tmp = search_back_local_reg_stack(self, mid_start_size, mid_start, 1, inst_log1->instruction.srcA.index, 0, &size, self->search_back_seen, &inst_list);
+					memset(&label, 0, sizeof(struct label_s));
+					tmp = log_to_label(instruction->srcA.store,
+						instruction->srcA.indirect,
+						instruction->srcA.index,
+						instruction->srcA.relocated,
+						inst_log1->value1.value_scope,
+						inst_log1->value1.value_id,
+						inst_log1->value1.indirect_offset_value,
+						inst_log1->value1.indirect_value_id,
+						&label);
 					if (tmp) {
-						debug_print(DEBUG_MAIN, 1, "SSA search_back Failed at inst_log 0x%x\n", n);
-						return 1;
+						debug_print(DEBUG_MAIN, 1, "Inst:0x, value1 unknown label %x\n", n);
+					}
+					if (!tmp && value_id > 0) {
+						label_redirect[value_id].redirect = value_id;
+						labels[value_id].scope = label.scope;
+						labels[value_id].type = label.type;
+						labels[value_id].lab_pointer += label.lab_pointer;
+						labels[value_id].value = label.value;
 					}
 				}
+				break;
+			case IF:
+			case RET:
+			case JMP:
+			case JMPT:
+				break;
+			default:
+				debug_print(DEBUG_MAIN, 1, "SSA1 failed for Inst:0x%x, OP 0x%x\n", n, instruction->opcode);
+				return 1;
+				break;
 			}
-			debug_print(DEBUG_MAIN, 1, "SSA inst:0x%x:size=0x%"PRIx64"\n", n, size);
-			/* Renaming is only needed if there are more than one label present */
-			if (size > 0) {
-				uint64_t value_id_highest = value_id;
-				inst_log1->value1.prev = calloc(size, sizeof(int *));
-				inst_log1->value1.prev_size = size;
-				for (l = 0; l < size; l++) {
-					struct inst_log_entry_s *inst_log_l;
-					inst_log_l = &inst_log_entry[inst_list[l]];
-					inst_log1->value1.prev[l] = inst_list[l];
-					inst_log_l->value3.next = realloc(inst_log_l->value3.next, (inst_log_l->value3.next_size + 1) * sizeof(inst_log_l->value3.next));
-					inst_log_l->value3.next[inst_log_l->value3.next_size] =
-						 inst_list[l];
-					inst_log_l->value3.next_size++;
-					if (label_redirect[inst_log_l->value3.value_id].redirect > value_id_highest) {
-						value_id_highest = label_redirect[inst_log_l->value3.value_id].redirect;
+		}
+		for (n = 0; n < self->local_counter; n++) {
+			debug_print(DEBUG_MAIN, 1, "labels 0x%x: redirect=0x%"PRIx64", scope=0x%"PRIx64", type=0x%"PRIx64", lab_pointer=0x%"PRIx64", value=0x%"PRIx64"\n",
+				n, label_redirect[n].redirect, labels[n].scope, labels[n].type, labels[n].lab_pointer, labels[n].value);
+		}
+		
+		/************************************************************
+		 * This section deals with correcting SSA for branches/joins.
+		 * It build bi-directional links to instruction operands.
+		 * This section does work for local_reg case. FIXME
+		 ************************************************************/
+		for (n = 1; n < inst_log; n++) {
+			uint64_t value_id;
+			uint64_t value_id1;
+			uint64_t value_id2;
+			uint64_t size;
+			uint64_t *inst_list;
+			uint64_t mid_start_size;
+			struct mid_start_s *mid_start;
+
+			size = 0;
+			inst_log1 =  &inst_log_entry[n];
+			instruction =  &inst_log1->instruction;
+			value_id1 = inst_log1->value1.value_id;
+			value_id2 = inst_log1->value2.value_id;
+			switch (instruction->opcode) {
+			case MOV:
+			case LOAD:
+			case STORE:
+			case ADD:
+			case ADC:
+			case MUL:
+			case OR:
+			case XOR:
+			case rAND:
+			case SHL:
+			case SHR:
+			case CMP:
+			/* FIXME: TODO */
+				value_id = label_redirect[value_id1].redirect;
+				if ((1 == labels[value_id].scope) &&
+					(1 == labels[value_id].type)) {
+					debug_print(DEBUG_MAIN, 1, "Found local_reg Inst:0x%x:value_id:0x%"PRIx64"\n", n, value_id1);
+					if (0 == inst_log1->prev_size) {
+						debug_print(DEBUG_MAIN, 1, "search_back ended\n");
+						return 1;
+					}
+					if (0 < inst_log1->prev_size) {
+						mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
+						mid_start_size = inst_log1->prev_size;
+						for (l = 0; l < inst_log1->prev_size; l++) {
+							mid_start[l].mid_start = inst_log1->prev[l];
+							mid_start[l].valid = 1;
+							debug_print(DEBUG_MAIN, 1, "mid_start added 0x%"PRIx64" at 0x%x\n", mid_start[l].mid_start, l);
+						}
+						tmp = search_back_local_reg_stack(self, external_entry_point->search_back_index, mid_start_size, mid_start, 1, inst_log1->instruction.srcA.index, 0, &size, &inst_list);
+						if (tmp) {
+							debug_print(DEBUG_MAIN, 1, "SSA search_back Failed at inst_log 0x%x\n", n);
+							return 1;
+						}
 					}
-					debug_print(DEBUG_MAIN, 1, "rel inst:0x%"PRIx64"\n", inst_list[l]);
 				}
-				debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
-					label_redirect[value_id1].redirect,
-					value_id_highest);
-				label_redirect[value_id1].redirect =
-					value_id_highest;
-				for (l = 0; l < size; l++) {
-					struct inst_log_entry_s *inst_log_l;
-					inst_log_l = &inst_log_entry[inst_list[l]];
+				debug_print(DEBUG_MAIN, 1, "SSA inst:0x%x:size=0x%"PRIx64"\n", n, size);
+				/* Renaming is only needed if there are more than one label present */
+				if (size > 0) {
+					uint64_t value_id_highest = value_id;
+					/* value1.prev and value3.next are the def-use chains, in the arena.
+					 * See build_def_use_chains(). */
+					for (l = 0; l < size; l++) {
+						struct inst_log_entry_s *inst_log_l;
+						inst_log_l = &inst_log_entry[inst_list[l]];
+						if (label_redirect[inst_log_l->value3.value_id].redirect > value_id_highest) {
+							value_id_highest = label_redirect[inst_log_l->value3.value_id].redirect;
+						}
+						debug_print(DEBUG_MAIN, 1, "rel inst:0x%"PRIx64"\n", inst_list[l]);
+					}
 					debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
-						label_redirect[inst_log_l->value3.value_id].redirect,
+						label_redirect[value_id1].redirect,
 						value_id_highest);
-					label_redirect[inst_log_l->value3.value_id].redirect =
+					label_redirect[value_id1].redirect =
 						value_id_highest;
+					for (l = 0; l < size; l++) {
+						struct inst_log_entry_s *inst_log_l;
+						inst_log_l = &inst_log_entry[inst_list[l]];
+						debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
+							label_redirect[inst_log_l->value3.value_id].redirect,
+							value_id_highest);
+						label_redirect[inst_log_l->value3.value_id].redirect =
+							value_id_highest;
+					}
 				}
+				break;
+			default:
+				break;
 			}
-			break;
-		default:
-			break;
-		}
-	}
-	/************************************************************
-	 * This section deals with correcting SSA for branches/joins.
-	 * It build bi-directional links to instruction operands.
-	 * This section does work for local_stack case.
-	 ************************************************************/
-	for (n = 1; n < inst_log; n++) {
-		uint64_t value_id;
-		uint64_t value_id1;
-		uint64_t size;
-		uint64_t *inst_list;
-		uint64_t mid_start_size;
-		struct mid_start_s *mid_start;
-
-		size = 0;
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		value_id1 = inst_log1->value1.value_id;
-		
-		if (value_id1 > self->local_counter) {
-			debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
-			return 1;
 		}
-		switch (instruction->opcode) {
-		case MOV:
-		case LOAD:
-		case STORE:
-		case ADD:
-		case ADC:
-		case SUB:
-		case SBB:
-		case MUL:
-		case IMUL:
-		case OR:
-		case XOR:
-		case rAND:
-		case NOT:
-		case NEG:
-		case SHL:
-		case SHR:
-		case SAL:
-		case SAR:
-		case CMP:
-		case TEST:
-		case SEX:
-			value_id = label_redirect[value_id1].redirect;
-			if ((1 == labels[value_id].scope) &&
-				(2 == labels[value_id].type)) {
-				debug_print(DEBUG_MAIN, 1, "Found local_stack Inst:0x%x:value_id:0x%"PRIx64"\n", n, value_id1);
-				if (0 == inst_log1->prev_size) {
-					debug_print(DEBUG_MAIN, 1, "search_back ended\n");
-					return 1;
-				}
-				if (0 < inst_log1->prev_size) {
-					mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
-					mid_start_size = inst_log1->prev_size;
-					for (l = 0; l < inst_log1->prev_size; l++) {
-						mid_start[l].mid_start = inst_log1->prev[l];
-						mid_start[l].valid = 1;
-						debug_print(DEBUG_MAIN, 1, "mid_start added 0x%"PRIx64" at 0x%x\n", mid_start[l].mid_start, l);
-					}
-					tmp = search_back_local_reg_stack(self, mid_start_size, mid_start, 2, inst_log1->value1.indirect_init_value, inst_log1->value1.indirect_offset_value, &size, self->search_back_seen, &inst_list);
-					if (tmp) {
-						debug_print(DEBUG_MAIN, 1, "SSA search_back Failed at inst_log 0x%x\n", n);
+		/************************************************************
+		 * This section deals with correcting SSA for branches/joins.
+		 * It build bi-directional links to instruction operands.
+		 * This section does work for local_stack case.
+		 ************************************************************/
+		for (n = 1; n < inst_log; n++) {
+			uint64_t value_id;
+			uint64_t value_id1;
+			uint64_t size;
+			uint64_t *inst_list;
+			uint64_t mid_start_size;
+			struct mid_start_s *mid_start;
+
+			size = 0;
+			inst_log1 =  &inst_log_entry[n];
+			instruction =  &inst_log1->instruction;
+			value_id1 = inst_log1->value1.value_id;
+			
+			if (value_id1 > self->local_counter) {
+				debug_print(DEBUG_MAIN, 1, "SSA Failed at inst_log 0x%x\n", n);
+				return 1;
+			}
+			switch (instruction->opcode) {
+			case MOV:
+			case LOAD:
+			case STORE:
+			case ADD:
+			case ADC:
+			case SUB:
+			case SBB:
+			case MUL:
+			case IMUL:
+			case OR:
+			case XOR:
+			case rAND:
+			case NOT:
+			case NEG:
+			case SHL:
+			case SHR:
+			case SAL:
+			case SAR:
+			case CMP:
+			case TEST:
+			case SEX:
+				value_id = label_redirect[value_id1].redirect;
+				if ((1 == labels[value_id].scope) &&
+					(2 == labels[value_id].type)) {
+					debug_print(DEBUG_MAIN, 1, "Found local_stack Inst:0x%x:value_id:0x%"PRIx64"\n", n, value_id1);
+					if (0 == inst_log1->prev_size) {
+						debug_print(DEBUG_MAIN, 1, "search_back ended\n");
 						return 1;
 					}
-				}
-			}
-			debug_print(DEBUG_MAIN, 1, "SSA inst:0x%x:size=0x%"PRIx64"\n", n, size);
-			/* Renaming is only needed if there are more than one label present */
-			if (size > 0) {
-				uint64_t value_id_highest = value_id;
-				inst_log1->value1.prev = calloc(size, sizeof(int *));
-				inst_log1->value1.prev_size = size;
-				for (l = 0; l < size; l++) {
-					struct inst_log_entry_s *inst_log_l;
-					inst_log_l = &inst_log_entry[inst_list[l]];
-					inst_log1->value1.prev[l] = inst_list[l];
-					inst_log_l->value3.next = realloc(inst_log_l->value3.next, (inst_log_l->value3.next_size + 1) * sizeof(inst_log_l->value3.next));
-					inst_log_l->value3.next[inst_log_l->value3.next_size] =
-						 inst_list[l];
-					inst_log_l->value3.next_size++;
-					if (label_redirect[inst_log_l->value3.value_id].redirect > value_id_highest) {
-						value_id_highest = label_redirect[inst_log_l->value3.value_id].redirect;
+					if (0 < inst_log1->prev_size) {
+						mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
+						mid_start_size = inst_log1->prev_size;
+						for (l = 0; l < inst_log1->prev_size; l++) {
+							mid_start[l].mid_start = inst_log1->prev[l];
+							mid_start[l].valid = 1;
+							debug_print(DEBUG_MAIN, 1, "mid_start added 0x%"PRIx64" at 0x%x\n", mid_start[l].mid_start, l);
+						}
+						tmp = search_back_local_reg_stack(self, external_entry_point->search_back_index, mid_start_size, mid_start, 2, inst_log1->value1.indirect_init_value, inst_log1->value1.indirect_offset_value, &size, &inst_list);
+						if (tmp) {
+							debug_print(DEBUG_MAIN, 1, "SSA search_back Failed at inst_log 0x%x\n", n);
+							return 1;
+						}
 					}
-					debug_print(DEBUG_MAIN, 1, "rel inst:0x%"PRIx64"\n", inst_list[l]);
 				}
-				debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
-					label_redirect[value_id1].redirect,
-					value_id_highest);
-				label_redirect[value_id1].redirect =
-					value_id_highest;
-				for (l = 0; l < size; l++) {
-					struct inst_log_entry_s *inst_log_l;
-					inst_log_l = &inst_log_entry[inst_list[l]];
+				debug_print(DEBUG_MAIN, 1, "SSA inst:0x%x:size=0x%"PRIx64"\n", n, size);
+				/* Renaming is only needed if there are more than one label present */
+				if (size > 0) {
+					uint64_t value_id_highest = value_id;
+					/* value1.prev and value3.next are the def-use chains, in the arena.
+					 * See build_def_use_chains(). */
+					for (l = 0; l < size; l++) {
+						struct inst_log_entry_s *inst_log_l;
+						inst_log_l = &inst_log_entry[inst_list[l]];
+						if (label_redirect[inst_log_l->value3.value_id].redirect > value_id_highest) {
+							value_id_highest = label_redirect[inst_log_l->value3.value_id].redirect;
+						}
+						debug_print(DEBUG_MAIN, 1, "rel inst:0x%"PRIx64"\n", inst_list[l]);
+					}
 					debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
-						label_redirect[inst_log_l->value3.value_id].redirect,
+						label_redirect[value_id1].redirect,
 						value_id_highest);
-					label_redirect[inst_log_l->value3.value_id].redirect =
+					label_redirect[value_id1].redirect =
 						value_id_highest;
+					for (l = 0; l < size; l++) {
+						struct inst_log_entry_s *inst_log_l;
+						inst_log_l = &inst_log_entry[inst_list[l]];
+						debug_print(DEBUG_MAIN, 1, "Renaming label 0x%"PRIx64" to 0x%"PRIx64"\n",
+							label_redirect[inst_log_l->value3.value_id].redirect,
+							value_id_highest);
+						label_redirect[inst_log_l->value3.value_id].redirect =
+							value_id_highest;
+					}
 				}
+				break;
+			case IF:
+			case RET:
+			case JMP:
+			case JMPT:
+				break;
+			case CALL:
+				//debug_print(DEBUG_MAIN, 1, "SSA2 failed for inst:0x%x, CALL\n", n);
+				//return 1;
+				break;
+			default:
+				debug_print(DEBUG_MAIN, 1, "SSA2 failed for inst:0x%x, OP 0x%x\n", n, instruction->opcode);
+				return 1;
+				break;
+			/* FIXME: TODO */
 			}
-			break;
-		case IF:
-		case RET:
-		case JMP:
-		case JMPT:
-			break;
-		case CALL:
-			//debug_print(DEBUG_MAIN, 1, "SSA2 failed for inst:0x%x, CALL\n", n);
-			//return 1;
-			break;
-		default:
-			debug_print(DEBUG_MAIN, 1, "SSA2 failed for inst:0x%x, OP 0x%x\n", n, instruction->opcode);
-			return 1;
-			break;
-		/* FIXME: TODO */
 		}
-	}
 #endif
-	/********************************************************
-	 * This section filters out duplicate param_reg entries.
-         * from the labels table: FIXME: THIS IS NOT NEEDED NOW
-	 ********************************************************/
+		/********************************************************
+		 * This section filters out duplicate param_reg entries.
+	         * from the labels table: FIXME: THIS IS NOT NEEDED NOW
+		 ********************************************************/
 #if 0
-	for (n = 0; n < (self->local_counter - 1); n++) {
-		int tmp1;
-		tmp1 = label_redirect[n].redirect;
-		debug_print(DEBUG_MAIN, 1, "param_reg:scanning base label 0x%x\n", n);
-		if ((tmp1 == n) &&
-			(labels[tmp1].scope == 2) &&
-			(labels[tmp1].type == 1)) {
-			int tmp2;
-			/* This is a param_stack */
-			for (l = n + 1; l < self->local_counter; l++) {
-				debug_print(DEBUG_MAIN, 1, "param_reg:scanning label 0x%x\n", l);
-				tmp2 = label_redirect[l].redirect;
-				if ((tmp2 == n) &&
-					(labels[tmp2].scope == 2) &&
-					(labels[tmp2].type == 1) &&
-					(labels[tmp1].value == labels[tmp2].value) ) {
-					debug_print(DEBUG_MAIN, 1, "param_stack:found duplicate\n");
-					label_redirect[l].redirect = n;
+		for (n = 0; n < (self->local_counter - 1); n++) {
+			int tmp1;
+			tmp1 = label_redirect[n].redirect;
+			debug_print(DEBUG_MAIN, 1, "param_reg:scanning base label 0x%x\n", n);
+			if ((tmp1 == n) &&
+				(labels[tmp1].scope == 2) &&
+				(labels[tmp1].type == 1)) {
+				int tmp2;
+				/* This is a param_stack */
+				for (l = n + 1; l < self->local_counter; l++) {
+					debug_print(DEBUG_MAIN, 1, "param_reg:scanning label 0x%x\n", l);
+					tmp2 = label_redirect[l].redirect;
+					if ((tmp2 == n) &&
+						(labels[tmp2].scope == 2) &&
+						(labels[tmp2].type == 1) &&
+						(labels[tmp1].value == labels[tmp2].value) ) {
+						debug_print(DEBUG_MAIN, 1, "param_stack:found duplicate\n");
+						label_redirect[l].redirect = n;
+					}
 				}
 			}
 		}
-	}
 #endif
-	/***************************************************
-	 * Register labels in order to print:
-	 * 	Function params,
-	 *	local vars.
-	 ***************************************************/
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if (external_entry_points[l].valid &&
-			external_entry_points[l].type == 1) {
+		/***************************************************
+		 * Register labels in order to print:
+		 * 	Function params,
+		 *	local vars.
+		 ***************************************************/
 		tmp = scan_for_labels_in_function_body(self, &external_entry_points[l],
 				external_entry_points[l].inst_log,
 				external_entry_points[l].inst_log_end,
@@ -6011,13 +6835,10 @@ int main(int argc, char *argv[])
 		debug_print(DEBUG_MAIN, 1, "scanned: params = 0x%x, locals = 0x%x\n",
 			external_entry_points[l].params_size,
 			external_entry_points[l].locals_size);
-		}
-	}
 
-	/***************************************************
-	 * This section sorts the external entry point params to the correct order
-	 ***************************************************/
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		/***************************************************
+		 * This section sorts the external entry point params to the correct order
+		 ***************************************************/
 		for (m = 0; m < REG_PARAMS_ORDER_MAX; m++) {
 			struct label_s *label;
 			for (n = 0; n < external_entry_points[l].params_size; n++) {
@@ -6047,6 +6868,9 @@ int main(int argc, char *argv[])
 							external_entry_points[l].params =
 								realloc(external_entry_points[l].params, external_entry_points[l].params_size * sizeof(int));
 							/* FIXME: Need to get label right */
+							if (label_table_reserve(&external_entry_points[l], external_entry_points[l].variable_id)) {
+								exit(1);
+							}
 							external_entry_points[l].params[external_entry_points[l].params_size - 1] =
 								external_entry_points[l].variable_id;
 							external_entry_points[l].variable_id++;
@@ -6059,409 +6883,276 @@ int main(int argc, char *argv[])
 				}
 			}
 		}
-	}
 
 
 
 
-	/***************************************************
-	 * This section, PARAM, deals with converting
-	 * function params to reference locals.
-	 * e.g. Change local0011 = function(param_reg0040);
-	 *      to     local0011 = function(local0009);
-	 ***************************************************/
-// FIXME: Working on this
-#if 0
-	for (n = 1; n < inst_log; n++) {
-		struct label_s *label;
-		uint64_t value_id1;
-		uint64_t size;
-		uint64_t *inst_list;
-		struct extension_call_s *call;
-		struct external_entry_point_s *external_entry_point;
-		uint64_t mid_start_size;
-		struct mid_start_s *mid_start;
-
-		size = 0;
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		value_id1 = inst_log1->value1.value_id;
-
-		if (value_id1 > self->local_counter) {
-			debug_print(DEBUG_MAIN, 1, "PARAM Failed at inst_log 0x%x\n", n);
+		/***************************************************
+		 * This section, PARAM, deals with converting
+		 * function params to reference locals.
+		 * e.g. Change local0011 = function(param_reg0040);
+		 *      to     local0011 = function(local0009);
+		 * Callees are analysed first, so their params are known.
+		 ***************************************************/
+		if (params_labels_fill(&external_entry_points[l])) {
+			debug_print(DEBUG_MAIN, 1, "PARAM failed for function 0x%x. Out of memory\n", l);
 			return 1;
 		}
-		switch (instruction->opcode) {
-		case CALL:
-			debug_print(DEBUG_MAIN, 1, "PRINTING INST CALL\n");
-			tmp = print_inst(self, instruction, n, labels);
-			external_entry_point = &external_entry_points[instruction->srcA.index];
-			inst_log1->extension = calloc(1, sizeof(struct extension_call_s));
-			call = inst_log1->extension;
-			call->params_size = external_entry_point->params_size;
-			/* FIXME: use struct in sizeof bit here */
-			call->params = calloc(call->params_size, sizeof(int *));
-			if (!call) {
-				debug_print(DEBUG_MAIN, 1, "PARAM failed for inst:0x%x, CALL. Out of memory\n", n);
-				return 1;
-			}
-			debug_print(DEBUG_MAIN, 1, "PARAM:call size=%x\n", call->params_size);
-			debug_print(DEBUG_MAIN, 1, "PARAM:params size=%x\n", external_entry_point->params_size);
-			for (m = 0; m < external_entry_point->params_size; m++) {
-				label = &labels[external_entry_point->params[m]];
-				if (0 == inst_log1->prev_size) {
-					debug_print(DEBUG_MAIN, 1, "search_back ended\n");
-					return 1;
-				}
-				if (0 < inst_log1->prev_size) {
-					mid_start = calloc(inst_log1->prev_size, sizeof(struct mid_start_s));
-					mid_start_size = inst_log1->prev_size;
-					for (l = 0; l < inst_log1->prev_size; l++) {
-						mid_start[l].mid_start = inst_log1->prev[l];
-						mid_start[l].valid = 1;
-						debug_print(DEBUG_MAIN, 1, "mid_start added 0x%"PRIx64" at 0x%x\n", mid_start[l].mid_start, l);
-					}
-				}
-				/* param_regXXX */
-				if ((2 == label->scope) &&
-					(1 == label->type)) {
-					debug_print(DEBUG_MAIN, 1, "PARAM: Searching for REG0x%"PRIx64":0x%"PRIx64" + label->value(0x%"PRIx64")\n", inst_log1->value1.init_value, inst_log1->value1.offset_value, label->value);
-					tmp = search_back_local_reg_stack(self, mid_start_size, mid_start, 1, label->value, 0, &size, self->search_back_seen, &inst_list);
-					debug_print(DEBUG_MAIN, 1, "search_backJCD1: tmp = %d\n", tmp);
-				} else {
-				/* param_stackXXX */
-				/* SP value held in value1 */
-					debug_print(DEBUG_MAIN, 1, "PARAM: Searching for SP(0x%"PRIx64":0x%"PRIx64") + label->value(0x%"PRIx64") - 8\n", inst_log1->value1.init_value, inst_log1->value1.offset_value, label->value);
-					tmp = search_back_local_reg_stack(self, mid_start_size, mid_start, 2, inst_log1->value1.init_value, inst_log1->value1.offset_value + label->value - 8, &size, self->search_back_seen, &inst_list);
-				/* FIXME: Some renaming of local vars will also be needed if size > 1 */
-				}
-				if (tmp) {
-					debug_print(DEBUG_MAIN, 1, "PARAM search_back Failed at inst_log 0x%x\n", n);
-					return 1;
-				}
-				tmp = output_label(label, stdout);
-				tmp = fprintf(stdout, ");\n");
-				tmp = fprintf(stdout, "PARAM size = 0x%"PRIx64"\n", size);
-				if (size > 1) {
-					debug_print(DEBUG_MAIN, 1, "number of param locals (0x%"PRIx64") found too big at instruction 0x%x\n", size, n);
-//					return 1;
-//					break;
-				}
-				if (size > 0) {
-					for (l = 0; l < size; l++) {
-						struct inst_log_entry_s *inst_log_l;
-						inst_log_l = &inst_log_entry[inst_list[l]];
-						call->params[m] = inst_log_l->value3.value_id;
-						// FIXME: Check next line. Force value type to unknown.
-						debug_print(DEBUG_MAIN, 1, "JCD3: Setting value_type to 0, was 0x%x\n", inst_log_l->value3.value_type);
-						if (6 == inst_log_l->value3.value_type) {	
-							inst_log_l->value1.value_type = 3;
-							inst_log_l->value3.value_type = 3;
-						}
-						debug_print(DEBUG_MAIN, 1, "JCD1: Param = 0x%"PRIx64", inst_list[0x%x] = 0x%"PRIx64"\n",
-
-							inst_log_l->value3.value_id,
-							l,
-							inst_list[l]);
-						//tmp = label_redirect[inst_log_l->value3.value_id].redirect;
-						//label = &labels[tmp];
-						//tmp = output_label(label, stdout);
-					}
-				}
-			}
-			//debug_print(DEBUG_MAIN, 1, "SSA2 failed for inst:0x%x, CALL\n", n);
-			//return 1;
-			break;
-
-		default:
-			break;
+		if (call_params_fill(self, &external_entry_points[l])) {
+			debug_print(DEBUG_MAIN, 1, "PARAM failed for function 0x%x. Out of memory\n", l);
+			return 1;
 		}
-	}
-#endif
-	/**************************************************
-	 * This section deals with variable types, scanning forwards
-	 * FIXME: Need to make this a little more intelligent
-	 * It might fall over with complex loops and program flow.
-	 * Maybe iterate up and down until no more changes need doing.
-	 * Problem with iterations, is that it could suffer from bistable flips
-	 * causing the iteration to never exit.
-	 **************************************************/
-	/* FIXME: change this to per external_entry_point */
+		/**************************************************
+		 * This section deals with variable types, scanning forwards
+		 * FIXME: Need to make this a little more intelligent
+		 * It might fall over with complex loops and program flow.
+		 * Maybe iterate up and down until no more changes need doing.
+		 * Problem with iterations, is that it could suffer from bistable flips
+		 * causing the iteration to never exit.
+		 **************************************************/
+		/* FIXME: change this to per external_entry_point */
 #if 0
-	for (n = 1; n < inst_log; n++) {
-		uint64_t value_id;
-		uint64_t value_id3;
+		for (n = 1; n < inst_log; n++) {
+			uint64_t value_id;
+			uint64_t value_id3;
 
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
-				n,
-				instruction->srcA.indirect,
-				instruction->srcA.index,
-				instruction->srcA.relocated,
-				inst_log1->value1.value_scope,
-				inst_log1->value1.value_id,
-				inst_log1->value1.indirect_offset_value,
-				inst_log1->value1.indirect_value_id);
+			inst_log1 =  &inst_log_entry[n];
+			instruction =  &inst_log1->instruction;
+			debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
+					n,
+					instruction->srcA.indirect,
+					instruction->srcA.index,
+					instruction->srcA.relocated,
+					inst_log1->value1.value_scope,
+					inst_log1->value1.value_id,
+					inst_log1->value1.indirect_offset_value,
+					inst_log1->value1.indirect_value_id);
 
-		switch (instruction->opcode) {
-		case MOV:
-			if (IND_MEM == instruction->dstA.indirect) {
-				value_id3 = inst_log1->value3.indirect_value_id;
-			} else {
-				value_id3 = inst_log1->value3.value_id;
-			}
+			switch (instruction->opcode) {
+			case MOV:
+				if (IND_MEM == instruction->dstA.indirect) {
+					value_id3 = inst_log1->value3.indirect_value_id;
+				} else {
+					value_id3 = inst_log1->value3.value_id;
+				}
 
-			if (IND_MEM == instruction->srcA.indirect) {
-				value_id = inst_log1->value1.indirect_value_id;
-			} else {
-				value_id = inst_log1->value1.value_id;
-			}
+				if (IND_MEM == instruction->srcA.indirect) {
+					value_id = inst_log1->value1.indirect_value_id;
+				} else {
+					value_id = inst_log1->value1.value_id;
+				}
 
-			if (labels[value_id3].lab_pointer != labels[value_id].lab_pointer) {
-				labels[value_id3].lab_pointer += labels[value_id].lab_pointer;
-				labels[value_id].lab_pointer = labels[value_id3].lab_pointer;
-			}
-			debug_print(DEBUG_MAIN, 1, "JCD4: value_id = 0x%"PRIx64", lab_pointer = 0x%"PRIx64", value_id3 = 0x%"PRIx64", lab_pointer = 0x%"PRIx64"\n",
-				value_id, labels[value_id].lab_pointer, value_id3, labels[value_id3].lab_pointer);
-			break;
+				if (labels[value_id3].lab_pointer != labels[value_id].lab_pointer) {
+					labels[value_id3].lab_pointer += labels[value_id].lab_pointer;
+					labels[value_id].lab_pointer = labels[value_id3].lab_pointer;
+				}
+				debug_print(DEBUG_MAIN, 1, "JCD4: value_id = 0x%"PRIx64", lab_pointer = 0x%"PRIx64", value_id3 = 0x%"PRIx64", lab_pointer = 0x%"PRIx64"\n",
+					value_id, labels[value_id].lab_pointer, value_id3, labels[value_id3].lab_pointer);
+				break;
 
-		default:
-			break;
+			default:
+				break;
+			}
 		}
-	}
 
-	/**************************************************
-	 * This section deals with variable types, scanning backwards
-	 **************************************************/
-	for (n = inst_log; n > 0; n--) {
-		uint64_t value_id;
-		uint64_t value_id3;
+		/**************************************************
+		 * This section deals with variable types, scanning backwards
+		 **************************************************/
+		for (n = inst_log; n > 0; n--) {
+			uint64_t value_id;
+			uint64_t value_id3;
 
-		inst_log1 =  &inst_log_entry[n];
-		instruction =  &inst_log1->instruction;
-		debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
-				n,
-				instruction->srcA.indirect,
-				instruction->srcA.index,
-				instruction->srcA.relocated,
-				inst_log1->value1.value_scope,
-				inst_log1->value1.value_id,
-				inst_log1->value1.indirect_offset_value,
-				inst_log1->value1.indirect_value_id);
+			inst_log1 =  &inst_log_entry[n];
+			instruction =  &inst_log1->instruction;
+			debug_print(DEBUG_MAIN, 1, "value to log_to_label:n = 0x%x: 0x%x, 0x%"PRIx64", 0x%x, 0x%x, 0x%"PRIx64", 0x%"PRIx64", 0x%"PRIx64"\n",
+					n,
+					instruction->srcA.indirect,
+					instruction->srcA.index,
+					instruction->srcA.relocated,
+					inst_log1->value1.value_scope,
+					inst_log1->value1.value_id,
+					inst_log1->value1.indirect_offset_value,
+					inst_log1->value1.indirect_value_id);
 
-		switch (instruction->opcode) {
-		case MOV:
-			if (IND_MEM == instruction->dstA.indirect) {
-				value_id3 = inst_log1->value3.indirect_value_id;
-			} else {
-				value_id3 = inst_log1->value3.value_id;
-			}
+			switch (instruction->opcode) {
+			case MOV:
+				if (IND_MEM == instruction->dstA.indirect) {
+					value_id3 = inst_log1->value3.indirect_value_id;
+				} else {
+					value_id3 = inst_log1->value3.value_id;
+				}
 
-			if (IND_MEM == instruction->srcA.indirect) {
-				value_id = inst_log1->value1.indirect_value_id;
-			} else {
-				value_id = inst_log1->value1.value_id;
-			}
+				if (IND_MEM == instruction->srcA.indirect) {
+					value_id = inst_log1->value1.indirect_value_id;
+				} else {
+					value_id = inst_log1->value1.value_id;
+				}
 
-			if (labels[value_id3].lab_pointer != labels[value_id].lab_pointer) {
-				labels[value_id3].lab_pointer += labels[value_id].lab_pointer;
-				labels[value_id].lab_pointer = labels[value_id3].lab_pointer;
-			}
-			debug_print(DEBUG_MAIN, 1, "JCD4: value_id = 0x%"PRIx64", lab_pointer = 0x%"PRIx64", value_id3 = 0x%"PRIx64", lab_pointer = 0x%"PRIx64"\n",
-				value_id, labels[value_id].lab_pointer, value_id3, labels[value_id3].lab_pointer);
-			break;
+				if (labels[value_id3].lab_pointer != labels[value_id].lab_pointer) {
+					labels[value_id3].lab_pointer += labels[value_id].lab_pointer;
+					labels[value_id].lab_pointer = labels[value_id3].lab_pointer;
+				}
+				debug_print(DEBUG_MAIN, 1, "JCD4: value_id = 0x%"PRIx64", lab_pointer = 0x%"PRIx64", value_id3 = 0x%"PRIx64", lab_pointer = 0x%"PRIx64"\n",
+					value_id, labels[value_id].lab_pointer, value_id3, labels[value_id3].lab_pointer);
+				break;
 
-		default:
-			break;
+			default:
+				break;
+			}
 		}
-	}
 
 #endif
 
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1)) {
-			debug_print(DEBUG_MAIN, 1, "name = %s\n", external_entry_points[l].name);
-			debug_print(DEBUG_MAIN, 1, "params size = 0x%x\n", external_entry_points[l].params_size);
-			for (n = 0; n < external_entry_points[l].params_size; n++) {
-				debug_print(DEBUG_MAIN, 1, "params = 0x%x\n", external_entry_points[l].params[n]);
-			}
+		debug_print(DEBUG_MAIN, 1, "name = %s\n", external_entry_points[l].name);
+		debug_print(DEBUG_MAIN, 1, "params size = 0x%x\n", external_entry_points[l].params_size);
+		for (n = 0; n < external_entry_points[l].params_size; n++) {
+			debug_print(DEBUG_MAIN, 1, "params = 0x%x\n", external_entry_points[l].params[n]);
 		}
-	}
 
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		if ((external_entry_points[l].valid) && (external_entry_points[l].type == 1)) {
-			tmp = output_cfg_dot(self, external_entry_points[l].label_redirect, external_entry_points[l].labels, l);
-		}
-	}
-	/***************************************************
-	 * This section deals with outputting the .c file.
-	 ***************************************************/
-	filename = "test.c";
-	fd = fopen(filename, "w");
-	if (!fd) {
-		debug_print(DEBUG_MAIN, 1, "Failed to open file %s, error=%p\n", filename, fd);
-		return 1;
-	}
-	debug_print(DEBUG_MAIN, 1, ".c fd=%p\n", fd);
-	debug_print(DEBUG_MAIN, 1, "writing out to file\n");
-	tmp = fprintf(fd, "#include <stdint.h>\n\n");
-	debug_print(DEBUG_MAIN, 1, "PRINTING MEMORY_DATA\n");
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		tmp = output_cfg_dot(self, external_entry_points[l].label_redirect, external_entry_points[l].labels, l);
+		debug_print(DEBUG_MAIN, 1, "%d:%s:start=%"PRIu64", end=%"PRIu64"\n", l,
+				external_entry_points[l].name,
+				external_entry_points[l].inst_log,
+				external_entry_points[l].inst_log_end);
 		struct process_state_s *process_state;
-		if (external_entry_points[l].valid) {
-			process_state = &external_entry_points[l].process_state;
-			memory_data = process_state->memory_data;
-			for (n = 0; n < 4; n++) {
-				debug_print(DEBUG_MAIN, 1, "memory_data:0x%x: 0x%"PRIx64"\n", n, memory_data[n].valid);
-				if (memory_data[n].valid) {
-	
-					tmp = bf_relocated_data(handle_void, memory_data[n].start_address, 4);
-					if (tmp) {
-						debug_print(DEBUG_MAIN, 1, "int *data%04"PRIx64" = &data%04"PRIx64"\n",
-							memory_data[n].start_address,
-							memory_data[n].init_value);
-						tmp = fprintf(fd, "int *data%04"PRIx64" = &data%04"PRIx64";\n",
-							memory_data[n].start_address,
-							memory_data[n].init_value);
-					} else {
-						debug_print(DEBUG_MAIN, 1, "int data%04"PRIx64" = 0x%04"PRIx64"\n",
-							memory_data[n].start_address,
-							memory_data[n].init_value);
-						tmp = fprintf(fd, "int data%04"PRIx64" = 0x%"PRIx64";\n",
-							memory_data[n].start_address,
-							memory_data[n].init_value);
+		int tmp_state;
+		long c_start;
+		
+		process_state = &external_entry_points[l].process_state;
+		c_start = ftell(fd);
+
+		tmp = fprintf(fd, "\n");
+		output_function_name(fd, &external_entry_points[l]);
+		tmp_state = 0;
+		for (m = 0; m < REG_PARAMS_ORDER_MAX; m++) {
+			struct label_s *label;
+			char buffer[1024];
+			for (n = 0; n < external_entry_points[l].params_size; n++) {
+				label = &(external_entry_points[l].labels[external_entry_points[l].params[n]]);
+				debug_print(DEBUG_MAIN, 1, "reg_params_order = 0x%x, label->value = 0x%"PRIx64"\n", reg_params_order[m], label->value);
+				if ((label->scope == 2) &&
+					(label->type == 1) &&
+					(label->value == reg_params_order[m])) {
+					if (tmp_state > 0) {
+						fprintf(fd, ", ");
+					}
+					fprintf(fd, "int%"PRId64"_t ",
+						label->size_bits);
+					if (label->lab_pointer) {
+						fprintf(fd, "*");
 					}
+					tmp = label_to_string(label, buffer, 1023);
+					fprintf(fd, "%s", buffer);
+					tmp_state++;
 				}
 			}
 		}
-	}
-	tmp = fprintf(fd, "\n");
-	debug_print(DEBUG_MAIN, 1, "\n");
-#if 0
-	for (n = 0; n < 100; n++) {
-		param_present[n] = 0;
-	}
-		
-	for (n = 0; n < 10; n++) {
-		if (memory_stack[n].start_address > 0x10000) {
-			uint64_t present_index;
-			present_index = memory_stack[n].start_address - 0x10000;
-			if (present_index >= 100) {
-				debug_print(DEBUG_MAIN, 1, "param limit reached:memory_stack[%d].start_address == 0x%"PRIx64"\n",
-					n, memory_stack[n].start_address);
+		for (n = 0; n < external_entry_points[l].params_size; n++) {
+			struct label_s *label;
+			char buffer[1024];
+			label = &(external_entry_points[l].labels[external_entry_points[l].params[n]]);
+			if ((label->scope == 2) &&
+				(label->type == 1)) {
 				continue;
 			}
-			param_present[present_index] = 1;
-			param_size[present_index] = memory_stack[n].length;
-		}
-	}
-	for (n = 0; n < 100; n++) {
-		if (param_present[n]) {
-			debug_print(DEBUG_MAIN, 1, "param%04x\n", n);
-			tmp = param_size[n];
-			n += tmp;
-		}
-	}
-#endif
-
-	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
-		/* FIXME: value == 0 for the first function in the .o file. */
-		/*        We need to be able to handle more than
-		          one function per .o file. */
-		if (external_entry_points[l].valid) {
-			debug_print(DEBUG_MAIN, 1, "%d:%s:start=%"PRIu64", end=%"PRIu64"\n", l,
-					external_entry_points[l].name,
-					external_entry_points[l].inst_log,
-					external_entry_points[l].inst_log_end);
-		}
-		if (external_entry_points[l].valid &&
-			external_entry_points[l].type == 1) {
-			struct process_state_s *process_state;
-			int tmp_state;
-			
-			process_state = &external_entry_points[l].process_state;
-
-			tmp = fprintf(fd, "\n");
-			output_function_name(fd, &external_entry_points[l]);
-			tmp_state = 0;
-			for (m = 0; m < REG_PARAMS_ORDER_MAX; m++) {
-				struct label_s *label;
-				char buffer[1024];
-				for (n = 0; n < external_entry_points[l].params_size; n++) {
-					label = &(external_entry_points[l].labels[external_entry_points[l].params[n]]);
-					debug_print(DEBUG_MAIN, 1, "reg_params_order = 0x%x, label->value = 0x%"PRIx64"\n", reg_params_order[m], label->value);
-					if ((label->scope == 2) &&
-						(label->type == 1) &&
-						(label->value == reg_params_order[m])) {
-						if (tmp_state > 0) {
-							fprintf(fd, ", ");
-						}
-						fprintf(fd, "int%"PRId64"_t ",
-							label->size_bits);
-						if (label->lab_pointer) {
-							fprintf(fd, "*");
-						}
-						tmp = label_to_string(label, buffer, 1023);
-						fprintf(fd, "%s", buffer);
-						tmp_state++;
-					}
-				}
+			if (tmp_state > 0) {
+				fprintf(fd, ", ");
 			}
-			for (n = 0; n < external_entry_points[l].params_size; n++) {
-				struct label_s *label;
-				char buffer[1024];
-				label = &(external_entry_points[l].labels[external_entry_points[l].params[n]]);
-				if ((label->scope == 2) &&
-					(label->type == 1)) {
-					continue;
-				}
-				if (tmp_state > 0) {
-					fprintf(fd, ", ");
-				}
-				fprintf(fd, "int%"PRId64"_t ",
-					label->size_bits);
-				if (label->lab_pointer) {
-					fprintf(fd, "*");
-				}
-				tmp = label_to_string(label, buffer, 1023);
-				fprintf(fd, "%s", buffer);
-				tmp_state++;
-			}
-			tmp = fprintf(fd, ")\n{\n");
-			for (n = 0; n < external_entry_points[l].locals_size; n++) {
-				struct label_s *label;
-				char buffer[1024];
-				label = &(external_entry_points[l].labels[external_entry_points[l].locals[n]]);
-				fprintf(fd, "\tint%"PRId64"_t ",
-					label->size_bits);
-				if (label->lab_pointer) {
-					fprintf(fd, "*");
-				}
-				tmp = label_to_string(label, buffer, 1023);
-				fprintf(fd, "%s", buffer);
-				fprintf(fd, ";\n");
+			fprintf(fd, "int%"PRId64"_t ",
+				label->size_bits);
+			if (label->lab_pointer) {
+				fprintf(fd, "*");
 			}
-			fprintf(fd, "\n");
-					
-			tmp = output_function_body(self, process_state,
-				fd,
-				external_entry_points[l].inst_log,
-				external_entry_points[l].inst_log_end,
-				external_entry_points[l].label_redirect,
-				external_entry_points[l].labels);
-			if (tmp) {
-				return 1;
+			tmp = label_to_string(label, buffer, 1023);
+			fprintf(fd, "%s", buffer);
+			tmp_state++;
+		}
+		tmp = fprintf(fd, ")\n{\n");
+		for (n = 0; n < external_entry_points[l].locals_size; n++) {
+			struct label_s *label;
+			char buffer[1024];
+			label = &(external_entry_points[l].labels[external_entry_points[l].locals[n]]);
+			fprintf(fd, "\tint%"PRId64"_t ",
+				label->size_bits);
+			if (label->lab_pointer) {
+				fprintf(fd, "*");
 			}
-//   This code is not doing anything, so comment it out
-//			for (n = external_entry_points[l].inst_log; n <= external_entry_points[l].inst_log_end; n++) {
-//			}			
+			tmp = label_to_string(label, buffer, 1023);
+			fprintf(fd, "%s", buffer);
+			fprintf(fd, ";\n");
+		}
+		fprintf(fd, "\n");
+				
+		tmp = output_function_body(self, process_state,
+			fd,
+			external_entry_points[l].inst_log,
+			external_entry_points[l].inst_log_end,
+			external_entry_points[l].label_redirect,
+			external_entry_points[l].labels);
+		if (tmp) {
+			return 1;
 		}
+		if (self->cache) {
+			/* Without it the function is just not stored in the cache */
+			tmp = output_c_keep(fd, c_start, &external_entry_points[l]);
+		}
+		stats_record(self->stats, &function_mark, "c_output", l, NULL, 0);
+
+		/* This also releases the function's analysis */
+		stats_mark(self->stats, &function_mark);
+		tmp = llvm_export_function(self, l);
+		stats_record(self->stats, &function_mark, "llvm_export", l, "functions", 1);
+	}
+	stats_record_total(self->stats, "paths_loops", "paths");
+	stats_record_total(self->stats, "node_analysis", "nodes");
+	stats_record_total(self->stats, "structure", "regions");
+	stats_record_total(self->stats, "used_register_table", "nodes");
+	stats_record_total(self->stats, "phi", "phis");
+	stats_record_total(self->stats, "label_assignment", "labels");
+	stats_record_total(self->stats, "assign_labels_to_src", "labels");
+	stats_record_total(self->stats, "c_output", NULL);
+	stats_record_total(self->stats, "llvm_export", "functions");
+	/* Wait for the export threads, link or write the module */
+	stats_mark(self->stats, &phase_mark);
+	tmp = llvm_export_end(self);
+	if (tmp) {
+		debug_print(DEBUG_MAIN, 1, "LLVM export failed\n");
 	}
-
+	stats_record(self->stats, &phase_mark, "llvm_write", -1, NULL, 0);
 	fclose(fd);
+	if (regions_fd) {
+		fclose(regions_fd);
+	}
+	free(order);
+	print_dis_instructions(self);
+	if (stats_filename) {
+		stats_failed = stats_write_json(self, self->stats, stats_filename);
+		stats_free(self->stats);
+		self->stats = NULL;
+	}
+	cache_free(self->cache);
+	self->cache = NULL;
 
-	tmp = llvm_export(self);
+	/* llvm_export_function() releases the analysis of each function as soon as it is exported.
+	 * Release any left, e.g. of functions that were not exported. */
+	for (l = 0; l < EXTERNAL_ENTRY_POINTS_MAX; l++) {
+		function_arena_free(self, &external_entry_points[l]);
+		free(external_entry_points[l].params_labels);
+		external_entry_points[l].params_labels = NULL;
+		free(external_entry_points[l].cached_bitcode);
+		external_entry_points[l].cached_bitcode = NULL;
+		free(external_entry_points[l].c_text);
+		external_entry_points[l].c_text = NULL;
+	}
+	/* The params of each CALL, from call_params_fill() */
+	for (n = 1; n < inst_log; n++) {
+		struct extension_call_s *call = inst_log_entry[n].extension;
+		if ((CALL == inst_log_entry[n].instruction.opcode) && call) {
+			free(call->params);
+			free(call);
+			inst_log_entry[n].extension = NULL;
+		}
+	}
 
 	bf_test_close_file(handle_void);
 	print_mem(memory_reg, 1);
@@ -6469,30 +7160,31 @@ int main(int argc, char *argv[])
 		debug_print(DEBUG_MAIN, 1, "0x%04x: %d\n", n, memory_used[n]);
 	}
 	debug_print(DEBUG_MAIN, 1, "PRINTING MEMORY_DATA\n");
-	for (n = 0; n < 4; n++) {
-		print_mem(memory_data, n);
+	for (n = 0; (n < 4) && (n < memory_data->size); n++) {
+		print_mem(memory_map_entry(memory_data, n), 0);
 		debug_print(DEBUG_MAIN, 1, "\n");
 	}
 	debug_print(DEBUG_MAIN, 1, "PRINTING STACK_DATA\n");
-	for (n = 0; n < 10; n++) {
-		print_mem(memory_stack, n);
+	for (n = 0; (n < 10) && (n < memory_stack->size); n++) {
+		print_mem(memory_map_entry(memory_stack, n), 0);
 		debug_print(DEBUG_MAIN, 1, "\n");
 	}
 	for (n = 0; n < 100; n++) {
 		param_present[n] = 0;
 	}
 		
-	for (n = 0; n < 10; n++) {
-		if (memory_stack[n].start_address >= tmp) {
+	for (n = 0; (n < 10) && (n < memory_stack->size); n++) {
+		memory = memory_map_entry(memory_stack, n);
+		if (memory->start_address >= tmp) {
 			uint64_t present_index;
-			present_index = memory_stack[n].start_address - 0x10000;
+			present_index = memory->start_address - 0x10000;
 			if (present_index >= 100) {
 				debug_print(DEBUG_MAIN, 1, "param limit reached:memory_stack[%d].start_address == 0x%"PRIx64"\n",
-					n, memory_stack[n].start_address);
+					n, memory->start_address);
 				continue;
 			}
 			param_present[present_index] = 1;
-			param_size[present_index] = memory_stack[n].length;
+			param_size[present_index] = memory->length;
 		}
 	}
 
@@ -6506,6 +7198,7 @@ int main(int argc, char *argv[])
 #endif
 //end_main:
 	debug_print(DEBUG_MAIN, 1, "END - FINISHED PROCESSING\n");
-	return 0;
+	/* The output is there, but tell the caller the --stats file is not */
+	return stats_failed;
 }
 